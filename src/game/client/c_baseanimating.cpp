@@ -651,6 +651,8 @@ void C_ClientRagdoll::Release( void )
 // was last time they setup their bones to determine if they need to re-setup their bones.
 static unsigned long	g_iModelBoneCounter = 0;
 CUtlVector<C_BaseAnimating *> g_PreviousBoneSetups;
+// Bone merged children whose bones were set up last frame
+CUtlVector<C_BaseAnimating *> g_PreviousBoneMergeSetups;
 static unsigned long	g_iPreviousBoneCounter = (unsigned)-1;
 
 class C_BaseAnimatingGameSystem : public CAutoGameSystem
@@ -663,6 +665,7 @@ class C_BaseAnimatingGameSystem : public CAutoGameSystem
 			Msg( "%d entities in bone setup array. Should have been cleaned up by now\n", g_PreviousBoneSetups.Count() );
 			g_PreviousBoneSetups.RemoveAll();
 		}
+		g_PreviousBoneMergeSetups.RemoveAll();
 	}
 } g_BaseAnimatingGameSystem;
 
@@ -755,6 +758,9 @@ C_BaseAnimating::~C_BaseAnimating()
 	int i = g_PreviousBoneSetups.Find( this );
 	if ( i != -1 )
 		g_PreviousBoneSetups.FastRemove( i );
+	i = g_PreviousBoneMergeSetups.Find( this );
+	if ( i != -1 )
+		g_PreviousBoneMergeSetups.FastRemove( i );
 
 	TermRopes();
 
@@ -2738,19 +2744,30 @@ CMouthInfo *C_BaseAnimating::GetMouth( void )
 ConVar cl_warn_thread_contested_bone_setup("cl_warn_thread_contested_bone_setup", "0" );
 #endif
 
-// Marked this developmentonly because it currently crashes, and users are enabling it and complaining because of
-// course.  Once this actually works it should just be FCVAR_INTERNAL_USE.
-ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", FCVAR_DEVELOPMENTONLY | FCVAR_INTERNAL_USE,
+// Only entities whose bone setup touches nothing but their own state go to the job pool: unparented,
+// not view models, and not using IK (IK locks trace and read other entities). Bone merged children
+// are set up on the main thread once the jobs are done, parents first.
+ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", FCVAR_INTERNAL_USE,
                               "Enable parallel processing of C_BaseAnimating::SetupBones()" );
 
+struct BoneMergeSetup_t
+{
+	C_BaseAnimating	*m_pEntity;
+	int				m_nDepth;		// number of bone merge links to the root of the hierarchy
+};
+
+static int __cdecl BoneMergeSetupLessFunc( const BoneMergeSetup_t *pLeft, const BoneMergeSetup_t *pRight )
+{
+	return pLeft->m_nDepth - pRight->m_nDepth;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Do the default sequence blending rules as done in HL1
 //-----------------------------------------------------------------------------
 
 static void SetupBonesOnBaseAnimating( C_BaseAnimating *&pBaseAnimating )
 {
-	if ( !pBaseAnimating->GetMoveParent() )
-		pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+	pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
 }
 
 static void PreThreadedBoneSetup()
@@ -2776,21 +2793,80 @@ void C_BaseAnimating::ShutdownBoneSetupThreadPool()
 
 void C_BaseAnimating::ThreadedBoneSetup()
 {
+	VPROF_BUDGET( "C_BaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
+
 	g_bDoThreadedBoneSetup = cl_threaded_bone_setup.GetBool();
 	if ( g_bDoThreadedBoneSetup )
 	{
-		int nCount = g_PreviousBoneSetups.Count();
-		if ( nCount > 1 )
+		CUtlVector< C_BaseAnimating * > jobs;
+		jobs.EnsureCapacity( g_PreviousBoneSetups.Count() );
+		for ( int i = 0; i < g_PreviousBoneSetups.Count(); i++ )
 		{
+			C_BaseAnimating *pEntity = g_PreviousBoneSetups[i];
+			if ( pEntity->GetMoveParent() || pEntity->IsDormant() || pEntity->IsViewModel() || pEntity->m_pIk )
+				continue;
+
+			CStudioHdr *hdr = pEntity->GetModelPtr();
+			if ( !hdr || ( hdr->numikchains() > 0 && !( pEntity->m_EntClientFlags & ENTCLIENTFLAG_DONTUSEIK ) ) )
+				continue;
+
+			jobs.AddToTail( pEntity );
+		}
+
+		if ( jobs.Count() > 1 )
+		{
+			VPROF_INCREMENT_COUNTER( "threaded bone setup entities", jobs.Count() );
+
 			g_bInThreadedBoneSetup = true;
 
-			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", g_PreviousBoneSetups.Base(), nCount, &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", jobs.Base(), jobs.Count(), &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
 
 			g_bInThreadedBoneSetup = false;
 		}
+
+		// Now the bone merged children, parents before children. The bone merge cache and
+		// CalcAbsolutePosition work reads their parents' bones, so it stays on this thread.
+		CUtlVector< BoneMergeSetup_t > boneMerges;
+		boneMerges.EnsureCapacity( g_PreviousBoneMergeSetups.Count() );
+		for ( int i = 0; i < g_PreviousBoneMergeSetups.Count(); i++ )
+		{
+			C_BaseAnimating *pEntity = g_PreviousBoneMergeSetups[i];
+			if ( pEntity->IsDormant() )
+				continue;
+
+			int nDepth = 0;
+			C_BaseEntity *pLink = pEntity;
+			while ( pLink && pLink->GetMoveParent() )
+			{
+				// Attached some other way; whoever needs its bones will set them up
+				if ( !pLink->IsEffectActive( EF_BONEMERGE ) || !pLink->GetMoveParent()->GetBaseAnimating() )
+				{
+					pLink = NULL;
+					break;
+				}
+				pLink = pLink->GetMoveParent();
+				++nDepth;
+			}
+
+			if ( !pLink )
+				continue;
+
+			int j = boneMerges.AddToTail();
+			boneMerges[j].m_pEntity = pEntity;
+			boneMerges[j].m_nDepth = nDepth;
+		}
+		boneMerges.Sort( BoneMergeSetupLessFunc );
+
+		VPROF_INCREMENT_COUNTER( "bone merged setups after threaded bone setup", boneMerges.Count() );
+
+		for ( int i = 0; i < boneMerges.Count(); i++ )
+		{
+			boneMerges[i].m_pEntity->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+		}
 	}
 	g_iPreviousBoneCounter++;
 	g_PreviousBoneSetups.RemoveAll();
+	g_PreviousBoneMergeSetups.RemoveAll();
 }
 
 bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, int boneMask, float currentTime )
@@ -2894,11 +2970,23 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 	}
 
 	int nBoneCount = m_CachedBoneData.Count();
-	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && !GetMoveParent() && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
 	{
-		m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
-		Assert( g_PreviousBoneSetups.Find( this ) == -1 );
-		g_PreviousBoneSetups.AddToTail( this );
+		if ( !GetMoveParent() )
+		{
+			if ( nBoneCount >= 16 )
+			{
+				m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
+				Assert( g_PreviousBoneSetups.Find( this ) == -1 );
+				g_PreviousBoneSetups.AddToTail( this );
+			}
+		}
+		else if ( IsEffectActive( EF_BONEMERGE ) )
+		{
+			m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
+			Assert( g_PreviousBoneMergeSetups.Find( this ) == -1 );
+			g_PreviousBoneMergeSetups.AddToTail( this );
+		}
 	}
 
 	// Keep track of everthing asked for over the entire frame
@@ -80,6 +80,7 @@ void cc_cl_interp_all_changed( IConVar *pConVar, const char *pOldString, float f
 static ConVar  cl_extrapolate( "cl_extrapolate", "1", FCVAR_CHEAT, "Enable/disable extrapolation if interpolation history runs out." );
 static ConVar  cl_interp_npcs( "cl_interp_npcs", "0.0", FCVAR_USERINFO, "Interpolate NPC positions starting this many seconds in past (or cl_interp, if greater)" );  
 static ConVar  cl_interp_all( "cl_interp_all", "0", 0, "Disable interpolation list optimizations.", 0, 0, 0, 0, cc_cl_interp_all_changed );
+static ConVar  cl_interp_batch( "cl_interp_batch", "0", 0, "Interpolate the origins and angles of everything on the interpolation list in one batch before the per-entity pass." );
 ConVar  r_drawmodeldecals( "r_drawmodeldecals", "1", FCVAR_ALLOWED_IN_COMPETITIVE );
 extern ConVar	cl_showerror;
 int C_BaseEntity::m_nPredictionRandomSeed = -1;
@@ -3123,6 +3124,12 @@ void C_BaseEntity::ProcessInterpolatedList()
 {
 	CheckInterpolatedVarParanoidMeasurement();
 
+	// Work out origins and angles up front, Interpolate() picks them up
+	if ( cl_interp_batch.GetBool() )
+	{
+		QueueInterpolationBatch();
+	}
+
 	// Interpolate the minimal set of entities that need it.
 	int iNext;
 	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=iNext )
@@ -3132,6 +3139,49 @@ void C_BaseEntity::ProcessInterpolatedList()
 		
 		pCur->m_bReadyToDraw = pCur->Interpolate( gpGlobals->curtime );
 	}
+
+	g_InterpolatedVarBatch.Reset();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queue the origin and angles of everything on the interpolation list
+//			that Interpolate() will interpolate at curtime, and evaluate them
+//-----------------------------------------------------------------------------
+void C_BaseEntity::QueueInterpolationBatch()
+{
+	VPROF( "C_BaseEntity::QueueInterpolationBatch" );
+
+	float currentTime = gpGlobals->curtime;
+
+	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=g_InterpolationList.Next( iCur ) )
+	{
+		C_BaseEntity *pCur = g_InterpolationList[iCur];
+
+		// BaseInterpolatePart1 snaps these, or interpolates them at their predicted time
+		if ( pCur->IsFollowingEntity() || !IsInterpolationEnabled() || pCur->GetPredictable() || pCur->IsClientCreated() )
+			continue;
+
+		// Same entries Interp_Interpolate will visit
+		VarMapping_t *map = pCur->GetVarMapping();
+		bool bAll = ( currentTime < map->m_lastInterpolationTime );
+		for ( int i = 0; i < map->m_nInterpolatedEntries; i++ )
+		{
+			VarMapEntry_t *e = &map->m_Entries[ i ];
+			if ( !bAll && !e->m_bNeedsToInterpolate )
+				continue;
+
+			if ( e->watcher == &pCur->m_iv_vecOrigin )
+			{
+				pCur->m_iv_vecOrigin.QueueBatchedInterpolate( currentTime );
+			}
+			else if ( e->watcher == &pCur->m_iv_angRotation )
+			{
+				pCur->m_iv_angRotation.QueueBatchedInterpolate( currentTime );
+			}
+		}
+	}
+
+	g_InterpolatedVarBatch.Evaluate();
 }
 
 
@@ -1197,6 +1197,7 @@ protected:
 	// Interpolate entity
 	static void ProcessTeleportList();
 	static void ProcessInterpolatedList();
+	static void QueueInterpolationBatch();
 	static void CheckInterpolatedVarParanoidMeasurement();
 
 	// overrideable rules if an entity should interpolate
@@ -270,6 +270,8 @@ void Soundscape_Update( audioparams_t &audio )
 void C_SoundscapeSystem::AddSoundScapeFile( const char *filename )
 {
 	KeyValues *script = new KeyValues( filename );
+	// these stay with the client for the whole map, so parse them into an arena
+	script->UsesArena( true );
 #ifndef _XBOX
 	if ( script->LoadFromFile( filesystem, filename ) )
 #else
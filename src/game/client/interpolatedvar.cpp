@@ -6,6 +6,8 @@
 
 #include "cbase.h"
 #include "interpolatedvar.h"
+#include "mathlib/ssemath.h"
+#include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,3 +30,290 @@ float g_flLastPacketTimestamp = 0;
 
 ConVar cl_extrapolate_amount( "cl_extrapolate_amount", "0.25", FCVAR_CHEAT, "Set how many seconds the client will extrapolate entities for." );
 
+ConVar cl_interp_simd( "cl_interp_simd", "0", 0, "Interpolate float arrays of four or more elements (pose parameters, flex weights) four at a time with SSE." );
+
+
+//-----------------------------------------------------------------------------
+// Batched float interpolation, enabled by cl_interp_simd. Groups of four with
+// no looping elements go through SSE, everything else through the same scalar
+// code as the generic loops. The SSE math is done in the same order as Lerp and
+// Lerp_Hermite, so the results match builds that do scalar float math with SSE.
+// Builds using x87 keep extra precision in the scalar code and can differ in
+// the last bit.
+//-----------------------------------------------------------------------------
+static inline bool IsAnyLooping4( const byte *pLooping )
+{
+	return ( pLooping[0] | pLooping[1] | pLooping[2] | pLooping[3] ) != 0;
+}
+
+bool InterpolatedVar_LerpBatch( float *pOut, float frac, const float *pStart, const float *pEnd, const byte *pLooping, int nCount )
+{
+	if ( nCount < 4 || !cl_interp_simd.GetBool() )
+		return false;
+
+	fltx4 fl4Frac = ReplicateX4( frac );
+
+	int i = 0;
+	for ( ; i + 4 <= nCount; i += 4 )
+	{
+		if ( IsAnyLooping4( pLooping + i ) )
+		{
+			for ( int j = i; j < i + 4; j++ )
+			{
+				pOut[j] = pLooping[j] ? LoopingLerp( frac, pStart[j], pEnd[j] ) : Lerp( frac, pStart[j], pEnd[j] );
+			}
+			continue;
+		}
+
+		fltx4 start = LoadUnalignedSIMD( pStart + i );
+		fltx4 end = LoadUnalignedSIMD( pEnd + i );
+		StoreUnalignedSIMD( pOut + i, AddSIMD( start, MulSIMD( SubSIMD( end, start ), fl4Frac ) ) );
+	}
+
+	for ( ; i < nCount; i++ )
+	{
+		pOut[i] = pLooping[i] ? LoopingLerp( frac, pStart[i], pEnd[i] ) : Lerp( frac, pStart[i], pEnd[i] );
+	}
+
+	return true;
+}
+
+bool InterpolatedVar_HermiteBatch( float *pOut, float t, const float *pPrev, const float *pStart, const float *pEnd, const byte *pLooping, int nCount )
+{
+	if ( nCount < 4 || !cl_interp_simd.GetBool() )
+		return false;
+
+	// Same basis as Lerp_Hermite
+	float tSqr = t*t;
+	float tCube = t*tSqr;
+	fltx4 fl4Start = ReplicateX4( 2*tCube-3*tSqr+1 );
+	fltx4 fl4End = ReplicateX4( -2*tCube+3*tSqr );
+	fltx4 fl4D1 = ReplicateX4( tCube-2*tSqr+t );
+	fltx4 fl4D2 = ReplicateX4( tCube-tSqr );
+
+	int i = 0;
+	for ( ; i + 4 <= nCount; i += 4 )
+	{
+		if ( IsAnyLooping4( pLooping + i ) )
+		{
+			for ( int j = i; j < i + 4; j++ )
+			{
+				pOut[j] = pLooping[j] ? LoopingLerp_Hermite( t, pPrev[j], pStart[j], pEnd[j] ) : Lerp_Hermite( t, pPrev[j], pStart[j], pEnd[j] );
+			}
+			continue;
+		}
+
+		fltx4 p0 = LoadUnalignedSIMD( pPrev + i );
+		fltx4 p1 = LoadUnalignedSIMD( pStart + i );
+		fltx4 p2 = LoadUnalignedSIMD( pEnd + i );
+		fltx4 d1 = SubSIMD( p1, p0 );
+		fltx4 d2 = SubSIMD( p2, p1 );
+
+		fltx4 out = MulSIMD( p1, fl4Start );
+		out = AddSIMD( out, MulSIMD( p2, fl4End ) );
+		out = AddSIMD( out, MulSIMD( d1, fl4D1 ) );
+		out = AddSIMD( out, MulSIMD( d2, fl4D2 ) );
+		StoreUnalignedSIMD( pOut + i, out );
+	}
+
+	for ( ; i < nCount; i++ )
+	{
+		pOut[i] = pLooping[i] ? LoopingLerp_Hermite( t, pPrev[i], pStart[i], pEnd[i] ) : Lerp_Hermite( t, pPrev[i], pStart[i], pEnd[i] );
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// CInterpolatedVarBatch. The SSE rows do the same operations in the same order
+// as Lerp and Lerp_Hermite on a Vector, so as with cl_interp_simd the results
+// match builds that do scalar float math with SSE. Angles go through the
+// quaternion Lerp<QAngle> one at a time.
+//-----------------------------------------------------------------------------
+CInterpolatedVarBatch g_InterpolatedVarBatch;
+
+CInterpolatedVarBatch::CInterpolatedVarBatch()
+{
+	m_nVectorLerps = 0;
+	m_nVectorHermites = 0;
+	m_bEvaluated = false;
+}
+
+int CInterpolatedVarBatch::AddSlot( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, int nType, int iIndex )
+{
+	// Anything queued after Evaluate would never be worked out
+	Assert( !m_bEvaluated );
+
+	int iSlot = m_Slots.AddToTail();
+	Slot_t &slot = m_Slots[iSlot];
+	slot.m_pOwner = pOwner;
+	slot.m_flCurrentTime = currentTime;
+	slot.m_flInterpolationAmount = interpolation_amount;
+	slot.m_nNoMoreChanges = noMoreChanges;
+	slot.m_nType = nType;
+	slot.m_iIndex = iIndex;
+	return iSlot;
+}
+
+int CInterpolatedVarBatch::AddLerp( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float frac, const Vector &start, const Vector &end )
+{
+	int iIndex = m_nVectorLerps++;
+	int iLane = iIndex & 3;
+	if ( !iLane )
+	{
+		// zero the unused lanes of the last block
+		memset( &m_VectorLerps[ m_VectorLerps.AddToTail() ], 0, sizeof( VectorLerp4_t ) );
+	}
+
+	VectorLerp4_t &block = m_VectorLerps[ iIndex >> 2 ];
+	for ( int c = 0; c < 3; c++ )
+	{
+		block.m_Start[c][iLane] = start[c];
+		block.m_End[c][iLane] = end[c];
+	}
+	block.m_Frac[iLane] = frac;
+
+	return AddSlot( pOwner, currentTime, interpolation_amount, noMoreChanges, BATCH_VECTOR_LERP, iIndex );
+}
+
+int CInterpolatedVarBatch::AddHermite( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float t, const Vector &prev, const Vector &start, const Vector &end )
+{
+	int iIndex = m_nVectorHermites++;
+	int iLane = iIndex & 3;
+	if ( !iLane )
+	{
+		memset( &m_VectorHermites[ m_VectorHermites.AddToTail() ], 0, sizeof( VectorHermite4_t ) );
+	}
+
+	VectorHermite4_t &block = m_VectorHermites[ iIndex >> 2 ];
+	for ( int c = 0; c < 3; c++ )
+	{
+		block.m_Prev[c][iLane] = prev[c];
+		block.m_Start[c][iLane] = start[c];
+		block.m_End[c][iLane] = end[c];
+	}
+
+	// Same basis as Lerp_Hermite
+	float tSqr = t*t;
+	float tCube = t*tSqr;
+	block.m_Basis[0][iLane] = 2*tCube-3*tSqr+1;
+	block.m_Basis[1][iLane] = -2*tCube+3*tSqr;
+	block.m_Basis[2][iLane] = tCube-2*tSqr+t;
+	block.m_Basis[3][iLane] = tCube-tSqr;
+
+	return AddSlot( pOwner, currentTime, interpolation_amount, noMoreChanges, BATCH_VECTOR_HERMITE, iIndex );
+}
+
+int CInterpolatedVarBatch::AddLerp( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float frac, const QAngle &start, const QAngle &end )
+{
+	int iIndex = m_AngleLerps.AddToTail();
+	AngleLerp_t &angles = m_AngleLerps[iIndex];
+	angles.m_Start = start;
+	angles.m_End = end;
+	angles.m_flFrac = frac;
+
+	return AddSlot( pOwner, currentTime, interpolation_amount, noMoreChanges, BATCH_ANGLES, iIndex );
+}
+
+int CInterpolatedVarBatch::AddHermite( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float t, const QAngle &prev, const QAngle &start, const QAngle &end )
+{
+	// Lerp_Hermite<QAngle> is a plain Lerp between start and end
+	return AddLerp( pOwner, currentTime, interpolation_amount, noMoreChanges, t, start, end );
+}
+
+void CInterpolatedVarBatch::Evaluate()
+{
+	VPROF( "CInterpolatedVarBatch::Evaluate" );
+
+	for ( int i = 0; i < m_VectorLerps.Count(); i++ )
+	{
+		VectorLerp4_t &block = m_VectorLerps[i];
+		fltx4 frac = LoadUnalignedSIMD( block.m_Frac );
+		for ( int c = 0; c < 3; c++ )
+		{
+			fltx4 start = LoadUnalignedSIMD( block.m_Start[c] );
+			fltx4 end = LoadUnalignedSIMD( block.m_End[c] );
+			StoreUnalignedSIMD( block.m_Out[c], AddSIMD( start, MulSIMD( SubSIMD( end, start ), frac ) ) );
+		}
+	}
+
+	for ( int i = 0; i < m_VectorHermites.Count(); i++ )
+	{
+		VectorHermite4_t &block = m_VectorHermites[i];
+		fltx4 basisStart = LoadUnalignedSIMD( block.m_Basis[0] );
+		fltx4 basisEnd = LoadUnalignedSIMD( block.m_Basis[1] );
+		fltx4 basisD1 = LoadUnalignedSIMD( block.m_Basis[2] );
+		fltx4 basisD2 = LoadUnalignedSIMD( block.m_Basis[3] );
+		for ( int c = 0; c < 3; c++ )
+		{
+			fltx4 p0 = LoadUnalignedSIMD( block.m_Prev[c] );
+			fltx4 p1 = LoadUnalignedSIMD( block.m_Start[c] );
+			fltx4 p2 = LoadUnalignedSIMD( block.m_End[c] );
+			fltx4 d1 = SubSIMD( p1, p0 );
+			fltx4 d2 = SubSIMD( p2, p1 );
+
+			fltx4 out = MulSIMD( p1, basisStart );
+			out = AddSIMD( out, MulSIMD( p2, basisEnd ) );
+			out = AddSIMD( out, MulSIMD( d1, basisD1 ) );
+			out = AddSIMD( out, MulSIMD( d2, basisD2 ) );
+			StoreUnalignedSIMD( block.m_Out[c], out );
+		}
+	}
+
+	for ( int i = 0; i < m_AngleLerps.Count(); i++ )
+	{
+		AngleLerp_t &angles = m_AngleLerps[i];
+		angles.m_Out = Lerp( angles.m_flFrac, angles.m_Start, angles.m_End );
+	}
+
+	m_bEvaluated = true;
+}
+
+const CInterpolatedVarBatch::Slot_t *CInterpolatedVarBatch::FindSlot( int iSlot, const void *pOwner, float currentTime, float interpolation_amount ) const
+{
+	if ( !m_bEvaluated || !m_Slots.IsValidIndex( iSlot ) )
+		return NULL;
+
+	const Slot_t &slot = m_Slots[iSlot];
+	if ( slot.m_pOwner != pOwner || slot.m_flCurrentTime != currentTime || slot.m_flInterpolationAmount != interpolation_amount )
+		return NULL;
+
+	return &slot;
+}
+
+bool CInterpolatedVarBatch::GetResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, Vector *pOut, int *pNoMoreChanges ) const
+{
+	const Slot_t *pSlot = FindSlot( iSlot, pOwner, currentTime, interpolation_amount );
+	if ( !pSlot || pSlot->m_nType == BATCH_ANGLES )
+		return false;
+
+	int iBlock = pSlot->m_iIndex >> 2;
+	int iLane = pSlot->m_iIndex & 3;
+	const float (*pOutRows)[4] = ( pSlot->m_nType == BATCH_VECTOR_LERP ) ? m_VectorLerps[iBlock].m_Out : m_VectorHermites[iBlock].m_Out;
+	pOut->Init( pOutRows[0][iLane], pOutRows[1][iLane], pOutRows[2][iLane] );
+	*pNoMoreChanges = pSlot->m_nNoMoreChanges;
+	return true;
+}
+
+bool CInterpolatedVarBatch::GetResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, QAngle *pOut, int *pNoMoreChanges ) const
+{
+	const Slot_t *pSlot = FindSlot( iSlot, pOwner, currentTime, interpolation_amount );
+	if ( !pSlot || pSlot->m_nType != BATCH_ANGLES )
+		return false;
+
+	*pOut = m_AngleLerps[ pSlot->m_iIndex ].m_Out;
+	*pNoMoreChanges = pSlot->m_nNoMoreChanges;
+	return true;
+}
+
+void CInterpolatedVarBatch::Reset()
+{
+	m_Slots.RemoveAll();
+	m_VectorLerps.RemoveAll();
+	m_nVectorLerps = 0;
+	m_VectorHermites.RemoveAll();
+	m_nVectorHermites = 0;
+	m_AngleLerps.RemoveAll();
+	m_bEvaluated = false;
+}
@@ -145,6 +145,128 @@ inline QAngle ExtrapolateInterpolatedVarType( const QAngle &oldVal, const QAngle
 }
 
 
+// Batched versions of the per element loops in _Interpolate and _Interpolate_Hermite. They work
+// four elements at a time, so are only used for arrays of floats (pose parameters, flex weights,
+// encoded controllers) when cl_interp_simd is set. They return false when the caller needs to
+// do the work itself.
+template< class T >
+inline bool InterpolatedVar_LerpBatch( T *pOut, float frac, const T *pStart, const T *pEnd, const byte *pLooping, int nCount )
+{
+	return false;
+}
+
+template< class T >
+inline bool InterpolatedVar_HermiteBatch( T *pOut, float t, const T *pPrev, const T *pStart, const T *pEnd, const byte *pLooping, int nCount )
+{
+	return false;
+}
+
+bool InterpolatedVar_LerpBatch( float *pOut, float frac, const float *pStart, const float *pEnd, const byte *pLooping, int nCount );
+bool InterpolatedVar_HermiteBatch( float *pOut, float t, const float *pPrev, const float *pStart, const float *pEnd, const byte *pLooping, int nCount );
+
+
+// -------------------------------------------------------------------------------------------------------------- //
+// CInterpolatedVarBatch - the cl_interp_batch pass. Before C_BaseEntity::ProcessInterpolatedList interpolates
+// anything, the origin and angle vars of the entities on the list find their samples and queue the math here. It's
+// all evaluated at once, origins four at a time with SSE, and Interpolate() then just picks up each var's result,
+// so everything that reads the values (BaseInterpolatePart2 on) sees them already done.
+// -------------------------------------------------------------------------------------------------------------- //
+class CInterpolatedVarBatch
+{
+public:
+	CInterpolatedVarBatch();
+
+	// Queue the same math as _Interpolate / _Interpolate_Hermite. Returns the slot pOwner gets its result from.
+	int		AddLerp( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float frac, const Vector &start, const Vector &end );
+	int		AddHermite( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float t, const Vector &prev, const Vector &start, const Vector &end );
+	int		AddLerp( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float frac, const QAngle &start, const QAngle &end );
+	int		AddHermite( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, float t, const QAngle &prev, const QAngle &start, const QAngle &end );
+
+	// Work out everything queued so far.
+	void	Evaluate();
+
+	// Copy out a result, if the slot was evaluated for pOwner with the same time and interpolation amount.
+	bool	GetResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, Vector *pOut, int *pNoMoreChanges ) const;
+	bool	GetResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, QAngle *pOut, int *pNoMoreChanges ) const;
+
+	void	Reset();
+
+private:
+	enum
+	{
+		BATCH_VECTOR_LERP = 0,
+		BATCH_VECTOR_HERMITE,
+		BATCH_ANGLES,
+	};
+
+	struct Slot_t
+	{
+		const void	*m_pOwner;
+		float		m_flCurrentTime;
+		float		m_flInterpolationAmount;
+		int			m_nNoMoreChanges;
+		int			m_nType;
+		int			m_iIndex;
+	};
+
+	// Four vectors a block, a row per component, so SSE can do a row at a time.
+	struct VectorLerp4_t
+	{
+		float	m_Start[3][4];
+		float	m_End[3][4];
+		float	m_Frac[4];
+		float	m_Out[3][4];
+	};
+
+	struct VectorHermite4_t
+	{
+		float	m_Prev[3][4];
+		float	m_Start[3][4];
+		float	m_End[3][4];
+		float	m_Basis[4][4];		// the Lerp_Hermite weights of start, end, start - prev and end - start
+		float	m_Out[3][4];
+	};
+
+	struct AngleLerp_t
+	{
+		QAngle	m_Start;
+		QAngle	m_End;
+		float	m_flFrac;
+		QAngle	m_Out;
+	};
+
+	int				AddSlot( const void *pOwner, float currentTime, float interpolation_amount, int noMoreChanges, int nType, int iIndex );
+	const Slot_t	*FindSlot( int iSlot, const void *pOwner, float currentTime, float interpolation_amount ) const;
+
+	CUtlVector< Slot_t >			m_Slots;
+	CUtlVector< VectorLerp4_t >		m_VectorLerps;
+	int								m_nVectorLerps;
+	CUtlVector< VectorHermite4_t >	m_VectorHermites;
+	int								m_nVectorHermites;
+	CUtlVector< AngleLerp_t >		m_AngleLerps;
+	bool							m_bEvaluated;
+};
+
+extern CInterpolatedVarBatch g_InterpolatedVarBatch;
+
+// Lets CInterpolatedVarArrayBase pick up a batched result whatever its type; only origins and angles get batched.
+template< class T >
+inline bool InterpolatedVar_GetBatchedResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, T *pOut, int *pNoMoreChanges )
+{
+	return false;
+}
+
+inline bool InterpolatedVar_GetBatchedResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, Vector *pOut, int *pNoMoreChanges )
+{
+	return g_InterpolatedVarBatch.GetResult( iSlot, pOwner, currentTime, interpolation_amount, pOut, pNoMoreChanges );
+}
+
+inline bool InterpolatedVar_GetBatchedResult( int iSlot, const void *pOwner, float currentTime, float interpolation_amount, QAngle *pOut, int *pNoMoreChanges )
+{
+	return g_InterpolatedVarBatch.GetResult( iSlot, pOwner, currentTime, interpolation_amount, pOut, pNoMoreChanges );
+}
+
+
 // -------------------------------------------------------------------------------------------------------------- //
 // IInterpolatedVar interface.
 // -------------------------------------------------------------------------------------------------------------- //
@@ -463,6 +585,10 @@ public:
 	bool NoteChanged( float changetime, float interpolation_amount, bool bUpdateLastNetworkedValue );
 	int Interpolate( float currentTime, float interpolation_amount );
 
+	// Find the samples Interpolate( currentTime ) will use and queue the math on g_InterpolatedVarBatch.
+	// Only single Vector and QAngle vars can be batched; cases it doesn't handle are left to Interpolate.
+	void QueueBatchedInterpolate( float currentTime );
+
 	void DebugInterpolate( Type *pOut, float currentTime );
 
 	void GetDerivative( Type *pOut, float currentTime );
@@ -571,6 +697,7 @@ protected:
 	byte *								m_bLooping;
 	float								m_InterpolationAmount;
 	const char *						m_pDebugName;
+	int									m_iBatchSlot;	// g_InterpolatedVarBatch slot with this var's next value, or -1
 	bool								m_bDebug : 1;
 };
 
@@ -586,6 +713,7 @@ inline CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarArrayBase( con
 	m_LastNetworkedTime = 0;
 	m_LastNetworkedValue = NULL;
 	m_bLooping = NULL;
+	m_iBatchSlot = -1;
 	m_bDebug = false;
 }
 
@@ -688,6 +816,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::RestoreToLastNetworked()
 template< typename Type, bool IS_ARRAY >
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::ClearHistory()
 {
+	m_iBatchSlot = -1;
 	for ( int i = 0; i < m_VarHistory.Count(); i++ )
 	{
 		m_VarHistory[i].DeleteEntry();
@@ -700,6 +829,9 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::AddToHead( float changeTi
 {
 	MEM_ALLOC_CREDIT_CLASS();
 	int newslot;
+
+	// a batched value was worked out from the old history
+	m_iBatchSlot = -1;
 	
 	if ( bFlushNewer )
 	{
@@ -968,6 +1100,18 @@ template< typename Type, bool IS_ARRAY >
 inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate( float currentTime, float interpolation_amount )
 {
 	int noMoreChanges = 0;
+
+	if ( m_iBatchSlot != -1 )
+	{
+		// cl_interp_batch has already done the math
+		int iBatchSlot = m_iBatchSlot;
+		m_iBatchSlot = -1;
+		if ( InterpolatedVar_GetBatchedResult( iBatchSlot, this, currentTime, interpolation_amount, m_pValue, &noMoreChanges ) )
+		{
+			RemoveEntriesPreviousTo( currentTime - interpolation_amount - EXTRA_INTERPOLATION_HISTORY_STORED );
+			return noMoreChanges;
+		}
+	}
 	
 	CInterpolationInfo info;
 	if (!GetInterpolationInfo( &info, currentTime, interpolation_amount, &noMoreChanges ))
@@ -1059,6 +1203,46 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate( float current
 }
 
 
+template< typename Type, bool IS_ARRAY >
+inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::QueueBatchedInterpolate( float currentTime )
+{
+	m_iBatchSlot = -1;
+
+	// Debug output and looping values stay on the normal path
+	if ( m_bDebug || m_nMaxCount != 1 || m_bLooping[0] )
+		return;
+
+	int noMoreChanges = 0;
+	CInterpolationInfo info;
+	if ( !GetInterpolationInfo( &info, currentTime, m_InterpolationAmount, &noMoreChanges ) )
+		return;
+
+	CVarHistory &history = m_VarHistory;
+
+	if ( info.m_bHermite )
+	{
+		// Same samples and time fixup as _Interpolate_Hermite; the batch copies the values
+		CInterpolatedVarEntry *prev = &history[info.oldest];
+		CInterpolatedVarEntry *start = &history[info.older];
+		CInterpolatedVarEntry *end = &history[info.newer];
+
+		CInterpolatedVarEntry fixup;
+		fixup.Init( m_nMaxCount );
+		TimeFixup_Hermite( fixup, prev, start, end );
+
+		m_iBatchSlot = g_InterpolatedVarBatch.AddHermite( this, currentTime, m_InterpolationAmount, noMoreChanges, info.frac,
+			prev->GetValue()[0], start->GetValue()[0], end->GetValue()[0] );
+	}
+	else if ( info.newer != info.older )
+	{
+		m_iBatchSlot = g_InterpolatedVarBatch.AddLerp( this, currentTime, m_InterpolationAmount, noMoreChanges, info.frac,
+			history[info.older].GetValue()[0], history[info.newer].GetValue()[0] );
+	}
+
+	// Holding the newest value and extrapolating are cheap, Interpolate does those
+}
+
+
 template< typename Type, bool IS_ARRAY >
 void CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetDerivative( Type *pOut, float currentTime )
 {
@@ -1184,6 +1368,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::Copy( IInterpolatedVar *p
 	m_LastNetworkedTime = pSrc->m_LastNetworkedTime;
 
 	// Copy the entries.
+	m_iBatchSlot = -1;
 	m_VarHistory.RemoveAll();
 
 	for ( int i = 0; i < pSrc->m_VarHistory.Count(); i++ )
@@ -1261,6 +1446,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetHistoryValuesForItem(
 {
 	Assert( item >= 0 && item < m_nMaxCount );
 
+	m_iBatchSlot = -1;
 	for ( int i = 0; i < m_VarHistory.Count(); i++ )
 	{
 		CInterpolatedVarEntry *entry = &m_VarHistory[ i ];
@@ -1273,6 +1459,7 @@ inline void	CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetLooping( bool looping,
 {
 	Assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
 	m_bLooping[ iArrayIndex ] = looping;
+	m_iBatchSlot = -1;
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -1325,6 +1512,9 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate( Type *out,
 
 	Assert( frac >= 0.0f && frac <= 1.0f );
 
+	if ( InterpolatedVar_LerpBatch( out, frac, start->GetValue(), end->GetValue(), m_bLooping, m_nMaxCount ) )
+		return;
+
 	// Note that QAngle has a specialization that will do quaternion interpolation here...
 	for ( int i = 0; i < m_nMaxCount; i++ )
 	{
@@ -1388,15 +1578,18 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::TimeFixup2_Hermite(
 		// Fixed interval into past
 		fixup.changetime = start->changetime - dt1;
 
-		for ( int i = 0; i < m_nMaxCount; i++ )
+		if ( !InterpolatedVar_LerpBatch( fixup.GetValue(), 1-frac, prev->GetValue(), start->GetValue(), m_bLooping, m_nMaxCount ) )
 		{
-			if ( m_bLooping[i] )
-			{
-				fixup.GetValue()[i] = LoopingLerp( 1-frac, prev->GetValue()[i], start->GetValue()[i] );
-			}
-			else
+			for ( int i = 0; i < m_nMaxCount; i++ )
 			{
-				fixup.GetValue()[i] = Lerp( 1-frac, prev->GetValue()[i], start->GetValue()[i] );
+				if ( m_bLooping[i] )
+				{
+					fixup.GetValue()[i] = LoopingLerp( 1-frac, prev->GetValue()[i], start->GetValue()[i] );
+				}
+				else
+				{
+					fixup.GetValue()[i] = Lerp( 1-frac, prev->GetValue()[i], start->GetValue()[i] );
+				}
 			}
 		}
 
@@ -1437,6 +1630,9 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
 	fixup.Init(m_nMaxCount);
 	TimeFixup_Hermite( fixup, prev, start, end );
 
+	if ( InterpolatedVar_HermiteBatch( out, frac, prev->GetValue(), start->GetValue(), end->GetValue(), m_bLooping, m_nMaxCount ) )
+		return;
+
 	for( int i = 0; i < m_nMaxCount; i++ )
 	{
 		// Note that QAngle has a specialization that will do quaternion interpolation here...
@@ -150,6 +150,46 @@ float AI_CriteriaSet::GetWeight( int index ) const
 	return entry->weight;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Iterate the criteria in the set
+// Output : index of the first criterion, or -1 if the set is empty
+//-----------------------------------------------------------------------------
+int AI_CriteriaSet::First() const
+{
+	int idx = m_Lookup.FirstInorder();
+	if ( idx == m_Lookup.InvalidIndex() )
+		return -1;
+
+	return idx;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : index - 
+// Output : index of the next criterion, or -1 at the end of the set
+//-----------------------------------------------------------------------------
+int AI_CriteriaSet::Next( int index ) const
+{
+	int idx = m_Lookup.NextInorder( index );
+	if ( idx == m_Lookup.InvalidIndex() )
+		return -1;
+
+	return idx;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : index - 
+// Output : the criterion's name, as a symbol in the global symbol table
+//-----------------------------------------------------------------------------
+UtlSymId_t AI_CriteriaSet::GetNameSymbol( int index ) const
+{
+	if ( !m_Lookup.IsValidIndex( index ) )
+		return UTL_INVAL_SYMBOL;
+
+	return m_Lookup[ index ].criterianame;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
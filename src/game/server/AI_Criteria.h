@@ -37,6 +37,11 @@ public:
 	const char *GetValue( int index ) const;
 	float		GetWeight( int index ) const;
 
+	// Iterate the criteria in the set, e.g. for( int i = First(); i != -1; i = Next( i ) )
+	int			First() const;
+	int			Next( int index ) const;
+	UtlSymId_t	GetNameSymbol( int index ) const;
+
 private:
 
 	struct CritEntry_t
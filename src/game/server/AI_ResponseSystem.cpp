@@ -29,6 +29,7 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_ruleindex( "rr_ruleindex", "1", FCVAR_NONE, "Use the compiled rule index to skip scoring rules whose required criteria can't match." );
 
 static CUtlSymbolTable g_RS;
 
@@ -59,6 +60,7 @@ public:
 		maxequals = false;
 		maxval = 0.0f;
 		minval = 0.0f;
+		tokenval = 0.0f;
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -110,6 +112,7 @@ public:
 
 	float	maxval;
 	float	minval;
+	float	tokenval;		// the token as a number, for numeric comparisons
 
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
@@ -396,6 +399,7 @@ struct Criteria
 		value = NULL;
 		weight.SetFloat( 1.0f );
 		required = false;
+		key = -1;
 	}
 	Criteria& operator =(const Criteria& src )
 	{
@@ -406,6 +410,7 @@ struct Criteria
 		value = CopyString( src.value );
 		weight = src.weight;
 		required = src.required;
+		key = src.key;
 
 		matcher = src.matcher;
 
@@ -423,6 +428,7 @@ struct Criteria
 		value = CopyString( src.value );
 		weight = src.weight;
 		required = src.required;
+		key = src.key;
 
 		matcher = src.matcher;
 
@@ -447,6 +453,7 @@ struct Criteria
 	char						*value;
 	float16						weight;
 	bool						required;
+	short						key;		// interned name, assigned by CResponseSystem::BuildRuleIndex()
 
 	Matcher						matcher;
 
@@ -678,6 +685,7 @@ public:
 	
 	bool		Compare( const char *setValue, Criteria *c, bool verbose = false );
 	bool		CompareUsingMatcher( const char *setValue, Matcher& m, bool verbose = false );
+	bool		CompareUsingMatcher( const char *setValue, float v, Matcher& m );
 	void		ComputeMatcher( Criteria *c, Matcher& matcher );
 	void		ResolveToken( Matcher& matcher, char *token, size_t bufsize, char const *rawtoken );
 	float		LookupEnumeration( const char *name, bool& found );
@@ -705,6 +713,39 @@ public:
 
 	void		ResponseWarning( const char *fmt, ... );
 
+	// Compiled rule index.
+	// Criterion names are interned into keys, so a query resolves each value in the criteria set once
+	// instead of once per rule. Rules are bucketed by the value of one of their required, plain string
+	// criteria (preferably the concept), so a query only scores the rules in its buckets plus the
+	// rules that have no such criterion. A rule that isn't in a matching bucket would fail that
+	// required criterion, so the result is the same as scoring every rule.
+	struct CriterionValue
+	{
+		const char	*value;			// value from the criteria set, or "" if the set doesn't have this criterion
+		float		numeric;		// value as a number, with enumerations resolved
+		float		weight;
+	};
+
+	bool		IsRuleIndexValid() const;
+	void		InvalidateRuleIndex()		{ ++m_nRulesGeneration; }	// call whenever a rule, criterion, or enumeration is added or removed
+	void		BuildRuleIndex();
+	int			FindCriterionKey( UtlSymId_t name );
+	void		ResolveCriterionValues( const AI_CriteriaSet& set );
+	void		CollectCandidateRules( CUtlVector< int > &candidates );
+	float		ScoreCompiledRule( int irule );
+	float		ScoreCompiledCriterion( int icriterion, bool& exclude );
+
+	unsigned int	m_nRulesGeneration;
+	unsigned int	m_nIndexedGeneration;				// m_nRulesGeneration when the index was built
+	CUtlDict< short, short >	m_CriterionKeys;		// distinct criterion names -> key
+	CUtlVector< short >			m_KeyForSymbol;			// global symbol of a criteria set name -> key, or -1, or -2 if not looked up yet
+	CUtlVector< short >			m_BucketKeys;			// the keys rules are bucketed by
+	CUtlDict< int, int >		m_RuleBuckets;			// "key:value" -> index into m_RuleBucketRules
+	CUtlVector< CCopyableUtlVector< int > >	m_RuleBucketRules;
+	CUtlVector< int >			m_UnbucketedRules;		// rules with no criterion to bucket by
+	CUtlVector< CriterionValue >	m_QueryValues;		// by key, for the query being scored
+	CUtlVector< int >			m_CandidateRules;
+
 	CUtlDict< ResponseGroup, short >	m_Responses;
 	CUtlDict< Criteria, short >	m_Criteria;
 	CUtlDict< Rule, short >	m_Rules;
@@ -762,6 +803,8 @@ CResponseSystem::CResponseSystem()
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
+	m_nRulesGeneration = 1;
+	m_nIndexedGeneration = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -817,6 +860,8 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+
+	InvalidateRuleIndex();
 }
 
 //-----------------------------------------------------------------------------
@@ -988,6 +1033,7 @@ void CResponseSystem::ComputeMatcher( Criteria *c, Matcher& matcher )
 
 	matcher.SetToken( token );
 	matcher.SetRaw( rawtoken );
+	matcher.tokenval = (float)atof( token );
 	matcher.valid = true;
 }
 
@@ -1002,7 +1048,18 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		bool found = false;
 		v = LookupEnumeration( setValue, found );
 	}
-	
+
+	return CompareUsingMatcher( setValue, v, m );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compare a criteria set value, already converted to a number, against a matcher
+//-----------------------------------------------------------------------------
+bool CResponseSystem::CompareUsingMatcher( const char *setValue, float v, Matcher& m )
+{
+	if ( !m.valid )
+		return false;
+
 	int minmaxcount = 0;
 
 	if ( m.usemin )
@@ -1047,7 +1104,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.tokenval )
 				return false;
 		}
 		else
@@ -1066,7 +1123,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.tokenval;
 	}
 
 	return !Q_stricmp( setValue, m.GetToken() ) ? true : false;
@@ -1273,6 +1330,254 @@ float CResponseSystem::ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int
 	return score;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Return true if the rule index was built for the current rules
+//-----------------------------------------------------------------------------
+bool CResponseSystem::IsRuleIndexValid() const
+{
+	return m_nIndexedGeneration == m_nRulesGeneration;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Intern criterion names and bucket the rules - see the declaration of CriterionValue
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_CriterionKeys.RemoveAll();
+	m_KeyForSymbol.RemoveAll();
+	m_BucketKeys.RemoveAll();
+	m_RuleBuckets.RemoveAll();
+	m_RuleBucketRules.RemoveAll();
+	m_UnbucketedRules.RemoveAll();
+
+	int c = m_Criteria.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		Criteria *criteria = &m_Criteria[ i ];
+		criteria->key = -1;
+
+		if ( criteria->IsSubCriteriaType() || !criteria->name )
+			continue;
+
+		int idx = m_CriterionKeys.Find( criteria->name );
+		if ( idx == m_CriterionKeys.InvalidIndex() )
+		{
+			idx = m_CriterionKeys.Insert( criteria->name, m_CriterionKeys.Count() );
+		}
+		criteria->key = m_CriterionKeys[ idx ];
+	}
+
+	c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		Rule *rule = &m_Rules[ i ];
+
+		// find a required criterion that is a plain string comparison, preferably on the concept or classname
+		Criteria *bucketCriteria = NULL;
+		int bucketPriority = 0;
+		for ( int j = 0; j < rule->m_Criteria.Count(); j++ )
+		{
+			Criteria *criteria = &m_Criteria[ rule->m_Criteria[ j ] ];
+			const Matcher &m = criteria->matcher;
+			if ( !criteria->required || criteria->key < 0 || !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+				continue;
+
+			int priority = 1;
+			if ( !Q_stricmp( criteria->name, "concept" ) )
+			{
+				priority = 3;
+			}
+			else if ( !Q_stricmp( criteria->name, "classname" ) )
+			{
+				priority = 2;
+			}
+
+			if ( priority > bucketPriority )
+			{
+				bucketCriteria = criteria;
+				bucketPriority = priority;
+			}
+		}
+
+		if ( !bucketCriteria )
+		{
+			m_UnbucketedRules.AddToTail( i );
+			continue;
+		}
+
+		char bucketName[ 256 ];
+		Q_snprintf( bucketName, sizeof( bucketName ), "%d:%s", bucketCriteria->key, bucketCriteria->matcher.GetToken() );
+
+		int idx = m_RuleBuckets.Find( bucketName );
+		if ( idx == m_RuleBuckets.InvalidIndex() )
+		{
+			idx = m_RuleBuckets.Insert( bucketName, m_RuleBucketRules.AddToTail() );
+		}
+		m_RuleBucketRules[ m_RuleBuckets[ idx ] ].AddToTail( i );
+
+		if ( m_BucketKeys.Find( bucketCriteria->key ) == m_BucketKeys.InvalidIndex() )
+		{
+			m_BucketKeys.AddToTail( bucketCriteria->key );
+		}
+	}
+
+	m_QueryValues.SetCount( m_CriterionKeys.Count() );
+
+	m_nIndexedGeneration = m_nRulesGeneration;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Map the name of a criterion in a criteria set to our key for it
+// Output : the key, or -1 if no rule uses the criterion
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindCriterionKey( UtlSymId_t name )
+{
+	if ( name == UTL_INVAL_SYMBOL )
+		return -1;
+
+	// criteria set names are global symbols, so remember what each one maps to
+	while ( m_KeyForSymbol.Count() <= name )
+	{
+		m_KeyForSymbol.AddToTail( -2 );
+	}
+
+	if ( m_KeyForSymbol[ name ] == -2 )
+	{
+		int idx = m_CriterionKeys.Find( CUtlSymbol( name ).String() );
+		m_KeyForSymbol[ name ] = ( idx == m_CriterionKeys.InvalidIndex() ) ? -1 : m_CriterionKeys[ idx ];
+	}
+
+	return m_KeyForSymbol[ name ];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Look up the value of each criterion key in the set, once per query
+//-----------------------------------------------------------------------------
+void CResponseSystem::ResolveCriterionValues( const AI_CriteriaSet& set )
+{
+	// criteria missing from the set compare as an empty string of weight 1, as in ScoreCriteriaAgainstRuleCriteria
+	for ( int i = 0; i < m_QueryValues.Count(); i++ )
+	{
+		CriterionValue &cv = m_QueryValues[ i ];
+		cv.value = "";
+		cv.numeric = 0.0f;
+		cv.weight = 1.0f;
+	}
+
+	for ( int i = set.First(); i != -1; i = set.Next( i ) )
+	{
+		int key = FindCriterionKey( set.GetNameSymbol( i ) );
+		if ( key < 0 )
+			continue;
+
+		CriterionValue &cv = m_QueryValues[ key ];
+		cv.value = set.GetValue( i );
+		cv.weight = set.GetWeight( i );
+		cv.numeric = (float)atof( cv.value );
+		if ( cv.value[0] == '[' )
+		{
+			bool found = false;
+			cv.numeric = LookupEnumeration( cv.value, found );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collect the rules that could match the current query, in rule order
+//-----------------------------------------------------------------------------
+static int __cdecl CompareRuleIndices( const int *a, const int *b )
+{
+	return *a - *b;
+}
+
+void CResponseSystem::CollectCandidateRules( CUtlVector< int > &candidates )
+{
+	candidates.RemoveAll();
+	candidates.AddVectorToTail( m_UnbucketedRules );
+
+	for ( int i = 0; i < m_BucketKeys.Count(); i++ )
+	{
+		char bucketName[ 256 ];
+		Q_snprintf( bucketName, sizeof( bucketName ), "%d:%s", m_BucketKeys[ i ], m_QueryValues[ m_BucketKeys[ i ] ].value );
+
+		int idx = m_RuleBuckets.Find( bucketName );
+		if ( idx != m_RuleBuckets.InvalidIndex() )
+		{
+			candidates.AddVectorToTail( m_RuleBucketRules[ m_RuleBuckets[ idx ] ] );
+		}
+	}
+
+	// ties are broken by position in the list of matches, so keep the rules in the same order as a full scan
+	candidates.Sort( CompareRuleIndices );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: ScoreCriteriaAgainstRule, using the values resolved for the current query
+//-----------------------------------------------------------------------------
+float CResponseSystem::ScoreCompiledRule( int irule )
+{
+	Rule *rule = &m_Rules[ irule ];
+	if ( !rule->IsEnabled() )
+		return 0.0f;
+
+	float score = 0.0f;
+
+	int count = rule->m_Criteria.Count();
+	for ( int i = 0; i < count; i++ )
+	{
+		bool exclude = false;
+		score += ScoreCompiledCriterion( rule->m_Criteria[ i ], exclude );
+
+		if ( exclude )
+		{
+			score = 0.0f;
+			break;
+		}
+	}
+
+	return score;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: ScoreCriteriaAgainstRuleCriteria, using the values resolved for the current query
+//-----------------------------------------------------------------------------
+float CResponseSystem::ScoreCompiledCriterion( int icriterion, bool& exclude )
+{
+	Criteria *c = &m_Criteria[ icriterion ];
+
+	if ( c->IsSubCriteriaType() )
+	{
+		float score = 0.0f;
+		int subcount = c->subcriteria.Count();
+		for ( int i = 0; i < subcount; i++ )
+		{
+			bool excludesubrule = false;
+			score += ScoreCompiledCriterion( c->subcriteria[ i ], excludesubrule );
+		}
+
+		exclude = ( c->required && score == 0.0f ) ? true : false;
+
+		return score * c->weight.GetFloat();
+	}
+
+	exclude = false;
+
+	static const CriterionValue missing = { "", 0.0f, 1.0f };
+	const CriterionValue &cv = ( c->key >= 0 ) ? m_QueryValues[ c->key ] : missing;
+
+	if ( CompareUsingMatcher( cv.value, cv.numeric, c->matcher ) )
+	{
+		return cv.weight * c->weight.GetFloat();
+	}
+
+	if ( c->required )
+	{
+		exclude = true;
+	}
+
+	return 0.0f;
+}
+
 void CResponseSystem::DebugPrint( int depth, const char *fmt, ... )
 {
 	int indentchars = 3 * depth;
@@ -1687,11 +1992,26 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	CUtlVector< int >	bestrules;
 	float bestscore = 0.001f;
 
-	int c = m_Rules.Count();
-	int i;
-	for ( i = 0; i < c; i++ )
+	// Verbose output and rr_debugrule describe rules the index would skip, so score every rule for those
+	const char *pszDebugRule = rr_debugrule.GetString();
+	bool bScoreAll = verbose || ( pszDebugRule && pszDebugRule[0] ) || !rr_ruleindex.GetBool();
+
+	if ( !bScoreAll )
+	{
+		if ( !IsRuleIndexValid() )
+		{
+			BuildRuleIndex();
+		}
+
+		ResolveCriterionValues( set );
+		CollectCandidateRules( m_CandidateRules );
+	}
+
+	int c = bScoreAll ? m_Rules.Count() : m_CandidateRules.Count();
+	for ( int n = 0; n < c; n++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
+		int i = bScoreAll ? n : m_CandidateRules[ n ];
+		float score = bScoreAll ? ScoreCriteriaAgainstRule( set, i, verbose ) : ScoreCompiledRule( i );
 		// Check equals so that we keep track of all matching rules
 		if ( score >= bestscore )
 		{
@@ -2412,6 +2732,7 @@ int CResponseSystem::ParseOneCriterion( const char *criterionName )
 	}
 
 	int idx = m_Criteria.Insert( criterionName, newCriterion );
+	InvalidateRuleIndex();
 	return idx;
 }
 
@@ -2474,6 +2795,7 @@ void CResponseSystem::ParseEnumeration( void )
 		if ( m_Enumerations.Find( sz ) == m_Enumerations.InvalidIndex() )
 		{
 			m_Enumerations.Insert( sz, newEnum );
+			InvalidateRuleIndex();
 		}
 		/*
 		else
@@ -2607,6 +2929,7 @@ void CResponseSystem::ParseRule( void )
 	if ( validRule )
 	{
 		m_Rules.Insert( ruleName, newRule );
+		InvalidateRuleIndex();
 	}
 	else
 	{
@@ -2694,11 +3017,13 @@ void CResponseSystem::CopyCriteriaFrom( Rule *pSrcRule, Rule *pDstRule, CRespons
 					dstSubCriteria.matcher = pSrcSubCriteria->matcher;
 
 					int iSubInsertIndex = pCustomSystem->m_Criteria.Insert( pSrcSubCriteria->value, dstSubCriteria );
+					pCustomSystem->InvalidateRuleIndex();
 					dstCriteria.subcriteria.AddToTail( iSubInsertIndex );
 				}
 			}
 
 			int iInsertIndex = pCustomSystem->m_Criteria.Insert( m_Criteria.GetElementName( iSrcIndex ), dstCriteria );
+			pCustomSystem->InvalidateRuleIndex();
 			pDstRule->m_Criteria.AddToTail( iInsertIndex );
 		}
 	}
@@ -2770,6 +3095,7 @@ void CResponseSystem::CopyEnumerationsFrom( CResponseSystem *pCustomSystem )
 			Enumeration dstEnumeration;
 			dstEnumeration.value = pSrcEnumeration->value;
 			pCustomSystem->m_Enumerations.Insert( m_Enumerations.GetElementName( iEnumeration ), dstEnumeration );
+			pCustomSystem->InvalidateRuleIndex();
 		}
 	}
 }
@@ -2804,6 +3130,7 @@ void CResponseSystem::CopyRuleFrom( Rule *pSrcRule, int iRule, CResponseSystem *
 
 	// Add rule.
 	pCustomSystem->m_Rules.Insert( m_Rules.GetElementName( iRule ), dstRule );
+	pCustomSystem->InvalidateRuleIndex();
 }
 
 //-----------------------------------------------------------------------------
@@ -4,8 +4,14 @@
 
 #include "cbase.h"
 
+#include "nav_mesh.h"
+#include "datacache/imdlcache.h"
+#include "vstdlib/jobthread.h"
+
 #include "NextBotManager.h"
 #include "NextBotInterface.h"
+#include "NextBotLocomotionInterface.h"
+#include "Path/NextBotPath.h"
 
 #ifdef TERROR
 #include "ZombieBot/Infected/Infected.h"
@@ -25,6 +31,9 @@ ConVar nb_update_frequency( "nb_update_frequency", ".1", FCVAR_CHEAT );
 ConVar nb_update_framelimit( "nb_update_framelimit", ( IsDebug() ) ? "30" : "15", FCVAR_CHEAT );
 ConVar nb_update_maxslide( "nb_update_maxslide", "2", FCVAR_CHEAT );
 ConVar nb_update_debug( "nb_update_debug", "0", FCVAR_CHEAT );
+ConVar nb_vision_batch( "nb_vision_batch", "1", FCVAR_CHEAT, "If nonzero, the line-of-sight traces of every bot updating its vision this tick are gathered and traced as one batch." );
+ConVar nb_vision_batch_threaded( "nb_vision_batch_threaded", "1", FCVAR_CHEAT, "If nonzero, batched vision traces are spread across worker threads." );
+ConVar nb_path_query_threaded( "nb_path_query_threaded", "1", FCVAR_CHEAT, "If nonzero, asynchronous path queries are searched on worker threads. If zero, they are searched on the main thread when dispatched." );
 
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
@@ -242,11 +251,21 @@ NextBotManager::NextBotManager( void )
 	m_selectedBot = NULL;
 	
 	m_iUpdateTickrate = 0;
+
+	m_nextPathQueryHandle = PATH_QUERY_INVALID_HANDLE + 1;
 }
 
 //---------------------------------------------------------------------------------------------
 NextBotManager::~NextBotManager()
 {
+	FinishPathQueries();
+	m_pathQueryVector.PurgeAndDeleteElements();
+	m_pathSearchStateVector.PurgeAndDeleteElements();
+
+	if ( sInstance == this )
+	{
+		sInstance = NULL;
+	}
 }
 
 
@@ -269,6 +288,8 @@ void NextBotManager::Reset( void )
 		i = iNext;
 	}
 
+	AbortPathQueries();
+
 	m_selectedBot = NULL;
 }
 
@@ -306,6 +327,20 @@ static int g_nSlid;
 static int g_nBlockedSlides;
 
 void NextBotManager::Update( void )
+{
+	// search the path queries requested since the last tick while the bots do their upkeep. The searches
+	// read nav area connections, attributes, and blocked state, so they must finish before any entity
+	// thinks or fires inputs that can change the mesh.
+	DispatchPathQueries();
+
+	UpdateBots();
+
+	FinishPathQueries();
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::UpdateBots( void )
 {
 	// do lightweight upkeep every tick
 	for( int u=m_botList.Head(); u != m_botList.InvalidIndex(); u = m_botList.Next( u ) )
@@ -409,7 +444,80 @@ void NextBotManager::Update( void )
 			g_nRun = g_nSlid = g_nBlockedSlides = 0;
 		}
 
+		UpdateVision();
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------
+static void TraceLineOfSightQuery( NextBotLineOfSightQuery &query )
+{
+	query.Trace();
+}
+
+static void PreTraceLineOfSightQueries()
+{
+	mdlcache->BeginLock();
+}
+
+static void PostTraceLineOfSightQueries()
+{
+	mdlcache->EndLock();
+}
+
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Gather the line-of-sight queries of every bot scheduled to update this tick, and trace them
+ * together across worker threads, instead of one at a time as each bot thinks.
+ * Bots that end up updating without having been scheduled (sliders) trace their own queries.
+ */
+void NextBotManager::UpdateVision( void )
+{
+#ifndef TERROR		// vision traces already go through the query cache
+	if ( !nb_vision_batch.GetBool() )
+		return;
+
+	VPROF_BUDGET( "NextBotManager::UpdateVision", "NextBotExpensive" );
+
+	m_lineOfSightQueryVector.RemoveAll();
+
+	CUtlVector< IVision * > visionVector;
+	CUtlVector< int > firstQueryVector;
+
+	for( int i=m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+	{
+		INextBot *bot = m_botList[i];
+
+		if ( m_iUpdateTickrate > 0 && !bot->IsFlaggedForUpdate() )
+			continue;
+
+		if ( IsDead( bot ) )
+			continue;
+
+		IVision *vision = bot->GetVisionInterface();
+		if ( vision == NULL )
+			continue;
+
+		visionVector.AddToTail( vision );
+		firstQueryVector.AddToTail( m_lineOfSightQueryVector.Count() );
+
+		vision->CollectLineOfSightQueries( &m_lineOfSightQueryVector );
 	}
+
+	VPROF_INCREMENT_COUNTER( "NextBotManager::UpdateVision( queries )", m_lineOfSightQueryVector.Count() );
+
+	ParallelProcess( "NextBotManager::UpdateVision", m_lineOfSightQueryVector.Base(), m_lineOfSightQueryVector.Count(), TraceLineOfSightQuery, PreTraceLineOfSightQueries, PostTraceLineOfSightQueries, ( nb_vision_batch_threaded.GetBool() ) ? INT_MAX : 0 );
+
+	// hand each bot its results
+	FOR_EACH_VEC( visionVector, v )
+	{
+		int first = firstQueryVector[v];
+		int last = ( v+1 < firstQueryVector.Count() ) ? firstQueryVector[v+1] : m_lineOfSightQueryVector.Count();
+
+		visionVector[v]->SetLineOfSightResults( m_lineOfSightQueryVector.Base() + first, last - first );
+	}
+#endif
 }
 
 //---------------------------------------------------------------------------------------------
@@ -515,6 +623,16 @@ void NextBotManager::UnRegister( INextBot *bot )
 {
 	m_botList.Remove( bot->GetBotId() );
 
+	// forget this bot's path queries
+	FOR_EACH_VEC_BACK( m_pathQueryVector, it )
+	{
+		NextBotPathQuery *query = m_pathQueryVector[ it ];
+		if ( query->m_bot == bot )
+		{
+			CancelPathQuery( query->m_handle );
+		}
+	}
+
 	if ( bot == m_selectedBot)
 	{
 		// we can't access virtual methods because this is called from a destructor, so just clear it
@@ -526,6 +644,309 @@ void NextBotManager::UnRegister( INextBot *bot )
 //--------------------------------------------------------------------------------------------------------
 void NextBotManager::OnBeginChangeLevel( void )
 {
+	AbortPathQueries();
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Queue a path search from the bot's current area to 'goal', using 'cost'.
+ * The search runs on a worker thread during the next frame, after which the result can be
+ * collected with CollectPathQuery(). Returns PATH_QUERY_INVALID_HANDLE if the bot is not on the mesh,
+ * or if 'cost' can't be evaluated off the main thread.
+ */
+PathQueryHandle NextBotManager::RequestPath( INextBot *bot, const Vector &goal, const IPathCost &cost, float maxPathLength, bool includeGoalIfPathFails )
+{
+	NextBotPathQuery *query = new NextBotPathQuery;
+
+	query->m_bot = bot;
+	query->m_goal = goal;
+
+	// capture the cost now, since the cost functor and the bot can't be used from a worker thread
+	if ( !cost.GetPathQueryCost( &query->m_costFunc ) || !SetupPathQueryAreas( query ) )
+	{
+		delete query;
+		return PATH_QUERY_INVALID_HANDLE;
+	}
+
+	query->m_handle = m_nextPathQueryHandle++;
+	if ( m_nextPathQueryHandle == PATH_QUERY_INVALID_HANDLE )
+	{
+		++m_nextPathQueryHandle;
+	}
+
+	query->m_status = NextBotPathQuery::QUEUED;
+	query->m_maxPathLength = maxPathLength;
+	query->m_teamID = bot->GetEntity()->GetTeamNumber();
+	query->m_includeGoalIfPathFails = includeGoalIfPathFails;
+	query->m_isPathComplete = false;
+	query->m_searchTime = 0.0f;
+	query->m_costFunc.m_searchState = NULL;
+
+	m_pathQueryVector.AddToTail( query );
+
+	return query->m_handle;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Find the nav areas the query's bot and goal are in, as Path::Compute() does.
+ * Returns false if the bot is not on the mesh.
+ */
+bool NextBotManager::SetupPathQueryAreas( NextBotPathQuery *query ) const
+{
+	query->m_startArea = query->m_bot->GetEntity()->GetLastKnownArea();
+	if ( query->m_startArea == NULL )
+		return false;
+
+	// check line-of-sight to the goal position when finding it's nav area
+	const float maxDistanceToArea = 200.0f;
+	query->m_goalArea = TheNavMesh->GetNearestNavArea( query->m_goal, true, maxDistanceToArea, true );
+
+	// make sure path end position is on the ground
+	query->m_pathEndPosition = query->m_goal;
+	if ( query->m_goalArea )
+	{
+		query->m_pathEndPosition.z = query->m_goalArea->GetZ( query->m_goal );
+	}
+	else
+	{
+		TheNavMesh->GetGroundHeight( query->m_goal, &query->m_pathEndPosition.z );
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+NextBotPathQuery *NextBotManager::FindPathQuery( PathQueryHandle handle ) const
+{
+	if ( handle == PATH_QUERY_INVALID_HANDLE )
+		return NULL;
+
+	FOR_EACH_VEC( m_pathQueryVector, it )
+	{
+		if ( m_pathQueryVector[ it ]->m_handle == handle )
+		{
+			return m_pathQueryVector[ it ];
+		}
+	}
+
+	return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Return true if the given query has not finished searching yet
+ */
+bool NextBotManager::IsPathQueryPending( PathQueryHandle handle ) const
+{
+	NextBotPathQuery *query = FindPathQuery( handle );
+	if ( query == NULL )
+		return false;
+
+	return query->m_status == NextBotPathQuery::QUEUED || query->m_status == NextBotPathQuery::RUNNING;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Build 'path' from a finished query and release the query.
+ * When PATH_QUERY_COLLECTED is returned, 'isPath' is true if the path reaches the goal, as Path::Compute()
+ * returns. A query that was aborted because the nav mesh changed is searched again on the main thread first.
+ * If the query is still pending, or is unknown because it was cancelled or superseded, 'path' is left alone.
+ */
+PathQueryResultType NextBotManager::CollectPathQuery( PathQueryHandle handle, INextBot *bot, Path *path, bool *isPath )
+{
+	*isPath = false;
+
+	NextBotPathQuery *query = FindPathQuery( handle );
+	if ( query == NULL )
+		return PATH_QUERY_CANCELLED;
+
+	if ( IsPathQueryPending( handle ) )
+		return PATH_QUERY_PENDING;
+
+	// release the query before building the path, since invalidating the path may try to cancel it
+	m_pathQueryVector.FindAndRemove( query );
+
+	if ( query->m_status == NextBotPathQuery::ABORTED )
+	{
+		// the areas this query found are gone - search the new mesh now, with the cost captured when it was requested
+		if ( !SetupPathQueryAreas( query ) )
+		{
+			delete query;
+			return PATH_QUERY_CANCELLED;
+		}
+
+		if ( m_pathSearchStateVector.Count() == 0 )
+		{
+			m_pathSearchStateVector.AddToTail( new CNavPathSearchState );
+		}
+
+		// the jobs are only running during Update(), so their search states are free now
+		query->Execute( m_pathSearchStateVector[0] );
+		query->m_status = NextBotPathQuery::COMPLETE;
+	}
+
+	*isPath = path->ComputeFromQuery( bot, *query );
+
+	delete query;
+
+	return PATH_QUERY_COLLECTED;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void NextBotManager::CancelPathQuery( PathQueryHandle handle )
+{
+	NextBotPathQuery *query = FindPathQuery( handle );
+	if ( query == NULL )
+		return;
+
+	if ( query->m_status == NextBotPathQuery::RUNNING )
+	{
+		// a worker owns this query - orphan it, and it will be deleted when the job is collected
+		query->m_bot = NULL;
+		query->m_handle = PATH_QUERY_INVALID_HANDLE;
+		return;
+	}
+
+	m_pathQueryVector.FindAndRemove( query );
+	delete query;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Wait for running queries, and discard the results of every outstanding query. They are searched
+ * again when they are collected. Invoked when the nav mesh is about to change, since queued and
+ * completed queries refer to its areas.
+ */
+void NextBotManager::AbortPathQueries( void )
+{
+	FinishPathQueries();
+
+	FOR_EACH_VEC( m_pathQueryVector, it )
+	{
+		NextBotPathQuery *query = m_pathQueryVector[ it ];
+
+		query->m_status = NextBotPathQuery::ABORTED;
+		query->m_startArea = NULL;
+		query->m_goalArea = NULL;
+		query->m_areaPath.RemoveAll();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+static void ProcessPathQueries( NextBotPathQuery **queryArray, int count, CNavPathSearchState *searchState )
+{
+	for( int i=0; i<count; ++i )
+	{
+		queryArray[i]->Execute( searchState );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Hand all queued path queries to worker threads, one job per worker
+ */
+void NextBotManager::DispatchPathQueries( void )
+{
+	Assert( m_pathQueryJobVector.Count() == 0 );
+
+	m_runningPathQueryVector.RemoveAll();
+
+	FOR_EACH_VEC( m_pathQueryVector, it )
+	{
+		NextBotPathQuery *query = m_pathQueryVector[ it ];
+		if ( query->m_status == NextBotPathQuery::QUEUED )
+		{
+			query->m_status = NextBotPathQuery::RUNNING;
+			m_runningPathQueryVector.AddToTail( query );
+		}
+	}
+
+	int queryCount = m_runningPathQueryVector.Count();
+	if ( queryCount == 0 )
+		return;
+
+	// the nav mesh must not change while workers are reading it, so search in place while it is being edited
+	bool isThreaded = nb_path_query_threaded.GetBool() && g_pThreadPool && g_pThreadPool->NumThreads() > 0;
+	if ( nav_edit.GetBool() || TheNavMesh->IsGenerating() )
+	{
+		isThreaded = false;
+	}
+
+	int jobCount = isThreaded ? MIN( g_pThreadPool->NumThreads(), queryCount ) : 1;
+
+	while( m_pathSearchStateVector.Count() < jobCount )
+	{
+		m_pathSearchStateVector.AddToTail( new CNavPathSearchState );
+	}
+
+	if ( !isThreaded )
+	{
+		ProcessPathQueries( m_runningPathQueryVector.Base(), queryCount, m_pathSearchStateVector[0] );
+		FinishPathQueries();
+		return;
+	}
+
+	// split the queries into contiguous runs, one per job
+	int first = 0;
+	for( int j=0; j<jobCount; ++j )
+	{
+		int count = ( queryCount - first ) / ( jobCount - j );
+
+		m_pathQueryJobVector.AddToTail( ThreadExecute( &ProcessPathQueries, m_runningPathQueryVector.Base() + first, count, m_pathSearchStateVector[j] ) );
+
+		first += count;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Wait for the jobs started by DispatchPathQueries(), and make their results available
+ */
+void NextBotManager::FinishPathQueries( void )
+{
+	VPROF_BUDGET( "NextBotManager::FinishPathQueries", "NextBot" );
+
+	FOR_EACH_VEC( m_pathQueryJobVector, it )
+	{
+		m_pathQueryJobVector[ it ]->WaitForFinishAndRelease();
+	}
+	m_pathQueryJobVector.RemoveAll();
+
+	float searchTime = 0.0f;
+	FOR_EACH_VEC( m_runningPathQueryVector, it )
+	{
+		NextBotPathQuery *query = m_runningPathQueryVector[ it ];
+
+		searchTime += query->m_searchTime;
+
+		if ( query->m_bot == NULL )
+		{
+			// query was cancelled while it was running
+			m_pathQueryVector.FindAndRemove( query );
+			delete query;
+			continue;
+		}
+
+		query->m_status = NextBotPathQuery::COMPLETE;
+	}
+
+	if ( nb_update_debug.GetBool() && m_runningPathQueryVector.Count() )
+	{
+		Msg( "Frame %8d/tick %8d: %3d path queries completed, %.2fms total search time\n", gpGlobals->framecount, gpGlobals->tickcount, m_runningPathQueryVector.Count(), searchTime * 1000.0f );
+	}
+
+	m_runningPathQueryVector.RemoveAll();
 }
 
 
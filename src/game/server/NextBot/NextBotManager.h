@@ -6,8 +6,13 @@
 #define _NEXT_BOT_MANAGER_H_
 
 #include "NextBotInterface.h"
+#include "NextBotVisionInterface.h"
+#include "Path/NextBotPathQuery.h"
 
 class CTerrorPlayer;
+class CJob;
+class Path;
+class IPathCost;
 
 //----------------------------------------------------------------------------------------------------------------
 /**
@@ -99,6 +104,17 @@ public:
 		return close;
 	}
 
+	/**
+	 * Asynchronous path queries.
+	 * Queries requested during a tick are searched on worker threads during the manager's next
+	 * Update(), and their results can be collected once it returns.
+	 */
+	PathQueryHandle RequestPath( INextBot *bot, const Vector &goal, const IPathCost &cost, float maxPathLength = 0.0f, bool includeGoalIfPathFails = true );
+	bool IsPathQueryPending( PathQueryHandle handle ) const;	// return true if the query has not finished yet
+	PathQueryResultType CollectPathQuery( PathQueryHandle handle, INextBot *bot, Path *path, bool *isPath );	// if the query has finished, build 'path' from it and release the query
+	void CancelPathQuery( PathQueryHandle handle );
+	void AbortPathQueries( void );					// wait for all running queries, and mark every outstanding one to be searched again (invoked when the nav mesh changes)
+
 	/**
 	 * Event propagators
 	 */
@@ -162,6 +178,21 @@ protected:
 	CUtlVector< DebugFilter > m_debugFilterList;
 
 	INextBot *m_selectedBot;						// selected bot for further debug operations
+
+	void UpdateBots( void );						// bot upkeep, and scheduling of full bot updates
+	void UpdateVision( void );						// trace the line-of-sight queries of every bot updating this tick as one batch
+	CUtlVector< NextBotLineOfSightQuery > m_lineOfSightQueryVector;	// reused each tick
+
+	void DispatchPathQueries( void );				// hand queued path queries to worker threads
+	void FinishPathQueries( void );					// wait for running path queries and mark them complete
+	NextBotPathQuery *FindPathQuery( PathQueryHandle handle ) const;
+	bool SetupPathQueryAreas( NextBotPathQuery *query ) const;	// find the start and goal areas of the query on the current nav mesh
+
+	CUtlVector< NextBotPathQuery * > m_pathQueryVector;	// all outstanding path queries
+	CUtlVector< NextBotPathQuery * > m_runningPathQueryVector;	// the queries being searched by worker threads
+	CUtlVector< CJob * > m_pathQueryJobVector;			// jobs servicing the RUNNING queries
+	CUtlVector< CNavPathSearchState * > m_pathSearchStateVector;	// one search state per job, reused across ticks
+	PathQueryHandle m_nextPathQueryHandle;
 };
 
 inline int NextBotManager::GetNextBotCount( void ) const
@@ -46,6 +46,9 @@ void IVision::Reset( void )
 	m_lastVisionUpdateTimestamp = 0.0f;
 	m_primaryThreat = NULL;
 
+	m_batchedVisibleVector.RemoveAll();
+	m_batchedTick = -1;
+
 	m_FOV = GetDefaultFieldOfView();
 	m_cosHalfFOV = cos( 0.5f * m_FOV * M_PI / 180.0f );
 	
@@ -345,6 +348,18 @@ public:
 			
 		return true;
 	}
+
+	// the line-of-sight trace to this entity has already been done as part of a batch
+	void AddBatched( CBaseEntity *entity )
+	{
+		if ( entity &&
+			 !m_vision->IsIgnored( entity ) &&
+			 entity->IsAlive() &&
+			 m_vision->IsVisibleEntityNoticed( entity ) )
+		{
+			m_recognized.AddToTail( entity );	
+		}
+	}
 	
 	bool Contains( CBaseEntity *entity ) const
 	{
@@ -368,18 +383,34 @@ void IVision::UpdateKnownEntities( void )
 {
 	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
 
-	// construct set of potentially visible objects
-	CUtlVector< CBaseEntity * > potentiallyVisible;
-	CollectPotentiallyVisibleEntities( &potentiallyVisible );
-
 	// collect set of visible and recognized entities at this moment
 	CollectVisible visibleNow( this );
-	FOR_EACH_VEC( potentiallyVisible, pit )
+
+	if ( m_batchedTick == gpGlobals->tickcount )
 	{
-		VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+		// the NextBotManager already traced our line-of-sight queries for this tick
+		VPROF_BUDGET( "IVision::UpdateKnownEntities( collect batched )", "NextBot" );
 
-		if ( visibleNow( potentiallyVisible[ pit ] ) == false )
-			break;
+		FOR_EACH_VEC( m_batchedVisibleVector, bit )
+		{
+			visibleNow.AddBatched( m_batchedVisibleVector[ bit ] );
+		}
+
+		m_batchedTick = -1;
+	}
+	else
+	{
+		// construct set of potentially visible objects
+		CUtlVector< CBaseEntity * > potentiallyVisible;
+		CollectPotentiallyVisibleEntities( &potentiallyVisible );
+
+		FOR_EACH_VEC( potentiallyVisible, pit )
+		{
+			VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+
+			if ( visibleNow( potentiallyVisible[ pit ] ) == false )
+				break;
+		}
 	}
 	
 	// update known set with new data
@@ -569,6 +600,28 @@ bool IVision::IsAbleToSee( CBaseEntity *subject, FieldOfViewCheckType checkFOV,
 {
 	VPROF_BUDGET( "IVision::IsAbleToSee", "NextBotExpensive" );
 
+	if ( !IsPotentiallyVisible( subject, checkFOV ) )
+	{
+		return false;
+	}
+
+	// do actual line-of-sight trace
+	if ( !IsLineOfSightClearToEntity( subject ) )
+	{
+		return false;
+	}
+
+	return IsVisibleEntityNoticed( subject );
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Return true if the subject passes every visibility check short of the actual
+ * line-of-sight trace - range, fog, field of view, and nav area potential visibility.
+ */
+bool IVision::IsPotentiallyVisible( CBaseEntity *subject, FieldOfViewCheckType checkFOV ) const
+{
 	if ( GetBot()->IsRangeGreaterThan( subject, GetMaxVisionRange() ) )
 	{
 		return false;
@@ -601,13 +654,7 @@ bool IVision::IsAbleToSee( CBaseEntity *subject, FieldOfViewCheckType checkFOV,
 		}
 	}
 
-	// do actual line-of-sight trace
-	if ( !IsLineOfSightClearToEntity( subject ) )
-	{
-		return false;
-	}
-
-	return IsVisibleEntityNoticed( subject );
+	return true;
 }
 
 
@@ -749,17 +796,49 @@ bool IVision::IsLineOfSightClearToEntity( const CBaseEntity *subject, Vector *vi
 	// TODO: Use plain-old traces until querycache/etc gets integrated
 	VPROF_BUDGET( "IVision::IsLineOfSightClearToEntity", "NextBot" );
 
+	NextBotLineOfSightQuery query;
+	CollectLineOfSightSpots( subject, &query );
+	query.Trace( visibleSpot );
+
+	return query.isClear;
+
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Fill in the eye position and the spots on the subject to check for line-of-sight
+ */
+void IVision::CollectLineOfSightSpots( const CBaseEntity *subject, NextBotLineOfSightQuery *query ) const
+{
+	query->vision = const_cast< IVision * >( this );
+	query->subject = const_cast< CBaseEntity * >( subject );
+	query->eye = GetBot()->GetBodyInterface()->GetEyePosition();
+	query->spot[0] = subject->WorldSpaceCenter();
+	query->spot[1] = subject->EyePosition();
+	query->spot[2] = subject->GetAbsOrigin();
+	query->spotCount = 3;
+	query->isClear = false;
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Trace from the eye to each spot in turn, stopping at the first one that is visible.
+ * This only reads the query and the collision world, so it is safe to run on a worker thread.
+ */
+void NextBotLineOfSightQuery::Trace( Vector *visibleSpot )
+{
 	trace_t result;
 	NextBotTraceFilterIgnoreActors filter( subject, COLLISION_GROUP_NONE );
 
-	UTIL_TraceLine( GetBot()->GetBodyInterface()->GetEyePosition(), subject->WorldSpaceCenter(), MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
-	if ( result.DidHit() )
+	for( int i=0; i<spotCount; ++i )
 	{
-		UTIL_TraceLine( GetBot()->GetBodyInterface()->GetEyePosition(), subject->EyePosition(), MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
-
-		if ( result.DidHit() )
+		UTIL_TraceLine( eye, spot[i], MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
+		if ( !result.DidHit() )
 		{
-			UTIL_TraceLine( GetBot()->GetBodyInterface()->GetEyePosition(), subject->GetAbsOrigin(), MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
+			break;
 		}
 	}
 
@@ -768,9 +847,65 @@ bool IVision::IsLineOfSightClearToEntity( const CBaseEntity *subject, Vector *vi
 		*visibleSpot = result.endpos;
 	}
 
-	return ( result.fraction >= 1.0f && !result.startsolid );
+	isClear = ( result.fraction >= 1.0f && !result.startsolid );
+}
 
-#endif
+
+//------------------------------------------------------------------------------------------
+/**
+ * Append a line-of-sight query for each entity we could see this tick, if the trace is clear.
+ * This mirrors the checks done by UpdateKnownEntities(), leaving only the traces to be batched.
+ */
+void IVision::CollectLineOfSightQueries( CUtlVector< NextBotLineOfSightQuery > *queryVector )
+{
+	VPROF_BUDGET( "IVision::CollectLineOfSightQueries", "NextBot" );
+
+	m_batchedVisibleVector.RemoveAll();
+	m_batchedTick = -1;
+
+	if ( nb_blind.GetBool() )
+	{
+		return;
+	}
+
+	CUtlVector< CBaseEntity * > potentiallyVisible;
+	CollectPotentiallyVisibleEntities( &potentiallyVisible );
+
+	FOR_EACH_VEC( potentiallyVisible, pit )
+	{
+		CBaseEntity *entity = potentiallyVisible[ pit ];
+
+		if ( entity &&
+			 !IsIgnored( entity ) &&
+			 entity->IsAlive() &&
+			 entity != GetBot()->GetEntity() &&
+			 IsPotentiallyVisible( entity, USE_FOV ) )
+		{
+			CollectLineOfSightSpots( entity, &queryVector->Element( queryVector->AddToTail() ) );
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Store the traced results of the queries we collected, for use by our next vision update this tick
+ */
+void IVision::SetLineOfSightResults( const NextBotLineOfSightQuery *queries, int count )
+{
+	m_batchedVisibleVector.RemoveAll();
+
+	for( int i=0; i<count; ++i )
+	{
+		Assert( queries[i].vision == this );
+
+		if ( queries[i].isClear )
+		{
+			m_batchedVisibleVector.AddToTail( queries[i].subject );
+		}
+	}
+
+	m_batchedTick = gpGlobals->tickcount;
 }
 
 
@@ -11,6 +11,28 @@
 
 class IBody;
 class INextBotEntityFilter;
+class IVision;
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * A line-of-sight test from a bot's eye to a subject it could potentially see.
+ * These are gathered from every bot updating this tick by IVision::CollectLineOfSightQueries(),
+ * and traced together as one batch by the NextBotManager.
+ */
+struct NextBotLineOfSightQuery
+{
+	enum { MAX_SPOTS = 3 };
+
+	void Trace( Vector *visibleSpot = NULL );	// trace to each spot until one is visible - may be invoked on a worker thread
+
+	IVision *vision;
+	CBaseEntity *subject;
+	Vector eye;									// viewer's eye position
+	Vector spot[ MAX_SPOTS ];					// spots on the subject to test, in priority order
+	int spotCount;
+	bool isClear;								// result of the trace
+};
 
 
 //----------------------------------------------------------------------------------------------------------------
@@ -108,6 +130,16 @@ public:
 	virtual bool IsLookingAt( const Vector &pos, float cosTolerance = 0.95f ) const;					// are we looking at the given position
 	virtual bool IsLookingAt( const CBaseCombatCharacter *actor, float cosTolerance = 0.95f ) const;	// are we looking at the given actor
 
+	/**
+	 * Batched line-of-sight support, used by the NextBotManager to trace the vision
+	 * updates of every bot updating this tick at once.
+	 * CollectLineOfSightQueries() appends a query for each potentially visible entity that survives
+	 * the range, fog, FOV, and nav area visibility checks. Once traced, the results for this bot
+	 * are handed back with SetLineOfSightResults(), and are used by the next vision update this tick.
+	 */
+	void CollectLineOfSightQueries( CUtlVector< NextBotLineOfSightQuery > *queryVector );
+	void SetLineOfSightResults( const NextBotLineOfSightQuery *queries, int count );
+
 private:
 	CountdownTimer m_scanTimer;			// for throttling update rate
 	
@@ -116,6 +148,11 @@ private:
 	
 	CUtlVector< CKnownEntity > m_knownEntityVector;		// the set of enemies/friends we are aware of
 	void UpdateKnownEntities( void );
+	bool IsPotentiallyVisible( CBaseEntity *subject, FieldOfViewCheckType checkFOV ) const;	// return true if subject passes every check short of the line-of-sight trace
+	void CollectLineOfSightSpots( const CBaseEntity *subject, NextBotLineOfSightQuery *query ) const;
+
+	CUtlVector< CHandle< CBaseEntity > > m_batchedVisibleVector;	// subjects found to be in clear line-of-sight by the last batch
+	int m_batchedTick;									// the tick the batched results are valid for, or -1
 	bool IsAwareOf( const CKnownEntity &known ) const;	// return true if our reaction time has passed for this entity
 	mutable CHandle< CBaseEntity > m_primaryThreat;
 
@@ -45,6 +45,9 @@ public:
 
 private:
 	void RefreshPath( INextBot *bot, CBaseEntity *subject, const IPathCost &cost, Vector *pPredictedSubjectPos );
+	void OnRefreshPathResult( INextBot *bot, CBaseEntity *subject, const Vector &pathTarget, bool isPath );
+
+	Vector m_pathQueryTarget;							// goal of our pending asynchronous repath, if any
 
 	CountdownTimer m_failTimer;							// throttle re-pathing if last path attempt failed
 	CountdownTimer m_throttleTimer;						// require a minimum time between re-paths
@@ -182,7 +185,30 @@ inline void ChasePath::RefreshPath( INextBot *bot, CBaseEntity *subject, const I
 		m_failTimer.Invalidate();
 	}
 
-	if ( IsValid() && !m_throttleTimer.IsElapsed() )
+	bool isRepathForced = false;
+
+	if ( IsComputePending() )
+	{
+		bool isPath;
+		PathQueryResultType result = CollectPath( bot, &isPath );
+
+		if ( result == PATH_QUERY_PENDING )
+		{
+			// keep following our current path until the new one is ready
+			return;
+		}
+
+		if ( result == PATH_QUERY_COLLECTED )
+		{
+			OnRefreshPathResult( bot, subject, m_pathQueryTarget, isPath );
+			return;
+		}
+
+		// the repath was cancelled - compute it now instead
+		isRepathForced = true;
+	}
+
+	if ( IsValid() && !m_throttleTimer.IsElapsed() && !isRepathForced )
 	{
 		// require a minimum time between repaths, as long as we have a path to follow
 // 		if ( bot->IsDebugging( NEXTBOT_PATH ) )
@@ -198,12 +224,30 @@ inline void ChasePath::RefreshPath( INextBot *bot, CBaseEntity *subject, const I
 		Invalidate();
 	}
 	
-	if ( !IsValid() || IsRepathNeeded( bot, subject ) )
+	if ( !IsValid() || IsRepathNeeded( bot, subject ) || isRepathForced )
 	{
 		// the situation has changed - try a new path
 		bool isPath;
 		Vector pathTarget = subject->GetAbsOrigin();
 
+		if ( !isRepathForced )
+		{
+			// if we have a path to follow in the meantime, and our cost allows it, let the new one be found asynchronously
+			Vector queryTarget = pathTarget;
+			if ( m_chaseHow == LEAD_SUBJECT )
+			{
+				queryTarget = pPredictedSubjectPos ? *pPredictedSubjectPos : PredictSubjectPosition( bot, subject );
+			}
+
+			if ( RequestPath( bot, queryTarget, cost, GetMaxPathLength(), true ) )
+			{
+				m_pathQueryTarget = queryTarget;
+
+				// don't request another path until this one is collected
+				return;
+			}
+		}
+
 		if ( m_chaseHow == LEAD_SUBJECT )
 		{
 			pathTarget = pPredictedSubjectPos ? *pPredictedSubjectPos : PredictSubjectPosition( bot, subject );
@@ -218,53 +262,63 @@ inline void ChasePath::RefreshPath( INextBot *bot, CBaseEntity *subject, const I
 			isPath = Compute( bot, pathTarget, cost, GetMaxPathLength() );
 		}
 
-		if ( isPath )
+		OnRefreshPathResult( bot, subject, pathTarget, isPath );
+	}
+}
+
+
+//----------------------------------------------------------------------------------------------
+/**
+ * Update repath timers and notify the bot after a new path has been computed
+ */
+inline void ChasePath::OnRefreshPathResult( INextBot *bot, CBaseEntity *subject, const Vector &pathTarget, bool isPath )
+{
+	if ( isPath )
+	{
+		if ( bot->IsDebugging( NEXTBOT_PATH ) )
 		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				//const float size = 20.0f;			
-				//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, RandomInt( 0, 200 ), 255, 255, true, 30.0f );
+			//const float size = 20.0f;			
+			//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, RandomInt( 0, 200 ), 255, 255, true, 30.0f );
 
-				DevMsg( "%3.2f: bot(#%d) REPATH\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-			}
+			DevMsg( "%3.2f: bot(#%d) REPATH\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+		}
 
-			m_lastPathSubject = subject;
+		m_lastPathSubject = subject;
 
-			const float minRepathInterval = 0.5f;
-			m_throttleTimer.Start( minRepathInterval );
+		const float minRepathInterval = 0.5f;
+		m_throttleTimer.Start( minRepathInterval );
 
-			// track the lifetime of this new path
-			float lifetime = GetLifetime();
-			if ( lifetime > 0.0f )
-			{
-				m_lifetimeTimer.Start( lifetime );
-			}
-			else
-			{
-				m_lifetimeTimer.Invalidate();
-			}
+		// track the lifetime of this new path
+		float lifetime = GetLifetime();
+		if ( lifetime > 0.0f )
+		{
+			m_lifetimeTimer.Start( lifetime );
 		}
 		else
 		{
-			// can't reach subject - throttle retry based on range to subject
-			m_failTimer.Start( 0.005f * ( bot->GetRangeTo( subject ) ) );
-			
-			// allow bot to react to path failure
-			bot->OnMoveToFailure( this, FAIL_NO_PATH_EXISTS );
-
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				//const float size = 20.0f;	
-				const float dT = 90.0f;		
-				int c = RandomInt( 0, 100 );
-				//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, c, c, 255, true, dT );
-				NDebugOverlay::HorzArrow( bot->GetPosition(), pathTarget, 5.0f, 255, c, c, 255, true, dT );
+			m_lifetimeTimer.Invalidate();
+		}
+	}
+	else
+	{
+		// can't reach subject - throttle retry based on range to subject
+		m_failTimer.Start( 0.005f * ( bot->GetRangeTo( subject ) ) );
+		
+		// allow bot to react to path failure
+		bot->OnMoveToFailure( this, FAIL_NO_PATH_EXISTS );
 
-				DevMsg( "%3.2f: bot(#%d) REPATH FAILED\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-			}
+		if ( bot->IsDebugging( NEXTBOT_PATH ) )
+		{
+			//const float size = 20.0f;	
+			const float dT = 90.0f;		
+			int c = RandomInt( 0, 100 );
+			//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, c, c, 255, true, dT );
+			NDebugOverlay::HorzArrow( bot->GetPosition(), pathTarget, 5.0f, 255, c, c, 255, true, dT );
 
-			Invalidate();
+			DevMsg( "%3.2f: bot(#%d) REPATH FAILED\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
 		}
+
+		Invalidate();
 	}
 }
 
@@ -9,6 +9,7 @@
 #include "fmtstr.h"
 
 #include "NextBotPath.h"
+#include "NextBotPathQuery.h"
 #include "NextBotInterface.h"
 #include "NextBotLocomotionInterface.h"
 #include "NextBotBodyInterface.h"
@@ -399,6 +400,85 @@ void Path::InsertSegment( Segment newSegment, int i )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build this path from the area chain found by a completed asynchronous path query
+ */
+bool Path::ComputeFromQuery( INextBot *bot, const NextBotPathQuery &query )
+{
+	VPROF_BUDGET( "Path::ComputeFromQuery", "NextBot" );
+
+	Invalidate();
+
+	if ( query.m_status != NextBotPathQuery::COMPLETE )
+	{
+		OnPathChanged( bot, NO_PATH );
+		return false;
+	}
+
+	const Vector &start = bot->GetPosition();
+
+	// if we are already in the goal area, build trivial path
+	if ( query.m_startArea == query.m_goalArea )
+	{
+		BuildTrivialPath( bot, query.m_goal );
+		return true;
+	}
+
+	// Failed?
+	if ( query.m_areaPath.Count() == 0 )
+		return false;
+
+	bool pathResult = query.m_isPathComplete;
+
+	if ( query.m_areaPath.Count() == 1 )
+	{
+		BuildTrivialPath( bot, query.m_goal );
+		return pathResult;
+	}
+
+	// assemble path, keeping the areas nearest the goal if the path is too long
+	int count = MIN( query.m_areaPath.Count(), (int)MAX_PATH_SEGMENTS-1 );	// save room for endpoint
+	int first = query.m_areaPath.Count() - count;
+
+	m_segmentCount = count;
+	for( int i=0; i<count; ++i )
+	{
+		m_path[ i ].area = query.m_areaPath[ first + i ].area;
+		m_path[ i ].how = query.m_areaPath[ first + i ].how;
+		m_path[ i ].type = ON_GROUND;
+	}
+
+	if ( pathResult || query.m_includeGoalIfPathFails )
+	{
+		// append actual goal position
+		m_path[ m_segmentCount ].area = query.m_areaPath.Tail().area;
+		m_path[ m_segmentCount ].pos = query.m_pathEndPosition;
+		m_path[ m_segmentCount ].ladder = NULL;
+		m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
+		m_path[ m_segmentCount ].type = ON_GROUND;
+		++m_segmentCount;
+	}
+
+	// compute path positions
+	if ( ComputePathDetails( bot, start ) == false )
+	{
+		Invalidate();
+		OnPathChanged( bot, NO_PATH );
+		return false;
+	}
+
+	// remove redundant nodes and clean up path
+	Optimize( bot );
+
+	PostProcess();
+
+	OnPathChanged( bot, pathResult ? COMPLETE_PATH : PARTIAL_PATH );
+
+	return pathResult;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Build trivial path when start and goal are in the same nav area
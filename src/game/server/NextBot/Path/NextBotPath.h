@@ -16,6 +16,8 @@
 class INextBot;
 class CNavArea;
 class CNavLadder;
+class NextBotPathQuery;
+class NextBotPathQueryCost;
 
 
 //---------------------------------------------------------------------------------------------------------------
@@ -27,6 +29,11 @@ class IPathCost
 {
 public:
 	virtual float operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const = 0;
+
+	// If this cost can be evaluated off the main thread, describe it in 'queryCost' and return true, so paths
+	// using it can be searched asynchronously (see NextBotManager::RequestPath). Costs that read bot or game
+	// state which can't be captured when the path is requested must return false.
+	virtual bool GetPathQueryCost( NextBotPathQueryCost *queryCost ) const { return false; }
 };
 
 
@@ -390,6 +397,16 @@ public:
 	}
 
 
+	//-----------------------------------------------------------------------------------------------------------------
+	/**
+	 * Build this path from the results of a completed asynchronous path query (see NextBotManager::RequestPath).
+	 * If returns true, path was found to the goal position.
+	 * If returns false, path may either be invalid (use IsValid() to check), or valid but 
+	 * doesn't reach all the way to the goal.
+	 */
+	bool ComputeFromQuery( INextBot *bot, const NextBotPathQuery &query );
+
+
 	//-----------------------------------------------------------------------------------------------------------------
 	/**
 	 * Build a path from bot's current location to an undetermined goal area
@@ -31,6 +31,8 @@ ConVar NextBotAllowGapJumping( "nb_allow_gap_jumping", "1", FCVAR_CHEAT );
 
 ConVar NextBotDebugClimbing( "nb_debug_climbing", "0", FCVAR_CHEAT );
 
+ConVar nb_path_async( "nb_path_async", "0", FCVAR_CHEAT, "If nonzero, bots that have a path to follow search for its replacement on worker threads, when their path cost can be evaluated off the main thread." );
+
 
 //--------------------------------------------------------------------------------------------------------------
 /**
@@ -49,6 +51,8 @@ PathFollower::PathFollower( void )
 
 	// was 10.0f for L4D - need a better solution here (MSB 5/15/09)
 	m_goalTolerance = 25.0f;
+
+	m_pathQuery = PATH_QUERY_INVALID_HANDLE;
 }
 
 
@@ -73,6 +77,8 @@ public:
 //--------------------------------------------------------------------------------------------------------------
 PathFollower::~PathFollower()
 {
+	CancelPath();
+
 	// allow bots to detach pointer to me
 	CDetachPath detach( this );
 	TheNextBots().ForEachBot( detach );
@@ -85,6 +91,9 @@ PathFollower::~PathFollower()
  */
 void PathFollower::Invalidate( void )
 {
+	// any repath in flight is now stale
+	CancelPath();
+
 	// extend
 	Path::Invalidate();
 
@@ -108,6 +117,79 @@ void PathFollower::OnPathChanged( INextBot *bot, Path::ResultType result )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Recompute this path, searching for it asynchronously if we can keep following the current one meanwhile
+ */
+bool PathFollower::ComputeAsync( INextBot *bot, const Vector &goal, const IPathCost &cost, float maxPathLength, bool includeGoalIfPathFails )
+{
+	if ( RequestPath( bot, goal, cost, maxPathLength, includeGoalIfPathFails ) )
+	{
+		return true;
+	}
+
+	return Compute( bot, goal, cost, maxPathLength, includeGoalIfPathFails );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Ask the NextBotManager to search for a new path on a worker thread, replacing any repath already in flight.
+ * Returns false if the path must be computed synchronously instead.
+ */
+bool PathFollower::RequestPath( INextBot *bot, const Vector &goal, const IPathCost &cost, float maxPathLength, bool includeGoalIfPathFails )
+{
+	CancelPath();
+
+	if ( !nb_path_async.GetBool() || !IsValid() )
+	{
+		// no path to follow while we wait
+		return false;
+	}
+
+	m_pathQuery = TheNextBots().RequestPath( bot, goal, cost, maxPathLength, includeGoalIfPathFails );
+
+	return m_pathQuery != PATH_QUERY_INVALID_HANDLE;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * If our asynchronous repath has finished, replace this path with it.
+ * A cancelled repath leaves the current path alone, and is not reported to the bot as a failure.
+ */
+PathQueryResultType PathFollower::CollectPath( INextBot *bot, bool *isPath )
+{
+	*isPath = false;
+
+	if ( m_pathQuery == PATH_QUERY_INVALID_HANDLE )
+		return PATH_QUERY_CANCELLED;
+
+	// clear our handle first, since building the path invalidates us
+	PathQueryHandle query = m_pathQuery;
+	m_pathQuery = PATH_QUERY_INVALID_HANDLE;
+
+	PathQueryResultType result = TheNextBots().CollectPathQuery( query, bot, this, isPath );
+	if ( result == PATH_QUERY_PENDING )
+	{
+		m_pathQuery = query;
+	}
+
+	return result;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void PathFollower::CancelPath( void )
+{
+	if ( m_pathQuery != PATH_QUERY_INVALID_HANDLE )
+	{
+		TheNextBots().CancelPathQuery( m_pathQuery );
+		m_pathQuery = PATH_QUERY_INVALID_HANDLE;
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Adjust speed based on path curvature
@@ -579,6 +661,13 @@ void PathFollower::Update( INextBot *bot )
 
 
 	ILocomotion *mover = bot->GetLocomotionInterface();
+
+	// switch to a path that has finished searching, unless we're on a ladder
+	if ( IsComputePending() && !mover->IsUsingLadder() )
+	{
+		bool isPath;
+		CollectPath( bot, &isPath );
+	}
 	
 	if ( !IsValid() || m_goal == NULL )
 	{
@@ -9,6 +9,7 @@
 #include "nav_mesh.h"
 #include "nav_pathfind.h"
 #include "NextBotPath.h"
+#include "NextBotPathQuery.h"
 
 class INextBot;
 class ILocomotion;
@@ -42,7 +43,23 @@ public:
 
 	Path::ResultType GetResult() const { return m_result;  }
 
+	/**
+	 * Recompute this path to 'goal'. If nb_path_async is set, we have a path to follow in the meantime, and
+	 * 'cost' can be evaluated off the main thread, the new path is searched by a worker thread and replaces
+	 * this one during a later Update(). Otherwise the path is computed now, exactly as Compute() does.
+	 * Returns false if the path was computed now and did not reach the goal.
+	 */
+	bool ComputeAsync( INextBot *bot, const Vector &goal, const IPathCost &cost, float maxPathLength = 0.0f, bool includeGoalIfPathFails = true );
+	bool IsComputePending( void ) const;			// return true if an asynchronous repath has been requested and not collected yet
+
+protected:
+	bool RequestPath( INextBot *bot, const Vector &goal, const IPathCost &cost, float maxPathLength, bool includeGoalIfPathFails );	// start an asynchronous repath, return false if it can't be
+	PathQueryResultType CollectPath( INextBot *bot, bool *isPath );	// if our asynchronous repath has finished, replace this path with it
+	void CancelPath( void );						// forget any asynchronous repath in flight
+
 private:
+	PathQueryHandle m_pathQuery;					// pending asynchronous repath, if any
+
 	const Path::Segment *m_goal;					// our current goal along the path
 	float m_minLookAheadRange;
 
@@ -94,6 +111,12 @@ inline const Path::Segment *PathFollower::GetCurrentGoal( void ) const
 }
 
 
+inline bool PathFollower::IsComputePending( void ) const
+{
+	return m_pathQuery != PATH_QUERY_INVALID_HANDLE;
+}
+
+
 inline void PathFollower::SetMinLookAheadDistance( float value )
 {
 	m_minLookAheadRange = value;
@@ -0,0 +1,56 @@
+// NextBotPathQuery.cpp
+// Path requests that are serviced asynchronously by worker threads
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#include "cbase.h"
+
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+#include "NextBotPathQuery.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search the nav mesh for this query's path.
+ * Invoked on a worker thread - must not touch anything but nav mesh geometry and this query.
+ */
+void NextBotPathQuery::Execute( CNavPathSearchState *searchState )
+{
+	double startTime = Plat_FloatTime();
+
+	m_areaPath.RemoveAll();
+	m_isPathComplete = false;
+
+	m_costFunc.m_searchState = searchState;
+
+	CNavArea *closestArea = NULL;
+	m_isPathComplete = NavAreaBuildPath( m_startArea, m_goalArea, &m_goal, m_costFunc, &closestArea, m_maxPathLength, m_teamID, false, searchState );
+
+	if ( closestArea )
+	{
+		// follow parent links back from the closest area to the start, then reverse them into path order
+		for( CNavArea *area = closestArea; area; area = searchState->GetParent( area ) )
+		{
+			AreaStep step;
+			step.area = area;
+			step.how = searchState->GetParentHow( area );
+			m_areaPath.AddToTail( step );
+
+			if ( area == m_startArea )
+			{
+				// startArea can be re-evaluated during the pathfind and given a parent...
+				break;
+			}
+		}
+
+		for( int i=0, j=m_areaPath.Count()-1; i < j; ++i, --j )
+		{
+			V_swap( m_areaPath[i], m_areaPath[j] );
+		}
+	}
+
+	m_searchTime = Plat_FloatTime() - startTime;
+}
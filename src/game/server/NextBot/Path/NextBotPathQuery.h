@@ -0,0 +1,171 @@
+// NextBotPathQuery.h
+// Path requests that are serviced asynchronously by worker threads
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#ifndef _NEXT_BOT_PATH_QUERY_H_
+#define _NEXT_BOT_PATH_QUERY_H_
+
+#include "nav_pathfind.h"
+
+class INextBot;
+
+typedef unsigned int PathQueryHandle;
+#define PATH_QUERY_INVALID_HANDLE 0
+
+enum PathQueryResultType
+{
+	PATH_QUERY_PENDING,				// the query has not finished searching yet
+	PATH_QUERY_COLLECTED,			// the path was built from the query's results
+	PATH_QUERY_CANCELLED			// the query was cancelled or superseded, and the path was left unchanged
+};
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * Path cost used by asynchronous path queries.
+ * An IPathCost that can be searched asynchronously describes itself with one of these (see
+ * IPathCost::GetPathQueryCost). It only reads nav mesh geometry, the bot state captured when the
+ * query was made, and the cost so far from the query's own search state instead of the areas
+ * themselves, so it is safe to evaluate on a worker thread.
+ */
+class NextBotPathQueryCost
+{
+public:
+	NextBotPathQueryCost( void )
+	{
+		m_stepHeight = StepHeight;
+		m_maxJumpHeight = JumpCrouchHeight;
+		m_maxDropHeight = DeathDrop;
+		m_jumpPenalty = 2.0f;
+		m_crouchPenalty = 0.0f;
+		m_routePreferenceID = 0;
+		m_routePreferenceTimeMod = 0;
+		m_funcNavCostActor = NULL;
+		m_searchState = NULL;
+	}
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const
+	{
+		if ( fromArea == NULL )
+		{
+			// first area in path, no cost
+			return 0.0f;
+		}
+
+		// compute distance traveled along path so far
+		float dist;
+
+		if ( ladder )
+		{
+			dist = ladder->m_length;
+		}
+		else if ( length > 0.0 )
+		{
+			dist = length;
+		}
+		else
+		{
+			dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
+		}
+
+		// check height change
+		float deltaZ = fromArea->ComputeAdjacentConnectionHeightChange( area );
+
+		if ( deltaZ >= m_stepHeight )
+		{
+			if ( deltaZ >= m_maxJumpHeight )
+			{
+				// too high to reach
+				return -1.0f;
+			}
+
+			// jumping is slower than flat ground
+			dist *= m_jumpPenalty;
+		}
+		else if ( deltaZ < -m_maxDropHeight )
+		{
+			// too far to drop
+			return -1.0f;
+		}
+
+		// if this is a "crouch" area, add penalty
+		if ( m_crouchPenalty > 0.0f && ( area->GetAttributes() & NAV_MESH_CROUCH ) )
+		{
+			dist += m_crouchPenalty * dist;
+		}
+
+		float cost = dist;
+
+		if ( m_routePreferenceID )
+		{
+			// random route preference unique to the bot, see CHL2MPBotPathCost
+			cost *= 1.0f + 50.0f * ( 1.0f + FastCos( (float)( m_routePreferenceID * area->GetID() * m_routePreferenceTimeMod ) ) );
+		}
+
+		if ( m_funcNavCostActor && area->HasAttributes( NAV_MESH_FUNC_COST ) )
+		{
+			// func_nav_cost entities only change when they think, and the query jobs are joined before any entity thinks
+			cost *= area->ComputeFuncNavCost( m_funcNavCostActor );
+		}
+
+		return cost + m_searchState->GetCostSoFar( fromArea );
+	}
+
+	float m_stepHeight;
+	float m_maxJumpHeight;
+	float m_maxDropHeight;
+	float m_jumpPenalty;								// distance multiplier for climbing up to an area
+	float m_crouchPenalty;								// extra distance fraction for entering a crouch area
+	int m_routePreferenceID;							// if nonzero, the per-bot route preference term uses this ID
+	int m_routePreferenceTimeMod;						// time term of the route preference, captured when the query was made
+	CBaseCombatCharacter *m_funcNavCostActor;			// if non-NULL, func_nav_cost multipliers are applied for this actor
+	const CNavPathSearchState *m_searchState;			// set by the worker running the query
+};
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * A single asynchronous path request, owned by the NextBotManager.
+ * Inputs are captured on the main thread when the request is made. Outputs are written by a
+ * worker thread, and are only read on the main thread once the manager has collected the job.
+ */
+class NextBotPathQuery
+{
+public:
+	enum StatusType
+	{
+		QUEUED,				// waiting to be dispatched to a worker
+		RUNNING,			// a worker thread owns this query
+		COMPLETE,			// results are ready to be collected
+		ABORTED				// the nav mesh changed before the results were collected, and must be searched again
+	};
+
+	void Execute( CNavPathSearchState *searchState );	// run the search - invoked on a worker thread
+
+	PathQueryHandle m_handle;
+	INextBot *m_bot;									// NULL if the bot went away while the query was running
+	StatusType m_status;
+
+	// inputs
+	CNavArea *m_startArea;
+	CNavArea *m_goalArea;								// may be NULL, in which case the path gets as close as it can to m_goal
+	Vector m_goal;
+	Vector m_pathEndPosition;							// goal position, on the ground
+	float m_maxPathLength;
+	int m_teamID;
+	bool m_includeGoalIfPathFails;
+	NextBotPathQueryCost m_costFunc;
+
+	// outputs
+	struct AreaStep
+	{
+		CNavArea *area;
+		NavTraverseType how;							// how to enter this area from the previous one
+	};
+	CUtlVector< AreaStep > m_areaPath;					// areas along the path, from start to the closest area to the goal
+	bool m_isPathComplete;								// true if the path reaches the goal
+	float m_searchTime;									// how long the search took, in seconds
+};
+
+
+#endif // _NEXT_BOT_PATH_QUERY_H_
@@ -162,7 +162,7 @@ public:
 			if ( pick.m_area )
 			{
 				CSimpleBotPathCost cost( me );
-				m_path.Compute( me, pick.m_area->GetCenter(), cost );
+				m_path.ComputeAsync( me, pick.m_area->GetCenter(), cost );
 			}
 
 			// follow this path for a random duration (or until we reach the end)
@@ -109,6 +109,22 @@ public:
 		}
 	}
 
+	// this cost only reads the nav mesh and our locomotion limits, so it can be searched asynchronously
+	virtual bool GetPathQueryCost( NextBotPathQueryCost *queryCost ) const
+	{
+		ILocomotion *mover = m_me->GetLocomotionInterface();
+
+		queryCost->m_stepHeight = mover->GetStepHeight();
+		queryCost->m_maxJumpHeight = mover->GetMaxJumpHeight();
+		queryCost->m_maxDropHeight = mover->GetDeathDropHeight();
+
+		// the jump penalty above is added on top of the distance
+		queryCost->m_jumpPenalty = 1.0f + 5.0f;
+
+		// blocked areas are skipped by the search itself, using our team
+		return true;
+	}
+
 	CSimpleBot *m_me;
 };
 
@@ -326,8 +326,8 @@ static void ProcessNavigationQueries( CFunctor **pData, unsigned int nCount )
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
-void CPostFrameNavigationHook::FrameUpdatePreEntityThink( void )
-{ 
+void CPostFrameNavigationHook::FinishNavigationQueries( void )
+{
 	// If the thread is executing, then wait for it to finish
 	if ( g_pQueuedNavigationQueryJob )
 	{
@@ -335,6 +335,14 @@ void CPostFrameNavigationHook::FrameUpdatePreEntityThink( void )
 		g_pQueuedNavigationQueryJob = NULL;
 		m_Functors.Purge();
 	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CPostFrameNavigationHook::FrameUpdatePreEntityThink( void )
+{ 
+	FinishNavigationQueries();
 	
 	if ( ai_post_frame_navigation.GetBool() == false )
 		return;
@@ -353,6 +361,12 @@ void CPostFrameNavigationHook::FrameUpdatePostEntityThink( void )
 	// The guts of the NPC will check against this to decide whether or not to queue its navigation calls
 	SetGrameFrameRunning( false );
 
+	// The job can't rebuild the pathfinding data the graph needs, so bring it up to date first
+	if ( g_pBigAINet )
+	{
+		g_pBigAINet->UpdateHullPathData();
+	}
+
 	// Throw this off to a thread job
 	g_pQueuedNavigationQueryJob = ThreadExecute( &ProcessNavigationQueries, m_Functors.Base(), m_Functors.Count() );
 }
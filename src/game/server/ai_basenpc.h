@@ -3114,6 +3114,9 @@ public:
 	
 	void EnqueueEntityNavigationQuery( CAI_BaseNPC *pNPC, CFunctor *functor );
 
+	// Waits for the queued navigation from the last frame to finish
+	void FinishNavigationQueries( void );
+
 private:
 	CUtlVector<CFunctor *>	m_Functors;
 	bool					m_bGameFrameRunning;
@@ -12,6 +12,8 @@
 #include "ai_node.h"
 #include "ai_link.h"
 #include "ai_networkmanager.h"
+#include "ai_pathfinder.h"
+#include "ai_waypoint.h"
 #include "ndebugoverlay.h"
 #include "datacache/imdlcache.h"
 
@@ -23,6 +25,7 @@ extern void			SetDebugBits( CBasePlayer* pPlayer, const char *name, int bit );
 extern CBaseEntity *FindPickerEntity( CBasePlayer *pPlayer );
 
 extern bool g_bAIDisabledByUser;
+extern int g_nPathfindNodesExpanded;
 
 
 //------------------------------------------------------------------------------
@@ -875,6 +878,71 @@ CON_COMMAND( ai_test_los, "Test AI LOS from the player's POV" )
 	NDebugOverlay::Cross3D( tr.endpos, 24, 255, 255, 255, true, 5 );
 }
 
+//------------------------------------------------------------------------------
+// Purpose: Times node pathfinding between random pairs of nodes
+//------------------------------------------------------------------------------
+CON_COMMAND_F( ai_pathfind_bench, "Times node pathfinding between random pairs of nodes for the NPC under the crosshair (or the first NPC).\n\tArguments:	[searches] [seed]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !g_pBigAINet || g_pBigAINet->NumNodes() < 2 )
+	{
+		Msg( "No node graph loaded.\n" );
+		return;
+	}
+
+	CAI_BaseNPC *pNPC = NULL;
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( pPlayer )
+	{
+		CBaseEntity *pEntity = FindPickerEntity( pPlayer );
+		pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+	}
+	if ( !pNPC && g_AI_Manager.NumAIs() )
+	{
+		pNPC = g_AI_Manager.AccessAIs()[0];
+	}
+	if ( !pNPC || !pNPC->GetPathfinder() )
+	{
+		Msg( "No NPC to pathfind with.\n" );
+		return;
+	}
+
+	int nSearches = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 200;
+	int nSeed = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 1;
+
+	CUniformRandomStream randomStream;
+	randomStream.SetSeed( nSeed );
+
+	// make sure the zones and landmarks aren't built inside the timed loop
+	g_pBigAINet->IsConnectedForHull( pNPC->GetHullType(), 0, 0 );
+
+	int nFound = 0;
+	int nExpanded = g_nPathfindNodesExpanded;
+	double flStartTime = Plat_FloatTime();
+
+	for ( int i = 0; i < nSearches; i++ )
+	{
+		int srcID = randomStream.RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+		int destID = randomStream.RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+
+		AI_Waypoint_t *pRoute = pNPC->GetPathfinder()->FindBestPath( srcID, destID );
+		if ( pRoute )
+		{
+			nFound++;
+			DeleteAll( pRoute );
+		}
+	}
+
+	double flTime = ( Plat_FloatTime() - flStartTime ) * 1000.0;
+	nExpanded = g_nPathfindNodesExpanded - nExpanded;
+
+	Msg( "%s (%s): %d searches, %d paths, %.2f ms total, %.3f ms avg, %.1f nodes expanded avg\n",
+		pNPC->GetDebugName(), NAI_Hull::Name( pNPC->GetHullType() ), nSearches, nFound,
+		flTime, flTime / nSearches, (float)nExpanded / nSearches );
+}
+
 #ifdef VPROF_ENABLED
 
 CON_COMMAND(ainet_generate_report, "Generate a report to the console.")
@@ -120,6 +120,36 @@ void CAI_TestHull::ReturnTestHull(void)
 	pTestHull = NULL;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Get a test hull of its own for a node graph building thread.  Every
+//			thread needs one since testing a connection changes the hull's state
+//-----------------------------------------------------------------------------
+CAI_TestHull* CAI_TestHull::GetWorkerTestHull(void)
+{
+	CAI_TestHull *pHull = CREATE_ENTITY( CAI_TestHull, "aitesthull" );
+	pHull->Spawn();
+	pHull->AddFlag( FL_NPC );
+
+	pHull->RemoveSolidFlags( FSOLID_NOT_SOLID );
+	pHull->bInUse = true;
+
+	return pHull;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Return a test hull from GetWorkerTestHull
+//-----------------------------------------------------------------------------
+void CAI_TestHull::ReturnWorkerTestHull( CAI_TestHull *pHull )
+{
+	Assert( pHull != pTestHull );
+
+	pHull->bInUse = false;
+	pHull->AddSolidFlags( FSOLID_NOT_SOLID );
+	UTIL_SetSize( pHull, vec3_origin, vec3_origin );
+
+	UTIL_RemoveImmediate( pHull );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : &startPos - 
@@ -90,6 +90,8 @@ private:
 public:
 	static CAI_TestHull*	GetTestHull(void);						// Get the test hull
 	static void				ReturnTestHull(void);					// Return the test hull
+	static CAI_TestHull*	GetWorkerTestHull(void);				// Get an extra hull for testing on another thread
+	static void				ReturnWorkerTestHull( CAI_TestHull *pHull );	// Return an extra hull
 
 	bool					bInUse;
 	virtual void			Precache();
@@ -21,6 +21,7 @@
 #include "tier0/memdbgon.h"
 
 ConVar ai_no_node_cache( "ai_no_node_cache", "0" );
+ConVar ai_pathfind_landmarks( "ai_pathfind_landmarks", "8", 0, "Landmarks per hull used to guide node pathfinding. 0 uses straight line distance only." );
 
 extern float MOVE_HEIGHT_EPSILON;
 
@@ -109,6 +110,9 @@ CAI_Network::CAI_Network()
 	m_iNumNodes				= 0;		// Number of nodes in this network
 	m_pAInode				= NULL;		// Array of all nodes in this network
 
+	m_nHullPathDataNodes	= -1;
+	m_nHullPathDataLandmarks = 0;
+
 	m_iNearestCacheNext	= NEARNODE_CACHE_SIZE - 1;
 	// Force empty node caches to be rebuild
 	for (int node=0;node<NEARNODE_CACHE_SIZE;node++)
@@ -190,6 +194,277 @@ int	CAI_Network::FindBSSmallest(CVarBitVec *bitString, float *float_array, int a
 	return winIndex;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Sets up the node scratch for a new pathfinding search
+//-----------------------------------------------------------------------------
+
+unsigned CAI_Network::BeginPathSearch( AI_PathSearchScratch_t &scratch )
+{
+	if ( scratch.nodeState.Count() < m_iNumNodes )
+	{
+		int nOldCount = scratch.nodeState.Count();
+		scratch.nodeState.SetCount( m_iNumNodes );
+		scratch.parents.SetCount( m_iNumNodes );
+		for ( int i = nOldCount; i < m_iNumNodes; i++ )
+		{
+			scratch.nodeState[i].generation = 0;
+		}
+	}
+
+	// Generation 0 is never used, so it can mark entries from no search at all
+	if ( ++scratch.generation == 0 )
+	{
+		for ( int i = 0; i < scratch.nodeState.Count(); i++ )
+		{
+			scratch.nodeState[i].generation = 0;
+		}
+		scratch.generation = 1;
+	}
+
+	scratch.openList.RemoveAll();
+
+	return scratch.generation;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Shortest distances from one node to every other using the links
+//			of a hull. Straight line lengths never exceed the movement cost
+//			of a link, so these are lower bounds on the cost of a route.
+//-----------------------------------------------------------------------------
+
+static void ComputeHullDistances( CAI_Node **ppNodes, int nNodes, Hull_t hull, int sourceID, float *pDist, CNodeList &openList )
+{
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		pDist[i] = FLT_MAX;
+	}
+
+	pDist[sourceID] = 0;
+	openList.RemoveAll();
+	openList.Insert( AI_NearNode_t( sourceID, 0 ) );
+
+	while ( openList.Count() )
+	{
+		AI_NearNode_t nearest = openList.ElementAtHead();
+		openList.RemoveAtHead();
+		if ( nearest.dist > pDist[nearest.nodeIndex] )
+			continue;
+
+		CAI_Node *pNode = ppNodes[nearest.nodeIndex];
+		Vector vecPos = pNode->GetPosition( hull );
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
+		{
+			CAI_Link *pLink = pNode->GetLinkByIndex( link );
+			if ( !pLink->m_iAcceptedMoveTypes[hull] )
+				continue;
+
+			int destID = pLink->DestNodeID( nearest.nodeIndex );
+			float dist = nearest.dist + ( ppNodes[destID]->GetPosition( hull ) - vecPos ).Length();
+			if ( dist < pDist[destID] )
+			{
+				pDist[destID] = dist;
+				openList.Insert( AI_NearNode_t( destID, dist ) );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Works out which nodes each hull can get between, and picks landmarks
+//			for the pathfinding heuristic. The landmarks are spread through each
+//			hull's largest group of nodes, each one as far as possible from the
+//			ones before it.
+//-----------------------------------------------------------------------------
+
+void CAI_Network::BuildHullPathData()
+{
+	MEM_ALLOC_CREDIT();
+
+	// Queued navigation reads this data from a job thread
+	Assert( ThreadInMainThread() );
+	PostFrameNavigationSystem()->FinishNavigationQueries();
+
+	int nNodes = m_iNumNodes;
+	int nLandmarks = clamp( ai_pathfind_landmarks.GetInt(), 0, 32 );
+
+	m_nHullPathDataNodes = nNodes;
+	m_nHullPathDataLandmarks = ai_pathfind_landmarks.GetInt();
+
+	CUtlVector<int> stack;
+	CUtlVector<float> dist;
+	CUtlVector<float> nearestLandmarkDist;
+	CNodeList openList;
+
+	for ( int hull = 0; hull < NUM_HULLS; hull++ )
+	{
+		HullPathData_t &data = m_HullPathData[hull];
+		data.zones.SetCount( nNodes );
+		data.landmarkDist.Purge();
+		data.numLandmarks = 0;
+
+		// Flood fill the groups of nodes this hull's links connect
+		for ( int i = 0; i < nNodes; i++ )
+		{
+			data.zones[i] = -1;
+		}
+
+		int nZones = 0;
+		int largestZone = -1;
+		int largestZoneSize = 0;
+		int largestZoneNode = NO_NODE;
+		for ( int i = 0; i < nNodes; i++ )
+		{
+			if ( data.zones[i] != -1 )
+				continue;
+
+			int zoneSize = 0;
+			data.zones[i] = nZones;
+			stack.AddToTail( i );
+			while ( stack.Count() )
+			{
+				int nodeID = stack.Tail();
+				stack.RemoveMultipleFromTail( 1 );
+				zoneSize++;
+
+				CAI_Node *pNode = m_pAInode[nodeID];
+				for ( int link = 0; link < pNode->NumLinks(); link++ )
+				{
+					CAI_Link *pLink = pNode->GetLinkByIndex( link );
+					int destID = pLink->DestNodeID( nodeID );
+					if ( pLink->m_iAcceptedMoveTypes[hull] && data.zones[destID] == -1 )
+					{
+						data.zones[destID] = nZones;
+						stack.AddToTail( destID );
+					}
+				}
+			}
+
+			if ( zoneSize > largestZoneSize )
+			{
+				largestZone = nZones;
+				largestZoneSize = zoneSize;
+				largestZoneNode = i;
+			}
+			nZones++;
+		}
+
+		// Landmarks only pay off in groups too big to search in a blink
+		if ( !nLandmarks || largestZoneSize < 64 )
+			continue;
+
+		dist.SetCount( nNodes );
+		nearestLandmarkDist.SetCount( nNodes );
+		data.landmarkDist.SetCount( nNodes * nLandmarks );
+
+		// Start from the node farthest from an arbitrary one
+		ComputeHullDistances( m_pAInode, nNodes, (Hull_t)hull, largestZoneNode, dist.Base(), openList );
+		for ( int i = 0; i < nNodes; i++ )
+		{
+			nearestLandmarkDist[i] = ( data.zones[i] == largestZone ) ? dist[i] : -1;
+		}
+
+		for ( int landmark = 0; landmark < nLandmarks; landmark++ )
+		{
+			int landmarkID = NO_NODE;
+			float farthest = 0;
+			for ( int i = 0; i < nNodes; i++ )
+			{
+				if ( nearestLandmarkDist[i] > farthest )
+				{
+					landmarkID = i;
+					farthest = nearestLandmarkDist[i];
+				}
+			}
+
+			if ( landmarkID == NO_NODE )
+				break;
+
+			ComputeHullDistances( m_pAInode, nNodes, (Hull_t)hull, landmarkID, dist.Base(), openList );
+			for ( int i = 0; i < nNodes; i++ )
+			{
+				data.landmarkDist[i * nLandmarks + landmark] = dist[i];
+				if ( nearestLandmarkDist[i] > dist[i] )
+				{
+					nearestLandmarkDist[i] = dist[i];
+				}
+			}
+			data.numLandmarks++;
+		}
+
+		// If the group ran out of distinct nodes, squeeze out the unused columns
+		if ( data.numLandmarks < nLandmarks )
+		{
+			for ( int i = 0; i < nNodes; i++ )
+			{
+				memmove( &data.landmarkDist[i * data.numLandmarks], &data.landmarkDist[i * nLandmarks], data.numLandmarks * sizeof( float ) );
+			}
+			data.landmarkDist.SetCountNonDestructively( nNodes * data.numLandmarks );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the hull path data matches the current graph
+//-----------------------------------------------------------------------------
+
+bool CAI_Network::IsHullPathDataValid() const
+{
+	return ( m_nHullPathDataNodes == m_iNumNodes && m_nHullPathDataLandmarks == ai_pathfind_landmarks.GetInt() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds the hull path data if the graph changed since it was built
+//-----------------------------------------------------------------------------
+
+void CAI_Network::UpdateHullPathData()
+{
+	if ( !IsHullPathDataValid() )
+	{
+		BuildHullPathData();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns false if no route for the hull can join the two nodes,
+//			whatever the state of the dynamic links
+//-----------------------------------------------------------------------------
+
+bool CAI_Network::IsConnectedForHull( Hull_t hull, int srcID, int destID )
+{
+	if ( !IsHullPathDataValid() )
+	{
+		// Off the main thread the data can't be rebuilt, so assume there may be a route
+		if ( !ThreadInMainThread() )
+			return true;
+
+		BuildHullPathData();
+	}
+
+	return ( m_HullPathData[hull].zones[srcID] == m_HullPathData[hull].zones[destID] );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the distances from each of the hull's landmarks to a node,
+//			FLT_MAX where the landmark can't reach it, or NULL if the hull
+//			has no landmarks. Call IsConnectedForHull() first.
+//-----------------------------------------------------------------------------
+
+const float *CAI_Network::GetLandmarkDistances( Hull_t hull, int nodeID, int *pNumLandmarks )
+{
+	if ( !IsHullPathDataValid() )
+	{
+		*pNumLandmarks = 0;
+		return NULL;
+	}
+
+	const HullPathData_t &data = m_HullPathData[hull];
+	*pNumLandmarks = data.numLandmarks;
+	if ( !data.numLandmarks )
+		return NULL;
+
+	return &data.landmarkDist[nodeID * data.numLandmarks];
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a list of nearby nodes sorted by distance
 // Input  : &list - 
@@ -586,6 +861,9 @@ CAI_Link *CAI_Network::CreateLink( int srcID, int destID, CAI_DynamicLink *pDyna
 
 	CAI_Link *pLink = new CAI_Link;
 
+	// The caller fills in the move types afterwards, so rebuild when next needed
+	m_nHullPathDataNodes = -1;
+
 	pLink->m_iSrcID = srcID;
 	pLink->m_iDestID = destID;
 	pLink->m_pDynamicLink = pDynamicLink;
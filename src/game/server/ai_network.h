@@ -14,6 +14,7 @@
 
 #include "ispatialpartition.h"
 #include "utlpriorityqueue.h"
+#include "ai_hull.h"
 
 // ------------------------------------
 
@@ -78,6 +79,30 @@ public:
 	CNodeList( AI_NearNode_t *pMemory, int count ) : CUtlPriorityQueue<AI_NearNode_t>( pMemory, count, IsLowerPriority ) {}
 };
 
+//-------------------------------------
+// Per node scratch for node pathfinding, kept by the network between searches.
+// An entry only belongs to the current search if its generation matches.
+//-------------------------------------
+
+struct AI_PathNodeState_t
+{
+	float		g;
+	float		f;
+	unsigned	generation;
+	bool		bOpen;
+};
+
+// Per node state for a pathfinding search. Each thread that searches needs its own.
+struct AI_PathSearchScratch_t
+{
+	AI_PathSearchScratch_t() : generation( 0 ) {}
+
+	CUtlVector<AI_PathNodeState_t>	nodeState;
+	CUtlVector<int>					parents;
+	CNodeList						openList;
+	unsigned						generation;
+};
+
 //-----------------------------------------------------------------------------
 // CAI_Network
 //
@@ -127,6 +152,20 @@ public:
 	}
 	
 	CAI_Node**		AccessNodes() const	{ return m_pAInode; }
+
+	// Sizes pathfinding scratch to the network. Returns the generation of the new
+	// search; the node states of other generations are stale. The network's own
+	// scratch may only be used on the main thread.
+	unsigned		BeginPathSearch( AI_PathSearchScratch_t &scratch );
+	AI_PathSearchScratch_t &GetMainThreadPathScratch()	{ Assert( ThreadInMainThread() ); return m_PathScratch; }
+
+	// Per hull connectivity and landmark distances for node pathfinding. Built
+	// when the graph loads, and again on the main thread after the graph changes.
+	void			BuildHullPathData();
+	void			UpdateHullPathData();
+	bool			IsHullPathDataValid() const;
+	bool			IsConnectedForHull( Hull_t hull, int srcID, int destID );
+	const float *	GetLandmarkDistances( Hull_t hull, int nodeID, int *pNumLandmarks );
 	
 private:
 	friend class CAI_NetworkManager;
@@ -159,6 +198,19 @@ private:
 	int					m_iNumNodes;				// Number of nodes in this network
 	CAI_Node**			m_pAInode;					// Array of all nodes in this network
 
+	AI_PathSearchScratch_t m_PathScratch;
+
+	struct HullPathData_t
+	{
+		CUtlVector<short>	zones;			// connected group of each node, for this hull's links
+		CUtlVector<float>	landmarkDist;	// shortest distance from each landmark, numLandmarks per node
+		int					numLandmarks;
+	};
+
+	HullPathData_t		m_HullPathData[NUM_HULLS];
+	int					m_nHullPathDataNodes;		// node count when the data was built, -1 if it needs rebuilding
+	int					m_nHullPathDataLandmarks;
+
 	enum
 	{
 		PARTITION_NODE	= ( 1 << 0 )
@@ -25,6 +25,7 @@
 #include "ndebugoverlay.h"
 #include "ai_hint.h"
 #include "tier0/icommandline.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -70,6 +71,8 @@ CON_COMMAND( ai_debug_node_connect, "Debug the attempted connection between two
 
 ConVar g_ai_norebuildgraph( "ai_norebuildgraph", "0" );
 
+ConVar ai_buildgraph_threaded( "ai_buildgraph_threaded", "1", 0, "Test node visibility and connections on worker threads when building the node graph" );
+
 
 //-----------------------------------------------------------------------------
 // CAI_NetworkManager
@@ -710,6 +713,9 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		DevMsg( "\n** Should run \"Check For Problems\" on the VMF then verify dynamic links\n" );
 #endif
 
+	// Zones and landmarks are derived from the links, so build them while we're loading
+	m_pNetwork->BuildHullPathData();
+
 	gm_fNetworksLoaded = true;
 	CAI_DynamicLink::gm_bInitialized = false;
 }
@@ -2241,6 +2247,8 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 
 	BeginBuild();
 
+	m_nMaxParallel = ai_buildgraph_threaded.GetBool() ? INT_MAX : 0;
+
 	CFastTimer masterTimer;
 	CFastTimer timer;
 	
@@ -2276,10 +2284,7 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		m_NeighborsTable[i].Resize( nNodes );
 		m_NeighborsTable[i].ClearAll();
 	}
-	for (i = 0; i < nNodes; i++)
-	{	
-		InitNeighbors( pNetwork, ppNodes[i] );
-	}
+	InitAllNeighbors( pNetwork );
 	timer.End();
 	DevMsg( "...done initializing node neighbors. %f seconds\n", timer.GetDuration().GetSeconds() );
 
@@ -2302,10 +2307,7 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		// Make sure all the links are clear
 		ppNodes[i]->ClearLinks();
 	}
-	for (i = 0; i < nNodes; i++)
-	{	
-		InitLinks( pNetwork, ppNodes[i] );
-	}
+	InitAllLinks( pNetwork );
 	timer.End();
 	DevMsg( "...done determining links. %f seconds\n", timer.GetDuration().GetSeconds() );
 
@@ -2606,6 +2608,59 @@ void CAI_NetworkBuilder::InitNodePosition(CAI_Network *pNetwork, CAI_Node *pNode
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Line of sight test between two node positions.  Only traces against
+//			the world and static props, so it's safe on any thread
+//-----------------------------------------------------------------------------
+static bool IsNodeVisible( const Vector &srcPos, const Vector &destPos )
+{
+	trace_t	tr;
+	tr.m_pEnt = NULL;
+
+	// Try several line of sight checks
+
+	// ------------------
+	//  Bottom to bottom
+	// ------------------
+	AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+	{
+		return true;
+	}
+
+	// ------------------
+	//  Top to top
+	// ------------------
+	AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+	{	
+		return true;
+	}
+
+	// ------------------
+	//  Top to Bottom
+	// ------------------
+	AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+	{	
+		return true;
+	}
+
+	// ------------------
+	//  Bottom to Top
+	// ------------------
+	AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+	{	
+		return true;
+	}
+
+	// ------------------
+	//  Failure
+	// ------------------
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Set the visibility for this node.  (What nodes it can see with a
 //			line trace)
@@ -2683,62 +2738,7 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 		// position using the smallest hull to make sure were not in geometry
 		Vector destPos = pNetwork->GetNode( testnode )->GetPosition(HULL_SMALL_CENTERED);
 
-		trace_t	tr;
-		tr.m_pEnt = NULL;
-
-		// Try several line of sight checks
-
-		bool isVisible = false;
-
-		// ------------------
-		//  Bottom to bottom
-		// ------------------
-		AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-		if (!tr.startsolid && tr.fraction == 1.0)
-		{
-			isVisible = true;
-		}
-
-		// ------------------
-		//  Top to top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Top to Bottom
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Bottom to Top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Failure
-		// ------------------
-		if (!isVisible)
+		if ( !IsNodeVisible( srcPos, destPos ) )
 		{
 			continue;
 		}
@@ -2806,6 +2806,18 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 	// Begin by establishing viewability to limit the number of nodes tested
 	InitVisibility( pNetwork, pNode );
 
+	PruneRedundantNeighbors( pNetwork, pNode );
+
+	m_DidSetNeighborsTable.Set(pNode->m_iID);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes the neighbors that are behind a closer neighbor in about
+//			the same direction
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::PruneRedundantNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
+{
 	AI_PROFILE_SCOPE_BEGIN( CAI_Node_InitNeighbors );
 
 	// Now check each neighbor against all other neighbors to see if one of
@@ -2911,8 +2923,6 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 	}
 	
 	AI_PROFILE_SCOPE_END();
-
-	m_DidSetNeighborsTable.Set(pNode->m_iID);
 }
 
 //-----------------------------------------------------------------------------
@@ -2958,39 +2968,40 @@ static bool IsInLineForClimb( const Vector &srcPos, const Vector &srcFacing, con
 
 //-------------------------------------
 
-int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
+int CAI_NetworkBuilder::ComputeConnection( CAI_TestHull *pTestHull, CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
 {
 	int srcId = pSrcNode->m_iID;
 	int destId = pDestNode->m_iID;
 	int result = 0;
 	trace_t tr;
 	
-	// Set the size of the test hull
-	if ( m_pTestHull->GetHullType() != hull ) 
+	// Set the size of the test hull.  Worker threads get theirs already set
+	if ( pTestHull->GetHullType() != hull ) 
 	{
-		m_pTestHull->SetHullType( hull );
-		m_pTestHull->SetHullSizeNormal( true );
+		Assert( ThreadInMainThread() );
+		pTestHull->SetHullType( hull );
+		pTestHull->SetHullSizeNormal( true );
 	}
 
-	if ( !( m_pTestHull->GetFlags() & FL_ONGROUND ) )
+	if ( !( pTestHull->GetFlags() & FL_ONGROUND ) )
 	{
 		DevWarning( 2, "OFFGROUND!\n" );
+		pTestHull->AddFlag( FL_ONGROUND );
 	}
-	m_pTestHull->AddFlag( FL_ONGROUND );
 
 	// ==============================================================
 	// FIRST CHECK IF HULL CAN EVEN FIT AT THESE NODES
 	// ==============================================================
 	// @Note (toml 02-10-03): this should be optimized, caching the results of CanFitAtNode() 
 	if ( !( pSrcNode->m_eNodeInfo & ( HullToBit( hull ) << NODE_ENT_FLAGS_SHIFT ) ) &&
-		 !m_pTestHull->GetNavigator()->CanFitAtNode(srcId,MASK_NPCWORLDSTATIC) )
+		 !pTestHull->GetNavigator()->CanFitAtNode(srcId,MASK_NPCWORLDSTATIC) )
 	{
 		DebugConnectMsg( srcId, destId, "      Cannot fit at node %d\n", srcId );
 		return 0;
 	}
 	
 	if (  !( pDestNode->m_eNodeInfo & ( HullToBit( hull ) << NODE_ENT_FLAGS_SHIFT ) ) &&
-		 !m_pTestHull->GetNavigator()->CanFitAtNode(destId,MASK_NPCWORLDSTATIC) )
+		 !pTestHull->GetNavigator()->CanFitAtNode(destId,MASK_NPCWORLDSTATIC) )
 	{
 		DebugConnectMsg( srcId, destId, "      Cannot fit at node %d\n", destId );
 		return 0;
@@ -3006,7 +3017,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		// Air nodes only connect to other air nodes and nothing else
 		if (pSrcNode->m_eNodeType == NODE_AIR && pDestNode->GetType() == NODE_AIR)
 		{
-			AI_TraceHull( pSrcNode->GetOrigin(), pDestNode->GetOrigin(), NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+			AI_TraceHull( pSrcNode->GetOrigin(), pDestNode->GetOrigin(), NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_FLY;
@@ -3031,7 +3042,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		{
 			AI_TraceHull( srcPos, destPos, 
 							NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), 
-							MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+							MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_CLIMB;
@@ -3047,7 +3058,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 				return 0;
 			}
 
-			AI_TraceHull( srcPos, destPos, NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+			AI_TraceHull( srcPos, destPos, NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_CLIMB;
@@ -3075,13 +3086,13 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		Vector srcPos	 = pSrcNode->GetPosition(hull);
 		Vector destPos	 = pDestNode->GetPosition(hull);
 
-		if (!m_pTestHull->GetMoveProbe()->CheckStandPosition( srcPos, MASK_NPCWORLDSTATIC))
+		if (!pTestHull->GetMoveProbe()->CheckStandPosition( srcPos, MASK_NPCWORLDSTATIC))
 		{
 			DebugConnectMsg( srcId, destId, "      Failed to stand at %d\n", srcId );
 			fStandFailed = true;
 		}
 
-		if (!m_pTestHull->GetMoveProbe()->CheckStandPosition( destPos, MASK_NPCWORLDSTATIC))
+		if (!pTestHull->GetMoveProbe()->CheckStandPosition( destPos, MASK_NPCWORLDSTATIC))
 		{
 			DebugConnectMsg( srcId, destId, "      Failed to stand at %d\n", destId );
 			fStandFailed = true;
@@ -3092,7 +3103,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 		if ( !fStandFailed )
 		{
-			fWalkFailed = !m_pTestHull->GetMoveProbe()->TestGroundMove( srcPos, destPos, MASK_NPCWORLDSTATIC, AITGM_IGNORE_INITIAL_STAND_POS, NULL );
+			fWalkFailed = !pTestHull->GetMoveProbe()->TestGroundMove( srcPos, destPos, MASK_NPCWORLDSTATIC, AITGM_IGNORE_INITIAL_STAND_POS, NULL );
 			if ( fWalkFailed )
 				DebugConnectMsg( srcId, destId, "      Failed to walk between nodes\n" );
 		}
@@ -3118,15 +3129,15 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 			// Jumps aren't bi-directional.  We can jump down further than we can jump up so
 			// we have to test for either one
-			bool canDestJump = m_pTestHull->IsJumpLegal(srcPos, destPos, destPos);
-			bool canSrcJump  = m_pTestHull->IsJumpLegal(destPos, srcPos, srcPos);
+			bool canDestJump = pTestHull->IsJumpLegal(srcPos, destPos, destPos);
+			bool canSrcJump  = pTestHull->IsJumpLegal(destPos, srcPos, srcPos);
 
 			if (canDestJump || canSrcJump) 
 			{
-				CAI_MoveProbe *pMoveProbe = m_pTestHull->GetMoveProbe();
+				CAI_MoveProbe *pMoveProbe = pTestHull->GetMoveProbe();
 
 				bool fJumpLegal = false;
-				m_pTestHull->SetGravity(1.0);
+				pTestHull->SetGravity(1.0);
 
 				AIMoveTrace_t moveTrace;
 				pMoveProbe->MoveLimit( NAV_JUMP, srcPos,destPos, MASK_NPCWORLDSTATIC, NULL, &moveTrace);
@@ -3213,7 +3224,7 @@ void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode)
 				{
 					DebugConnectMsg( pNode->m_iID, i, "   Testing for hull %s\n", NAI_Hull::Name( (Hull_t)hull  ) );
 					
-					acceptedMotions[hull] = ComputeConnection( pNode, pDestNode, (Hull_t)hull );
+					acceptedMotions[hull] = ComputeConnection( m_pTestHull, pNode, pDestNode, (Hull_t)hull );
 					if ( acceptedMotions[hull] != 0 )
 						bAllFailed = false;
 				}
@@ -3246,3 +3257,416 @@ void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode)
 }
 
 //-----------------------------------------------------------------------------
+// Parallel graph building
+//
+// Build() runs the traces and move probes of every node pair on worker threads.
+// It happens while the level loads, so nothing in the world moves underneath the
+// workers. They only trace against MASK_NPCWORLDSTATIC, and each one probes with
+// its own test hull. Anything that changes entities or the network is done on the
+// main thread between the parallel passes: resizing hulls, deleting nodes and
+// creating links. The results are merged in node order, so the saved graph does
+// not depend on the number of threads.
+//-----------------------------------------------------------------------------
+
+static CTHREADLOCALPTR( CAI_TestHull ) s_pWorkerTestHull;
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::BeginWorker()
+{
+	int iHull = ++m_iNextWorkerTestHull - 1;
+	Assert( iHull < m_WorkerTestHulls.Count() );
+	s_pWorkerTestHull = m_WorkerTestHulls[iHull];
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::EndWorker()
+{
+	s_pWorkerTestHull = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Visibility from a node to every higher numbered node that
+//			InitVisibility() would trace to.  Lower numbered nodes have
+//			already decided their visibility to this one
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::ComputeVisibilityJob( int &iNode )
+{
+	CAI_Network *pNetwork = m_pBuildNetwork;
+	CAI_Node *pNode = pNetwork->GetNode( iNode );
+
+	Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
+
+	for (int testnode = iNode + 1; testnode < pNetwork->NumNodes(); testnode++ )
+	{
+		if ( IsNodeDeletedAt( testnode, iNode ) )
+			continue;
+
+		CAI_Node *testNode = pNetwork->GetNode( testnode );
+
+		float flDistToCheckNode = ( testNode->GetOrigin() - pNode->GetOrigin() ).LengthSqr(); 
+		if ( flDistToCheckNode > ( ( testNode->GetType() == NODE_AIR ) ? MAX_AIR_NODE_LINK_DIST_SQ : MAX_NODE_LINK_DIST_SQ ) )
+			continue;
+
+		if ( IsNodeVisible( srcPos, testNode->GetPosition(HULL_SMALL_CENTERED) ) )
+		{
+			m_VisibleTable[iNode].Set( testnode );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same result as calling InitNeighbors() on every node in order
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::InitAllNeighbors( CAI_Network *pNetwork )
+{
+	int nNodes = pNetwork->NumNodes();
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+	int i;
+
+	CFastTimer timer;
+	timer.Start();
+
+	// ------------------------------------------------------------
+	// InitVisibility() deletes the duplicates of each node it
+	// visits.  Work out up front which node deletes which, so
+	// every thread sees the node types as they would have been
+	// ------------------------------------------------------------
+	m_NodeDeletedBy.SetCount( nNodes );
+	for ( i = 0; i < nNodes; i++ )
+	{
+		m_NodeDeletedBy[i] = ( ppNodes[i]->GetType() == NODE_DELETED ) ? -1 : INT_MAX;
+	}
+
+	CUtlVector<int> visibilityJobs;
+	for ( i = 0; i < nNodes; i++ )
+	{
+		if ( IsNodeDeletedAt( i, i - 1 ) )
+			continue;
+
+		visibilityJobs.AddToTail( i );
+
+		for ( int j = 0; j < nNodes; j++ )
+		{
+			if ( j != i && m_NodeDeletedBy[j] == INT_MAX && ppNodes[j]->GetType() != NODE_CLIMB && ppNodes[j]->GetOrigin() == ppNodes[i]->GetOrigin() )
+			{
+				m_NodeDeletedBy[j] = i;
+				DevMsg( 2, "Probable duplicate node placed at %s\n", VecToString(ppNodes[j]->GetOrigin()) );
+			}
+		}
+	}
+
+	// ------------------------------------------------------------
+	// Trace to the higher numbered nodes in parallel
+	// ------------------------------------------------------------
+	m_pBuildNetwork = pNetwork;
+	m_VisibleTable.SetSize( nNodes );
+	for ( i = 0; i < nNodes; i++ )
+	{
+		m_VisibleTable[i].Resize( nNodes );
+		m_VisibleTable[i].ClearAll();
+	}
+
+	if ( visibilityJobs.Count() )
+	{
+		ParallelProcess<int, CAI_NetworkBuilder, CAI_NetworkBuilder>( "CAI_NetworkBuilder::InitVisibility", visibilityJobs.Base(), visibilityJobs.Count(), this, &CAI_NetworkBuilder::ComputeVisibilityJob, NULL, NULL, m_nMaxParallel );
+	}
+
+	timer.End();
+	float flTraceTime = timer.GetDuration().GetSeconds();
+	timer.Start();
+
+	// ------------------------------------------------------------
+	// Merge in node order.  A lower numbered node's final neighbors
+	// decide its visibility to this one, as in InitVisibility()
+	// ------------------------------------------------------------
+	for ( i = 0; i < nNodes; i++ )
+	{
+		CVarBitVec &neighbors = m_NeighborsTable[i];
+		neighbors.ClearAll();
+
+		if ( !IsNodeDeletedAt( i, i - 1 ) )
+		{
+			neighbors.Set( i );
+
+			int j;
+			for ( j = 0; j < i; j++ )
+			{
+				if ( !IsNodeDeletedAt( j, i ) && m_NeighborsTable[j].IsBitSet( i ) )
+					neighbors.Set( j );
+			}
+			for ( j = i + 1; j < nNodes; j++ )
+			{
+				if ( m_VisibleTable[i].IsBitSet( j ) )
+					neighbors.Set( j );
+			}
+		}
+
+		PruneRedundantNeighbors( pNetwork, ppNodes[i] );
+		m_DidSetNeighborsTable.Set( i );
+	}
+
+	for ( i = 0; i < nNodes; i++ )
+	{
+		if ( m_NodeDeletedBy[i] != INT_MAX )
+			ppNodes[i]->SetType( NODE_DELETED );
+	}
+
+	timer.End();
+	int nThreads = ( m_nMaxParallel && g_pThreadPool ) ? g_pThreadPool->NumThreads() + 1 : 1;
+	DevMsg( "...%d nodes traced on %d threads in %f seconds, merged in %f seconds\n", visibilityJobs.Count(), nThreads, flTraceTime, timer.GetDuration().GetSeconds() );
+
+	m_VisibleTable.Purge();
+	m_NodeDeletedBy.Purge();
+	m_pBuildNetwork = NULL;
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::ComputeConnectionJob( int &iJob )
+{
+	ConnectionJob_t &job = m_ConnectionJobs[iJob];
+	CAI_Node *pSrcNode = m_pBuildNetwork->GetNode( job.iSrc );
+	CAI_Node *pDestNode = m_pBuildNetwork->GetNode( job.iDest );
+
+	DebugConnectMsg( job.iSrc, job.iDest, "   Testing for hull %s\n", NAI_Hull::Name( m_WorkerHull ) );
+	job.acceptedMotions[m_WorkerHull] = ComputeConnection( s_pWorkerTestHull, pSrcNode, pDestNode, m_WorkerHull );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Tests the given connections for every hull.  Each hull is a
+//			separate pass so the test hulls are only resized on this thread
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::RunConnectionJobs( CUtlVector<int> &jobs )
+{
+	if ( !jobs.Count() )
+		return;
+
+	for ( int hull = 0; hull < NUM_HULLS; hull++ )
+	{
+		for ( int i = 0; i < m_WorkerTestHulls.Count(); i++ )
+		{
+			CAI_TestHull *pTestHull = m_WorkerTestHulls[i];
+			if ( pTestHull->GetHullType() != hull )
+			{
+				pTestHull->SetHullType( (Hull_t)hull );
+				pTestHull->SetHullSizeNormal( true );
+			}
+			pTestHull->AddFlag( FL_ONGROUND );
+		}
+
+		m_WorkerHull = (Hull_t)hull;
+		m_iNextWorkerTestHull = 0;
+		ParallelProcess( "CAI_NetworkBuilder::InitLinks", jobs.Base(), jobs.Count(), this, &CAI_NetworkBuilder::ComputeConnectionJob, &CAI_NetworkBuilder::BeginWorker, &CAI_NetworkBuilder::EndWorker, m_nMaxParallel );
+	}
+
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		m_ConnectionJobs[jobs[i]].bComputed = true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same result as calling InitLinks() on every node in order
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::InitAllLinks( CAI_Network *pNetwork )
+{
+	int nNodes = pNetwork->NumNodes();
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+	int i, j;
+
+	CFastTimer timer;
+	timer.Start();
+
+	m_pBuildNetwork = pNetwork;
+
+	// ------------------------------------------------------------
+	// One test hull per thread
+	// ------------------------------------------------------------
+	int nThreads = ( m_nMaxParallel && g_pThreadPool ) ? g_pThreadPool->NumThreads() + 1 : 1;
+	m_WorkerTestHulls.AddToTail( m_pTestHull );
+	while ( m_WorkerTestHulls.Count() < nThreads )
+	{
+		m_WorkerTestHulls.AddToTail( CAI_TestHull::GetWorkerTestHull() );
+	}
+	for ( i = 0; i < m_WorkerTestHulls.Count(); i++ )
+	{
+		m_WorkerTestHulls[i]->GetNavigator()->SetNetwork( pNetwork );
+	}
+
+	// ------------------------------------------------------------
+	// Every pair InitLinks() may test, in the order it would test
+	// them.  If the lower numbered node also tests the pair, it
+	// links them unless all the hulls fail, so the reverse test
+	// waits until we know whether it's needed
+	// ------------------------------------------------------------
+	CUtlVector<int> firstJob;
+	CUtlVector<int> jobs;
+	CUtlVector<int> deferredJobs;
+
+	firstJob.SetCount( nNodes + 1 );
+	for ( i = 0; i < nNodes; i++ )
+	{
+		firstJob[i] = m_ConnectionJobs.Count();
+
+		if ( ppNodes[i]->m_eNodeInfo & bits_NODE_FALLEN )
+			continue;
+
+		for ( j = 0; j < nNodes; j++ )
+		{
+			if ( !m_NeighborsTable[i].IsBitSet( j ) || ( ppNodes[j]->m_eNodeInfo & bits_NODE_FALLEN ) )
+				continue;
+
+			int iJob = m_ConnectionJobs.AddToTail();
+			ConnectionJob_t &job = m_ConnectionJobs[iJob];
+			job.iSrc = i;
+			job.iDest = j;
+			job.bComputed = false;
+
+			if ( j < i && m_NeighborsTable[j].IsBitSet( i ) )
+				deferredJobs.AddToTail( iJob );
+			else
+				jobs.AddToTail( iJob );
+		}
+	}
+	firstJob[nNodes] = m_ConnectionJobs.Count();
+
+	RunConnectionJobs( jobs );
+	int nTested = jobs.Count();
+
+	jobs.RemoveAll();
+	for ( i = 0; i < deferredJobs.Count(); i++ )
+	{
+		const ConnectionJob_t &job = m_ConnectionJobs[deferredJobs[i]];
+
+		for ( j = firstJob[job.iDest]; j < firstJob[job.iDest + 1]; j++ )
+		{
+			const ConnectionJob_t &reverseJob = m_ConnectionJobs[j];
+			if ( reverseJob.iDest != job.iSrc )
+				continue;
+
+			bool bAllFailed = true;
+			for ( int hull = 0; hull < NUM_HULLS; hull++ )
+			{
+				if ( reverseJob.acceptedMotions[hull] != 0 )
+					bAllFailed = false;
+			}
+			if ( bAllFailed )
+				jobs.AddToTail( deferredJobs[i] );
+			break;
+		}
+	}
+
+	RunConnectionJobs( jobs );
+	nTested += jobs.Count();
+
+	timer.End();
+	float flTestTime = timer.GetDuration().GetSeconds();
+	timer.Start();
+
+	// ------------------------------------------------------------
+	// Merge in node order
+	// ------------------------------------------------------------
+	int iJob = 0;
+	for ( i = 0; i < nNodes; i++ )
+	{
+		CAI_Node *pNode = ppNodes[i];
+
+		for ( j = 0; j < nNodes; j++ )
+		{
+			DebugConnectMsg( i, j, "Testing connection between %d and %d:\n", i, j );
+
+			if ( pNode->HasLink( j ) )
+			{
+				DebugConnectMsg( i, j, "   Nodes already connected\n" );
+				continue;
+			}
+
+			CAI_Node *pDestNode = ppNodes[j];
+
+			CAI_Link *pOldLink = pDestNode->HasLink( i );
+			if ( pOldLink )
+			{
+				DebugConnectMsg( i, j, "   Sharing previously establish connection\n" );
+				pNode->AddLink( pOldLink );
+				continue;
+			}
+
+			if ( !m_NeighborsTable[i].IsBitSet( j ) )
+			{
+				DebugConnectMsg( i, j, "   NO LINK (not neighbors)\n" );
+				continue;
+			}
+
+			bool bAllFailed = true;
+			const int *acceptedMotions = NULL;
+
+			if ( !(pNode->m_eNodeInfo & bits_NODE_FALLEN) && !(pDestNode->m_eNodeInfo & bits_NODE_FALLEN) )
+			{
+				while ( m_ConnectionJobs[iJob].iSrc != i || m_ConnectionJobs[iJob].iDest != j )
+				{
+					iJob++;
+					Assert( iJob < m_ConnectionJobs.Count() );
+				}
+				ConnectionJob_t &job = m_ConnectionJobs[iJob];
+
+				// A pair skipped above because it was expected to be linked already
+				if ( !job.bComputed )
+				{
+					for ( int hull = 0; hull < NUM_HULLS; hull++ )
+					{
+						job.acceptedMotions[hull] = ComputeConnection( m_pTestHull, pNode, pDestNode, (Hull_t)hull );
+					}
+					job.bComputed = true;
+					nTested++;
+				}
+
+				acceptedMotions = job.acceptedMotions;
+				for ( int hull = 0; hull < NUM_HULLS; hull++ )
+				{
+					if ( acceptedMotions[hull] != 0 )
+						bAllFailed = false;
+				}
+			}
+			else
+				DebugConnectMsg( i, j, "   No connection: one or both are fallen nodes\n" );
+
+			// If there were any passible hulls create link
+			if ( !bAllFailed )
+			{
+				CAI_Link *pLink = pNetwork->CreateLink( i, j );
+				if ( pLink )
+				{
+					for ( int hull = 0; hull < NUM_HULLS; hull++ )
+					{
+						pLink->m_iAcceptedMoveTypes[hull] = acceptedMotions[hull];
+					}
+					DebugConnectMsg( i, j, "   Added link\n" );
+				}
+			}
+			else 
+			{
+				m_NeighborsTable[i].Clear( j );
+				DebugConnectMsg( i, j, "   NO LINK\n" );
+			}
+		}
+	}
+
+	timer.End();
+	DevMsg( "...%d connections tested on %d threads in %f seconds, merged in %f seconds\n", nTested, nThreads, flTestTime, timer.GetDuration().GetSeconds() );
+
+	for ( i = 1; i < m_WorkerTestHulls.Count(); i++ )
+	{
+		CAI_TestHull::ReturnWorkerTestHull( m_WorkerTestHulls[i] );
+	}
+	m_WorkerTestHulls.RemoveAll();
+	m_ConnectionJobs.Purge();
+	m_pBuildNetwork = NULL;
+}
+
+//-----------------------------------------------------------------------------
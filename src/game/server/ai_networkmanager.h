@@ -9,6 +9,7 @@
 
 #include "utlvector.h"
 #include "bitstring.h"
+#include "ai_hull.h"
 
 #if defined( _WIN32 )
 #pragma once
@@ -105,21 +106,51 @@ public:
 private:
 	void			InitVisibility( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitNeighbors( CAI_Network *pNetwork, CAI_Node *pNode );
+	void			PruneRedundantNeighbors( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitClimbNodePosition( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitGroundNodePosition( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitLinks( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			ForceDynamicLinkNeighbors();
+
+	// Used by Build().  The traces and move probes run on worker threads, and the results
+	// are merged in node order so the graph is the same as InitNeighbors() and InitLinks()
+	// would build one node at a time.
+	void			InitAllNeighbors( CAI_Network *pNetwork );
+	void			InitAllLinks( CAI_Network *pNetwork );
+	void			ComputeVisibilityJob( int &iNode );
+	void			ComputeConnectionJob( int &iJob );
+	void			RunConnectionJobs( CUtlVector<int> &jobs );
+	void			BeginWorker();
+	void			EndWorker();
+	bool			IsNodeDeletedAt( int iNode, int iProcessingNode ) const	{ return m_NodeDeletedBy[iNode] <= iProcessingNode; }
 	
 	void			FloodFillZone( CAI_Node **ppNodes, CAI_Node *pNode, int zone );
 
-	int				ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+	int				ComputeConnection( CAI_TestHull *pTestHull, CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
 	
 	void 			BeginBuild();
 	void			EndBuild();
 
+	struct ConnectionJob_t
+	{
+		int		iSrc;
+		int		iDest;
+		bool	bComputed;
+		int		acceptedMotions[NUM_HULLS];
+	};
+
 	CUtlVector<CVarBitVec>	m_NeighborsTable;
 	CVarBitVec				m_DidSetNeighborsTable;
 	CAI_TestHull *			m_pTestHull;
+
+	CAI_Network *			m_pBuildNetwork;
+	CUtlVector<int>			m_NodeDeletedBy;			// node that deletes each duplicate node, -1 if already deleted
+	CUtlVector<CVarBitVec>	m_VisibleTable;				// visibility to each higher numbered node
+	CUtlVector<ConnectionJob_t> m_ConnectionJobs;
+	CUtlVector<CAI_TestHull *> m_WorkerTestHulls;
+	CInterlockedInt			m_iNextWorkerTestHull;
+	Hull_t					m_WorkerHull;
+	int						m_nMaxParallel;
 };
 
 extern CAI_NetworkBuilder g_AINetworkBuilder;
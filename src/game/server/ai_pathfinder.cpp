@@ -272,6 +272,55 @@ int CAI_Pathfinder::NearestNodeToPoint( const Vector &vecOrigin )
 	return GetNetwork()->NearestNodeToPoint( GetOuter(), vecOrigin );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Estimated cost from a node to the goal. The straight line distance,
+//			or if the hull has landmarks, the best triangle inequality bound
+//			they give, whichever is larger. Neither overestimates.
+//-----------------------------------------------------------------------------
+
+int g_nPathfindNodesExpanded;
+
+class CAI_PathCostEstimate
+{
+public:
+	CAI_PathCostEstimate( CAI_Network *pNetwork, Hull_t hull, int endID )
+	  :	m_pNetwork( pNetwork ),
+		m_hull( hull ),
+		m_vecEnd( pNetwork->AccessNodes()[endID]->GetPosition( hull ) )
+	{
+		m_pEndLandmarkDist = pNetwork->GetLandmarkDistances( hull, endID, &m_nLandmarks );
+	}
+
+	float Estimate( int nodeID ) const
+	{
+		float estimate = ( m_pNetwork->AccessNodes()[nodeID]->GetPosition( m_hull ) - m_vecEnd ).Length();
+		if ( m_pEndLandmarkDist )
+		{
+			int nLandmarks;
+			const float *pNodeLandmarkDist = m_pNetwork->GetLandmarkDistances( m_hull, nodeID, &nLandmarks );
+			for ( int i = 0; i < m_nLandmarks; i++ )
+			{
+				if ( pNodeLandmarkDist[i] == FLT_MAX || m_pEndLandmarkDist[i] == FLT_MAX )
+					continue;
+
+				float bound = fabsf( m_pEndLandmarkDist[i] - pNodeLandmarkDist[i] );
+				if ( bound > estimate )
+				{
+					estimate = bound;
+				}
+			}
+		}
+		return estimate;
+	}
+
+private:
+	CAI_Network *	m_pNetwork;
+	Hull_t			m_hull;
+	Vector			m_vecEnd;
+	const float *	m_pEndLandmarkDist;
+	int				m_nLandmarks;
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a path between two nodes
 //-----------------------------------------------------------------------------
@@ -287,38 +336,47 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	m_nPerfStatPB++;
 #endif
 
-	int nNodes = GetNetwork()->NumNodes();
-	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+	CAI_Network *pNetwork = GetNetwork();
+	CAI_Node **pAInode = pNetwork->AccessNodes();
+	Hull_t hull = GetHullType();
+
+	// No links this hull can use join the two nodes
+	if ( !pNetwork->IsConnectedForHull( hull, startID, endID ) )
+		return NULL;
 
-	CVarBitVec	openBS(nNodes);
-	CVarBitVec	closeBS(nNodes);
+	CAI_PathCostEstimate costEstimate( pNetwork, hull, endID );
 
 	// ------------- INITIALIZE ------------------------
-	float* nodeG = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeH = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeF = (float *)stackalloc( nNodes * sizeof(float) );
-	int*   nodeP = (int *)stackalloc( nNodes * sizeof(int) );		// Node parent 
-
-	for (int node=0;node<nNodes;node++)
-	{
-		nodeG[node] = FLT_MAX;
-		nodeP[node] = -1;
-	}
+	// Queued navigation searches on a job thread, which can't share the network's scratch
+	AI_PathSearchScratch_t threadScratch;
+	AI_PathSearchScratch_t &scratch = ThreadInMainThread() ? pNetwork->GetMainThreadPathScratch() : threadScratch;
+	unsigned generation = pNetwork->BeginPathSearch( scratch );
 
-	nodeG[startID] = 0;
+	AI_PathNodeState_t *nodeState = scratch.nodeState.Base();
+	int *nodeP = scratch.parents.Base();		// Node parent
+	CNodeList *pOpenList = &scratch.openList;
 
-	nodeH[startID] = 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
-	nodeF[startID] = nodeG[startID] + nodeH[startID];
+	nodeState[startID].generation = generation;
+	nodeState[startID].g = 0;
+	nodeState[startID].f = 0.1*(pAInode[startID]->GetPosition(hull)-pAInode[endID]->GetPosition(hull)).Length(); // Don't want to over estimate
+	nodeState[startID].bOpen = true;
+	nodeP[startID] = NO_NODE;
 
-	openBS.Set(startID);
-	closeBS.Set( startID );
+	pOpenList->Insert( AI_NearNode_t( startID, nodeState[startID].f ) );
 
 	// --------------- FIND BEST PATH ------------------
-	while (!openBS.IsAllClear()) 
+	while ( pOpenList->Count() ) 
 	{
-		int smallestID = CAI_Network::FindBSSmallest(&openBS,nodeF,nNodes);
-	
-		openBS.Clear(smallestID);
+		AI_NearNode_t smallest = pOpenList->ElementAtHead();
+		pOpenList->RemoveAtHead();
+
+		// A node is pushed again each time its cost drops; skip the stale entries
+		int smallestID = smallest.nodeIndex;
+		if ( !nodeState[smallestID].bOpen || smallest.dist != nodeState[smallestID].f )
+			continue;
+
+		nodeState[smallestID].bOpen = false;
+		g_nPathfindNodesExpanded++;
 
 		CAI_Node *pSmallestNode = pAInode[smallestID];
 		
@@ -327,7 +385,7 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 		if (smallestID == endID) 
 		{
-			AI_Waypoint_t* route = MakeRouteFromParents(&nodeP[0], endID);
+			AI_Waypoint_t* route = MakeRouteFromParents(nodeP, endID);
 			return route;
 		}
 
@@ -341,27 +399,28 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 				continue;
 
 			// FIXME: the cost function should take into account Node costs (danger, flanking, etc).
-			int moveType = nodeLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+			int moveType = nodeLink->m_iAcceptedMoveTypes[hull] & CapabilitiesGet();
 			int testID	 = nodeLink->DestNodeID(smallestID);
 
-			Vector r1 = pSmallestNode->GetPosition(GetHullType());
-			Vector r2 = pAInode[testID]->GetPosition(GetHullType());
+			Vector r1 = pSmallestNode->GetPosition(hull);
+			Vector r2 = pAInode[testID]->GetPosition(hull);
 			float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
 
 			if ( dist == FLT_MAX )
 				continue;
 
-			float new_g  = nodeG[smallestID] + dist;
+			float new_g  = nodeState[smallestID].g + dist;
 
-			if ( !closeBS.IsBitSet(testID) || (new_g < nodeG[testID]) ) 
+			AI_PathNodeState_t &test = nodeState[testID];
+			if ( test.generation != generation || (new_g < test.g) ) 
 			{
+				test.generation = generation;
+				test.g = new_g;
+				test.f = new_g + costEstimate.Estimate( testID );
+				test.bOpen = true;
 				nodeP[testID] = smallestID;
-				nodeG[testID] = new_g;
-				nodeH[testID] = (pAInode[testID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length();
-				nodeF[testID] = nodeG[testID] + nodeH[testID];
 
-				closeBS.Set( testID );
-				openBS.Set( testID );
+				pOpenList->Insert( AI_NearNode_t( testID, test.f ) );
 			}
 		}
 	}
@@ -144,7 +144,7 @@ private:
 	AI_Waypoint_t *pNext;
 	AI_Waypoint_t *pPrev;
 
-	DECLARE_FIXEDSIZE_ALLOCATOR(AI_Waypoint_t);
+	DECLARE_FIXEDSIZE_ALLOCATOR_MT(AI_Waypoint_t);
 
 public:
 	DECLARE_SIMPLE_DATADESC();
@@ -731,8 +731,10 @@ CEventQueue g_EventQueue;
 
 CEventQueue::CEventQueue()
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	m_iNextSequence = 0;
+	m_pServicingEvent = NULL;
+	V_memset( m_pTargetSlotEvents, 0, sizeof( m_pTargetSlotEvents ) );
+	V_memset( m_pCallerSlotEvents, 0, sizeof( m_pCallerSlotEvents ) );
 
 	Init();
 }
@@ -846,21 +848,20 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	while ( m_Heap.Count() )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = m_Heap.Tail();
+		RemoveEvent( pe );
 		delete pe;
-		pe = next;
 	}
 
-	m_Events.m_pNext = NULL;
+	m_iNextSequence = 0;
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	CUtlVector< EventQueuePrioritizedEvent_t * > events;
+	GetSortedEvents( events );
 
 	Msg("Dumping event queue. Current time is: %.2f\n",
 #ifdef TF_DLL
@@ -870,9 +871,9 @@ void CEventQueue::Dump( void )
 #endif
 		);
 
-	while ( pe != NULL )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = events[i];
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -881,8 +882,6 @@ void CEventQueue::Dump( void )
 			pe->m_VariantValue.String(),
 			pe->m_pActivator ? pe->m_pActivator->GetDebugName() : "None", 
 			pe->m_pCaller ? pe->m_pCaller->GetDebugName() : "None"  );
-
-		pe = next;
 	}
 
 	Msg("Finished dump.\n");
@@ -949,35 +948,180 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	// events with the same fire time are serviced in the order they were added
+	if ( m_Heap.Count() == 0 )
+	{
+		m_iNextSequence = 0;
+	}
+	newEvent->m_iSequence = m_iNextSequence++;
+
+	// insert into the heap
+	int index = m_Heap.AddToTail( newEvent );
+	HeapSet( index, newEvent );
+	HeapSiftUp( index );
+
+	// index by target and caller
+	CBaseEntity *pTarget = newEvent->m_pEntTarget;
+	newEvent->m_iTargetSlot = pTarget ? newEvent->m_pEntTarget.GetEntryIndex() : -1;
+	newEvent->m_pPrevForTarget = NULL;
+	newEvent->m_pNextForTarget = NULL;
+	if ( newEvent->m_iTargetSlot >= 0 )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
+		newEvent->m_pNextForTarget = m_pTargetSlotEvents[ newEvent->m_iTargetSlot ];
+		if ( newEvent->m_pNextForTarget )
 		{
-			break;
+			newEvent->m_pNextForTarget->m_pPrevForTarget = newEvent;
 		}
+		m_pTargetSlotEvents[ newEvent->m_iTargetSlot ] = newEvent;
 	}
 
-	Assert( pe );
-
-	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+	CBaseEntity *pCaller = newEvent->m_pCaller;
+	newEvent->m_iCallerSlot = pCaller ? newEvent->m_pCaller.GetEntryIndex() : -1;
+	newEvent->m_pPrevForCaller = NULL;
+	newEvent->m_pNextForCaller = NULL;
+	if ( newEvent->m_iCallerSlot >= 0 )
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		newEvent->m_pNextForCaller = m_pCallerSlotEvents[ newEvent->m_iCallerSlot ];
+		if ( newEvent->m_pNextForCaller )
+		{
+			newEvent->m_pNextForCaller->m_pPrevForCaller = newEvent;
+		}
+		m_pCallerSlotEvents[ newEvent->m_iCallerSlot ] = newEvent;
 	}
 }
 
 void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
-	if ( pe->m_pNext )
+	// remove from the heap, filling the hole with the last event
+	int index = pe->m_iHeapIndex;
+	Assert( m_Heap.IsValidIndex( index ) && m_Heap[index] == pe );
+
+	EventQueuePrioritizedEvent_t *pLast = m_Heap.Tail();
+	m_Heap.RemoveMultipleFromTail( 1 );
+	if ( pLast != pe )
 	{
-		pe->m_pNext->m_pPrev = pe->m_pPrev;
+		HeapSet( index, pLast );
+		HeapSiftUp( index );
+		HeapSiftDown( pLast->m_iHeapIndex );
+	}
+	pe->m_iHeapIndex = -1;
+
+	// remove from the target and caller indices
+	if ( pe->m_iTargetSlot >= 0 )
+	{
+		if ( pe->m_pPrevForTarget )
+			pe->m_pPrevForTarget->m_pNextForTarget = pe->m_pNextForTarget;
+		else
+			m_pTargetSlotEvents[ pe->m_iTargetSlot ] = pe->m_pNextForTarget;
+
+		if ( pe->m_pNextForTarget )
+			pe->m_pNextForTarget->m_pPrevForTarget = pe->m_pPrevForTarget;
+	}
+
+	if ( pe->m_iCallerSlot >= 0 )
+	{
+		if ( pe->m_pPrevForCaller )
+			pe->m_pPrevForCaller->m_pNextForCaller = pe->m_pNextForCaller;
+		else
+			m_pCallerSlotEvents[ pe->m_iCallerSlot ] = pe->m_pNextForCaller;
+
+		if ( pe->m_pNextForCaller )
+			pe->m_pNextForCaller->m_pPrevForCaller = pe->m_pPrevForCaller;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: removes and frees a cancelled event. The event being serviced is left
+//			for ServiceEvents to remove once its input has been fired.
+//-----------------------------------------------------------------------------
+void CEventQueue::DeleteEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	if ( pe == m_pServicingEvent )
+		return;
+
+	RemoveEvent( pe );
+	delete pe;
+}
+
+bool CEventQueue::IsEventBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b ) const
+{
+	if ( a->m_flFireTime != b->m_flFireTime )
+		return a->m_flFireTime < b->m_flFireTime;
+
+	return a->m_iSequence < b->m_iSequence;
+}
+
+void CEventQueue::HeapSet( int index, EventQueuePrioritizedEvent_t *pe )
+{
+	m_Heap[index] = pe;
+	pe->m_iHeapIndex = index;
+}
+
+void CEventQueue::HeapSiftUp( int index )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[index];
+	while ( index > 0 )
+	{
+		int parent = ( index - 1 ) / 2;
+		if ( !IsEventBefore( pe, m_Heap[parent] ) )
+			break;
+
+		HeapSet( index, m_Heap[parent] );
+		index = parent;
+	}
+	HeapSet( index, pe );
+}
+
+void CEventQueue::HeapSiftDown( int index )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[index];
+	int count = m_Heap.Count();
+	while ( 1 )
+	{
+		int child = 2 * index + 1;
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && IsEventBefore( m_Heap[child + 1], m_Heap[child] ) )
+		{
+			child++;
+		}
+
+		if ( !IsEventBefore( m_Heap[child], pe ) )
+			break;
+
+		HeapSet( index, m_Heap[child] );
+		index = child;
+	}
+	HeapSet( index, pe );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: fills in the events in the order they will be serviced
+//-----------------------------------------------------------------------------
+static int CompareEventOrder( EventQueuePrioritizedEvent_t * const *a, EventQueuePrioritizedEvent_t * const *b )
+{
+	if ( (*a)->m_flFireTime != (*b)->m_flFireTime )
+		return ( (*a)->m_flFireTime < (*b)->m_flFireTime ) ? -1 : 1;
+
+	if ( (*a)->m_iSequence != (*b)->m_iSequence )
+		return ( (*a)->m_iSequence < (*b)->m_iSequence ) ? -1 : 1;
+
+	return 0;
+}
+
+void CEventQueue::GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &events ) const
+{
+	events.CopyArray( m_Heap.Base(), m_Heap.Count() );
+	events.Sort( CompareEventOrder );
+}
+
+void CEventQueue::ValidateQueue( void )
+{
+	for ( int i = 0; i < m_Heap.Count(); i++ )
+	{
+		Assert( m_Heap[i]->m_iHeapIndex == i );
+		Assert( i == 0 || !IsEventBefore( m_Heap[i], m_Heap[( i - 1 ) / 2] ) );
 	}
 }
 
@@ -992,7 +1136,7 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pe = m_Heap.Count() ? m_Heap[0] : NULL;
 
 #ifdef TF_DLL
 	while ( pe != NULL && pe->m_flFireTime <= engine->GetServerTime() )
@@ -1002,6 +1146,9 @@ void CEventQueue::ServiceEvents( void )
 	{
 		MDLCACHE_CRITICAL_SECTION();
 
+		// the event stays queued while it is serviced, but can't be cancelled out from under us
+		m_pServicingEvent = pe;
+
 		bool targetFound = false;
 
 		// find the targets
@@ -1065,7 +1212,8 @@ void CEventQueue::ServiceEvents( void )
 			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 		}
 
-		// remove the event from the list (remembering that the queue may have been added to)
+		// remove the event from the queue (remembering that the queue may have been added to)
+		m_pServicingEvent = NULL;
 		RemoveEvent( pe );
 		delete pe;
 
@@ -1080,8 +1228,8 @@ void CEventQueue::ServiceEvents( void )
 			}
 		}
 
-		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
+		// restart from the head of the queue (to catch any new items have probably been added to the queue)
+		pe = m_Heap.Count() ? m_Heap[0] : NULL;
 	}
 }
 
@@ -1109,7 +1257,7 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pCur = m_pCallerSlotEvents[ pCaller->GetRefEHandle().GetEntryIndex() ];
 
 	while (pCur != NULL)
 	{
@@ -1126,12 +1274,11 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextForCaller;
 
 		if (bDelete)
 		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
+			DeleteEvent( pCurSave );
 		}
 	}
 }
@@ -1147,7 +1294,7 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pCur = m_pTargetSlotEvents[ pTarget->GetRefEHandle().GetEntryIndex() ];
 
 	while (pCur != NULL)
 	{
@@ -1162,12 +1309,11 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextForTarget;
 
 		if (bDelete)
 		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
+			DeleteEvent( pCurSave );
 		}
 	}
 }
@@ -1182,7 +1328,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pCur = m_pTargetSlotEvents[ pTarget->GetRefEHandle().GetEntryIndex() ];
 
 	while (pCur != NULL)
 	{
@@ -1195,7 +1341,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 				return true;
 		}
 
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextForTarget;
 	}
 
 	return false;
@@ -1230,29 +1376,28 @@ BEGIN_SIMPLE_DATADESC( EventQueuePrioritizedEvent_t )
 	DEFINE_FIELD( m_iOutputID, FIELD_INTEGER ),
 	DEFINE_CUSTOM_FIELD( m_VariantValue, variantFuncs ),
 
-//	DEFINE_FIELD( m_pNext, FIELD_??? ),
-//	DEFINE_FIELD( m_pPrev, FIELD_??? ),
+//	DEFINE_FIELD( m_iHeapIndex, FIELD_INTEGER ),
+//	DEFINE_FIELD( m_iSequence, FIELD_INTEGER ),
 END_DATADESC()
 
 
 int CEventQueue::Save( ISave &save )
 {
-	// count the number of items in the queue
-	EventQueuePrioritizedEvent_t *pe;
+	// save the events in the order they will be serviced, so restoring them preserves that order
+	CUtlVector< EventQueuePrioritizedEvent_t * > events;
+	GetSortedEvents( events );
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	// count the number of items in the queue
+	m_iListCount = events.Count();
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
 	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pe = events[i];
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
 	}
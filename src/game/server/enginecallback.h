@@ -101,6 +101,7 @@ void MessageWriteBool( bool bValue );
 void MessageWriteUBitLong( unsigned int data, int numbits );
 void MessageWriteSBitLong( int data, int numbits );
 void MessageWriteBits( const void *pIn, int nBits );
+void MessageWriteUBitLongArray( const uint32 *pData, int nCount, int numbits );
 
 #ifndef NO_STEAM
 
@@ -132,5 +133,6 @@ extern CSteamID GetSteamIDForPlayerIndex( int iPlayerIndex );
 #define WRITE_UBITLONG	(MessageWriteUBitLong)
 #define WRITE_SBITLONG	(MessageWriteSBitLong)
 #define WRITE_BITS		(MessageWriteBits)
+#define WRITE_UBITLONG_ARRAY	(MessageWriteUBitLongArray)
 
 #endif		//ENGINECALLBACK_H
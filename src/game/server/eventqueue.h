@@ -15,6 +15,7 @@
 #endif
 
 #include "mempool.h"
+#include "utlvector.h"
 
 struct EventQueuePrioritizedEvent_t
 {
@@ -28,8 +29,15 @@ struct EventQueuePrioritizedEvent_t
 
 	variant_t m_VariantValue;	// variable-type parameter
 
-	EventQueuePrioritizedEvent_t *m_pNext;
-	EventQueuePrioritizedEvent_t *m_pPrev;
+	// queue bookkeeping - not saved
+	int m_iHeapIndex;			// position in the queue's heap
+	unsigned int m_iSequence;	// when the event was added, so events with the same fire time are serviced in order
+	int m_iTargetSlot;			// entity list slot of m_pEntTarget, or -1
+	int m_iCallerSlot;			// entity list slot of m_pCaller, or -1
+	EventQueuePrioritizedEvent_t *m_pNextForTarget;	// other events whose target is in the same slot
+	EventQueuePrioritizedEvent_t *m_pPrevForTarget;
+	EventQueuePrioritizedEvent_t *m_pNextForCaller;	// other events whose caller is in the same slot
+	EventQueuePrioritizedEvent_t *m_pPrevForCaller;
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -70,9 +78,24 @@ private:
 
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
+	void DeleteEvent( EventQueuePrioritizedEvent_t *pe );	// remove and free, unless it is being serviced right now
+
+	// the queue is a binary min-heap ordered by fire time, then by the order events were added
+	bool IsEventBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b ) const;
+	void HeapSet( int index, EventQueuePrioritizedEvent_t *pe );
+	void HeapSiftUp( int index );
+	void HeapSiftDown( int index );
+	void GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &events ) const;
 
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
+	CUtlVector< EventQueuePrioritizedEvent_t * > m_Heap;
+	unsigned int m_iNextSequence;
+	EventQueuePrioritizedEvent_t *m_pServicingEvent;	// the event whose input is being fired
+
+	// events indexed by the entity list slot of their target and caller, for CancelEvents/CancelEventOn/HasEventPending
+	EventQueuePrioritizedEvent_t *m_pTargetSlotEvents[ NUM_ENT_ENTRIES ];
+	EventQueuePrioritizedEvent_t *m_pCallerSlotEvents[ NUM_ENT_ENTRIES ];
+
 	int m_iListCount;
 };
 
@@ -90,6 +90,8 @@
 #include "serverbenchmark_base.h"
 #include "querycache.h"
 #include "player_voice_listener.h"
+#include "checksum_crc.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TF_DLL
 #include "gc_clientsystem.h"
@@ -205,6 +207,9 @@ static ConVar s_UseNetworkVars( "UseNetworkVars", "1", FCVAR_CHEAT, "For profili
 extern ConVar sv_noclipduringpause;
 ConVar sv_massreport( "sv_massreport", "0" );
 ConVar sv_force_transmit_ents( "sv_force_transmit_ents", "0", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Will transmit all entities to client, regardless of PVS conditions (will still skip based on transmit flags, however)." );
+ConVar sv_transmit_pvs_cache( "sv_transmit_pvs_cache", "1", 0, "Share PVS checks between clients that have the same PVS and networked areas when deciding which entities to transmit." );
+ConVar sv_transmit_pvs_parallel( "sv_transmit_pvs_parallel", "1", 0, "Compute shared PVS checks on worker threads when there are enough entities." );
+ConVar sv_transmit_pvs_validate( "sv_transmit_pvs_validate", "0", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Development only: also decide which entities to transmit without sharing PVS checks, and report any differences. Runs every client's transmit checks twice." );
 
 ConVar sv_autosave( "sv_autosave", "1", 0, "Set to 1 to autosave game on level transition. Does not affect autosave triggers." );
 ConVar *sv_maxreplay = NULL;
@@ -2412,6 +2417,9 @@ public:
 	virtual edict_t*		BaseEntityToEdict( CBaseEntity *pEnt );
 	virtual CBaseEntity*	EdictToBaseEntity( edict_t *pEdict );
 	virtual void			CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts );
+
+private:
+	void					CheckTransmitEdicts( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts, bool bSharePVS );
 };
 EXPOSE_SINGLE_INTERFACE(CServerGameEnts, IServerGameEnts, INTERFACEVERSION_SERVERGAMEENTS);
 
@@ -2477,7 +2485,265 @@ inline void CServerNetworkProperty::CheckTransmit( CCheckTransmitInfo *pInfo )
 	}
 } */
 
+// open state of every area portal, as last set by ClientSetupVisibility() for the client being checked
+static CUtlVector< byte > g_TransmitAreaPortalStates;
+
+//-----------------------------------------------------------------------------
+// Purpose: PVS checks shared by the clients of a snapshot.
+//  The engine calls CheckTransmit() once per client with the same edict list. Clients in the
+//  same cluster with the same networked areas and area portal states get the same IsInPVS()
+//  answer for every entity that only needs a PVS check, so that answer is computed once for
+//  all of them. The portal states matter because IsInPVS() checks area connectivity, and
+//  ClientSetupVisibility() opens portals per client, for example fading areaportal windows.
+//-----------------------------------------------------------------------------
+class CTransmitPVSCache
+{
+public:
+	struct Visibility_t
+	{
+		CRC32_t m_nHash;
+		int m_nPVSSize;
+		byte m_PVS[ PAD_NUMBER( MAX_MAP_CLUSTERS,8 ) / 8 ];
+		int m_nAreas;
+		int m_Areas[ MAX_WORLD_AREAS ];
+		CUtlVector< byte > m_AreaPortalStates;
+		CUtlVector< byte > m_InPVS;					// parallel to m_Entities
+	};
+
+	CTransmitPVSCache();
+
+	const Visibility_t *FindVisibility( const CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts );
+
+	bool IsInPVS( const Visibility_t *pVisibility, int iEdict, CServerNetworkProperty *netProp, const CCheckTransmitInfo *pInfo ) const
+	{
+		int index = m_EntityIndex[ iEdict ];
+		if ( index < 0 )
+			return netProp->IsInPVS( pInfo );
+
+		return pVisibility->m_InPVS[ index ] != 0;
+	}
+
+private:
+	void BeginSnapshot( const unsigned short *pEdictIndices, int nEdicts );
+	void ComputeVisibility( Visibility_t *pVisibility, const CCheckTransmitInfo *pInfo );
+
+	int m_nFrame;										// snapshots are still sent while paused, when the tick count stops
+	const unsigned short *m_pEdictIndices;
+	int m_nEdicts;
+
+	CUtlVector< CServerNetworkProperty * > m_Entities;	// edicts that only need a PVS check this snapshot
+	short m_EntityIndex[ MAX_EDICTS ];					// edict -> index in m_Entities, or -1
+
+	CUtlVector< Visibility_t * > m_Visibility;			// allocated once, reused by later snapshots
+	int m_nVisibilityUsed;
+};
+
+static CTransmitPVSCache g_TransmitPVSCache;
+
+struct TransmitPVSChunk_t
+{
+	CServerNetworkProperty * const *m_ppEntities;
+	byte *m_pInPVS;
+	int m_nCount;
+	const CCheckTransmitInfo *m_pInfo;
+};
+
+// entities per job, and the fewest entities worth handing to worker threads
+enum
+{
+	TRANSMIT_PVS_CHUNK_SIZE = 128,
+	TRANSMIT_PVS_PARALLEL_MIN = 512,
+};
+
+static void ComputeTransmitPVSChunk( TransmitPVSChunk_t &chunk )
+{
+	for ( int i = 0; i < chunk.m_nCount; i++ )
+	{
+		chunk.m_pInPVS[i] = chunk.m_ppEntities[i]->IsInPVS( chunk.m_pInfo );
+	}
+}
+
+CTransmitPVSCache::CTransmitPVSCache()
+{
+	m_nFrame = -1;
+	m_pEdictIndices = NULL;
+	m_nEdicts = 0;
+	m_nVisibilityUsed = 0;
+	memset( m_EntityIndex, 0xff, sizeof( m_EntityIndex ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Gather the entities whose transmit state only depends on the PVS,
+//  and bring their PVS information up to date while still on the main thread
+//-----------------------------------------------------------------------------
+void CTransmitPVSCache::BeginSnapshot( const unsigned short *pEdictIndices, int nEdicts )
+{
+	m_nFrame = gpGlobals->framecount;
+	m_pEdictIndices = pEdictIndices;
+	m_nEdicts = nEdicts;
+	m_nVisibilityUsed = 0;
+
+	// entities from the last snapshot may be gone, so don't go through them
+	memset( m_EntityIndex, 0xff, sizeof( m_EntityIndex ) );
+	m_Entities.RemoveAll();
+
+	edict_t *pBaseEdict = engine->PEntityOfEntIndex( 0 );
+	for ( int i = 0; i < nEdicts; i++ )
+	{
+		int iEdict = pEdictIndices[i];
+		edict_t *pEdict = &pBaseEdict[iEdict];
+
+		int nFlags = pEdict->m_fStateFlags & (FL_EDICT_DONTSEND|FL_EDICT_ALWAYS|FL_EDICT_PVSCHECK|FL_EDICT_FULLCHECK);
+		if ( nFlags != FL_EDICT_PVSCHECK )
+			continue;
+
+		CServerNetworkProperty *netProp = static_cast<CServerNetworkProperty*>( pEdict->GetNetworkable() );
+		if ( !netProp )
+			continue;
+
+		netProp->RecomputePVSInformation();
+
+		m_EntityIndex[ iEdict ] = m_Entities.Count();
+		m_Entities.AddToTail( netProp );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Check every shared entity against one client's PVS and areas
+//-----------------------------------------------------------------------------
+void CTransmitPVSCache::ComputeVisibility( Visibility_t *pVisibility, const CCheckTransmitInfo *pInfo )
+{
+	int nCount = m_Entities.Count();
+	pVisibility->m_InPVS.SetCount( nCount );
+
+	if ( !nCount )
+		return;
+
+	TransmitPVSChunk_t chunks[ ( MAX_EDICTS + TRANSMIT_PVS_CHUNK_SIZE - 1 ) / TRANSMIT_PVS_CHUNK_SIZE ];
+	int nChunks = 0;
+	for ( int i = 0; i < nCount; i += TRANSMIT_PVS_CHUNK_SIZE )
+	{
+		TransmitPVSChunk_t &chunk = chunks[ nChunks++ ];
+		chunk.m_ppEntities = m_Entities.Base() + i;
+		chunk.m_pInPVS = pVisibility->m_InPVS.Base() + i;
+		chunk.m_nCount = MIN( (int)TRANSMIT_PVS_CHUNK_SIZE, nCount - i );
+		chunk.m_pInfo = pInfo;
+	}
+
+	// each chunk writes only its own bytes of m_InPVS
+	if ( sv_transmit_pvs_parallel.GetBool() && nCount >= TRANSMIT_PVS_PARALLEL_MIN )
+	{
+		ParallelProcess( "CTransmitPVSCache::ComputeVisibility", chunks, nChunks, &ComputeTransmitPVSChunk );
+	}
+	else
+	{
+		for ( int i = 0; i < nChunks; i++ )
+		{
+			ComputeTransmitPVSChunk( chunks[i] );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Return the shared PVS checks for this client, computing them if no
+//  other client this snapshot had the same PVS and networked areas
+//-----------------------------------------------------------------------------
+const CTransmitPVSCache::Visibility_t *CTransmitPVSCache::FindVisibility( const CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts )
+{
+	if ( m_nFrame != gpGlobals->framecount || m_pEdictIndices != pEdictIndices || m_nEdicts != nEdicts )
+	{
+		BeginSnapshot( pEdictIndices, nEdicts );
+	}
+
+	CRC32_t nHash;
+	CRC32_Init( &nHash );
+	CRC32_ProcessBuffer( &nHash, pInfo->m_PVS, pInfo->m_nPVSSize );
+	CRC32_ProcessBuffer( &nHash, pInfo->m_Areas, pInfo->m_AreasNetworked * sizeof( int ) );
+	CRC32_ProcessBuffer( &nHash, g_TransmitAreaPortalStates.Base(), g_TransmitAreaPortalStates.Count() );
+	CRC32_Final( &nHash );
+
+	for ( int i = 0; i < m_nVisibilityUsed; i++ )
+	{
+		Visibility_t *pVisibility = m_Visibility[i];
+		if ( pVisibility->m_nHash == nHash &&
+			 pVisibility->m_nPVSSize == pInfo->m_nPVSSize &&
+			 pVisibility->m_nAreas == pInfo->m_AreasNetworked &&
+			 pVisibility->m_AreaPortalStates.Count() == g_TransmitAreaPortalStates.Count() &&
+			 !memcmp( pVisibility->m_PVS, pInfo->m_PVS, pInfo->m_nPVSSize ) &&
+			 !memcmp( pVisibility->m_Areas, pInfo->m_Areas, pInfo->m_AreasNetworked * sizeof( int ) ) &&
+			 !memcmp( pVisibility->m_AreaPortalStates.Base(), g_TransmitAreaPortalStates.Base(), g_TransmitAreaPortalStates.Count() ) )
+		{
+			return pVisibility;
+		}
+	}
+
+	if ( m_nVisibilityUsed == m_Visibility.Count() )
+	{
+		m_Visibility.AddToTail( new Visibility_t );
+	}
+
+	Visibility_t *pVisibility = m_Visibility[ m_nVisibilityUsed++ ];
+	pVisibility->m_nHash = nHash;
+	pVisibility->m_nPVSSize = pInfo->m_nPVSSize;
+	memcpy( pVisibility->m_PVS, pInfo->m_PVS, pInfo->m_nPVSSize );
+	pVisibility->m_nAreas = pInfo->m_AreasNetworked;
+	memcpy( pVisibility->m_Areas, pInfo->m_Areas, pInfo->m_AreasNetworked * sizeof( int ) );
+	pVisibility->m_AreaPortalStates.CopyArray( g_TransmitAreaPortalStates.Base(), g_TransmitAreaPortalStates.Count() );
+
+	ComputeVisibility( pVisibility, pInfo );
+
+	return pVisibility;
+}
+
+
 void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts )
+{
+	if ( !sv_transmit_pvs_validate.GetBool() )
+	{
+		CheckTransmitEdicts( pInfo, pEdictIndices, nEdicts, sv_transmit_pvs_cache.GetBool() );
+		return;
+	}
+
+	// run the unshared checks on a copy, then compare the results
+	static CCheckTransmitInfo s_UnsharedInfo;
+	static CBitVec<MAX_EDICTS> s_UnsharedTransmitEdict;
+	static CBitVec<MAX_EDICTS> s_UnsharedTransmitAlways;
+
+	s_UnsharedInfo = *pInfo;
+	pInfo->m_pTransmitEdict->CopyTo( &s_UnsharedTransmitEdict );
+	s_UnsharedInfo.m_pTransmitEdict = &s_UnsharedTransmitEdict;
+	if ( pInfo->m_pTransmitAlways )
+	{
+		pInfo->m_pTransmitAlways->CopyTo( &s_UnsharedTransmitAlways );
+		s_UnsharedInfo.m_pTransmitAlways = &s_UnsharedTransmitAlways;
+	}
+
+	CheckTransmitEdicts( &s_UnsharedInfo, pEdictIndices, nEdicts, false );
+	CheckTransmitEdicts( pInfo, pEdictIndices, nEdicts, sv_transmit_pvs_cache.GetBool() );
+
+	int nDifferent = 0;
+	int iFirstDifferent = -1;
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		if ( !pInfo->m_pTransmitEdict->IsBitSet( i ) != !s_UnsharedTransmitEdict.IsBitSet( i ) )
+		{
+			if ( iFirstDifferent < 0 )
+			{
+				iFirstDifferent = i;
+			}
+			nDifferent++;
+		}
+	}
+
+	if ( nDifferent )
+	{
+		CBaseEntity *pFirst = CBaseEntity::Instance( iFirstDifferent );
+		Warning( "CheckTransmit: %d entities sent differently to client %d (first is #%d %s)\n",
+			nDifferent, engine->IndexOfEdict( pInfo->m_pClientEnt ), iFirstDifferent, pFirst ? pFirst->GetClassname() : "<none>" );
+	}
+}
+
+void CServerGameEnts::CheckTransmitEdicts( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts, bool bSharePVS )
 {
 	// NOTE: for speed's sake, this assumes that all networkables are CBaseEntities and that the edict list
 	// is consecutive in memory. If either of these things change, then this routine needs to change, but
@@ -2503,8 +2769,16 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 	// m_pTransmitAlways must be set if HLTV client
 	Assert( bIsHLTV == ( pInfo->m_pTransmitAlways != NULL) ||
 		    bIsReplay == ( pInfo->m_pTransmitAlways != NULL) );
+
+	// the HLTV/Replay don't cull against PVS
+	if ( bIsHLTV || bIsReplay )
+	{
+		bSharePVS = false;
+	}
 #endif
 
+	const CTransmitPVSCache::Visibility_t *pVisibility = bSharePVS ? g_TransmitPVSCache.FindVisibility( pInfo, pEdictIndices, nEdicts ) : NULL;
+
 	for ( int i=0; i < nEdicts; i++ )
 	{
 		int iEdict = pEdictIndices[i];
@@ -2599,7 +2873,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			continue;
 		}
 
-		bool bInPVS = netProp->IsInPVS( pInfo );
+		bool bInPVS = pVisibility ? g_TransmitPVSCache.IsInPVS( pVisibility, iEdict, netProp, pInfo ) : netProp->IsInPVS( pInfo );
 		if ( bInPVS || sv_force_transmit_ents.GetBool() )
 		{
 			// only send if entity is in PVS
@@ -2654,7 +2928,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			{
 				// Check pvs
 				check->RecomputePVSInformation();
-				bool bMoveParentInPVS = check->IsInPVS( pInfo );
+				bool bMoveParentInPVS = pVisibility ? g_TransmitPVSCache.IsInPVS( pVisibility, checkIndex, check, pInfo ) : check->IsInPVS( pInfo );
 				if ( bMoveParentInPVS )
 				{
 					orig->SetTransmit( pInfo, true );
@@ -2952,6 +3226,9 @@ void CServerGameClients::ClientSetupVisibility( edict_t *pViewEntity, edict_t *p
 	int isOpen[512];
 	int iOutPortal = 0;
 
+	// remember the states the engine will check areas against, so CheckTransmit() only shares PVS checks between matching clients
+	g_TransmitAreaPortalStates.RemoveAll();
+
 	for( unsigned short i = g_AreaPortals.Head(); i != g_AreaPortals.InvalidIndex(); i = g_AreaPortals.Next(i) )
 	{
 		CFuncAreaPortalBase *pCur = g_AreaPortals[i];
@@ -2970,6 +3247,8 @@ void CServerGameClients::ClientSetupVisibility( edict_t *pViewEntity, edict_t *p
 		}
 #endif
 
+		g_TransmitAreaPortalStates.AddToTail( isOpen[iOutPortal] != 0 );
+
 		++iOutPortal;
 		if ( iOutPortal >= ARRAYSIZE( portalNums ) )
 		{
@@ -3430,6 +3709,14 @@ void MessageWriteBits( const void *pIn, int nBits )
 	g_pMsgBuffer->WriteBits( pIn, nBits );
 }
 
+void MessageWriteUBitLongArray( const uint32 *pData, int nCount, int numbits )
+{
+	if (!g_pMsgBuffer)
+		Error( "WriteUBitLongArray called with no active message\n" );
+
+	g_pMsgBuffer->WriteUBitLongArray( pData, nCount, numbits );
+}
+
 class CServerDLLSharedAppSystems : public IServerDLLSharedAppSystems
 {
 public:
@@ -54,7 +54,7 @@ ActionResult< CHL2MPBot >	CHL2MPBotApproachObject::Update( CHL2MPBot *me, float
 		m_repathTimer.Start( RandomFloat( 1.0f, 2.0f ) );
 
 		CHL2MPBotPathCost cost( me, FASTEST_ROUTE );
-		m_path.Compute( me, m_loot->GetAbsOrigin(), cost );
+		m_path.ComputeAsync( me, m_loot->GetAbsOrigin(), cost );
 	}
 
 	// move to the loot
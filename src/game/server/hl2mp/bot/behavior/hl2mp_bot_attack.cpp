@@ -115,12 +115,12 @@ ActionResult< CHL2MPBot >	CHL2MPBotAttack::Update( CHL2MPBot *me, float interval
 				if ( isUsingCloseRangeWeapon )
 				{
 					CHL2MPBotPathCost cost( me, FASTEST_ROUTE );
-					m_path.Compute( me, threat->GetLastKnownPosition(), cost );
+					m_path.ComputeAsync( me, threat->GetLastKnownPosition(), cost );
 				}
 				else
 				{
 					CHL2MPBotPathCost cost( me, DEFAULT_ROUTE );
-					m_path.Compute( me, threat->GetLastKnownPosition(), cost );
+					m_path.ComputeAsync( me, threat->GetLastKnownPosition(), cost );
 				}
 			}
 		}
@@ -236,7 +236,7 @@ ActionResult< CHL2MPBot >	CHL2MPBotRetreatToCover::Update( CHL2MPBot *me, float
 			m_repathTimer.Start( RandomFloat( 0.3f, 0.5f ) );
 
 			CHL2MPBotPathCost cost( me, RETREAT_ROUTE );
-			m_path.Compute( me, m_coverArea->GetCenter(), cost );
+			m_path.ComputeAsync( me, m_coverArea->GetCenter(), cost );
 		}
 
 		m_path.Update( me );
@@ -131,7 +131,7 @@ ActionResult< CHL2MPBot >	CHL2MPBotNavEntDestroyEntity::Update( CHL2MPBot *me, f
 		m_repathTimer.Start( RandomFloat( 1.0f, 2.0f ) );
 
 		CHL2MPBotPathCost cost( me, FASTEST_ROUTE );
-		m_path.Compute( me, target->GetAbsOrigin(), cost );
+		m_path.ComputeAsync( me, target->GetAbsOrigin(), cost );
 	}
 
 	m_path.Update( me );
@@ -93,7 +93,7 @@ ActionResult< CHL2MPBot >	CHL2MPBotNavEntMoveTo::Update( CHL2MPBot *me, float in
 				m_repathTimer.Start( RandomFloat( 1.0f, 2.0f ) );
 
 				CHL2MPBotPathCost cost( me, FASTEST_ROUTE );
-				m_path.Compute( me, m_goalPosition, cost );
+				m_path.ComputeAsync( me, m_goalPosition, cost );
 			}
 
 			// move into position
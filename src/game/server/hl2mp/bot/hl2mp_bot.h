@@ -850,6 +850,27 @@ public:
 		}
 	}
 
+	// everything above but the route preference time and the func_nav_cost actor is nav mesh geometry, so
+	// capture those and let paths using this cost be searched asynchronously
+	virtual bool GetPathQueryCost( NextBotPathQueryCost *queryCost ) const
+	{
+		queryCost->m_stepHeight = m_stepHeight;
+		queryCost->m_maxJumpHeight = m_maxJumpHeight;
+		queryCost->m_maxDropHeight = m_maxDropHeight;
+		queryCost->m_jumpPenalty = 2.0f;
+
+		if ( m_routeType == DEFAULT_ROUTE )
+		{
+			queryCost->m_routePreferenceID = m_me->GetEntity()->entindex();
+			queryCost->m_routePreferenceTimeMod = (int)( gpGlobals->curtime / 10.0f ) + 1;
+		}
+
+		queryCost->m_funcNavCostActor = m_me;
+
+		// CHL2MPBotLocomotion::IsAreaTraversable only rejects areas blocked for our team, which the search skips itself
+		return true;
+	}
+
 	CHL2MPBot *m_me;
 	RouteType m_routeType;
 	float m_stepHeight;
@@ -59,7 +59,7 @@ ConVar nav_show_light_intensity( "nav_show_light_intensity", "0", FCVAR_CHEAT );
 ConVar nav_debug_blocked( "nav_debug_blocked", "0", FCVAR_CHEAT );
 ConVar nav_show_contiguous( "nav_show_continguous", "0", FCVAR_CHEAT, "Highlight non-contiguous connections" );
 
-const float DEF_NAV_VIEW_DISTANCE = 1500.0;
+extern const float DEF_NAV_VIEW_DISTANCE = 1500.0;
 ConVar nav_max_view_distance( "nav_max_view_distance", "6000", FCVAR_CHEAT, "Maximum range for precomputed nav mesh visibility (0 = default 1500 units)" );
 ConVar nav_update_visibility_on_edit( "nav_update_visibility_on_edit", "0", FCVAR_CHEAT, "If nonzero editing the mesh will incrementally recompue visibility" );
 ConVar nav_potentially_visible_dot_tolerance( "nav_potentially_visible_dot_tolerance", "0.98", FCVAR_CHEAT );
@@ -167,8 +167,15 @@ void CNavArea::CompressIDs( void )
 		area->m_id = m_nextID++;
 
 		// remove and re-add the area from the nav mesh to update the hashed ID
+		bool wasVisibilityDirty = TheNavMesh->IsVisibilityDirty( area );
 		TheNavMesh->RemoveNavArea( area );
 		TheNavMesh->AddNavArea( area );
+
+		if ( !wasVisibilityDirty )
+		{
+			// renumbering doesn't change what the area can see
+			TheNavMesh->ClearVisibilityDirty( area );
+		}
 	}
 }
 
@@ -766,10 +773,20 @@ void CNavArea::OnDestroyNotify( CNavArea *dead )
 		m_incomingConnect[ d ].FindAndRemove( con );
 	}
 
-	// remove all visibility info, since we're editing the mesh anyways
-	m_inheritVisibilityFrom.area = NULL;
-	m_potentiallyVisibleAreas.RemoveAll();
-	m_isInheritedFrom = false;
+	// remove visibility info about the dead area - edited areas are recomputed by nav_update_visibility
+	if ( m_inheritVisibilityFrom.area == dead )
+	{
+		// our list is a delta from the dead area's list, complete it while the dead area still exists
+		ExpandInheritedVisibility();
+	}
+
+	for( int i=m_potentiallyVisibleAreas.Count()-1; i>=0; --i )
+	{
+		if ( m_potentiallyVisibleAreas[i].area == dead )
+		{
+			m_potentiallyVisibleAreas.Remove( i );
+		}
+	}
 }
 
 
@@ -915,6 +932,8 @@ void CNavArea::AddLadderDown( CNavLadder *ladder )
  */
 void CNavArea::FinishMerge( CNavArea *adjArea )
 {
+	TheNavMesh->RemoveFromNearestAreaIndex( this );
+
 	// update extent
 	m_nwCorner = *m_node[ NORTH_WEST ]->GetPosition();
 	m_seCorner = *m_node[ SOUTH_EAST ]->GetPosition();
@@ -936,6 +955,8 @@ void CNavArea::FinishMerge( CNavArea *adjArea )
 		m_invDxCorners = m_invDyCorners = 0;
 	}
 
+	TheNavMesh->AddToNearestAreaIndex( this );
+
 	// reassign the adjacent area's internal nodes to the final area
 	adjArea->AssignNodes( this );
 
@@ -1739,6 +1760,9 @@ bool CNavArea::MergeEdit( CNavArea *adj )
 
 	Vector originalNWCorner = m_nwCorner;
 	Vector originalSECorner = m_seCorner;
+
+	// the nearest area index is bounded by our extent, which is about to grow
+	TheNavMesh->RemoveFromNearestAreaIndex( this );
 	
 	// update extent
 	if (m_nwCorner.x > adj->m_nwCorner.x || m_nwCorner.y > adj->m_nwCorner.y)
@@ -1771,6 +1795,8 @@ bool CNavArea::MergeEdit( CNavArea *adj )
 	else
 		m_swZ = GetZ( m_nwCorner.x, m_seCorner.y );
 
+	TheNavMesh->AddToNearestAreaIndex( this );
+
 	// merge adjacency links - we gain all the connections that adjArea had
 	MergeAdjacentConnections( adj );
 
@@ -3555,6 +3581,8 @@ void CNavArea::ClearSearchLists( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
 {
+	TheNavMesh->RemoveFromNearestAreaIndex( this );
+
 	switch( corner )
 	{
 		case NORTH_WEST:
@@ -3602,6 +3630,8 @@ void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
 		m_invDxCorners = m_invDyCorners = 0;
 	}
 
+	TheNavMesh->AddToNearestAreaIndex( this );
+
 	CalcDebugID();
 }
 
@@ -4331,6 +4361,8 @@ void CNavArea::RaiseCorner( NavCornerType corner, int amount, bool raiseAdjacent
 		return;
 	}
 
+	TheNavMesh->MarkVisibilityDirty( this );
+
 	// Move the corner
 	switch (corner)
 	{
@@ -4558,10 +4590,16 @@ void CNavArea::PlaceOnGround( NavCornerType corner, float inset )
  */
 void CNavArea::Shift( const Vector &shift )
 {
+	TheNavMesh->RemoveFromNearestAreaIndex( this );
+
 	m_nwCorner += shift;
 	m_seCorner += shift;
 	
 	m_center += shift;
+
+	TheNavMesh->AddToNearestAreaIndex( this );
+
+	TheNavMesh->MarkVisibilityDirty( this );
 }
 
 
@@ -5240,8 +5278,6 @@ static ConCommand nav_select_overlapping( "nav_select_overlapping", CommandNavSe
 static byte m_PVS[PAD_NUMBER( MAX_MAP_CLUSTERS,8 ) / 8];
 static int m_nPVSSize;		// PVS size in bytes
 
-CUtlHash< NavVisPair_t, CVisPairHashFuncs, CVisPairHashFuncs > *g_pNavVisPairHash;
-
 #define MASK_NAV_VISION				(MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE)
 
 
@@ -5253,7 +5289,17 @@ CUtlHash< NavVisPair_t, CVisPairHashFuncs, CVisPairHashFuncs > *g_pNavVisPairHas
 void CNavArea::SetupPVS( void ) const
 {
 	m_nPVSSize = sizeof( m_PVS );
-	engine->ResetPVS( m_PVS, m_nPVSSize );
+	SetupPVS( m_PVS, m_nPVSSize );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Set up the PVS of this nav area in the given buffer, so several areas' PVS can be kept at once
+ */
+void CNavArea::SetupPVS( byte *pvs, int pvsSize ) const
+{
+	engine->ResetPVS( pvs, pvsSize );
 
 	const float margin = GenerationStepSize/2.0f;
 	Vector eye( 0, 0, 0.75f * HumanHeight );
@@ -5302,7 +5348,7 @@ bool CNavArea::IsInPVS( void ) const
 /**
  * Do actual line-of-sight traces to determine if any part of given area is visible from this area
  */
-CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool isPVSValid, bool bCheckPVS, bool *pOutsidePVS ) const
+CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool isPVSValid, bool bCheckPVS, bool *pOutsidePVS, const byte *pvs ) const
 {
 	float distanceSq = area->GetCenter().DistToSqr( GetCenter() );
 
@@ -5331,7 +5377,8 @@ CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool
 		areaExtent.Encompass( area->GetCorner( NORTH_EAST ) + eye );
 		areaExtent.Encompass( area->GetCorner( SOUTH_WEST ) + eye );
 		areaExtent.Encompass( area->GetCorner( SOUTH_EAST ) + eye );
-		if ( !engine->CheckBoxInPVS( areaExtent.lo, areaExtent.hi, m_PVS, m_nPVSSize ) )
+		bool isInPVS = pvs ? engine->CheckBoxInPVS( areaExtent.lo, areaExtent.hi, pvs, sizeof( m_PVS ) ) : engine->CheckBoxInPVS( areaExtent.lo, areaExtent.hi, m_PVS, m_nPVSSize );
+		if ( !isInPVS )
 		{
 			if ( pOutsidePVS )
 				*pOutsidePVS = true;
@@ -5520,109 +5567,78 @@ void CNavArea::ResetPotentiallyVisibleAreas()
 
 //--------------------------------------------------------------------------------------------------------
 /**
- * Determine visibility between areas.
- * Compute full list of all areas visible for each area.  This list will be compressed into deltas
- * in the PostCustomAnalysis() step.
+ * Replace an inherited visibility delta with the complete list of areas visible from this area
  */
-
-CNavArea *g_pCurVisArea;
-CTSListWithFreeList< CNavArea::AreaBindInfo > g_ComputedVis;
-
-void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
+void CNavArea::ExpandInheritedVisibility( void )
 {
-	CNavArea *area = assert_cast< CNavArea * >( pOtherArea );
-	VisibilityType visThisToOther = ( area == g_pCurVisArea ) ? COMPLETELY_VISIBLE : NOT_VISIBLE;
-	VisibilityType visOtherToThis = NOT_VISIBLE;
-
-	if ( area != g_pCurVisArea )
-	{
-		bool bOutsidePVS;
+	const CNavArea *anchor = m_inheritVisibilityFrom.area;
+	if ( !anchor )
+		return;
 
-		visOtherToThis = g_pCurVisArea->ComputeVisibility( area, true, true, &bOutsidePVS ); // TODO: Hacky right now. Compute visibility for the "complete" case actually returns how completely visible the area is to the other. Should fix it to be more clear [1/30/2009 tom]
+	CAreaBindInfoArray complete;
 
-		if ( !bOutsidePVS && ( visOtherToThis || ( g_pCurVisArea->GetCenter() - area->GetCenter() ).LengthSqr() < Sqr( nav_max_view_distance.GetFloat() ) ) )
+	// entries in our delta override the anchor's
+	for( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
+	{
+		if ( m_potentiallyVisibleAreas[i].attributes != NOT_VISIBLE )
 		{
-			visThisToOther = area->ComputeVisibility( g_pCurVisArea, true, false );
+			complete.AddToTail( m_potentiallyVisibleAreas[i] );
 		}
+	}
+
+	for( int i=0; i<anchor->m_potentiallyVisibleAreas.Count(); ++i )
+	{
+		const AreaBindInfo &info = anchor->m_potentiallyVisibleAreas[i];
 
-		if ( !visOtherToThis && visThisToOther )
+		int j;
+		for( j=0; j<m_potentiallyVisibleAreas.Count(); ++j )
 		{
-			visOtherToThis = POTENTIALLY_VISIBLE;
+			if ( m_potentiallyVisibleAreas[j].area == info.area )
+				break;
 		}
 
-		if ( !visThisToOther && visOtherToThis )
+		if ( j == m_potentiallyVisibleAreas.Count() )
 		{
-			visThisToOther = POTENTIALLY_VISIBLE;
+			complete.AddToTail( info );
 		}
 	}
 
-	CNavArea::AreaBindInfo info;
-	if ( visThisToOther != NOT_VISIBLE )
-	{
-		info.area = area;
-		info.attributes = visThisToOther;
-		g_ComputedVis.PushItem( info );
-	}
-
-	if ( visOtherToThis != NOT_VISIBLE )
-	{
-		info.area = g_pCurVisArea;
-		info.attributes = visOtherToThis;
-		area->m_potentiallyVisibleAreas.AddToTail( info );
-	}
+	m_potentiallyVisibleAreas = complete;
+	m_inheritVisibilityFrom.area = NULL;
 }
 
 
 //--------------------------------------------------------------------------------------------------------
 /**
- * Determine visibility from this area to all potentially/completely visible areas in the mesh
+ * Determine visibility both ways between this area and another.
+ * The PVS of this area must already be set up in 'pvs'. Only reads the areas and does traces,
+ * so this can be run on worker threads.
  */
-void CNavArea::ComputeVisibilityToMesh( void )
+void CNavArea::ComputeVisibilityPair( const CNavArea *other, const byte *pvs, VisibilityType *visThisToOther, VisibilityType *visOtherToThis ) const
 {
-	m_inheritVisibilityFrom.area = NULL;
-	m_isInheritedFrom = false;
+	*visThisToOther = ( other == this ) ? COMPLETELY_VISIBLE : NOT_VISIBLE;
+	*visOtherToThis = NOT_VISIBLE;
 
-	// collect all possible nav areas that could be visible from this area
-	NavAreaCollector collector;
-	float radius = nav_max_view_distance.GetFloat();
-	if ( radius == 0.0f )
-	{
-		radius = DEF_NAV_VIEW_DISTANCE;
-	}
-	collector.m_area.EnsureCapacity( 1000 );
-	TheNavMesh->ForAllAreasInRadius( collector, GetCenter(), radius );
+	if ( other == this )
+		return;
 
-	NavVisPair_t visPair;
-	UtlHashHandle_t hHash;
+	bool bOutsidePVS;
 
-	// First eliminate the ones already calculated
-	for ( int i = collector.m_area.Count() - 1; i >= 0; --i )
-	{
-		visPair.SetPair( this, collector.m_area[i] );
+	*visOtherToThis = ComputeVisibility( other, true, true, &bOutsidePVS, pvs ); // TODO: Hacky right now. Compute visibility for the "complete" case actually returns how completely visible the area is to the other. Should fix it to be more clear [1/30/2009 tom]
 
-		hHash = g_pNavVisPairHash->Find( visPair );
-		if ( hHash != g_pNavVisPairHash->InvalidHandle() )
-		{
-			collector.m_area.FastRemove( i );
-		}
+	if ( !bOutsidePVS && ( *visOtherToThis || ( GetCenter() - other->GetCenter() ).LengthSqr() < Sqr( nav_max_view_distance.GetFloat() ) ) )
+	{
+		*visThisToOther = other->ComputeVisibility( this, true, false );
 	}
 
-	SetupPVS();
-
-	g_pCurVisArea = this;
-	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", collector.m_area.Base(), collector.m_area.Count(), &ComputeVisToArea );
-
-	m_potentiallyVisibleAreas.EnsureCapacity( g_ComputedVis.Count() );
-	while ( g_ComputedVis.Count() )
+	if ( !*visOtherToThis && *visThisToOther )
 	{
-		g_ComputedVis.PopItem( &m_potentiallyVisibleAreas[ m_potentiallyVisibleAreas.AddToTail() ] );
+		*visOtherToThis = POTENTIALLY_VISIBLE;
 	}
 
-	FOR_EACH_VEC( collector.m_area, it )
+	if ( !*visThisToOther && *visOtherToThis )
 	{
-		visPair.SetPair( this, (CNavArea *)collector.m_area[it] );
-		Assert( g_pNavVisPairHash->Find( visPair ) == g_pNavVisPairHash->InvalidHandle() );
-		g_pNavVisPairHash->Insert( visPair );
+		*visThisToOther = POTENTIALLY_VISIBLE;
 	}
 }
 
@@ -275,6 +275,8 @@ public:
 	virtual void Save( CUtlBuffer &fileBuffer, unsigned int version ) const;	// (EXTEND)
 	virtual NavErrorType Load( CUtlBuffer &fileBuffer, unsigned int version, unsigned int subVersion );		// (EXTEND)
 	virtual NavErrorType PostLoad( void );								// (EXTEND) invoked after all areas have been loaded - for pointer binding, etc
+	virtual void SaveCompiledData( CUtlBuffer &fileBuffer ) const { }	// (EXTEND) store derived class data in a compiled nav file
+	virtual NavErrorType LoadCompiledData( CUtlBuffer &fileBuffer, unsigned int subVersion ) { return NAV_OK; }	// (EXTEND) load derived class data from a compiled nav file
 
 	virtual void SaveToSelectedSet( KeyValues *areaKey ) const;		// (EXTEND) saves attributes for the area to a KeyValues
 	virtual void RestoreFromSelectedSet( KeyValues *areaKey );		// (EXTEND) restores attributes from a KeyValues
@@ -496,8 +498,10 @@ public:
 		COMPLETELY_VISIBLE		= 0x02,
 	};
 
-	VisibilityType ComputeVisibility( const CNavArea *area, bool isPVSValid, bool bCheckPVS = true, bool *pOutsidePVS = NULL ) const;	// do actual line-of-sight traces to determine if any part of given area is visible from this area
+	VisibilityType ComputeVisibility( const CNavArea *area, bool isPVSValid, bool bCheckPVS = true, bool *pOutsidePVS = NULL, const byte *pvs = NULL ) const;	// do actual line-of-sight traces to determine if any part of given area is visible from this area
+	void ComputeVisibilityPair( const CNavArea *other, const byte *pvs, VisibilityType *visThisToOther, VisibilityType *visOtherToThis ) const;	// compute visibility both ways between this area and another - safe to call from worker threads
 	void SetupPVS( void ) const;
+	void SetupPVS( byte *pvs, int pvsSize ) const;				// set up the PVS of this area in the given buffer
 	bool IsInPVS( void ) const;					// return true if this area is within the current PVS
 
 	struct AreaBindInfo							// for pointer loading and binding
@@ -737,9 +741,8 @@ private:
 
 
 	//- visibility --------------------------------------------------------------------------------------
-	void ComputeVisibilityToMesh( void );						// compute visibility to surrounding mesh
 	void ResetPotentiallyVisibleAreas();
-	static void ComputeVisToArea( CNavArea *&pOtherArea );
+	void ExpandInheritedVisibility( void );						// replace an inherited visibility delta with the complete list
 
 #ifndef _X360
 	typedef CUtlVectorConservative<AreaBindInfo> CAreaBindInfoArray; // shaves 8 bytes off structure caused by need to support editing
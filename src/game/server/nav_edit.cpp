@@ -29,6 +29,10 @@
 #include "dota_player.h"
 #endif
 
+#ifdef NEXT_BOT
+#include "NextBot/NextBotManager.h"
+#endif
+
 // NOTE: This has to be the last file included!
 #include "tier0/memdbgon.h"
 
@@ -3929,6 +3933,14 @@ void CNavMesh::OnEditCreateNotify( CNavArea *newArea )
  */
 void CNavMesh::OnEditDestroyNotify( CNavArea *deadArea )
 {
+#ifdef NEXT_BOT
+	// asynchronous path queries may refer to this area
+	if ( NextBotManager::GetInstance() )
+	{
+		NextBotManager::GetInstance()->AbortPathQueries();
+	}
+#endif
+
 	// clean up any edit hooks
 	m_markedArea = NULL;
 	m_selectedArea = NULL;
@@ -3957,6 +3969,13 @@ void CNavMesh::OnEditDestroyNotify( CNavArea *deadArea )
  */
 void CNavMesh::OnEditDestroyNotify( CNavLadder *deadLadder )
 {
+#ifdef NEXT_BOT
+	// asynchronous path queries may refer to this ladder
+	if ( NextBotManager::GetInstance() )
+	{
+		NextBotManager::GetInstance()->AbortPathQueries();
+	}
+#endif
 }
 
 
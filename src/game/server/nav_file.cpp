@@ -46,6 +46,9 @@
 // TODO: Was changed from 15, update when latest 360 code is integrated (MSB 5/5/09)
 const int NavCurrentVersion = 16;
 
+ConVar nav_load_compiled( "nav_load_compiled", "1", FCVAR_CHEAT, "Load the compiled navigation mesh (maps/<map>.navc) instead of parsing the nav file, when it is up to date." );
+ConVar nav_save_compiled( "nav_save_compiled", "0", FCVAR_CHEAT, "Write the compiled navigation mesh whenever the nav file is saved." );
+
 //--------------------------------------------------------------------------------------------------------------
 //
 // The 'place directory' is used to save and load places from
@@ -1220,6 +1223,12 @@ bool CNavMesh::Save( void ) const
 	unsigned int navSize = filesystem->Size( filename );
 	DevMsg( "Size of nav file '%s' is %u bytes.\n", filename, navSize );
 
+	if ( nav_save_compiled.GetBool() )
+	{
+		// the compiled file records the nav file it was made from, so it must be written after it
+		SaveCompiled();
+	}
+
 	return true;
 }
 
@@ -1446,6 +1455,29 @@ NavErrorType CNavMesh::Load( void )
 
 	CNavArea::m_nextID = 1;
 
+	if ( nav_load_compiled.GetBool() )
+	{
+		NavErrorType compiledResult = LoadCompiled();
+		if ( compiledResult == NAV_OK )
+		{
+			return NAV_OK;
+		}
+
+		if ( compiledResult != NAV_CANT_ACCESS_FILE )
+		{
+			DevMsg( "Compiled navigation file can't be used, loading the nav file instead.\n" );
+
+			// throw away anything built before the compiled file was rejected
+			Reset();
+			placeDirectory.Reset();
+			CNavVectorNoEditAllocator::Reset();
+			CNavArea::m_nextID = 1;
+		}
+	}
+
+	V_memset( &m_loadStats, 0, sizeof( m_loadStats ) );
+	double startTime = Plat_FloatTime();
+
 	bool navIsInBsp = false;
 	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
 	NavErrorType readResult = GetNavDataFromFile( fileBuffer, &navIsInBsp );
@@ -1454,6 +1486,10 @@ NavErrorType CNavMesh::Load( void )
 		return readResult;
 	}
 
+	m_loadStats.fileSize = fileBuffer.TellPut();
+	m_loadStats.readTime = Plat_FloatTime() - startTime;
+	startTime = Plat_FloatTime();
+
 	// check magic number
 	unsigned int magic = fileBuffer.GetUnsignedInt();
 	if ( !fileBuffer.IsValid() || magic != NAV_MAGIC_NUMBER )
@@ -1568,6 +1604,8 @@ NavErrorType CNavMesh::Load( void )
 		AddNavArea( TheNavAreas[ it ] );
 	}
 
+	BuildNearestAreaIndex();
+
 
 	//
 	// Set up all the ladders
@@ -1598,11 +1636,30 @@ NavErrorType CNavMesh::Load( void )
 	//
 	LoadCustomData( fileBuffer, subVersion );
 
+	m_loadStats.buildTime = Plat_FloatTime() - startTime;
+	startTime = Plat_FloatTime();
+
 	//
 	// Bind pointers, etc
 	//
 	NavErrorType loadResult = PostLoad( version );
 
+	m_loadStats.bindTime = Plat_FloatTime() - startTime;
+	m_loadStats.areaCount = TheNavAreas.Count();
+	m_loadStats.hidingSpotCount = TheHidingSpots.Count();
+	FOR_EACH_VEC( TheNavAreas, sit )
+	{
+		const CNavArea *area = TheNavAreas[ sit ];
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			m_loadStats.connectionCount += area->m_connect[d].Count();
+		}
+		m_loadStats.encounterCount += area->m_spotEncounters.Count();
+		m_loadStats.visibilityCount += area->m_potentiallyVisibleAreas.Count();
+	}
+
+	DevMsg( "Navigation mesh loaded in %.3f seconds.\n", m_loadStats.readTime + m_loadStats.buildTime + m_loadStats.bindTime );
+
 	WarnIfMeshNeedsAnalysis( version );
 
 	return loadResult;
@@ -1656,6 +1713,18 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 		}
 	}
 
+	FinishLoad();
+
+	return NAV_OK;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Mesh-wide setup once all areas are loaded and their pointers bound, whichever format they came from
+ */
+void CNavMesh::FinishLoad( void )
+{
 	ComputeBattlefrontAreas();
 	
 	//
@@ -1721,6 +1790,994 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 
 	// the Navigation Mesh has been successfully loaded
 	m_isLoaded = true;
-	
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+//
+// Compiled nav files
+//
+// A compiled nav file holds the same mesh as the nav file, laid out as flat tables of fixed-size records
+// that are used in place once the file has been read in with a single read. References between records
+// are table indices rather than IDs, so binding needs no ID lookups, and data the nav file loader computes
+// at load time (connection lengths, encounter paths, hiding spot areas, water level) is stored precomputed.
+// The file is native byte order and records the size and time of the nav file it was compiled from;
+// if either no longer matches, the nav file is loaded instead.
+//
+
+#define NAV_COMPILED_MAGIC_NUMBER 0x4356414E		// "NAVC"
+#define NAV_COMPILED_BYTE_ORDER 0x01020304
+
+/// Increment whenever the layout of the compiled records changes
+const unsigned int NavCompiledVersion = 2;
+
+#define NAV_COMPILED_LADDER_SIZE ( 15 * sizeof( unsigned int ) )		// a ladder as written by CNavLadder::Save()
+
+#if defined( _X360 )
+	#define FORMAT_COMPILED_NAVFILE "maps\\%s.360.navc"
+#else
+	#define FORMAT_COMPILED_NAVFILE "maps\\%s.navc"
+#endif
+
+enum NavCompiledSectionType
+{
+	NAV_SECTION_PLACE_DIRECTORY,			// PlaceDirectory, as stored in the nav file
+	NAV_SECTION_CUSTOM_PRE_AREA,			// derived mesh data needed before areas are created, as stored in the nav file
+	NAV_SECTION_AREAS,						// NavCompiledArea
+	NAV_SECTION_CONNECTIONS,				// NavCompiledConnect
+	NAV_SECTION_LADDER_CONNECTIONS,			// unsigned int index of the ladder
+	NAV_SECTION_HIDING_SPOTS,				// NavCompiledHidingSpot
+	NAV_SECTION_ENCOUNTERS,					// NavCompiledEncounter
+	NAV_SECTION_ENCOUNTER_SPOTS,			// NavCompiledSpotOrder
+	NAV_SECTION_VISIBILITY,					// NavCompiledVisibility
+	NAV_SECTION_LADDERS,					// ladder count followed by the ladders, as stored in the nav file
+	NAV_SECTION_AREA_CUSTOM,				// derived area data, located by NavCompiledArea::customOffset
+	NAV_SECTION_CUSTOM,						// derived mesh data, as stored in the nav file
+
+	NAV_SECTION_COUNT
+};
+
+struct NavCompiledSection
+{
+	unsigned int offset;					// from the start of the file
+	unsigned int size;						// in bytes
+};
+
+struct NavCompiledHeader
+{
+	unsigned int magic;
+	unsigned int version;					// NavCompiledVersion
+	unsigned int byteOrder;					// NAV_COMPILED_BYTE_ORDER, as written by the compiling machine
+	unsigned int navVersion;				// NavCurrentVersion
+	unsigned int subVersion;
+	unsigned int bspSize;
+	unsigned int navSize;					// size of the nav file this was compiled from
+	unsigned int navFileTime;				// modification time of the nav file this was compiled from
+	unsigned int isAnalyzed;
+	unsigned int isOutOfDate;				// the nav file was built using a different version of the map
+	NavCompiledSection section[ NAV_SECTION_COUNT ];
+};
+
+struct NavCompiledArea
+{
+	unsigned int id;
+	int attributeFlags;
+	float nwCorner[3];
+	float seCorner[3];
+	float neZ;
+	float swZ;
+	unsigned int place;							// place directory entry
+	unsigned int isUnderwater;
+	float earliestOccupyTime[ MAX_NAV_TEAMS ];
+	float lightIntensity[ NUM_CORNERS ];
+
+	unsigned int firstConnect;
+	unsigned int connectCount[ NUM_DIRECTIONS ];
+	unsigned int firstLadderConnect;
+	unsigned int ladderConnectCount[ CNavLadder::NUM_LADDER_DIRECTIONS ];
+	unsigned int firstHidingSpot;
+	unsigned int hidingSpotCount;
+	unsigned int firstEncounter;
+	unsigned int encounterCount;
+	unsigned int firstVisible;
+	unsigned int visibleCount;
+	int inheritVisibilityFrom;					// area index, or -1
+	unsigned int customOffset;
+	unsigned int customSize;
+};
+
+struct NavCompiledConnect
+{
+	unsigned int area;							// area index
+	float length;
+};
+
+struct NavCompiledHidingSpot
+{
+	unsigned int id;
+	float pos[3];
+	unsigned int flags;
+	int area;									// area index, or -1
+};
+
+struct NavCompiledEncounter
+{
+	unsigned int from;							// area index
+	unsigned int fromDir;
+	unsigned int to;							// area index
+	unsigned int toDir;
+	float pathFrom[3];
+	float pathTo[3];
+	unsigned int firstSpot;
+	unsigned int spotCount;
+};
+
+struct NavCompiledSpotOrder
+{
+	int spot;									// hiding spot index, or -1
+	float t;
+};
+
+struct NavCompiledVisibility
+{
+	unsigned int area;							// area index
+	unsigned int attributes;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void GetNavFilenames( char *navFilename, char *compiledFilename, char *bspFilename, int size )
+{
+	char maptmp[256];
+	const char *pszMapName = GetCleanMapName( STRING( gpGlobals->mapname ), maptmp );
+
+	Q_snprintf( navFilename, size, FORMAT_NAVFILE, pszMapName );
+	Q_snprintf( compiledFilename, size, FORMAT_COMPILED_NAVFILE, pszMapName );
+	Q_snprintf( bspFilename, size, FORMAT_BSPFILE, STRING( gpGlobals->mapname ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return true if the nav file was built using a different version of the map, the way Load() decides it
+ */
+static bool IsNavFileOutOfDate( const char *navFilename, const char *bspFilename )
+{
+	// magic number, version, sub-version, bsp size
+	CUtlBuffer fileBuffer;
+	if ( !filesystem->ReadFile( navFilename, "MOD", fileBuffer, 4 * sizeof( unsigned int ) ) )
+		return false;
+
+	unsigned int magic = fileBuffer.GetUnsignedInt();
+	unsigned int version = fileBuffer.GetUnsignedInt();
+	if ( !fileBuffer.IsValid() || magic != NAV_MAGIC_NUMBER || version < 4 )
+		return false;
+
+	if ( version >= 10 )
+	{
+		fileBuffer.GetUnsignedInt();
+	}
+
+	unsigned int saveBspSize = fileBuffer.GetUnsignedInt();
+	return fileBuffer.IsValid() && saveBspSize != filesystem->Size( bspFilename );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void BeginCompiledSection( CUtlBuffer &fileBuffer, NavCompiledHeader *header, NavCompiledSectionType section )
+{
+	// keep every table aligned
+	while( fileBuffer.TellPut() % 16 )
+	{
+		fileBuffer.PutUnsignedChar( 0 );
+	}
+
+	header->section[ section ].offset = fileBuffer.TellPut();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void EndCompiledSection( CUtlBuffer &fileBuffer, NavCompiledHeader *header, NavCompiledSectionType section )
+{
+	header->section[ section ].size = fileBuffer.TellPut() - header->section[ section ].offset;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+template < typename T >
+static void PutCompiledTable( CUtlBuffer &fileBuffer, NavCompiledHeader *header, NavCompiledSectionType section, const CUtlVector< T > &table )
+{
+	BeginCompiledSection( fileBuffer, header, section );
+	fileBuffer.Put( table.Base(), table.Count() * sizeof( T ) );
+	EndCompiledSection( fileBuffer, header, section );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the records of a compiled file section, or false if the section doesn't fit in the file
+ */
+template < typename T >
+static bool GetCompiledTable( const CUtlBuffer &fileBuffer, const NavCompiledHeader *header, NavCompiledSectionType section, const T **table, unsigned int *count )
+{
+	const NavCompiledSection &info = header->section[ section ];
+	unsigned int fileSize = fileBuffer.TellPut();
+
+	if ( info.offset % sizeof( unsigned int ) || info.offset > fileSize || info.size > fileSize - info.offset || info.size % sizeof( T ) )
+		return false;
+
+	*table = (const T *)( (const byte *)fileBuffer.Base() + info.offset );
+	*count = info.size / sizeof( T );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store the loaded Navigation Mesh as a compiled nav file
+ */
+bool CNavMesh::SaveCompiled( void ) const
+{
+	if ( !IsLoaded() || TheNavAreas.Count() == 0 )
+	{
+		Msg( "No navigation mesh is loaded.\n" );
+		return false;
+	}
+
+	char navFilename[ MAX_PATH ], compiledFilename[ MAX_PATH ], bspFilename[ MAX_PATH ];
+	GetNavFilenames( navFilename, compiledFilename, bspFilename, MAX_PATH );
+
+	if ( !filesystem->FileExists( navFilename, "MOD" ) )
+	{
+		Msg( "The navigation mesh must be saved to '%s' before it can be compiled.\n", navFilename );
+		return false;
+	}
+
+	NavCompiledHeader header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.magic = NAV_COMPILED_MAGIC_NUMBER;
+	header.version = NavCompiledVersion;
+	header.byteOrder = NAV_COMPILED_BYTE_ORDER;
+	header.navVersion = NavCurrentVersion;
+	header.subVersion = GetSubVersionNumber();
+	header.bspSize = filesystem->Size( bspFilename );
+	header.navSize = filesystem->Size( navFilename, "MOD" );
+	header.navFileTime = (unsigned int)filesystem->GetFileTime( navFilename, "MOD" );
+	header.isAnalyzed = m_isAnalyzed;
+	header.isOutOfDate = IsNavFileOutOfDate( navFilename, bspFilename );
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024 );
+	fileBuffer.Put( &header, sizeof( header ) );
+
+	// map IDs to table indices
+	unsigned int maxAreaID = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		maxAreaID = MAX( maxAreaID, TheNavAreas[ it ]->GetID() );
+	}
+
+	CUtlVector< int > areaIndex;
+	areaIndex.SetCount( maxAreaID + 1 );
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		areaIndex[ TheNavAreas[ it ]->GetID() ] = it;
+	}
+
+	CUtlVector< NavCompiledHidingSpot > hidingSpots;
+	CUtlMap< unsigned int, int > spotIndex( DefLessFunc( unsigned int ) );
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const HidingSpotVector &areaSpots = TheNavAreas[ it ]->m_hidingSpots;
+		FOR_EACH_VEC( areaSpots, hit )
+		{
+			const HidingSpot *spot = areaSpots[ hit ];
+			spotIndex.InsertOrReplace( spot->GetID(), hidingSpots.Count() );
+
+			// the same area HidingSpot::PostLoad() would find
+			CNavArea *spotArea = GetNavArea( spot->GetPosition() + Vector( 0, 0, HalfHumanHeight ) );
+
+			NavCompiledHidingSpot &record = hidingSpots[ hidingSpots.AddToTail() ];
+			record.id = spot->GetID();
+			record.pos[0] = spot->GetPosition().x;
+			record.pos[1] = spot->GetPosition().y;
+			record.pos[2] = spot->GetPosition().z;
+			record.flags = spot->GetFlags();
+			record.area = spotArea ? areaIndex[ spotArea->GetID() ] : -1;
+		}
+	}
+
+	//
+	// Build the tables
+	//
+	CUtlVector< NavCompiledArea > areas;
+	CUtlVector< NavCompiledConnect > connections;
+	CUtlVector< unsigned int > ladderConnections;
+	CUtlVector< NavCompiledEncounter > encounters;
+	CUtlVector< NavCompiledSpotOrder > encounterSpots;
+	CUtlVector< NavCompiledVisibility > visibility;
+	CUtlBuffer areaCustom;
+
+	areas.EnsureCapacity( TheNavAreas.Count() );
+
+	placeDirectory.Reset();
+
+	int firstSpot = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		placeDirectory.AddPlace( area->GetPlace() );
+
+		NavCompiledArea &record = areas[ areas.AddToTail() ];
+		V_memset( &record, 0, sizeof( record ) );
+
+		record.id = area->GetID();
+		record.attributeFlags = area->GetAttributes();
+		V_memcpy( record.nwCorner, &area->m_nwCorner, sizeof( record.nwCorner ) );
+		V_memcpy( record.seCorner, &area->m_seCorner, sizeof( record.seCorner ) );
+		record.neZ = area->m_neZ;
+		record.swZ = area->m_swZ;
+		record.place = placeDirectory.GetIndex( area->GetPlace() );
+		record.isUnderwater = area->m_isUnderwater;
+
+		for( int t=0; t<MAX_NAV_TEAMS; ++t )
+		{
+			record.earliestOccupyTime[t] = area->m_earliestOccupyTime[t];
+		}
+
+		for( int c=0; c<NUM_CORNERS; ++c )
+		{
+			record.lightIntensity[c] = area->m_lightIntensity[c];
+		}
+
+		record.firstConnect = connections.Count();
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			record.connectCount[d] = area->m_connect[d].Count();
+
+			FOR_EACH_VEC( area->m_connect[d], cit )
+			{
+				const CNavArea *adjArea = area->m_connect[d][ cit ].area;
+
+				NavCompiledConnect &connect = connections[ connections.AddToTail() ];
+				connect.area = areaIndex[ adjArea->GetID() ];
+				connect.length = ( adjArea->GetCenter() - area->GetCenter() ).Length();
+			}
+		}
+
+		record.firstLadderConnect = ladderConnections.Count();
+		for( int l=0; l<CNavLadder::NUM_LADDER_DIRECTIONS; ++l )
+		{
+			record.ladderConnectCount[l] = area->m_ladder[l].Count();
+
+			FOR_EACH_VEC( area->m_ladder[l], lit )
+			{
+				ladderConnections.AddToTail( m_ladders.Find( area->m_ladder[l][ lit ].ladder ) );
+			}
+		}
+
+		record.firstHidingSpot = firstSpot;
+		record.hidingSpotCount = area->m_hidingSpots.Count();
+		firstSpot += record.hidingSpotCount;
+
+		record.firstEncounter = encounters.Count();
+		FOR_EACH_VEC( area->m_spotEncounters, eit )
+		{
+			const SpotEncounter *e = area->m_spotEncounters[ eit ];
+
+			// CNavArea::PostLoad() already reported these
+			if ( !e->from.area || !e->to.area )
+				continue;
+
+			++record.encounterCount;
+
+			NavCompiledEncounter &encounter = encounters[ encounters.AddToTail() ];
+			encounter.from = areaIndex[ e->from.area->GetID() ];
+			encounter.fromDir = e->fromDir;
+			encounter.to = areaIndex[ e->to.area->GetID() ];
+			encounter.toDir = e->toDir;
+
+			// compute the path the way CNavArea::PostLoad() does
+			Vector pathFrom, pathTo;
+			float halfWidth;
+			area->ComputePortal( e->to.area, e->toDir, &pathTo, &halfWidth );
+			area->ComputePortal( e->from.area, e->fromDir, &pathFrom, &halfWidth );
+
+			const float eyeHeight = HalfHumanHeight;
+			pathFrom.z = e->from.area->GetZ( pathFrom ) + eyeHeight;
+			pathTo.z = e->to.area->GetZ( pathTo ) + eyeHeight;
+
+			V_memcpy( encounter.pathFrom, &pathFrom, sizeof( encounter.pathFrom ) );
+			V_memcpy( encounter.pathTo, &pathTo, sizeof( encounter.pathTo ) );
+
+			encounter.firstSpot = encounterSpots.Count();
+			encounter.spotCount = e->spots.Count();
+			FOR_EACH_VEC( e->spots, sit )
+			{
+				const SpotOrder &order = e->spots[ sit ];
+
+				NavCompiledSpotOrder &spot = encounterSpots[ encounterSpots.AddToTail() ];
+				spot.t = order.t;
+				spot.spot = -1;
+
+				if ( order.spot )
+				{
+					unsigned short i = spotIndex.Find( order.spot->GetID() );
+					if ( spotIndex.IsValidIndex( i ) )
+					{
+						spot.spot = spotIndex[i];
+					}
+				}
+			}
+		}
+
+		record.firstVisible = visibility.Count();
+		record.visibleCount = area->m_potentiallyVisibleAreas.Count();
+		FOR_EACH_VEC( area->m_potentiallyVisibleAreas, vit )
+		{
+			const CNavArea::AreaBindInfo &info = area->m_potentiallyVisibleAreas[ vit ];
+
+			NavCompiledVisibility &visible = visibility[ visibility.AddToTail() ];
+			visible.area = areaIndex[ info.area->GetID() ];
+			visible.attributes = info.attributes;
+		}
+
+		record.inheritVisibilityFrom = area->m_inheritVisibilityFrom.area ? areaIndex[ area->m_inheritVisibilityFrom.area->GetID() ] : -1;
+
+		record.customOffset = areaCustom.TellPut();
+		area->SaveCompiledData( areaCustom );
+		record.customSize = areaCustom.TellPut() - record.customOffset;
+	}
+
+	//
+	// Write the sections
+	//
+	BeginCompiledSection( fileBuffer, &header, NAV_SECTION_PLACE_DIRECTORY );
+	placeDirectory.Save( fileBuffer );
+	EndCompiledSection( fileBuffer, &header, NAV_SECTION_PLACE_DIRECTORY );
+
+	BeginCompiledSection( fileBuffer, &header, NAV_SECTION_CUSTOM_PRE_AREA );
+	SaveCustomDataPreArea( fileBuffer );
+	EndCompiledSection( fileBuffer, &header, NAV_SECTION_CUSTOM_PRE_AREA );
+
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_AREAS, areas );
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_CONNECTIONS, connections );
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_LADDER_CONNECTIONS, ladderConnections );
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_HIDING_SPOTS, hidingSpots );
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_ENCOUNTERS, encounters );
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_ENCOUNTER_SPOTS, encounterSpots );
+	PutCompiledTable( fileBuffer, &header, NAV_SECTION_VISIBILITY, visibility );
+
+	BeginCompiledSection( fileBuffer, &header, NAV_SECTION_LADDERS );
+	fileBuffer.PutUnsignedInt( m_ladders.Count() );
+	FOR_EACH_VEC( m_ladders, lit )
+	{
+		m_ladders[ lit ]->Save( fileBuffer, NavCurrentVersion );
+	}
+	EndCompiledSection( fileBuffer, &header, NAV_SECTION_LADDERS );
+
+	BeginCompiledSection( fileBuffer, &header, NAV_SECTION_AREA_CUSTOM );
+	fileBuffer.Put( areaCustom.Base(), areaCustom.TellPut() );
+	EndCompiledSection( fileBuffer, &header, NAV_SECTION_AREA_CUSTOM );
+
+	BeginCompiledSection( fileBuffer, &header, NAV_SECTION_CUSTOM );
+	SaveCustomData( fileBuffer );
+	EndCompiledSection( fileBuffer, &header, NAV_SECTION_CUSTOM );
+
+	// now that the sections are known, fill in the header
+	V_memcpy( fileBuffer.Base(), &header, sizeof( header ) );
+
+	if ( p4 )
+	{
+		char szCorrectPath[MAX_PATH];
+		filesystem->GetCaseCorrectFullPath( compiledFilename, szCorrectPath );
+		CP4AutoEditAddFile a( szCorrectPath );
+	}
+
+	if ( !filesystem->WriteFile( compiledFilename, "MOD", fileBuffer ) )
+	{
+		Warning( "Unable to save %d bytes to %s\n", fileBuffer.TellPut(), compiledFilename );
+		return false;
+	}
+
+	Msg( "Compiled navigation map '%s' saved (%d bytes).\n", compiledFilename, fileBuffer.TellPut() );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load the compiled nav file for this map.
+ * Returns NAV_CANT_ACCESS_FILE if there is none, or another error if it can't be used, in which
+ * case the caller must Reset() the mesh and load the nav file instead.
+ */
+NavErrorType CNavMesh::LoadCompiled( void )
+{
+	V_memset( &m_loadStats, 0, sizeof( m_loadStats ) );
+	m_loadStats.isCompiled = true;
+
+	double startTime = Plat_FloatTime();
+
+	char navFilename[ MAX_PATH ], compiledFilename[ MAX_PATH ], bspFilename[ MAX_PATH ];
+	GetNavFilenames( navFilename, compiledFilename, bspFilename, MAX_PATH );
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
+	if ( !filesystem->ReadFile( compiledFilename, "MOD", fileBuffer ) )
+	{
+		return NAV_CANT_ACCESS_FILE;
+	}
+
+	m_loadStats.fileSize = fileBuffer.TellPut();
+	m_loadStats.readTime = Plat_FloatTime() - startTime;
+	startTime = Plat_FloatTime();
+
+	//
+	// Make sure the compiled file is usable, and still matches the nav file
+	//
+	if ( (unsigned int)fileBuffer.TellPut() < sizeof( NavCompiledHeader ) )
+	{
+		return NAV_INVALID_FILE;
+	}
+
+	const NavCompiledHeader *header = (const NavCompiledHeader *)fileBuffer.Base();
+	if ( header->magic != NAV_COMPILED_MAGIC_NUMBER || header->byteOrder != NAV_COMPILED_BYTE_ORDER )
+	{
+		return NAV_INVALID_FILE;
+	}
+
+	if ( header->version != NavCompiledVersion || header->navVersion != NavCurrentVersion || header->subVersion != GetSubVersionNumber() )
+	{
+		return NAV_BAD_FILE_VERSION;
+	}
+
+	// a nav file embedded in the bsp can't be checked, but it can't change without the bsp changing either
+	if ( filesystem->FileExists( navFilename, "MOD" ) )
+	{
+		if ( filesystem->Size( navFilename, "MOD" ) != header->navSize || (unsigned int)filesystem->GetFileTime( navFilename, "MOD" ) != header->navFileTime )
+		{
+			return NAV_FILE_OUT_OF_DATE;
+		}
+	}
+
+	// the stored water levels and hiding spot areas are only valid for the map they were computed on
+	if ( filesystem->Size( bspFilename ) != header->bspSize )
+	{
+		return NAV_FILE_OUT_OF_DATE;
+	}
+
+	const NavCompiledArea *areas;
+	const NavCompiledConnect *connections;
+	const unsigned int *ladderConnections;
+	const NavCompiledHidingSpot *hidingSpots;
+	const NavCompiledEncounter *encounters;
+	const NavCompiledSpotOrder *encounterSpots;
+	const NavCompiledVisibility *visibility;
+	const byte *unused;
+	unsigned int areaCount, connectCount, ladderConnectCount, hidingSpotCount, encounterCount, encounterSpotCount, visibleCount, areaCustomSize, ladderSize, blobSize;
+
+	if ( !GetCompiledTable( fileBuffer, header, NAV_SECTION_AREAS, &areas, &areaCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_CONNECTIONS, &connections, &connectCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_LADDER_CONNECTIONS, &ladderConnections, &ladderConnectCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_HIDING_SPOTS, &hidingSpots, &hidingSpotCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_ENCOUNTERS, &encounters, &encounterCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_ENCOUNTER_SPOTS, &encounterSpots, &encounterSpotCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_VISIBILITY, &visibility, &visibleCount ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_PLACE_DIRECTORY, &unused, &blobSize ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_CUSTOM_PRE_AREA, &unused, &blobSize ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_CUSTOM, &unused, &blobSize ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_LADDERS, &unused, &ladderSize ) ||
+		 !GetCompiledTable( fileBuffer, header, NAV_SECTION_AREA_CUSTOM, &unused, &areaCustomSize ) )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	if ( areaCount == 0 || ladderSize < sizeof( unsigned int ) )
+	{
+		return NAV_INVALID_FILE;
+	}
+
+	// counts stored inside a section must fit in it
+	unsigned int ladderCount = *(const unsigned int *)( (const byte *)fileBuffer.Base() + header->section[ NAV_SECTION_LADDERS ].offset );
+	if ( ladderCount > ( ladderSize - sizeof( unsigned int ) ) / NAV_COMPILED_LADDER_SIZE )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	const NavCompiledSection &placeSection = header->section[ NAV_SECTION_PLACE_DIRECTORY ];
+	if ( placeSection.size < sizeof( unsigned short ) )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	unsigned int placeCount = *(const unsigned short *)( (const byte *)fileBuffer.Base() + placeSection.offset );
+	if ( placeCount > ( placeSection.size - sizeof( unsigned short ) ) / sizeof( unsigned short ) )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	// hiding spots are owned by a single area, so their ranges must not overlap
+	CUtlVector< bool > isHidingSpotOwned;
+	isHidingSpotOwned.SetCount( hidingSpotCount );
+	FOR_EACH_VEC( isHidingSpotOwned, hit )
+	{
+		isHidingSpotOwned[ hit ] = false;
+	}
+
+	// check every index before anything is created, so a bad file can't leave the mesh half built
+	for( unsigned int a=0; a<areaCount; ++a )
+	{
+		const NavCompiledArea &record = areas[a];
+
+		// sum in 64 bits, so large per-direction counts can't wrap around
+		uint64 count = 0;
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			count += record.connectCount[d];
+		}
+		if ( record.firstConnect > connectCount || count > connectCount - record.firstConnect )
+			return NAV_CORRUPT_DATA;
+
+		count = 0;
+		for( int l=0; l<CNavLadder::NUM_LADDER_DIRECTIONS; ++l )
+		{
+			count += record.ladderConnectCount[l];
+		}
+		if ( record.firstLadderConnect > ladderConnectCount || count > ladderConnectCount - record.firstLadderConnect )
+			return NAV_CORRUPT_DATA;
+
+		if ( record.firstHidingSpot > hidingSpotCount || record.hidingSpotCount > hidingSpotCount - record.firstHidingSpot )
+			return NAV_CORRUPT_DATA;
+
+		for( unsigned int h=0; h<record.hidingSpotCount; ++h )
+		{
+			if ( isHidingSpotOwned[ record.firstHidingSpot + h ] )
+				return NAV_CORRUPT_DATA;
+
+			isHidingSpotOwned[ record.firstHidingSpot + h ] = true;
+		}
+
+		if ( record.firstEncounter > encounterCount || record.encounterCount > encounterCount - record.firstEncounter )
+			return NAV_CORRUPT_DATA;
+
+		if ( record.firstVisible > visibleCount || record.visibleCount > visibleCount - record.firstVisible )
+			return NAV_CORRUPT_DATA;
+
+		if ( record.inheritVisibilityFrom < -1 || record.inheritVisibilityFrom >= (int)areaCount || record.inheritVisibilityFrom == (int)a )
+			return NAV_CORRUPT_DATA;
+
+		if ( record.place > placeCount )
+			return NAV_CORRUPT_DATA;
+
+		if ( record.customOffset > areaCustomSize || record.customSize > areaCustomSize - record.customOffset )
+			return NAV_CORRUPT_DATA;
+	}
+
+	for( unsigned int i=0; i<connectCount; ++i )
+	{
+		if ( connections[i].area >= areaCount )
+			return NAV_CORRUPT_DATA;
+	}
+
+	for( unsigned int i=0; i<ladderConnectCount; ++i )
+	{
+		if ( ladderConnections[i] >= ladderCount )
+			return NAV_CORRUPT_DATA;
+	}
+
+	for( unsigned int i=0; i<hidingSpotCount; ++i )
+	{
+		if ( hidingSpots[i].area < -1 || hidingSpots[i].area >= (int)areaCount )
+			return NAV_CORRUPT_DATA;
+	}
+
+	for( unsigned int i=0; i<encounterCount; ++i )
+	{
+		const NavCompiledEncounter &record = encounters[i];
+		if ( record.from >= areaCount || record.to >= areaCount || record.firstSpot > encounterSpotCount || record.spotCount > encounterSpotCount - record.firstSpot )
+			return NAV_CORRUPT_DATA;
+	}
+
+	for( unsigned int i=0; i<encounterSpotCount; ++i )
+	{
+		if ( encounterSpots[i].spot < -1 || encounterSpots[i].spot >= (int)hidingSpotCount )
+			return NAV_CORRUPT_DATA;
+	}
+
+	for( unsigned int i=0; i<visibleCount; ++i )
+	{
+		if ( visibility[i].area >= areaCount )
+			return NAV_CORRUPT_DATA;
+	}
+
+	m_isAnalyzed = header->isAnalyzed != 0;
+
+	// the bsp size was checked above, so this is what the nav file loader would decide
+	m_isOutOfDate = header->isOutOfDate != 0;
+	if ( m_isOutOfDate )
+	{
+		if ( engine->IsDedicatedServer() )
+		{
+			DevMsg( "The Navigation Mesh was built using a different version of this map.\n" );
+		}
+		else
+		{
+			DevWarning( "The Navigation Mesh was built using a different version of this map.\n" );
+		}
+	}
+
+	CUtlBuffer placeBuffer( (const byte *)fileBuffer.Base() + placeSection.offset, placeSection.size, CUtlBuffer::READ_ONLY );
+	placeDirectory.Load( placeBuffer, NavCurrentVersion );
+	if ( !placeBuffer.IsValid() )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	CUtlBuffer preAreaBuffer( (const byte *)fileBuffer.Base() + header->section[ NAV_SECTION_CUSTOM_PRE_AREA ].offset, header->section[ NAV_SECTION_CUSTOM_PRE_AREA ].size, CUtlBuffer::READ_ONLY );
+	LoadCustomDataPreArea( preAreaBuffer, header->subVersion );
+
+	//
+	// Create the areas
+	//
+	Extent extent;
+	extent.lo.x = 9999999999.9f;
+	extent.lo.y = 9999999999.9f;
+	extent.hi.x = -9999999999.9f;
+	extent.hi.y = -9999999999.9f;
+
+	PreLoadAreas( areaCount );
+	TheNavAreas.EnsureCapacity( areaCount );
+
+	for( unsigned int a=0; a<areaCount; ++a )
+	{
+		const NavCompiledArea &record = areas[a];
+		CNavArea *area = CreateArea();
+
+		area->m_id = record.id;
+		if ( area->m_id >= CNavArea::m_nextID )
+			CNavArea::m_nextID = area->m_id + 1;
+
+		area->m_attributeFlags = record.attributeFlags;
+		area->m_nwCorner.Init( record.nwCorner[0], record.nwCorner[1], record.nwCorner[2] );
+		area->m_seCorner.Init( record.seCorner[0], record.seCorner[1], record.seCorner[2] );
+		area->m_neZ = record.neZ;
+		area->m_swZ = record.swZ;
+
+		area->m_center.x = ( area->m_nwCorner.x + area->m_seCorner.x )/2.0f;
+		area->m_center.y = ( area->m_nwCorner.y + area->m_seCorner.y )/2.0f;
+		area->m_center.z = ( area->m_nwCorner.z + area->m_seCorner.z )/2.0f;
+
+		if ( ( area->m_seCorner.x - area->m_nwCorner.x ) > 0.0f && ( area->m_seCorner.y - area->m_nwCorner.y ) > 0.0f )
+		{
+			area->m_invDxCorners = 1.0f / ( area->m_seCorner.x - area->m_nwCorner.x );
+			area->m_invDyCorners = 1.0f / ( area->m_seCorner.y - area->m_nwCorner.y );
+		}
+		else
+		{
+			area->m_invDxCorners = area->m_invDyCorners = 0;
+		}
+
+		area->m_isUnderwater = record.isUnderwater != 0;
+		area->SetPlace( placeDirectory.IndexToPlace( record.place ) );
+
+		for( int t=0; t<MAX_NAV_TEAMS; ++t )
+		{
+			area->m_earliestOccupyTime[t] = record.earliestOccupyTime[t];
+		}
+
+		for( int c=0; c<NUM_CORNERS; ++c )
+		{
+			area->m_lightIntensity[c] = record.lightIntensity[c];
+		}
+
+		TheNavAreas.AddToTail( area );
+
+		if ( area->m_nwCorner.x < extent.lo.x )
+			extent.lo.x = area->m_nwCorner.x;
+		if ( area->m_nwCorner.y < extent.lo.y )
+			extent.lo.y = area->m_nwCorner.y;
+		if ( area->m_seCorner.x > extent.hi.x )
+			extent.hi.x = area->m_seCorner.x;
+		if ( area->m_seCorner.y > extent.hi.y )
+			extent.hi.y = area->m_seCorner.y;
+	}
+
+	// create the hiding spots in the order their areas list them
+	TheHidingSpots.EnsureCapacity( hidingSpotCount );
+
+	CUtlVector< HidingSpot * > spots;
+	spots.EnsureCapacity( hidingSpotCount );
+
+	for( unsigned int h=0; h<hidingSpotCount; ++h )
+	{
+		const NavCompiledHidingSpot &record = hidingSpots[h];
+		HidingSpot *spot = CreateHidingSpot();
+
+		spot->m_id = record.id;
+		if ( spot->m_id >= HidingSpot::m_nextID )
+			HidingSpot::m_nextID = spot->m_id + 1;
+
+		spot->m_pos.Init( record.pos[0], record.pos[1], record.pos[2] );
+		spot->m_flags = (unsigned char)record.flags;
+		spot->m_area = ( record.area >= 0 ) ? TheNavAreas[ record.area ] : NULL;
+
+		spots.AddToTail( spot );
+	}
+
+	// add the areas to the grid
+	AllocateGrid( extent.lo.x, extent.hi.x, extent.lo.y, extent.hi.y );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		AddNavArea( TheNavAreas[ it ] );
+	}
+
+	BuildNearestAreaIndex();
+
+	// ladders bind to areas by ID, so they come after the areas are hashed
+	CUtlBuffer ladderBuffer( (const byte *)fileBuffer.Base() + header->section[ NAV_SECTION_LADDERS ].offset, header->section[ NAV_SECTION_LADDERS ].size, CUtlBuffer::READ_ONLY );
+	ladderBuffer.GetUnsignedInt();
+	m_ladders.EnsureCapacity( ladderCount );
+	for( unsigned int l=0; l<ladderCount; ++l )
+	{
+		CNavLadder *ladder = new CNavLadder;
+		ladder->Load( ladderBuffer, NavCurrentVersion );
+		m_ladders.AddToTail( ladder );
+	}
+
+	if ( !ladderBuffer.IsValid() )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	m_loadStats.buildTime = Plat_FloatTime() - startTime;
+	startTime = Plat_FloatTime();
+
+	//
+	// Bind everything together - every index has already been checked
+	//
+	const byte *areaCustom = (const byte *)fileBuffer.Base() + header->section[ NAV_SECTION_AREA_CUSTOM ].offset;
+
+	for( unsigned int a=0; a<areaCount; ++a )
+	{
+		const NavCompiledArea &record = areas[a];
+		CNavArea *area = TheNavAreas[a];
+
+		const NavCompiledConnect *connect = &connections[ record.firstConnect ];
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			area->m_connect[d].EnsureCapacity( record.connectCount[d] );
+
+			for( unsigned int c=0; c<record.connectCount[d]; ++c, ++connect )
+			{
+				NavConnect navConnect;
+				navConnect.area = TheNavAreas[ connect->area ];
+				navConnect.length = connect->length;
+				area->m_connect[d].AddToTail( navConnect );
+			}
+		}
+
+		const unsigned int *ladderConnect = &ladderConnections[ record.firstLadderConnect ];
+		for( int l=0; l<CNavLadder::NUM_LADDER_DIRECTIONS; ++l )
+		{
+			area->m_ladder[l].EnsureCapacity( record.ladderConnectCount[l] );
+
+			for( unsigned int c=0; c<record.ladderConnectCount[l]; ++c, ++ladderConnect )
+			{
+				NavLadderConnect navLadderConnect;
+				navLadderConnect.ladder = m_ladders[ *ladderConnect ];
+				area->m_ladder[l].AddToTail( navLadderConnect );
+			}
+		}
+
+		area->m_hidingSpots.EnsureCapacity( record.hidingSpotCount );
+		for( unsigned int h=0; h<record.hidingSpotCount; ++h )
+		{
+			area->m_hidingSpots.AddToTail( spots[ record.firstHidingSpot + h ] );
+		}
+
+		area->m_spotEncounters.EnsureCapacity( record.encounterCount );
+		for( unsigned int e=0; e<record.encounterCount; ++e )
+		{
+			const NavCompiledEncounter &encounterRecord = encounters[ record.firstEncounter + e ];
+
+			SpotEncounter *encounter = new SpotEncounter;
+			encounter->from.area = TheNavAreas[ encounterRecord.from ];
+			encounter->fromDir = (NavDirType)encounterRecord.fromDir;
+			encounter->to.area = TheNavAreas[ encounterRecord.to ];
+			encounter->toDir = (NavDirType)encounterRecord.toDir;
+			encounter->path.from.Init( encounterRecord.pathFrom[0], encounterRecord.pathFrom[1], encounterRecord.pathFrom[2] );
+			encounter->path.to.Init( encounterRecord.pathTo[0], encounterRecord.pathTo[1], encounterRecord.pathTo[2] );
+
+			encounter->spots.EnsureCapacity( encounterRecord.spotCount );
+			for( unsigned int s=0; s<encounterRecord.spotCount; ++s )
+			{
+				const NavCompiledSpotOrder &spotRecord = encounterSpots[ encounterRecord.firstSpot + s ];
+
+				SpotOrder order;
+				order.spot = ( spotRecord.spot >= 0 ) ? spots[ spotRecord.spot ] : NULL;
+				order.t = spotRecord.t;
+				encounter->spots.AddToTail( order );
+			}
+
+			area->m_spotEncounters.AddToTail( encounter );
+		}
+
+		area->m_potentiallyVisibleAreas.EnsureCapacity( record.visibleCount );
+		for( unsigned int v=0; v<record.visibleCount; ++v )
+		{
+			const NavCompiledVisibility &visibleRecord = visibility[ record.firstVisible + v ];
+
+			CNavArea::AreaBindInfo info;
+			info.area = TheNavAreas[ visibleRecord.area ];
+			info.attributes = (unsigned char)visibleRecord.attributes;
+			area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		area->m_inheritVisibilityFrom.area = ( record.inheritVisibilityFrom >= 0 ) ? TheNavAreas[ record.inheritVisibilityFrom ] : NULL;
+
+		// func avoid/prefer attributes are controlled by func_nav_cost entities
+		area->ClearAllNavCostEntities();
+
+		// each area can only read its own data
+		CUtlBuffer areaCustomBuffer( areaCustom + record.customOffset, record.customSize, CUtlBuffer::READ_ONLY );
+		NavErrorType customResult = area->LoadCompiledData( areaCustomBuffer, header->subVersion );
+		if ( customResult != NAV_OK )
+		{
+			return customResult;
+		}
+	}
+
+	CUtlBuffer customBuffer( (const byte *)fileBuffer.Base() + header->section[ NAV_SECTION_CUSTOM ].offset, header->section[ NAV_SECTION_CUSTOM ].size, CUtlBuffer::READ_ONLY );
+	LoadCustomData( customBuffer, header->subVersion );
+
+	FinishLoad();
+
+	m_loadStats.bindTime = Plat_FloatTime() - startTime;
+	m_loadStats.areaCount = areaCount;
+	m_loadStats.connectionCount = connectCount;
+	m_loadStats.hidingSpotCount = hidingSpotCount;
+	m_loadStats.encounterCount = encounterCount;
+	m_loadStats.visibilityCount = visibleCount;
+
+	DevMsg( "Navigation mesh loaded from '%s' in %.3f seconds.\n", compiledFilename, m_loadStats.readTime + m_loadStats.buildTime + m_loadStats.bindTime );
+
+	WarnIfMeshNeedsAnalysis( NavCurrentVersion );
+
 	return NAV_OK;
 }
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavCompile( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->SaveCompiled();
+}
+static ConCommand nav_compile( "nav_compile", CommandNavCompile, "Write the loaded navigation mesh as a compiled nav file (maps/<map>.navc), which loads without parsing.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavLoadStats( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !TheNavMesh->IsLoaded() )
+	{
+		Msg( "No navigation mesh is loaded.\n" );
+		return;
+	}
+
+	const CNavMesh::LoadStats &stats = TheNavMesh->GetLoadStats();
+
+	Msg( "Loaded from %s file, %u bytes\n", stats.isCompiled ? "a compiled nav" : "the nav", stats.fileSize );
+	Msg( "  read  %7.2f ms\n", stats.readTime * 1000.0f );
+	Msg( "  build %7.2f ms\n", stats.buildTime * 1000.0f );
+	Msg( "  bind  %7.2f ms\n", stats.bindTime * 1000.0f );
+	Msg( "  total %7.2f ms\n", ( stats.readTime + stats.buildTime + stats.bindTime ) * 1000.0f );
+	Msg( "%d areas, %d connections, %d hiding spots, %d encounter paths, %d visibility entries\n",
+		 stats.areaCount, stats.connectionCount, stats.hidingSpotCount, stats.encounterCount, stats.visibilityCount );
+}
+static ConCommand nav_load_stats( "nav_load_stats", CommandNavLoadStats, "Show how long the navigation mesh took to load, and from which format.", FCVAR_GAMEDLL | FCVAR_CHEAT );
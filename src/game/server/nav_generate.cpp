@@ -30,6 +30,7 @@ enum { MAX_BLOCKED_AREAS = 256 };
 static unsigned int blockedID[ MAX_BLOCKED_AREAS ];
 static int blockedIDCount = 0;
 static float lastMsgTime = 0.0f;
+static double phaseStartTime = 0.0;
 
 bool TraceAdjacentNode( int depth, const Vector& start, const Vector& end, trace_t *trace, float zLimit = DeathDrop );
 bool StayOnFloor( trace_t *trace, float zLimit = DeathDrop );
@@ -3365,6 +3366,8 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 		AddNavArea( TheNavAreas[ git ] );
 	}
 
+	BuildNearestAreaIndex();
+
 	
 	ConnectGeneratedAreas();
 	MarkPlayerClipAreas();
@@ -3482,6 +3485,7 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	Msg( "Generating Navigation Mesh...\n" );
 	m_generationStartTime = Plat_FloatTime();
+	phaseStartTime = m_generationStartTime;
 }
 
 
@@ -3549,6 +3553,32 @@ void CNavMesh::BeginAnalysis( bool quitWhenFinished )
 	m_bQuitWhenFinished = quitWhenFinished;
 	lastMsgTime = 0.0f;
 	m_generationStartTime = Plat_FloatTime();
+	phaseStartTime = m_generationStartTime;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Recompute visibility for only the areas edited since visibility was last computed, then save.
+ */
+void CNavMesh::BeginVisibilityUpdate( void )
+{
+	if ( m_visibilityDirtyAreas.Count() == 0 )
+	{
+		Msg( "No nav areas have been edited since visibility was computed.\n" );
+		return;
+	}
+
+	m_generationState = COMPUTE_MESH_VISIBILITY;
+	m_generationIndex = 0;
+	m_generationMode = GENERATE_VISIBILITY_ONLY;
+	m_bQuitWhenFinished = false;
+	lastMsgTime = 0.0f;
+	m_generationStartTime = Plat_FloatTime();
+	phaseStartTime = m_generationStartTime;
+
+	BeginVisibilityComputations( true );
+	Msg( "Computing mesh visibility for %d edited areas...\n", m_visibilityAreas.Count() );
 }
 
 
@@ -3619,6 +3649,18 @@ static void AnalysisProgress( const char *msg, int ticks, int current, bool show
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Report the end of a generation phase and how long it took
+ */
+static void AnalysisPhaseDone( const char *msg )
+{
+	double now = Plat_FloatTime();
+	Msg( "%sDONE (%.1f seconds)\n", msg, now - phaseStartTime );
+	phaseStartTime = now;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 static void HideAnalysisProgress( void )
 {
@@ -3707,6 +3749,8 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+			AnalysisPhaseDone( "Creating navigation areas from sampled data..." );
+
 			m_generationState = FIND_HIDING_SPOTS;
 			m_generationIndex = 0;
 			return true;
@@ -3730,7 +3774,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
-			Msg( "Finding hiding spots...DONE\n" );
+			AnalysisPhaseDone( "Finding hiding spots..." );
 
 			m_generationState = FIND_ENCOUNTER_SPOTS;
 			m_generationIndex = 0;
@@ -3755,7 +3799,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
-			Msg( "Finding encounter spots...DONE\n" );
+			AnalysisPhaseDone( "Finding encounter spots..." );
 
 			m_generationState = FIND_SNIPER_SPOTS;
 			m_generationIndex = 0;
@@ -3780,7 +3824,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
-			Msg( "Finding sniper spots...DONE\n" );
+			AnalysisPhaseDone( "Finding sniper spots..." );
 
 			m_generationState = COMPUTE_MESH_VISIBILITY;
 			m_generationIndex = 0;
@@ -3793,28 +3837,30 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		//---------------------------------------------------------------------------
 		case COMPUTE_MESH_VISIBILITY:
 		{
-			while( m_generationIndex < TheNavAreas.Count() )
+			while( m_generationIndex < m_visibilityAreas.Count() )
 			{
-				CNavArea *area = TheNavAreas[ m_generationIndex ];
-				++m_generationIndex;
-
-				area->ComputeVisibilityToMesh();
+				ComputeVisibilityBatch();
 
 				// don't go over our time allotment
 				if ( Plat_FloatTime() - startTime > maxTime )
 				{
-					AnalysisProgress( "Computing mesh visibility...", 100, 100 * m_generationIndex / TheNavAreas.Count() );
+					float elapsed = Plat_FloatTime() - phaseStartTime;
+					CFmtStr msg( "Computing mesh visibility... (%d/%d areas, %.0f pairs/sec)", m_generationIndex, m_visibilityAreas.Count(), ( elapsed > 0.0f ) ? m_visibilityPairCount / elapsed : 0.0f );
+					AnalysisProgress( msg, 100, 100 * m_generationIndex / m_visibilityAreas.Count() );
 					return true;
 				}
 			}
 
 			Msg( "Optimizing mesh visibility...\n" );
 
+			int pairCount = m_visibilityPairCount;
+
 			EndVisibilityComputations();
 
-			Msg( "Computing mesh visibility...DONE\n" );
+			Msg( "%d area pairs tested.\n", pairCount );
+			AnalysisPhaseDone( "Computing mesh visibility..." );
 
-			m_generationState = FIND_EARLIEST_OCCUPY_TIMES;
+			m_generationState = ( m_generationMode == GENERATE_VISIBILITY_ONLY ) ? SAVE_NAV_MESH : FIND_EARLIEST_OCCUPY_TIMES;
 			m_generationIndex = 0;
 			return true;
 		}
@@ -3837,7 +3883,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
-			Msg( "Finding earliest occupy times...DONE\n" );
+			AnalysisPhaseDone( "Finding earliest occupy times..." );
 
 #ifdef NAV_ANALYZE_LIGHT_INTENSITY
 			bool shouldSkipLightComputation = ( m_generationMode == GENERATE_INCREMENTAL || engine->IsDedicatedServer() );
@@ -3980,7 +4026,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			PostCustomAnalysis();
 
 			EndCustomAnalysis();
-			Msg( "Custom game-specific analysis...DONE\n" );
+			AnalysisPhaseDone( "Custom game-specific analysis..." );
 
 			m_generationState = SAVE_NAV_MESH;
 			m_generationIndex = 0;
@@ -4001,7 +4047,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			// generation complete!
 			float generationTime = Plat_FloatTime() - m_generationStartTime;
 			Msg( "Generation complete!  %0.1f seconds elapsed.\n", generationTime );
-			bool restart = m_generationMode != GENERATE_INCREMENTAL;
+			bool restart = m_generationMode != GENERATE_INCREMENTAL && m_generationMode != GENERATE_VISIBILITY_ONLY;
 			m_generationMode = GENERATE_NONE;
 			m_isLoaded = true;
 			ClearWalkableSeeds();
@@ -16,6 +16,7 @@
 #include "fmtstr.h"
 #include "utlbuffer.h"
 #include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 #ifdef TERROR
 #include "func_simpleladder.h"
 #endif
@@ -28,6 +29,7 @@
 
 #ifdef NEXT_BOT
 #include "NextBot/NavMeshEntities/func_nav_prerequisite.h"
+#include "NextBot/NextBotManager.h"
 #endif
 // Defines the ToHScript and ToNavArea stuff.
 #include "NextBot/NextBotLocomotionInterface.h"
@@ -53,6 +55,11 @@ ConVar nav_show_func_nav_avoid( "nav_show_func_nav_avoid", "0", FCVAR_GAMEDLL |
 ConVar nav_show_func_nav_prefer( "nav_show_func_nav_prefer", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Show areas of designer-placed bot preference due to func_nav_prefer entities" );
 ConVar nav_show_func_nav_prerequisite( "nav_show_func_nav_prerequisite", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Show areas of designer-placed bot preference due to func_nav_prerequisite entities" );
 ConVar nav_max_vis_delta_list_length( "nav_max_vis_delta_list_length", "64", FCVAR_CHEAT );
+ConVar nav_nearest_area_index( "nav_nearest_area_index", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "Use the precomputed nearest area index to speed up GetNearestNavArea()." );
+
+// parameters of the nearest area index
+static const int NearestAreaMinCandidates = 8;				// gather at least this many areas around each cell...
+static const int NearestAreaMaxShift = 3;					// ...searching no more than this many cells out
 
 extern ConVar nav_show_potentially_visible;
 
@@ -162,6 +169,14 @@ CNavArea *CNavMesh::GetMarkedArea( void ) const
  */
 void CNavMesh::DestroyNavigationMesh( bool incremental )
 {
+#ifdef NEXT_BOT
+	// asynchronous path queries refer to the areas we are about to destroy
+	if ( NextBotManager::GetInstance() )
+	{
+		NextBotManager::GetInstance()->AbortPathQueries();
+	}
+#endif
+
 	m_blockedAreas.RemoveAll();
 	m_avoidanceObstacleAreas.RemoveAll();
 	m_transientAreas.RemoveAll();
@@ -210,6 +225,9 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 	{
 		// destroy the grid
 		m_grid.RemoveAll();
+		m_nearestAreaCells.RemoveAll();
+		m_visibilityDirtyAreas.RemoveAll();
+		m_visibilityPendingDirtyAreas.RemoveAll();
 		m_gridSizeX = 0;
 		m_gridSizeY = 0;
 	}
@@ -454,6 +472,7 @@ void CNavMesh::FireGameEvent( IGameEvent *gameEvent )
 void CNavMesh::AllocateGrid( float minX, float maxX, float minY, float maxY )
 {
 	m_grid.RemoveAll();
+	m_nearestAreaCells.RemoveAll();
 
 	m_minX = minX;
 	m_minY = minY;
@@ -490,6 +509,10 @@ void CNavMesh::AddNavArea( CNavArea *area )
 		}
 	}
 
+	AddToNearestAreaIndex( area );
+
+	MarkVisibilityDirty( area );
+
 	// add to hash table
 	int key = ComputeHashKey( area->GetID() );
 
@@ -537,6 +560,29 @@ void CNavMesh::RemoveNavArea( CNavArea *area )
 		}
 	}
 
+	RemoveFromNearestAreaIndex( area );
+
+	m_visibilityDirtyAreas.FindAndRemove( area );
+	m_visibilityPendingDirtyAreas.FindAndRemove( area );
+
+	// an area deleted while visibility is being computed must not be visited by the rest of the pass
+	int visibilityOrder = m_visibilityAreas.Find( area );
+	if ( m_visibilityAreas.IsValidIndex( visibilityOrder ) )
+	{
+		m_visibilityAreas.Remove( visibilityOrder );
+		m_visibilityOrder[ area->GetID() ] = -1;
+
+		for( int i=visibilityOrder; i<m_visibilityAreas.Count(); ++i )
+		{
+			m_visibilityOrder[ m_visibilityAreas[i]->GetID() ] = i;
+		}
+
+		if ( m_generationState == COMPUTE_MESH_VISIBILITY && visibilityOrder < m_generationIndex )
+		{
+			--m_generationIndex;
+		}
+	}
+
 	// remove from hash table
 	int key = ComputeHashKey( area->GetID() );
 
@@ -820,6 +866,53 @@ CNavArea *CNavMesh::GetNavArea( CBaseEntity *pEntity, int nFlags, float flBeneat
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return true if the closest point on a nav area is visible from pos, for GetNearestNavArea()
+ */
+static bool IsNearestAreaVisible( const Vector &pos, const Vector &areaPos )
+{
+	trace_t result;
+
+	// make sure 'pos' is not embedded in the world
+	Vector safePos;
+
+	UTIL_TraceLine( pos, pos + Vector( 0, 0, StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+	if ( result.startsolid )
+	{
+		// it was embedded - move it out
+		safePos = result.endpos + Vector( 0, 0, 1.0f );
+	}
+	else
+	{
+		safePos = pos;
+	}
+
+	// Don't bother tracing from the nav area up to safePos.z if it's within StepHeight of the area, since areas can be embedded in the ground a bit
+	float heightDelta = fabs(areaPos.z - safePos.z);
+	if ( heightDelta > StepHeight )
+	{
+		// trace to the height of the original point
+		UTIL_TraceLine( areaPos + Vector( 0, 0, StepHeight ), Vector( areaPos.x, areaPos.y, safePos.z ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+		
+		if ( result.fraction != 1.0f )
+		{
+			return false;
+		}
+	}
+
+	// trace to the original point's height above the area
+	UTIL_TraceLine( safePos, Vector( areaPos.x, areaPos.y, safePos.z + StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+
+	if ( result.fraction != 1.0f )
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Given a position in the world, return the nav area that is closest
@@ -866,6 +959,18 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 	source.z += HalfHumanHeight;
 
 	// find closest nav area
+	if ( nav_nearest_area_index.GetBool() && m_nearestAreaCells.Count() )
+	{
+		bool isExact;
+		close = FindNearestNavAreaInIndex( pos, source, maxDist, checkLOS, team, &isExact );
+		if ( isExact )
+		{
+			return close;
+		}
+
+		// the closest area may be outside the candidates of this cell, fall back to searching the grid
+		close = NULL;
+	}
 
 	// use a unique marker for this method, so it can be used within a SearchSurroundingArea() call
 	static unsigned int searchMarker = RandomInt(0, 1024*1024 );
@@ -943,45 +1048,8 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 					// check LOS to area
 					// REMOVED: If we do this for !anyZ, it's likely we wont have LOS and will enumerate every area in the mesh
 					// It is still good to do this in some isolated cases, however
-					if ( checkLOS )
-					{
-						trace_t result;
-
-						// make sure 'pos' is not embedded in the world
-						Vector safePos;
-
-						UTIL_TraceLine( pos, pos + Vector( 0, 0, StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
-						if ( result.startsolid )
-						{
-							// it was embedded - move it out
-							safePos = result.endpos + Vector( 0, 0, 1.0f );
-						}
-						else
-						{
-							safePos = pos;
-						}
-
-						// Don't bother tracing from the nav area up to safePos.z if it's within StepHeight of the area, since areas can be embedded in the ground a bit
-						float heightDelta = fabs(areaPos.z - safePos.z);
-						if ( heightDelta > StepHeight )
-						{
-							// trace to the height of the original point
-							UTIL_TraceLine( areaPos + Vector( 0, 0, StepHeight ), Vector( areaPos.x, areaPos.y, safePos.z ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
-							
-							if ( result.fraction != 1.0f )
-							{
-								continue;
-							}
-						}
-
-						// trace to the original point's height above the area
-						UTIL_TraceLine( safePos, Vector( areaPos.x, areaPos.y, safePos.z + StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
-
-						if ( result.fraction != 1.0f )
-						{
-							continue;
-						}
-					}
+					if ( checkLOS && !IsNearestAreaVisible( pos, areaPos ) )
+						continue;
 
 					closeDistSq = distSq;
 					close = area;
@@ -1021,6 +1089,350 @@ CNavArea *CNavMesh::GetNearestNavArea( CBaseEntity *pEntity, int nFlags, float m
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the squared 2D distance between a grid cell and the extent of an area
+ */
+float CNavMesh::ComputeCellToAreaDistanceSq( int gridX, int gridY, const CNavArea *area ) const
+{
+	float cellLoX = m_minX + gridX * m_gridCellSize;
+	float cellLoY = m_minY + gridY * m_gridCellSize;
+	float cellHiX = cellLoX + m_gridCellSize;
+	float cellHiY = cellLoY + m_gridCellSize;
+
+	const Vector &areaLo = area->GetCorner( NORTH_WEST );
+	const Vector &areaHi = area->GetCorner( SOUTH_EAST );
+
+	float dx = MAX( 0.0f, MAX( areaLo.x - cellHiX, cellLoX - areaHi.x ) );
+	float dy = MAX( 0.0f, MAX( areaLo.y - cellHiY, cellLoY - areaHi.y ) );
+
+	return dx*dx + dy*dy;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int __cdecl CNavMesh::CompareNearestAreaCandidates( const NearestAreaCandidate *lhs, const NearestAreaCandidate *rhs )
+{
+	if ( lhs->minDistSq != rhs->minDistSq )
+		return ( lhs->minDistSq < rhs->minDistSq ) ? -1 : 1;
+
+	// keep the order of equally distant areas deterministic
+	if ( lhs->area->GetID() != rhs->area->GetID() )
+		return ( lhs->area->GetID() < rhs->area->GetID() ) ? -1 : 1;
+
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build the nearest area index from the grid.
+ * Each cell gathers the areas in rings of cells around it until it has enough candidates. Any area
+ * outside those rings is at least as far from the cell as the outermost ring, which bounds the distance
+ * at which the candidate list is known to be complete.
+ */
+void CNavMesh::BuildNearestAreaIndex( void )
+{
+	VPROF_BUDGET( "CNavMesh::BuildNearestAreaIndex", "NextBot" );
+
+	m_nearestAreaCells.RemoveAll();
+
+	if ( !m_grid.Count() )
+		return;
+
+	m_nearestAreaCells.SetCount( m_grid.Count() );
+
+	for( int originY = 0; originY < m_gridSizeY; ++originY )
+	{
+		for( int originX = 0; originX < m_gridSizeX; ++originX )
+		{
+			NearestAreaCell &cell = m_nearestAreaCells[ originX + originY*m_gridSizeX ];
+
+			int shift;
+			for( shift = 0; shift <= NearestAreaMaxShift; ++shift )
+			{
+				for( int x = originX - shift; x <= originX + shift; ++x )
+				{
+					if ( x < 0 || x >= m_gridSizeX )
+						continue;
+
+					for( int y = originY - shift; y <= originY + shift; ++y )
+					{
+						if ( y < 0 || y >= m_gridSizeY )
+							continue;
+
+						// only the outer edge of the ring, the inner cells have been gathered already
+						if ( x > originX - shift &&
+							 x < originX + shift &&
+							 y > originY - shift &&
+							 y < originY + shift )
+							continue;
+
+						const NavAreaVector &areaVector = m_grid[ x + y*m_gridSizeX ];
+						FOR_EACH_VEC( areaVector, it )
+						{
+							NearestAreaCandidate candidate;
+							candidate.area = areaVector[ it ];
+							candidate.minDistSq = ComputeCellToAreaDistanceSq( originX, originY, candidate.area );
+							cell.candidates.AddToTail( candidate );
+						}
+					}
+				}
+
+				if ( shift > 0 && cell.candidates.Count() >= NearestAreaMinCandidates )
+					break;
+			}
+
+			// the last ring gathered
+			shift = MIN( shift, NearestAreaMaxShift );
+
+			float coverage = shift * m_gridCellSize;
+			cell.coverageSq = coverage * coverage;
+
+			// large areas overlap several cells - sort and remove the duplicates
+			cell.candidates.Sort( CompareNearestAreaCandidates );
+
+			for( int i = cell.candidates.Count()-1; i > 0; --i )
+			{
+				if ( cell.candidates[i].area == cell.candidates[i-1].area )
+				{
+					cell.candidates.Remove( i );
+				}
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add a new or changed area to the candidates of the cells it is close enough to
+ */
+void CNavMesh::AddToNearestAreaIndex( CNavArea *area )
+{
+	if ( !m_nearestAreaCells.Count() )
+		return;
+
+	// cells further out than the largest coverage can't need this area
+	int loX = MAX( WorldToGridX( area->GetCorner( NORTH_WEST ).x ) - NearestAreaMaxShift, 0 );
+	int loY = MAX( WorldToGridY( area->GetCorner( NORTH_WEST ).y ) - NearestAreaMaxShift, 0 );
+	int hiX = MIN( WorldToGridX( area->GetCorner( SOUTH_EAST ).x ) + NearestAreaMaxShift, m_gridSizeX-1 );
+	int hiY = MIN( WorldToGridY( area->GetCorner( SOUTH_EAST ).y ) + NearestAreaMaxShift, m_gridSizeY-1 );
+
+	for( int y = loY; y <= hiY; ++y )
+	{
+		for( int x = loX; x <= hiX; ++x )
+		{
+			NearestAreaCell &cell = m_nearestAreaCells[ x + y*m_gridSizeX ];
+
+			NearestAreaCandidate candidate;
+			candidate.area = area;
+			candidate.minDistSq = ComputeCellToAreaDistanceSq( x, y, area );
+
+			if ( candidate.minDistSq >= cell.coverageSq )
+				continue;
+
+			// keep the candidates sorted
+			int i;
+			for( i = 0; i < cell.candidates.Count(); ++i )
+			{
+				if ( CompareNearestAreaCandidates( &candidate, &cell.candidates[i] ) < 0 )
+					break;
+			}
+
+			cell.candidates.InsertBefore( i, candidate );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Remove an area from the candidates of every cell near it
+ */
+void CNavMesh::RemoveFromNearestAreaIndex( CNavArea *area )
+{
+	if ( !m_nearestAreaCells.Count() )
+		return;
+
+	int loX = MAX( WorldToGridX( area->GetCorner( NORTH_WEST ).x ) - NearestAreaMaxShift, 0 );
+	int loY = MAX( WorldToGridY( area->GetCorner( NORTH_WEST ).y ) - NearestAreaMaxShift, 0 );
+	int hiX = MIN( WorldToGridX( area->GetCorner( SOUTH_EAST ).x ) + NearestAreaMaxShift, m_gridSizeX-1 );
+	int hiY = MIN( WorldToGridY( area->GetCorner( SOUTH_EAST ).y ) + NearestAreaMaxShift, m_gridSizeY-1 );
+
+	for( int y = loY; y <= hiY; ++y )
+	{
+		for( int x = loX; x <= hiX; ++x )
+		{
+			NearestAreaCell &cell = m_nearestAreaCells[ x + y*m_gridSizeX ];
+
+			FOR_EACH_VEC( cell.candidates, it )
+			{
+				if ( cell.candidates[ it ].area == area )
+				{
+					cell.candidates.Remove( it );
+					break;
+				}
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search the candidates of the cell containing pos for the closest area, as GetNearestNavArea() does.
+ * Since the candidates are sorted by a lower bound on their distance, the search stops at the first
+ * candidate that can't be closer than the best so far.
+ * isExact is set to false if an area that isn't a candidate could be closer than the one returned.
+ */
+CNavArea *CNavMesh::FindNearestNavAreaInIndex( const Vector &pos, const Vector &source, float maxDist, bool checkLOS, int team, bool *isExact ) const
+{
+	*isExact = false;
+
+	// the distance bounds only hold for positions inside the cell
+	float gridX = ( pos.x - m_minX ) / m_gridCellSize;
+	float gridY = ( pos.y - m_minY ) / m_gridCellSize;
+	if ( gridX < 0.0f || gridX >= m_gridSizeX || gridY < 0.0f || gridY >= m_gridSizeY )
+		return NULL;
+
+	const NearestAreaCell &cell = m_nearestAreaCells[ (int)gridX + (int)gridY * m_gridSizeX ];
+
+	CNavArea *close = NULL;
+	float closeDistSq = maxDist * maxDist;
+
+	FOR_EACH_VEC( cell.candidates, it )
+	{
+		const NearestAreaCandidate &candidate = cell.candidates[ it ];
+
+		// this and every following area are too far away to be closer
+		if ( candidate.minDistSq >= closeDistSq )
+			break;
+
+		CNavArea *area = candidate.area;
+
+		// don't consider blocked areas
+		if ( area->IsBlocked( team ) )
+			continue;
+
+		Vector areaPos;
+		area->GetClosestPointOnArea( source, &areaPos );
+
+		float distSq = ( areaPos - pos ).LengthSqr();
+
+		// keep the closest area
+		if ( distSq >= closeDistSq )
+			continue;
+
+		if ( checkLOS && !IsNearestAreaVisible( pos, areaPos ) )
+			continue;
+
+		closeDistSq = distSq;
+		close = area;
+	}
+
+	// areas that aren't candidates are at least the coverage distance away
+	*isExact = ( closeDistSq <= cell.coverageSq );
+
+	return close;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time GetNearestNavArea() for random positions around the mesh, with and without the nearest area index
+ */
+void CNavMesh::CommandNavBenchNearest( const CCommand &args )
+{
+	if ( !TheNavAreas.Count() )
+	{
+		Msg( "No navigation mesh loaded.\n" );
+		return;
+	}
+
+	int queryCount = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 10000;
+
+	// positions near the mesh - around random areas, offset up and out
+	CUniformRandomStream randomStream;
+	randomStream.SetSeed( ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0 );
+
+	CUtlVector< Vector > queries;
+	queries.SetCount( queryCount );
+	FOR_EACH_VEC( queries, it )
+	{
+		const CNavArea *area = TheNavAreas[ randomStream.RandomInt( 0, TheNavAreas.Count()-1 ) ];
+		Vector &pos = queries[ it ];
+		pos = area->GetRandomPoint();
+		pos.x += randomStream.RandomFloat( -m_gridCellSize, m_gridCellSize );
+		pos.y += randomStream.RandomFloat( -m_gridCellSize, m_gridCellSize );
+		pos.z += randomStream.RandomFloat( 0.0f, HumanHeight );
+	}
+
+	CUtlVector< CNavArea * > results[2];
+	double elapsed[2];
+
+	bool wasUsingIndex = nav_nearest_area_index.GetBool();
+
+	for( int pass = 0; pass < 2; ++pass )
+	{
+		nav_nearest_area_index.SetValue( pass );
+
+		results[ pass ].SetCount( queryCount );
+
+		double startTime = Plat_FloatTime();
+
+		FOR_EACH_VEC( queries, it )
+		{
+			results[ pass ][ it ] = GetNearestNavArea( queries[ it ] );
+		}
+
+		elapsed[ pass ] = MAX( Plat_FloatTime() - startTime, 0.000001 );
+	}
+
+	nav_nearest_area_index.SetValue( wasUsingIndex );
+
+	int differentCount = 0;
+	int candidateCount = 0;
+	FOR_EACH_VEC( queries, it )
+	{
+		if ( results[0][ it ] != results[1][ it ] )
+		{
+			++differentCount;
+		}
+	}
+	FOR_EACH_VEC( m_nearestAreaCells, cit )
+	{
+		candidateCount += m_nearestAreaCells[ cit ].candidates.Count();
+	}
+
+	Msg( "GetNearestNavArea: %d queries, %d areas, %d grid cells\n", queryCount, TheNavAreas.Count(), m_grid.Count() );
+	Msg( "  grid search:  %8.2f ms, %10.0f queries/sec\n", elapsed[0] * 1000.0, queryCount / elapsed[0] );
+	Msg( "  area index:   %8.2f ms, %10.0f queries/sec (%.2fx)\n", elapsed[1] * 1000.0, queryCount / elapsed[1], elapsed[0] / elapsed[1] );
+
+	if ( m_nearestAreaCells.Count() )
+	{
+		Msg( "  %.1f candidates per cell\n", (float)candidateCount / m_nearestAreaCells.Count() );
+	}
+	else
+	{
+		Msg( "  the nearest area index has not been built\n" );
+	}
+
+	// the grid search only looks one ring past the first area it finds, so it can miss a closer area
+	Msg( "  %d queries found a different area\n", differentCount );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_bench_nearest, "Time GetNearestNavArea() with and without the nearest area index. Arguments: [query count] [random seed]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->CommandNavBenchNearest( args );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Given an ID, return the associated area
@@ -2634,6 +3046,20 @@ void CommandNavAnalyze( void )
 static ConCommand nav_analyze( "nav_analyze", CommandNavAnalyze, "Re-analyze the current Navigation Mesh and save it to disk.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
 
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavUpdateVisibility( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( nav_edit.GetBool() )
+	{
+		TheNavMesh->BeginVisibilityUpdate();
+	}
+}
+static ConCommand nav_update_visibility( "nav_update_visibility", CommandNavUpdateVisibility, "Recompute visibility for the nav areas edited since it was last computed, and save the mesh to disk.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
 //--------------------------------------------------------------------------------------------------------------
 void CommandNavAnalyzeScripted( const CCommand &args )
 {
@@ -3431,35 +3857,240 @@ void CNavMesh::UpdateAvoidanceObstacleAreas( void )
 
 
 
-extern CUtlHash< NavVisPair_t, CVisPairHashFuncs, CVisPairHashFuncs > *g_pNavVisPairHash;
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Remember that an edited area needs its visibility recomputed
+ */
+void CNavMesh::MarkVisibilityDirty( CNavArea *area )
+{
+	if ( !m_isLoaded )
+		return;
+
+	if ( IsGenerating() )
+	{
+		if ( m_generationState == COMPUTE_MESH_VISIBILITY )
+		{
+			// the pass may already be past this area, and clears the dirty list when it ends
+			if ( !m_visibilityPendingDirtyAreas.HasElement( area ) )
+			{
+				m_visibilityPendingDirtyAreas.AddToTail( area );
+			}
+		}
+
+		// the other generation steps are followed by computing visibility for every area
+		return;
+	}
+
+	if ( !m_visibilityDirtyAreas.HasElement( area ) )
+	{
+		m_visibilityDirtyAreas.AddToTail( area );
+	}
+}
+
 
 //--------------------------------------------------------------------------------------------------------
-void CNavMesh::BeginVisibilityComputations( void )
+/**
+ * Prepare to compute visibility, for every area or only the edited areas.
+ * Each area's visibility to the other areas in range is computed as pairs, each pair once, by
+ * the first of its two areas in m_visibilityAreas. Pairs with an area whose visibility isn't
+ * being recomputed are always computed.
+ */
+void CNavMesh::BeginVisibilityComputations( bool incremental )
 {
-	if ( !g_pNavVisPairHash )
+	m_visibilityAreas.RemoveAll();
+	m_visibilityPairCount = 0;
+
+	if ( incremental )
 	{
-		g_pNavVisPairHash = new CUtlHash< NavVisPair_t, CVisPairHashFuncs, CVisPairHashFuncs >( 16*1024 );
+		// keep the order deterministic
+		FOR_EACH_VEC( TheNavAreas, it )
+		{
+			if ( m_visibilityDirtyAreas.HasElement( TheNavAreas[ it ] ) )
+			{
+				m_visibilityAreas.AddToTail( TheNavAreas[ it ] );
+			}
+		}
 	}
 	else
 	{
-		g_pNavVisPairHash->RemoveAll();
+		m_visibilityAreas.AddVectorToTail( TheNavAreas );
+	}
+
+	unsigned int maxID = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		maxID = MAX( maxID, TheNavAreas[ it ]->GetID() );
+	}
+
+	m_visibilityOrder.SetCount( maxID + 1 );
+	FOR_EACH_VEC( m_visibilityOrder, oit )
+	{
+		m_visibilityOrder[ oit ] = -1;
+	}
+	FOR_EACH_VEC( m_visibilityAreas, vit )
+	{
+		m_visibilityOrder[ m_visibilityAreas[ vit ]->GetID() ] = vit;
+	}
+
+	if ( incremental )
+	{
+		// lists will be added to, so undo the delta compression before removing the stale entries
+		FOR_EACH_VEC( TheNavAreas, it )
+		{
+			TheNavAreas[ it ]->ExpandInheritedVisibility();
+		}
 	}
 
 	FOR_EACH_VEC( TheNavAreas, it )
 	{
 		CNavArea *area = TheNavAreas[ it ];
-		area->ResetPotentiallyVisibleAreas();
+		area->m_inheritVisibilityFrom.area = NULL;
+		area->m_isInheritedFrom = false;
+
+		if ( m_visibilityOrder[ area->GetID() ] >= 0 )
+		{
+			area->ResetPotentiallyVisibleAreas();
+			continue;
+		}
+
+		// forget visibility to the areas being recomputed
+		CNavArea::CAreaBindInfoArray &visible = area->m_potentiallyVisibleAreas;
+		for( int i=visible.Count()-1; i>=0; --i )
+		{
+			if ( m_visibilityOrder[ visible[i].area->GetID() ] >= 0 )
+			{
+				visible.Remove( i );
+			}
+		}
 	}
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+// A pair of areas to compute visibility between, and the result
+struct NavVisibilityPair_t
+{
+	CNavArea *area;
+	CNavArea *other;
+	const byte *pvs;							// PVS of 'area'
+	CNavArea::VisibilityType visThisToOther;
+	CNavArea::VisibilityType visOtherToThis;
+};
+
+static void ComputeNavVisibilityPair( NavVisibilityPair_t &pair )
+{
+	pair.area->ComputeVisibilityPair( pair.other, pair.pvs, &pair.visThisToOther, &pair.visOtherToThis );
+}
+
+extern const float DEF_NAV_VIEW_DISTANCE;
+extern ConVar nav_max_view_distance;
+
+// number of areas whose pairs are computed together - each area in the batch needs its own PVS
+static const int NavVisibilityBatchSize = 64;
+static const int NavVisibilityPVSSize = PAD_NUMBER( MAX_MAP_CLUSTERS, 8 ) / 8;
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Compute visibility for the next batch of areas.
+ * PVS setup and merging the results stay on the main thread. The pairs themselves are traced in parallel,
+ * each writing only its own result, and are merged in a fixed order so the lists don't depend on threading.
+ */
+void CNavMesh::ComputeVisibilityBatch( void )
+{
+	VPROF_BUDGET( "CNavMesh::ComputeVisibilityBatch", "NextBot" );
+
+	static CUtlVector< byte > pvsBuffer;
+	static CUtlVector< NavVisibilityPair_t > pairs;
+
+	int batchCount = MIN( NavVisibilityBatchSize, m_visibilityAreas.Count() - m_generationIndex );
+	if ( batchCount <= 0 )
+		return;
+
+	pvsBuffer.SetCount( batchCount * NavVisibilityPVSSize );
+	pairs.RemoveAll();
+
+	// collect all possible nav areas that could be visible from each area
+	float radius = nav_max_view_distance.GetFloat();
+	if ( radius == 0.0f )
+	{
+		radius = DEF_NAV_VIEW_DISTANCE;
+	}
+
+	for( int b=0; b<batchCount; ++b )
+	{
+		int order = m_generationIndex + b;
+		CNavArea *area = m_visibilityAreas[ order ];
+
+		byte *pvs = &pvsBuffer[ b * NavVisibilityPVSSize ];
+		area->SetupPVS( pvs, NavVisibilityPVSSize );
+
+		NavAreaCollector collector;
+		collector.m_area.EnsureCapacity( 1000 );
+		ForAllAreasInRadius( collector, area->GetCenter(), radius );
+
+		FOR_EACH_VEC( collector.m_area, it )
+		{
+			CNavArea *other = collector.m_area[ it ];
+
+			// if the other area came first, it already computed this pair (the radius test is symmetric)
+			int otherOrder = m_visibilityOrder.IsValidIndex( other->GetID() ) ? m_visibilityOrder[ other->GetID() ] : -1;
+			if ( otherOrder >= 0 && otherOrder < order )
+				continue;
+
+			NavVisibilityPair_t &pair = pairs[ pairs.AddToTail() ];
+			pair.area = area;
+			pair.other = other;
+			pair.pvs = pvs;
+			pair.visThisToOther = CNavArea::NOT_VISIBLE;
+			pair.visOtherToThis = CNavArea::NOT_VISIBLE;
+		}
+	}
+
+	if ( pairs.Count() )
+	{
+		ParallelProcess( "CNavMesh::ComputeVisibilityBatch", pairs.Base(), pairs.Count(), &ComputeNavVisibilityPair );
+	}
+
+	// merge in order
+	FOR_EACH_VEC( pairs, pit )
+	{
+		const NavVisibilityPair_t &pair = pairs[ pit ];
+
+		CNavArea::AreaBindInfo info;
+		if ( pair.visThisToOther != CNavArea::NOT_VISIBLE )
+		{
+			info.area = pair.other;
+			info.attributes = pair.visThisToOther;
+			pair.area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		if ( pair.visOtherToThis != CNavArea::NOT_VISIBLE )
+		{
+			info.area = pair.area;
+			info.attributes = pair.visOtherToThis;
+			pair.other->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+	}
+
+	m_visibilityPairCount += pairs.Count();
+	m_generationIndex += batchCount;
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 /**
  * Invoked when custom analysis step is complete
  */
 void CNavMesh::EndVisibilityComputations( void )
 {
-	g_pNavVisPairHash->RemoveAll();
+	m_visibilityAreas.RemoveAll();
+	m_visibilityOrder.RemoveAll();
+
+	// areas edited during the pass still need to be recomputed
+	m_visibilityDirtyAreas.RemoveAll();
+	m_visibilityDirtyAreas.AddVectorToTail( m_visibilityPendingDirtyAreas );
+	m_visibilityPendingDirtyAreas.RemoveAll();
 
 	int avgVisLength = 0;
 	int maxVisLength = 0;
@@ -169,49 +169,6 @@ enum GetNavAreaFlags_t
 };
 
 
-//--------------------------------------------------------------------------------------------------------
-// for nav mesh visibilty computation
-struct NavVisPair_t
-{
-	void SetPair( CNavArea *pArea1, CNavArea *pArea2 )
-	{
-		int iArea1 = (int)( pArea1 > pArea2 );
-		int iArea2 = ( iArea1 + 1 ) % 2;
-		pAreas[iArea1] = pArea1;
-		pAreas[iArea2] = pArea2;
-	}
-
-	CNavArea *pAreas[2];
-};
-
-
-// for nav mesh visibilty computation
-class CVisPairHashFuncs
-{
-public:
-	CVisPairHashFuncs( int ) {}
-
-	bool operator()( const NavVisPair_t &lhs, const NavVisPair_t &rhs ) const
-	{
-		return ( lhs.pAreas[0] == rhs.pAreas[0] && lhs.pAreas[1] == rhs.pAreas[1] );
-	}
-
-	unsigned int operator()( const NavVisPair_t &item ) const
-	{
-		COMPILE_TIME_ASSERT( sizeof(CNavArea *) == sizeof( intp ) );
-		intp key[2] = { (intp) ( (intp)item.pAreas[0] + item.pAreas[1]->GetID() ), (intp)( (intp)item.pAreas[1] + item.pAreas[0]->GetID() ) };
-		if ( sizeof( key ) >= 16 )
-		{
-			return Hash16( key );
-		}
-		else
-		{
-			return Hash8( key );
-		}
-	}
-};
-
-
 //--------------------------------------------------------------------------------------------------------------
 //
 // The 'place directory' is used to save and load places from
@@ -294,6 +251,23 @@ public:
 	virtual bool Save( void ) const;									// store Navigation Mesh to a file
 	bool IsOutOfDate( void ) const	{ return m_isOutOfDate; }			// return true if the Navigation Mesh is older than the current map version
 
+	bool SaveCompiled( void ) const;									// store the loaded Navigation Mesh as a compiled file, which loads without parsing
+
+	struct LoadStats
+	{
+		bool isCompiled;												// true if the mesh was loaded from a compiled file
+		unsigned int fileSize;
+		float readTime;													// seconds spent reading the file
+		float buildTime;												// seconds spent creating areas, ladders and hiding spots
+		float bindTime;													// seconds spent connecting everything together
+		int areaCount;
+		int connectionCount;
+		int hidingSpotCount;
+		int encounterCount;
+		int visibilityCount;
+	};
+	const LoadStats &GetLoadStats( void ) const	{ return m_loadStats; }	// how the current mesh was loaded
+
 	virtual unsigned int GetSubVersionNumber( void ) const;										// returns sub-version number of data format used by derived classes
 	virtual void SaveCustomData( CUtlBuffer &fileBuffer ) const { }								// store custom mesh data for derived classes
 	virtual void LoadCustomData( CUtlBuffer &fileBuffer, unsigned int subVersion ) { }			// load custom mesh data for derived classes
@@ -356,6 +330,11 @@ public:
 	#define INCREMENTAL_GENERATION true
 	void BeginGeneration( bool incremental = false );					// initiate the generation process
 	void BeginAnalysis( bool quitWhenFinished = false );						// re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
+	void BeginVisibilityUpdate( void );									// recompute visibility of the areas edited since it was last computed
+
+	void MarkVisibilityDirty( CNavArea *area );						// the area was edited, so its visibility needs to be recomputed
+	bool IsVisibilityDirty( const CNavArea *area ) const	{ return m_visibilityDirtyAreas.HasElement( const_cast< CNavArea * >( area ) ) || m_visibilityPendingDirtyAreas.HasElement( const_cast< CNavArea * >( area ) ); }
+	void ClearVisibilityDirty( CNavArea *area )				{ m_visibilityDirtyAreas.FindAndRemove( area ); m_visibilityPendingDirtyAreas.FindAndRemove( area ); }
 
 	bool IsGenerating( void ) const		{ return m_generationMode != GENERATE_NONE; }	// return true while a Navigation Mesh is being generated
 	const char *GetPlayerSpawnName( void ) const;						// return name of player spawn entity
@@ -446,6 +425,7 @@ public:
 	void CommandNavSaveSelected( const CCommand &args );				// Save selected set to disk
 	void CommandNavMergeMesh( const CCommand &args );					// Merge a saved selected set into the current mesh
 	void CommandNavMarkWalkable( void );
+	void CommandNavBenchNearest( const CCommand &args );				// time GetNearestNavArea() with and without the nearest area index
 
 	void AddToDragSelectionSet( CNavArea *pArea );
 	void RemoveFromDragSelectionSet( CNavArea *pArea );
@@ -1113,9 +1093,39 @@ private:
 
 	void AddNavArea( CNavArea *area );							// add an area to the grid
 
+	//----------------------------------------------------------------------------------
+	// Nearest area index
+	// For each grid cell, the areas closest to it sorted by their 2D distance from the cell,
+	// so GetNearestNavArea() can stop as soon as no remaining area can be closer.
+	//
+	struct NearestAreaCandidate
+	{
+		CNavArea *area;
+		float minDistSq;										// squared 2D distance from the grid cell to the area's extent
+	};
+
+	struct NearestAreaCell
+	{
+		CUtlVector< NearestAreaCandidate > candidates;			// sorted by minDistSq
+		float coverageSq;										// every area closer than this to the cell is a candidate
+	};
+
+	CUtlVector< NearestAreaCell > m_nearestAreaCells;			// parallel to m_grid, empty if the index hasn't been built
+
+	void BuildNearestAreaIndex( void );							// build the index from the grid
+	void AddToNearestAreaIndex( CNavArea *area );
+	void RemoveFromNearestAreaIndex( CNavArea *area );
+	float ComputeCellToAreaDistanceSq( int gridX, int gridY, const CNavArea *area ) const;
+	static int __cdecl CompareNearestAreaCandidates( const NearestAreaCandidate *lhs, const NearestAreaCandidate *rhs );
+	CNavArea *FindNearestNavAreaInIndex( const Vector &pos, const Vector &source, float maxDist, bool checkLOS, int team, bool *isExact ) const;
+
 	void DestroyNavigationMesh( bool incremental = false );		// free all resources of the mesh and reset it to empty state
 	void DestroyHidingSpots( void );
 
+	NavErrorType LoadCompiled( void );							// load the compiled form of the nav file, if it is up to date
+	void FinishLoad( void );									// mesh-wide setup once areas are loaded and bound together
+	LoadStats m_loadStats;
+
 	void ComputeBattlefrontAreas( void );						// determine areas where rushing teams will first meet
 
 	//----------------------------------------------------------------------------------
@@ -1239,6 +1249,7 @@ private:
 		GENERATE_INCREMENTAL,
 		GENERATE_SIMPLIFY,
 		GENERATE_ANALYSIS_ONLY,
+		GENERATE_VISIBILITY_ONLY,
 	}
 	m_generationMode;											// true while a Navigation Mesh is being generated
 	int m_generationIndex;										// used for iterating nav areas during generation process
@@ -1272,9 +1283,16 @@ private:
 
 	CUtlVector< int > m_storedSelectedSet;						// "Stored" selected set, so we can do some editing and then restore the old selected set.  Done by ID, so we don't have to worry about split/delete/etc.
 
-	void BeginVisibilityComputations( void );
+	void BeginVisibilityComputations( bool incremental = false );	// incremental only recomputes the areas in m_visibilityDirtyAreas
+	void ComputeVisibilityBatch( void );						// compute visibility for the next batch of m_visibilityAreas
 	void EndVisibilityComputations( void );
 
+	NavAreaVector m_visibilityDirtyAreas;						// areas edited since visibility was last computed
+	NavAreaVector m_visibilityPendingDirtyAreas;				// areas edited while visibility is being computed, dirty once it is done
+	NavAreaVector m_visibilityAreas;							// areas having their visibility computed, in order
+	CUtlVector< int > m_visibilityOrder;						// area ID -> index in m_visibilityAreas, or -1 if the area's visibility is not being computed
+	int m_visibilityPairCount;									// pairs of areas tested so far
+
 	void TestAllAreasForBlockedStatus( void );					// Used to update blocked areas after a round restart. Need to delay so the map logic has all fired.
 	CountdownTimer m_updateBlockedAreasTimer;			
 };
@@ -0,0 +1,207 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_pathfind.cpp
+// Per-query search state for path-finding on the Navigation Mesh
+
+#include "cbase.h"
+
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+CNavPathSearchState TheNavPathSearchState;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathSearchState::CNavPathSearchState( void )
+{
+	m_generation = 1;
+	m_sequence = 0;
+	m_maxOpenCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Begin a new search. All node state from prior searches is invalidated by bumping the generation.
+ */
+void CNavPathSearchState::Reset( void )
+{
+	m_openHeap.RemoveAll();
+	m_sequence = 0;
+	m_maxOpenCount = 0;
+
+	++m_generation;
+	if ( m_generation == 0 )
+	{
+		// generation wrapped - explicitly invalidate every node, since zero is never a valid generation
+		FOR_EACH_VEC( m_node, it )
+		{
+			m_node[ it ].generation = 0;
+		}
+		m_generation = 1;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add to open list, ordered by the area's current total cost
+ */
+void CNavPathSearchState::AddToOpenList( CNavArea *area )
+{
+	SearchNode &node = Node( area );
+
+	if ( node.heapIndex >= 0 )
+	{
+		// already on list
+		return;
+	}
+
+	// being on the open list means we are no longer closed
+	node.isClosed = false;
+
+	HeapEntry entry;
+	entry.totalCost = node.totalCost;
+	entry.sequence = m_sequence++;
+	entry.area = area;
+
+	int index = m_openHeap.AddToTail( entry );
+	node.heapIndex = index;
+
+	SiftUp( index );
+
+	m_maxOpenCount = MAX( m_maxOpenCount, m_openHeap.Count() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A smaller total cost has been found, update this area's position in the heap
+ */
+void CNavPathSearchState::UpdateOnOpenList( CNavArea *area )
+{
+	SearchNode &node = Node( area );
+
+	if ( node.heapIndex < 0 )
+	{
+		AddToOpenList( area );
+		return;
+	}
+
+	// since value can only decrease, sift this area up from its current spot
+	HeapEntry &entry = m_openHeap[ node.heapIndex ];
+	Assert( node.totalCost <= entry.totalCost );
+	if ( node.totalCost < entry.totalCost )
+	{
+		// like CNavArea::UpdateOnOpenList(), go behind the areas already open at the new cost
+		entry.totalCost = node.totalCost;
+		entry.sequence = m_sequence++;
+		SiftUp( node.heapIndex );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Remove and return the lowest cost area on the open list
+ */
+CNavArea *CNavPathSearchState::PopOpenList( void )
+{
+	if ( m_openHeap.Count() == 0 )
+		return NULL;
+
+	CNavArea *area = m_openHeap[0].area;
+	Node( area ).heapIndex = -1;
+
+	int last = m_openHeap.Count() - 1;
+	if ( last > 0 )
+	{
+		HeapMove( 0, m_openHeap[ last ] );
+		m_openHeap.FastRemove( last );
+		SiftDown( 0 );
+	}
+	else
+	{
+		m_openHeap.RemoveAll();
+	}
+
+	return area;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearchState::AddToClosedList( CNavArea *area )
+{
+	SearchNode &node = Node( area );
+
+	Assert( node.heapIndex < 0 );
+	node.isClosed = true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store entry at the given heap index, keeping the owning node's back-index current
+ */
+void CNavPathSearchState::HeapMove( int to, const HeapEntry &entry )
+{
+	m_openHeap[ to ] = entry;
+	m_node[ entry.area->GetID() ].heapIndex = to;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearchState::SiftUp( int index )
+{
+	HeapEntry entry = m_openHeap[ index ];
+
+	while( index > 0 )
+	{
+		int parent = ( index - 1 ) / 2;
+		if ( !IsHeapLess( entry, m_openHeap[ parent ] ) )
+			break;
+
+		HeapMove( index, m_openHeap[ parent ] );
+		index = parent;
+	}
+
+	HeapMove( index, entry );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearchState::SiftDown( int index )
+{
+	int count = m_openHeap.Count();
+	HeapEntry entry = m_openHeap[ index ];
+
+	while( true )
+	{
+		int child = 2 * index + 1;
+		if ( child >= count )
+			break;
+
+		// pick the smaller child
+		if ( child + 1 < count && IsHeapLess( m_openHeap[ child + 1 ], m_openHeap[ child ] ) )
+		{
+			++child;
+		}
+
+		if ( !IsHeapLess( m_openHeap[ child ], entry ) )
+			break;
+
+		HeapMove( index, m_openHeap[ child ] );
+		index = child;
+	}
+
+	HeapMove( index, entry );
+}
@@ -84,6 +84,195 @@ public:
 	}
 };
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search state for a single NavAreaBuildPath() query.
+ * The open list is an indexed binary heap ordered by total cost, and per-area cost, parent, and 
+ * open/closed status live here instead of in the CNavArea, so independent queries do not share state.
+ * Nodes are indexed by area ID and invalidated in bulk by bumping the generation for each new search.
+ */
+class CNavPathSearchState
+{
+public:
+	CNavPathSearchState( void );
+
+	void Reset( void );											// begin a new search, invalidating all node state
+
+	bool IsOpenListEmpty( void ) const		{ return m_openHeap.Count() == 0; }
+	void AddToOpenList( CNavArea *area );						// add to open list, keyed by current total cost
+	void UpdateOnOpenList( CNavArea *area );					// a smaller total cost has been found, restore heap order
+	CNavArea *PopOpenList( void );								// remove and return the lowest cost area on the open list
+	void AddToClosedList( CNavArea *area );
+
+	bool IsOpen( const CNavArea *area ) const;
+	bool IsClosed( const CNavArea *area ) const;
+
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( const CNavArea *area ) const;
+	NavTraverseType GetParentHow( const CNavArea *area ) const;
+
+	void SetTotalCost( CNavArea *area, float value );
+	float GetTotalCost( const CNavArea *area ) const;
+
+	void SetCostSoFar( CNavArea *area, float value );
+	float GetCostSoFar( const CNavArea *area ) const;
+
+	void SetPathLengthSoFar( CNavArea *area, float value );
+	float GetPathLengthSoFar( const CNavArea *area ) const;
+
+	int GetMaxOpenListSize( void ) const	{ return m_maxOpenCount; }	// high-water mark of the open list for the current search
+
+private:
+	struct SearchNode
+	{
+		CNavArea *parent;
+		float costSoFar;
+		float totalCost;
+		float pathLengthSoFar;
+		int heapIndex;											// index into m_openHeap, or -1 if not open
+		bool isClosed;
+		unsigned int generation;								// node is only valid if this equals m_generation
+		NavTraverseType parentHow;
+	};
+
+	struct HeapEntry
+	{
+		float totalCost;
+		unsigned int sequence;									// when the area was added or its cost last lowered, so equal costs pop in the same order as CNavArea's sorted open list
+		CNavArea *area;
+	};
+
+	SearchNode &Node( const CNavArea *area );					// fetch node, initializing it for this search if needed
+	const SearchNode *FindNode( const CNavArea *area ) const;	// NULL if area has not been touched in this search
+
+	bool IsHeapLess( const HeapEntry &a, const HeapEntry &b ) const
+	{
+		return ( a.totalCost < b.totalCost ) || ( a.totalCost == b.totalCost && a.sequence < b.sequence );
+	}
+	void SiftUp( int index );
+	void SiftDown( int index );
+	void HeapMove( int to, const HeapEntry &entry );
+
+	CUtlVector< SearchNode > m_node;							// indexed by area ID
+	CUtlVector< HeapEntry > m_openHeap;
+	unsigned int m_generation;
+	unsigned int m_sequence;
+	int m_maxOpenCount;
+};
+
+inline const CNavPathSearchState::SearchNode *CNavPathSearchState::FindNode( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_node.Count() || m_node[ id ].generation != m_generation )
+		return NULL;
+
+	return &m_node[ id ];
+}
+
+inline bool CNavPathSearchState::IsOpen( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node && node->heapIndex >= 0;
+}
+
+inline bool CNavPathSearchState::IsClosed( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node && node->isClosed;
+}
+
+inline void CNavPathSearchState::SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how )
+{
+	SearchNode &node = Node( area );
+	node.parent = parent;
+	node.parentHow = how;
+}
+
+inline CNavArea *CNavPathSearchState::GetParent( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node ? node->parent : NULL;
+}
+
+inline NavTraverseType CNavPathSearchState::GetParentHow( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node ? node->parentHow : NUM_TRAVERSE_TYPES;
+}
+
+inline void CNavPathSearchState::SetTotalCost( CNavArea *area, float value )
+{
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	Node( area ).totalCost = value;
+}
+
+inline float CNavPathSearchState::GetTotalCost( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node ? node->totalCost : 0.0f;
+}
+
+inline void CNavPathSearchState::SetCostSoFar( CNavArea *area, float value )
+{
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	Node( area ).costSoFar = value;
+}
+
+inline float CNavPathSearchState::GetCostSoFar( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node ? node->costSoFar : 0.0f;
+}
+
+inline void CNavPathSearchState::SetPathLengthSoFar( CNavArea *area, float value )
+{
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	Node( area ).pathLengthSoFar = value;
+}
+
+inline float CNavPathSearchState::GetPathLengthSoFar( const CNavArea *area ) const
+{
+	const SearchNode *node = FindNode( area );
+	return node ? node->pathLengthSoFar : 0.0f;
+}
+
+inline CNavPathSearchState::SearchNode &CNavPathSearchState::Node( const CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_node.Count() )
+	{
+		// new areas may have been created since the last search
+		int oldCount = m_node.Count();
+		m_node.AddMultipleToTail( id + 1 - oldCount );
+		for( int i=oldCount; i<m_node.Count(); ++i )
+		{
+			m_node[i].generation = 0;
+		}
+	}
+
+	SearchNode &node = m_node[ id ];
+	if ( node.generation != m_generation )
+	{
+		node.generation = m_generation;
+		node.parent = NULL;
+		node.parentHow = NUM_TRAVERSE_TYPES;
+		node.costSoFar = 0.0f;
+		node.totalCost = 0.0f;
+		node.pathLengthSoFar = 0.0f;
+		node.heapIndex = -1;
+		node.isClosed = false;
+	}
+
+	return node;
+}
+
+/**
+ * The search state used by NavAreaBuildPath() when the caller does not supply one.
+ * Only valid on the main thread.
+ */
+extern CNavPathSearchState TheNavPathSearchState;
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
@@ -94,14 +283,22 @@ public:
  * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
  * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
  * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
+ * If 'searchState' is NULL, the main thread search state is used and the resulting costs and parent
+ * pointers are also written to the areas themselves, so cost functors and callers may use
+ * CNavArea::GetCostSoFar() and CNavArea::GetParent() as before. If 'searchState' is given, the
+ * areas are not modified and the path must be read back with searchState->GetParent().
  * Returns true if a path exists.
  */
 #define IGNORE_NAV_BLOCKERS true
 template< typename CostFunctor >
-bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false, CNavPathSearchState *searchState = NULL )
 {
 	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
 
+	// only the shared main thread state is mirrored back into the areas
+	bool updateAreas = ( searchState == NULL );
+	CNavPathSearchState &state = updateAreas ? TheNavPathSearchState : *searchState;
+
 	if ( closestArea )
 	{
 		*closestArea = startArea;
@@ -111,7 +308,14 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	if (startArea == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	// start search
+	state.Reset();
+
+	state.SetParent( startArea, NULL );
+	if ( updateAreas )
+	{
+		startArea->SetParent( NULL );
+	}
 
 	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
 		goalArea = NULL;
@@ -128,29 +332,35 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	// determine actual goal position
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
-	// start search
-	CNavArea::ClearSearchLists();
-
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	float initTotalCost = (startArea->GetCenter() - actualGoalPos).Length();
 
 	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
 
-	startArea->AddToOpenList();
+	state.SetTotalCost( startArea, initTotalCost );
+	state.SetCostSoFar( startArea, initCost );
+	state.SetPathLengthSoFar( startArea, 0.0 );
+
+	if ( updateAreas )
+	{
+		startArea->SetTotalCost( initTotalCost );
+		startArea->SetCostSoFar( initCost );
+		startArea->SetPathLengthSoFar( 0.0 );
+	}
+
+	state.AddToOpenList( startArea );
 
 	// keep track of the area we visit that is closest to the goal
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = initTotalCost;
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !state.IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		CNavArea *area = state.PopOpenList();
 
 
 		// don't consider blocked areas
@@ -323,7 +533,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// don't backtrack
 			Assert( newArea );
-			if ( newArea == area->GetParent() )
+			if ( newArea == state.GetParent( area ) )
 				continue;
 			if ( newArea == area ) // self neighbor?
 				continue;
@@ -346,28 +556,28 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// Safety check against a bogus functor.  The cost of the path
 			// A...B, C should always be at least as big as the path A...B.
-			Assert( newCostSoFar >= area->GetCostSoFar() );
+			float areaCostSoFar = state.GetCostSoFar( area );
+			Assert( newCostSoFar >= areaCostSoFar );
 
 			// And now that we've asserted, let's be a bit more defensive.
 			// Make sure that any jump to a new area incurs some pathfinsing
 			// cost, to avoid us spinning our wheels over insignificant cost
 			// benefit, floating point precision bug, or busted cost functor.
-			float minNewCostSoFar = area->GetCostSoFar() * 1.00001f + 0.00001f;
+			float minNewCostSoFar = areaCostSoFar * 1.00001f + 0.00001f;
 			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
 				
 			// stop if path length limit reached
+			float newLengthSoFar = 0.0f;
 			if ( bHaveMaxPathLength )
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				newLengthSoFar = state.GetPathLengthSoFar( area ) + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
-				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			if ( ( state.IsOpen( newArea ) || state.IsClosed( newArea ) ) && state.GetCostSoFar( newArea ) <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
@@ -385,30 +595,34 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
+				state.SetCostSoFar( newArea, newCostSoFar );
+				state.SetTotalCost( newArea, newCostSoFar + newCostRemaining );
+				state.SetPathLengthSoFar( newArea, newLengthSoFar );
+				state.SetParent( newArea, area, how );
 
-				if ( newArea->IsClosed() )
+				if ( updateAreas )
 				{
-					newArea->RemoveFromClosedList();
+					newArea->SetCostSoFar( newCostSoFar );
+					newArea->SetTotalCost( newCostSoFar + newCostRemaining );
+					newArea->SetPathLengthSoFar( newLengthSoFar );
+					newArea->SetParent( area, how );
 				}
 
-				if ( newArea->IsOpen() )
+				if ( state.IsOpen( newArea ) )
 				{
-					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
+					// area already on open list, update the heap to keep costs sorted
+					state.UpdateOnOpenList( newArea );
 				}
 				else
 				{
-					newArea->AddToOpenList();
+					// adding to the open list also removes it from the closed list
+					state.AddToOpenList( newArea );
 				}
-
-				newArea->SetParent( area, how );
 			}
 		}
 
 		// we have searched this area
-		area->AddToClosedList();
+		state.AddToClosedList( area );
 	}
 
 	return false;
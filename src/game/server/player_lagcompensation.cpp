@@ -10,7 +10,6 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
 
@@ -37,6 +36,16 @@ ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
+ConVar sv_unlag_firecone( "sv_unlag_firecone", "0", FCVAR_NONE, "Only lag compensate players whose bounds, swept back to the compensated time, intersect the shooter's fire cone" );
+ConVar sv_unlag_firecone_angle( "sv_unlag_firecone_angle", "20", FCVAR_NONE, "Half angle of the fire cone used by sv_unlag_firecone, in degrees", true, 0.0f, true, 180.0f );
+
+// Hitboxes stick out of the collision bounds, so bloat the bounds by this much for the fire cone test
+#define LAG_COMPENSATION_FIRECONE_BLOAT 16.0f
+
+// sv_maxunlag is at most 1 second, but FrameUpdatePostEntityThink rounds the dead time down
+// to a whole second, so records can live for up to 2 seconds
+#define LAG_COMPENSATION_HISTORY_SECONDS 2.0f
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -127,6 +136,206 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Purpose: History of lag records for one player.
+// A fixed capacity ring buffer stored as parallel arrays, so searching by
+// simulation time and checking the track for discontinuities only touch the
+// fields they need. Records are addressed by age: 0 is the newest record.
+//-----------------------------------------------------------------------------
+class CLagRecordTrack
+{
+public:
+	CLagRecordTrack()
+	{
+		m_capacity = 0;
+		RemoveAll();
+	}
+
+	void Init( int capacity )
+	{
+		Assert( IsPowerOfTwo( capacity ) );
+
+		m_capacity = capacity;
+		m_flSimulationTime.SetCount( capacity );
+		m_fFlags.SetCount( capacity );
+		m_vecOrigin.SetCount( capacity );
+		m_vecAngles.SetCount( capacity );
+		m_vecMinsPreScaled.SetCount( capacity );
+		m_vecMaxsPreScaled.SetCount( capacity );
+		m_masterSequence.SetCount( capacity );
+		m_masterCycle.SetCount( capacity );
+		m_layerRecords.SetCount( capacity * MAX_LAYER_RECORDS );
+		m_flPoseParameters.SetCount( capacity * MAXSTUDIOPOSEPARAM );
+
+		RemoveAll();
+	}
+
+	void Purge()
+	{
+		m_capacity = 0;
+		m_flSimulationTime.Purge();
+		m_fFlags.Purge();
+		m_vecOrigin.Purge();
+		m_vecAngles.Purge();
+		m_vecMinsPreScaled.Purge();
+		m_vecMaxsPreScaled.Purge();
+		m_masterSequence.Purge();
+		m_masterCycle.Purge();
+		m_layerRecords.Purge();
+		m_flPoseParameters.Purge();
+
+		RemoveAll();
+	}
+
+	void RemoveAll()
+	{
+		m_head = 0;
+		m_count = 0;
+		m_continuousCount = 0;
+		m_flContinuousTeleportDistanceSqr = -1.0f;
+	}
+
+	bool IsInitialized() const	{ return m_capacity > 0; }
+	int Count() const			{ return m_count; }
+
+	int Slot( int age ) const
+	{
+		Assert( age >= 0 && age < m_count );
+		return ( m_head - age ) & ( m_capacity - 1 );
+	}
+
+	LayerRecord *LayerRecords( int slot )	{ return &m_layerRecords[ slot * MAX_LAYER_RECORDS ]; }
+	float *PoseParameters( int slot )		{ return &m_flPoseParameters[ slot * MAXSTUDIOPOSEPARAM ]; }
+
+	// Make room for a new newest record and return its slot. Call CommitHead() once it is filled in.
+	int AddToHead()
+	{
+		Assert( IsInitialized() );
+
+		if ( m_count == m_capacity )
+		{
+			RemoveTail();
+		}
+
+		m_head = ( m_head + 1 ) & ( m_capacity - 1 );
+		++m_count;
+
+		return m_head;
+	}
+
+	void CommitHead( float flTeleportDistanceSqr )
+	{
+		if ( flTeleportDistanceSqr != m_flContinuousTeleportDistanceSqr )
+		{
+			UpdateContinuousCount( flTeleportDistanceSqr );
+			return;
+		}
+
+		// the older records are still continuous with each other, so only the link to the new head needs checking
+		if ( !( m_fFlags[ m_head ] & LC_ALIVE ) )
+		{
+			m_continuousCount = 0;
+		}
+		else if ( m_continuousCount > 0 && IsContinuous( 1, flTeleportDistanceSqr ) )
+		{
+			m_continuousCount = MIN( m_continuousCount + 1, m_count );
+		}
+		else
+		{
+			m_continuousCount = 1;
+		}
+	}
+
+	void RemoveTail()
+	{
+		Assert( m_count > 0 );
+		--m_count;
+		m_continuousCount = MIN( m_continuousCount, m_count );
+	}
+
+	// Return the age of the newest record at or before the given time, or of the oldest record if there is none
+	int FindRecord( float flTargetTime ) const
+	{
+		Assert( m_count > 0 );
+
+		// simulation times strictly decrease with age
+		int lo = 0;
+		int hi = m_count - 1;
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) / 2;
+			if ( m_flSimulationTime[ Slot( mid ) ] <= flTargetTime )
+			{
+				hi = mid;
+			}
+			else
+			{
+				lo = mid + 1;
+			}
+		}
+
+		return lo;
+	}
+
+	// Return how many records, starting from the newest, the player was alive for and moved
+	// between without teleporting. A player can't be backtracked past the first break.
+	int GetContinuousCount( float flTeleportDistanceSqr )
+	{
+		if ( flTeleportDistanceSqr != m_flContinuousTeleportDistanceSqr )
+		{
+			UpdateContinuousCount( flTeleportDistanceSqr );
+		}
+
+		return m_continuousCount;
+	}
+
+	// per slot data
+	CUtlVector< float >			m_flSimulationTime;
+	CUtlVector< int >			m_fFlags;
+	CUtlVector< Vector >		m_vecOrigin;
+	CUtlVector< QAngle >		m_vecAngles;
+	CUtlVector< Vector >		m_vecMinsPreScaled;
+	CUtlVector< Vector >		m_vecMaxsPreScaled;
+	CUtlVector< int >			m_masterSequence;
+	CUtlVector< float >			m_masterCycle;
+	CUtlVector< LayerRecord >	m_layerRecords;			// MAX_LAYER_RECORDS per slot
+	CUtlVector< float >			m_flPoseParameters;		// MAXSTUDIOPOSEPARAM per slot
+
+private:
+	// is the record of this age alive, and close enough to the next newer record?
+	bool IsContinuous( int age, float flTeleportDistanceSqr ) const
+	{
+		int slot = Slot( age );
+		if ( !( m_fFlags[ slot ] & LC_ALIVE ) )
+			return false;
+
+		if ( age == 0 )
+			return true;
+
+		Vector delta = m_vecOrigin[ slot ] - m_vecOrigin[ Slot( age - 1 ) ];
+		return delta.Length2DSqr() <= flTeleportDistanceSqr;
+	}
+
+	void UpdateContinuousCount( float flTeleportDistanceSqr )
+	{
+		m_continuousCount = 0;
+		while ( m_continuousCount < m_count && IsContinuous( m_continuousCount, flTeleportDistanceSqr ) )
+		{
+			++m_continuousCount;
+		}
+
+		m_flContinuousTeleportDistanceSqr = flTeleportDistanceSqr;
+	}
+
+	int		m_capacity;
+	int		m_head;					// slot of the newest record
+	int		m_count;
+
+	int		m_continuousCount;
+	float	m_flContinuousTeleportDistanceSqr;	// teleport distance m_continuousCount was computed with
+};
+
+
 //
 // Try to take the player from his current origin to vWantedPos.
 // If it can't get there, leave the player where he is.
@@ -185,6 +394,7 @@ public:
 	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_flTeleportDistanceSqr( 64 *64 )
 	{
 		m_isCurrentlyDoingCompensation = false;
+		ResetFireConeStats();
 	}
 
 	// IServerSystem stuff
@@ -209,8 +419,12 @@ public:
 
 	bool			IsCurrentlyDoingLagCompensation() const OVERRIDE { return m_isCurrentlyDoingCompensation; }
 
+	void			PrintFireConeStats() const;
+	void			ResetFireConeStats();
+
 private:
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	bool			IsInFireCone( CBasePlayer *pPlayer, float flTargetTime, const Vector &vecEye, const Vector &vecForward, float flHalfAngle );
 
 	void ClearHistory()
 	{
@@ -218,8 +432,8 @@ private:
 			m_PlayerTrack[i].Purge();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a history of lag records for each player
+	CLagRecordTrack			m_PlayerTrack[ MAX_PLAYERS ];
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -233,12 +447,54 @@ private:
 	float					m_flTeleportDistanceSqr;
 
 	bool					m_isCurrentlyDoingCompensation;	// Sentinel to prevent calling StartLagCompensation a second time before a Finish.
+
+	// sv_unlag_firecone counters
+	int						m_nFireConeSessions;	// lag compensation sessions that used the fire cone
+	int						m_nFireConeTested;		// players tested against the fire cone
+	int						m_nFireConeSkipped;		// players outside the fire cone, not backtracked
+	int						m_nFireConeRestored;	// players inside the fire cone that were backtracked and need restoring
 };
 
 static CLagCompensationManager g_LagCompensationManager( "CLagCompensationManager" );
 ILagCompensationManager *lagcompensation = &g_LagCompensationManager;
 
 
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::PrintFireConeStats() const
+{
+	Msg( "Lag compensation fire cone: %d sessions, %d players tested, %d skipped, %d restored\n",
+		m_nFireConeSessions, m_nFireConeTested, m_nFireConeSkipped, m_nFireConeRestored );
+
+	if ( m_nFireConeTested > 0 )
+	{
+		Msg( "  %.1f%% of players outside the fire cone\n", 100.0f * m_nFireConeSkipped / m_nFireConeTested );
+	}
+}
+
+void CLagCompensationManager::ResetFireConeStats()
+{
+	m_nFireConeSessions = 0;
+	m_nFireConeTested = 0;
+	m_nFireConeSkipped = 0;
+	m_nFireConeRestored = 0;
+}
+
+CON_COMMAND( sv_unlag_firecone_stats, "Print how many players sv_unlag_firecone skipped and restored. Pass 'reset' to clear the counters." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_LagCompensationManager.PrintFireConeStats();
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_LagCompensationManager.ResetFireConeStats();
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Called once per frame after all entities have had a chance to think
 //-----------------------------------------------------------------------------
@@ -257,12 +513,15 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	// remove all records before that time:
 	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
+	// enough records to cover the history at this tick rate
+	int capacity = SmallestPowerOfTwoGreaterOrEqual( TIME_TO_TICKS( LAG_COMPENSATION_HISTORY_SECONDS ) + 4 );
+
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagRecordTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
@@ -274,67 +533,67 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
+		if ( !track->IsInitialized() )
+		{
+			track->Init( capacity );
+		}
 
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->m_flSimulationTime[ track->Slot( track->Count() - 1 ) ] >= flDeadtime )
 				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+
+			track->RemoveTail();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ track->Slot( 0 ) ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		int record = track->AddToHead();
 
-		record.m_fFlags = 0;
+		track->m_fFlags[record] = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			track->m_fFlags[record] |= LC_ALIVE;
 		}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		track->m_flSimulationTime[record]	= pPlayer->GetSimulationTime();
+		track->m_vecAngles[record]			= pPlayer->GetLocalAngles();
+		track->m_vecOrigin[record]			= pPlayer->GetLocalOrigin();
+		track->m_vecMinsPreScaled[record]	= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		track->m_vecMaxsPreScaled[record]	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
 
+		LayerRecord *layerRecords = track->LayerRecords( record );
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
 			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
 			if( currentLayer )
 			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+				layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 			}
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
+		track->m_masterSequence[record] = pPlayer->GetSequence();
+		track->m_masterCycle[record] = pPlayer->GetCycle();
 
+		float *poseParameters = track->PoseParameters( record );
 		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
 		{
-			record.m_flPoseParameters[i] = pPlayer->GetPoseParameter(i);
+			poseParameters[i] = pPlayer->GetPoseParameter(i);
 		}
+
+		track->CommitHead( m_flTeleportDistanceSqr );
 	}
 
 	//Clear the current player.
@@ -411,6 +670,20 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
 	
+	float flTargetTime = TICKS_TO_TIME( targettick );
+
+	// Optionally skip players that can't be in the line of fire
+	bool bFireCone = sv_unlag_firecone.GetBool();
+	Vector vecEye, vecForward;
+	float flFireConeHalfAngle = 0.0f;
+	if ( bFireCone )
+	{
+		vecEye = player->EyePosition();
+		AngleVectors( cmd->viewangles, &vecForward );
+		flFireConeHalfAngle = DEG2RAD( sv_unlag_firecone_angle.GetFloat() );
+		++m_nFireConeSessions;
+	}
+
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
@@ -432,11 +705,71 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
 			continue;
 
+		if ( bFireCone )
+		{
+			++m_nFireConeTested;
+
+			if ( !IsInFireCone( pPlayer, flTargetTime, vecEye, vecForward, flFireConeHalfAngle ) )
+			{
+				++m_nFireConeSkipped;
+				continue;
+			}
+		}
+
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackPlayer( pPlayer, flTargetTime );
+
+		if ( bFireCone && m_RestorePlayer.Get( i - 1 ) )
+		{
+			++m_nFireConeRestored;
+		}
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Return true if the player's bounds, swept over everywhere they have been
+// between flTargetTime and now, intersect the cone the shooter is firing into
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::IsInFireCone( CBasePlayer *pPlayer, float flTargetTime, const Vector &vecEye, const Vector &vecForward, float flHalfAngle )
+{
+	VPROF_BUDGET( "IsInFireCone", "CLagCompensationManager" );
+
+	CLagRecordTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
+	if ( track->Count() <= 0 )
+		return true; // nothing to backtrack, leave it to BacktrackPlayer
+
+	Vector vecSweptMins, vecSweptMaxs;
+	pPlayer->CollisionProp()->WorldSpaceAABB( &vecSweptMins, &vecSweptMaxs );
+
+	// the backtracked position is interpolated from the found record and the one after it,
+	// both of which are included here
+	float flScale = pPlayer->GetModelScale();
+	int age = track->FindRecord( flTargetTime );
+	for ( int i = 0; i <= age; ++i )
+	{
+		int record = track->Slot( i );
+		const Vector &origin = track->m_vecOrigin[ record ];
+
+		VectorMin( vecSweptMins, origin + track->m_vecMinsPreScaled[ record ] * flScale, vecSweptMins );
+		VectorMax( vecSweptMaxs, origin + track->m_vecMaxsPreScaled[ record ] * flScale, vecSweptMaxs );
+	}
+
+	// test the sphere around the bounds against the cone
+	Vector vecCenter = 0.5f * ( vecSweptMins + vecSweptMaxs );
+	float flRadius = 0.5f * ( vecSweptMaxs - vecSweptMins ).Length() + LAG_COMPENSATION_FIRECONE_BLOAT;
+
+	Vector vecToCenter = vecCenter - vecEye;
+	float flDist = vecToCenter.Length();
+	if ( flDist <= flRadius )
+		return true;
+
+	float flCosAngle = clamp( DotProduct( vecToCenter, vecForward ) / flDist, -1.0f, 1.0f );
+	float flAngle = acos( flCosAngle );
+	float flSphereAngle = asin( flRadius / flDist );
+
+	return flAngle <= flHalfAngle + flSphereAngle;
+}
+
 void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
 {
 	Vector org;
@@ -448,93 +781,65 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	CLagRecordTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
 		return;
 
-	intp curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	// find the newest record at or before the target time
+	int age = track->FindRecord( flTargetTime );
 
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	// the player must have been alive and not teleported in every record back to that one
+	if ( age >= track->GetContinuousCount( m_flTeleportDistanceSqr ) )
 	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
-
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
-		{
-			// lost track, too much difference
-			return; 
-		}
-
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
-
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
+		// lost track
+		return;
 	}
 
-	Assert( record );
+	int record = track->Slot( age );
+	int prevRecord = ( age > 0 ) ? track->Slot( age - 1 ) : -1;
 
-	if ( !record )
+	Vector delta = track->m_vecOrigin[ track->Slot( 0 ) ] - pPlayer->GetLocalOrigin();
+	if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
 	{
-		if ( sv_unlag_debug.GetBool() )
-		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
-		}
-
-		return; // that should never happen
+		// lost track, too much difference
+		return; 
 	}
 
+	float flRecordTime = track->m_flSimulationTime[ record ];
+
 	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+	if ( prevRecord >= 0 && 
+		 (flRecordTime < flTargetTime) &&
+		 (flRecordTime < track->m_flSimulationTime[ prevRecord ]) )
 	{
 		// we didn't find the exact time but have a valid previous record
 		// so interpolate between these two records;
+		float flPrevRecordTime = track->m_flSimulationTime[ prevRecord ];
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+		Assert( flPrevRecordTime > flRecordTime );
+		Assert( flTargetTime < flPrevRecordTime );
 
 		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+		frac = ( flTargetTime - flRecordTime ) / 
+			( flPrevRecordTime - flRecordTime );
 
 		Assert( frac > 0 && frac < 1 ); // should never extrapolate
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+		ang				= Lerp( frac, track->m_vecAngles[ record ], track->m_vecAngles[ prevRecord ] );
+		org				= Lerp( frac, track->m_vecOrigin[ record ], track->m_vecOrigin[ prevRecord ] );
+		minsPreScaled	= Lerp( frac, track->m_vecMinsPreScaled[ record ], track->m_vecMinsPreScaled[ prevRecord ] );
+		maxsPreScaled	= Lerp( frac, track->m_vecMaxsPreScaled[ record ], track->m_vecMaxsPreScaled[ prevRecord ] );
 	}
 	else
 	{
 		// we found the exact record or no other record to interpolate with
 		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		org				= track->m_vecOrigin[ record ];
+		ang				= track->m_vecAngles[ record ];
+		minsPreScaled	= track->m_vecMinsPreScaled[ record ];
+		maxsPreScaled	= track->m_vecMaxsPreScaled[ record ];
 	}
 
 	// See if this is still a valid position for us to teleport to
@@ -645,8 +950,13 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	restore->m_masterSequence = pPlayer->GetSequence();
 	restore->m_masterCycle = pPlayer->GetCycle();
 
+	int recordMasterSequence = track->m_masterSequence[ record ];
+	float recordMasterCycle = track->m_masterCycle[ record ];
+	const LayerRecord *recordLayers = track->LayerRecords( record );
+	const float *recordPoseParameters = track->PoseParameters( record );
+
 	bool interpolationAllowed = false;
-	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+	if( prevRecord >= 0 && (recordMasterSequence == track->m_masterSequence[ prevRecord ]) )
 	{
 		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
 		interpolationAllowed = true;
@@ -657,37 +967,40 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	bool interpolatedMasters = false;
 	if( frac > 0.0f && interpolationAllowed )
 	{
+		int prevMasterSequence = track->m_masterSequence[ prevRecord ];
+		float prevMasterCycle = track->m_masterCycle[ prevRecord ];
+
 		interpolatedMasters = true;
-		pPlayer->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
-		pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+		pPlayer->SetSequence( Lerp( frac, recordMasterSequence, prevMasterSequence ) );
+		pPlayer->SetCycle( Lerp( frac, recordMasterCycle, prevMasterCycle ) );
 
-		if( record->m_masterCycle > prevRecord->m_masterCycle )
+		if( recordMasterCycle > prevMasterCycle )
 		{
 			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
 			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
+			float newCycle = Lerp( frac, recordMasterCycle, prevMasterCycle + 1 );
 			pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
 		}
 		else
 		{
-			pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+			pPlayer->SetCycle( Lerp( frac, recordMasterCycle, prevMasterCycle ) );
 		}
 
 		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
 		{
 			//don't lerp pose params, just pick the closest
-			pPlayer->SetPoseParameter( i, record->m_flPoseParameters[i] );
+			pPlayer->SetPoseParameter( i, recordPoseParameters[i] );
 			//pAnimating->SetPoseParameter( i, Lerp( frac, record->m_flPoseParameters[i], prevRecord->m_flPoseParameters[i] ) );
 		}
 	}
 	if( !interpolatedMasters )
 	{
-		pPlayer->SetSequence(record->m_masterSequence);
-		pPlayer->SetCycle(record->m_masterCycle);
+		pPlayer->SetSequence(recordMasterSequence);
+		pPlayer->SetCycle(recordMasterCycle);
 
 		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
 		{
-			pPlayer->SetPoseParameter( i, record->m_flPoseParameters[i] );
+			pPlayer->SetPoseParameter( i, recordPoseParameters[i] );
 		}
 	}
 
@@ -707,8 +1020,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			bool interpolated = false;
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+				const LayerRecord &recordsLayerRecord = recordLayers[layerIndex];
+				const LayerRecord &prevRecordsLayerRecord = track->LayerRecords( prevRecord )[layerIndex];
 				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
 					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
 					)
@@ -734,10 +1047,10 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			if( !interpolated )
 			{
 				//Either no interp, or interp failed.  Just use record.
-				currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
-				currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
-				currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
-				currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
+				currentLayer->m_flCycle = recordLayers[layerIndex].m_cycle;
+				currentLayer->m_nOrder = recordLayers[layerIndex].m_order;
+				currentLayer->m_nSequence = recordLayers[layerIndex].m_sequence;
+				currentLayer->m_flWeight = recordLayers[layerIndex].m_weight;
 			}
 		}
 	}
@@ -816,6 +816,28 @@ NavErrorType CTFNavArea::Load( CUtlBuffer &fileBuffer, unsigned int version, uns
 }
 
 
+//------------------------------------------------------------------------------------------------
+void CTFNavArea::SaveCompiledData( CUtlBuffer &fileBuffer ) const
+{
+	unsigned int attributes = m_attributeFlags & TF_NAV_PERSISTENT_ATTRIBUTES;
+	fileBuffer.PutUnsignedInt( attributes );
+}
+
+
+//------------------------------------------------------------------------------------------------
+NavErrorType CTFNavArea::LoadCompiledData( CUtlBuffer &fileBuffer, unsigned int subVersion )
+{
+	m_attributeFlags = fileBuffer.GetUnsignedInt();
+	if ( !fileBuffer.IsValid() )
+	{
+		Warning( "Can't read TF-specific attributes\n" );
+		return NAV_INVALID_FILE;
+	}
+
+	return NAV_OK;
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 unsigned int CTFNavArea::m_masterTFMark = 1;
 
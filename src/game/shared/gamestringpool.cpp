@@ -11,15 +11,17 @@
 #include "igamesystem.h"
 #include "gamestringpool.h"
 
-#include "tier1/stringpool.h"
+#include "tier1/utlsymbol.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 //-----------------------------------------------------------------------------
-// Purpose: The actual storage for pooled per-level strings
+// Purpose: The actual storage for pooled per-level strings. Strings can be
+//			found and allocated from any thread; finding a string that is
+//			already pooled never takes a lock.
 //-----------------------------------------------------------------------------
-class CGameStringPool : public CStringPool,	public CBaseGameSystem
+class CGameStringPool : public CBaseGameSystem
 {
 	virtual char const *Name() { return "CGameStringPool"; }
 
@@ -29,6 +31,10 @@ class CGameStringPool : public CStringPool,	public CBaseGameSystem
 	}
 
 public:
+	CGameStringPool() : m_Strings( true, 512 )
+	{
+	}
+
 	~CGameStringPool()
 	{
 		Cleanup();
@@ -40,14 +46,23 @@ public:
 		PurgeDeferredDeleteList();
 		PurgeKeyLookupCache();
 	}
+
+	void FreeAll()
+	{
+		CFreeString freeString;
+		m_Strings.ForEach( freeString );
+		m_Strings.Purge();
+	}
 	
 	void PurgeDeferredDeleteList()
 	{
+		m_Strings.Lock();
 		for ( int i = 0; i < m_DeferredDeleteList.Count(); ++ i )
 		{
 			free( ( void * )m_DeferredDeleteList[ i ] );
 		}
 		m_DeferredDeleteList.Purge();
+		m_Strings.Unlock();
 	}
 
 	void PurgeKeyLookupCache()
@@ -57,26 +72,78 @@ public:
 
 	void Dump( void )
 	{
-		for ( int i = m_Strings.FirstInorder(); i != m_Strings.InvalidIndex(); i = m_Strings.NextInorder(i) )
+		CUtlVector< const char * > sorted;
+		sorted.EnsureCapacity( m_Strings.Count() );
+		CAddToList addToList( sorted );
+		m_Strings.ForEach( addToList );
+		sorted.Sort( StringSortFunc );
+
+		for ( int i = 0; i < sorted.Count(); i++ )
 		{
-			DevMsg( "  %d (0x%p) : %s\n", i, m_Strings[i], m_Strings[i] );
+			DevMsg( "  %d (0x%p) : %s\n", i, sorted[i], sorted[i] );
 		}
 		DevMsg( "\n" );
-		DevMsg( "Size:  %d items\n", m_Strings.Count() );
+		DevMsg( "Size:  %d items\n", sorted.Count() );
+	}
+
+	void DumpStats( void )
+	{
+		UtlStringSetStats_t stats;
+		m_Strings.GetStats( stats );
+		Msg( "Game strings:   %5d strings, %5d slots, %5d locked inserts, %4d contended, %4d races, %3d rehashes\n",
+			stats.m_nStrings, stats.m_nTableSize, stats.m_nLockedInserts, stats.m_nLockContention, stats.m_nInsertRaces, stats.m_nRehashes );
+
+		CUtlSymbol::GetStaticTableStats( stats );
+		Msg( "Symbol table:   %5d strings, %5d slots, %5d locked inserts, %4d contended, %4d races, %3d rehashes\n",
+			stats.m_nStrings, stats.m_nTableSize, stats.m_nLockedInserts, stats.m_nLockContention, stats.m_nInsertRaces, stats.m_nRehashes );
+	}
+
+	const char *Find( const char *pszValue )
+	{
+		return m_Strings.Find( pszValue );
+	}
+
+	const char *Allocate( const char *pszValue )
+	{
+		unsigned nHash = m_Strings.HashString( pszValue );
+		const char *pszFound = m_Strings.Find( pszValue, nHash );
+		if ( pszFound )
+			return pszFound;
+
+		m_Strings.Lock();
+		pszFound = m_Strings.Find( pszValue, nHash );
+		if ( pszFound )
+		{
+			m_Strings.NoteInsertRace();
+		}
+		else
+		{
+			pszFound = strdup( pszValue );
+			m_Strings.InsertLocked( pszFound, nHash );
+		}
+		m_Strings.Unlock();
+
+		return pszFound;
 	}
 
 	void Remove( const char *pszValue )
 	{
-		int i = m_Strings.Find( pszValue );
-		if ( i != m_Strings.InvalidIndex() )
+		// Other threads may still be looking at the string, so it's freed with the deferred list
+		m_Strings.Lock();
+		const char *pszRemoved = m_Strings.RemoveLocked( pszValue );
+		if ( pszRemoved )
 		{
-			m_DeferredDeleteList.AddToTail( m_Strings[ i ] );
-			m_Strings.RemoveAt( i );
+			m_DeferredDeleteList.AddToTail( pszRemoved );
 		}
+		m_Strings.Unlock();
 	}
 
 	const char *AllocateWithKey(const char *string, const void* key)
 	{
+		// The key cache isn't thread safe; it's only a shortcut, so other threads skip it
+		if ( !ThreadInMainThread() )
+			return Allocate( string );
+
 		const char * &cached = m_KeyLookupCache[ m_KeyLookupCache.Insert( key, NULL ) ];
 		if ( cached == NULL )
 		{
@@ -86,6 +153,25 @@ public:
 	}
 
 private:
+	struct CFreeString
+	{
+		void operator()( const char *pszValue ) { free( ( void * )pszValue ); }
+	};
+
+	struct CAddToList
+	{
+		CAddToList( CUtlVector< const char * > &list ) : m_List( list ) {}
+		void operator()( const char *pszValue ) { m_List.AddToTail( pszValue ); }
+		CUtlVector< const char * > &m_List;
+	};
+
+	static int __cdecl StringSortFunc( const char * const *ppLeft, const char * const *ppRight )
+	{
+		return Q_stricmp( *ppLeft, *ppRight );
+	}
+
+	CUtlConcurrentStringSet m_Strings;
+
 	CUtlVector< const char * > m_DeferredDeleteList;
 
 	CUtlHashtable< const void*, const char* > m_KeyLookupCache;
@@ -146,3 +232,19 @@ void CC_DumpGameStringTable( void )
 }
 static ConCommand dumpgamestringtable("dumpgamestringtable", CC_DumpGameStringTable, "Dump the contents of the game string table to the console.", FCVAR_CHEAT);
 #endif
+
+#if !defined( GC )
+#if defined( CLIENT_DLL )
+CON_COMMAND_F( cl_gamestring_stats, "Display the size and lock contention of the game string and symbol tables (client only)", FCVAR_CHEAT )
+#else
+CON_COMMAND( sv_gamestring_stats, "Display the size and lock contention of the game string and symbol tables" )
+#endif
+{
+#ifndef CLIENT_DLL
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+#endif
+
+	g_GameStringPool.DumpStats();
+}
+#endif
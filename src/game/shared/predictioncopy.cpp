@@ -21,6 +21,7 @@
 #include "predictioncopy.h"
 #include "engine/ivmodelinfo.h"
 #include "tier1/fmtstr.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1015,7 +1016,6 @@ void CPredictionCopy::CopyFields( int chain_count, datamap_t *pRootMap, typedesc
 	int				flags;
 	int				fieldOffsetSrc;
 	int				fieldOffsetDest;
-	int				fieldSize;
 
 	m_pCurrentMap = pRootMap;
 	if ( !m_pCurrentClassName )
@@ -1061,7 +1061,6 @@ void CPredictionCopy::CopyFields( int chain_count, datamap_t *pRootMap, typedesc
 
 		fieldOffsetDest = m_pCurrentField->fieldOffset[ m_nDestOffsetIndex ];
 		fieldOffsetSrc	= m_pCurrentField->fieldOffset[ m_nSrcOffsetIndex ];
-		fieldSize = m_pCurrentField->fieldSize;
 
 		pOutputData = (void *)((char *)m_pDest + fieldOffsetDest );
 		pInputData = (void const *)((char *)m_pSrc + fieldOffsetSrc );
@@ -1072,8 +1071,6 @@ void CPredictionCopy::CopyFields( int chain_count, datamap_t *pRootMap, typedesc
 
 		bool bShouldWatch = m_pWatchField == m_pCurrentField;
 
-		difftype_t difftype;
-
 		switch( m_pCurrentField->fieldType )
 		{
 		case FIELD_EMBEDDED:
@@ -1107,145 +1104,162 @@ void CPredictionCopy::CopyFields( int chain_count, datamap_t *pRootMap, typedesc
 				m_pSrc = saveSrc;
 			}
 			break;
-		case FIELD_FLOAT:
-			{
-				difftype = CompareFloat( (float *)pOutputData, (float const *)pInputData, fieldSize );
-				CopyFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
-			}
+		default:
+			TransferField( pOutputData, pInputData, bShouldWatch );
 			break;
+		}
+	}
 
-		case FIELD_TIME:
-		case FIELD_TICK:
-			Assert( 0 );
-			break;
+	m_pCurrentClassName = NULL;
+}
 
-		case FIELD_STRING:
-			{
-				difftype = CompareString( (char *)pOutputData, (char const*)pInputData );
-				CopyString( difftype, (char *)pOutputData, (char const*)pInputData );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeString( difftype,(char *)pOutputData, (char const*)pInputData );
-				if ( bShouldWatch ) WatchString( difftype,(char *)pOutputData, (char const*)pInputData );
-			}
-			break;
+//-----------------------------------------------------------------------------
+// Purpose: Compares, copies and describes m_pCurrentField, which can be any
+//			type but FIELD_EMBEDDED
+//-----------------------------------------------------------------------------
+void CPredictionCopy::TransferField( void *pOutputData, void const *pInputData, bool bShouldWatch )
+{
+	int fieldSize = m_pCurrentField->fieldSize;
+	difftype_t difftype;
 
-		case FIELD_MODELINDEX:
-			Assert( 0 );
-			break;
+	switch( m_pCurrentField->fieldType )
+	{
+	case FIELD_FLOAT:
+		{
+			difftype = CompareFloat( (float *)pOutputData, (float const *)pInputData, fieldSize );
+			CopyFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
+		}
+		break;
 
-		case FIELD_MODELNAME:
-		case FIELD_SOUNDNAME:
-			Assert( 0 );
-			break;
+	case FIELD_TIME:
+	case FIELD_TICK:
+		Assert( 0 );
+		break;
 
-		case FIELD_CUSTOM:
-			Assert( 0 );
-			break;
+	case FIELD_STRING:
+		{
+			difftype = CompareString( (char *)pOutputData, (char const*)pInputData );
+			CopyString( difftype, (char *)pOutputData, (char const*)pInputData );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeString( difftype,(char *)pOutputData, (char const*)pInputData );
+			if ( bShouldWatch ) WatchString( difftype,(char *)pOutputData, (char const*)pInputData );
+		}
+		break;
 
-		case FIELD_CLASSPTR:
-		case FIELD_EDICT:
-			Assert( 0 );
-			break;
+	case FIELD_MODELINDEX:
+		Assert( 0 );
+		break;
 
-		case FIELD_POSITION_VECTOR:
-			Assert( 0 );
-			break;
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+		Assert( 0 );
+		break;
 
-		case FIELD_VECTOR:
-			{
-				difftype = CompareVector( (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-				CopyVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_CUSTOM:
+		Assert( 0 );
+		break;
 
-		case FIELD_QUATERNION:
-			{
-				difftype = CompareQuaternion( (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-				CopyQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_CLASSPTR:
+	case FIELD_EDICT:
+		Assert( 0 );
+		break;
 
-		case FIELD_COLOR32:
-			{
-				difftype = CompareData( 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-				CopyData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-				if ( bShouldWatch ) WatchData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-			}
-			break;
+	case FIELD_POSITION_VECTOR:
+		Assert( 0 );
+		break;
 
-		case FIELD_BOOLEAN:
-			{
-				difftype = CompareBool( (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-				CopyBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_VECTOR:
+		{
+			difftype = CompareVector( (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+			CopyVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+		}
+		break;
 
-		case FIELD_INTEGER:
-			{
-				difftype = CompareInt( (int *)pOutputData, (int const *)pInputData, fieldSize );
-				CopyInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_QUATERNION:
+		{
+			difftype = CompareQuaternion( (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+			CopyQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+		}
+		break;
 
-		case FIELD_SHORT:
-			{
-				difftype = CompareShort( (short *)pOutputData, (short const *)pInputData, fieldSize );
-				CopyShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_COLOR32:
+		{
+			difftype = CompareData( 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+			CopyData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+			if ( bShouldWatch ) WatchData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+		}
+		break;
 
-		case FIELD_CHARACTER:
-			{
-				difftype = CompareData( fieldSize, ((char *)pOutputData), (const char *)pInputData );
-				CopyData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
-				
-				int valOut = *((char *)pOutputData);
-				int valIn  = *((const char *)pInputData);
-				
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, &valOut, &valIn, fieldSize );
-				if ( bShouldWatch ) WatchData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
-			}
-			break;
-		case FIELD_EHANDLE:
-			{
-				difftype = CompareEHandle( (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-				CopyEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-			}
-			break;
-		case FIELD_FUNCTION:
-			{
-			Assert( 0 );
-			}
-			break;
-		case FIELD_VOID:
-			{
-				// Don't do anything, it's an empty data description
-			}
-			break;
-		default:
-			{
-				Warning( "Bad field type\n" );
-				Assert(0);
-			}
-			break;
+	case FIELD_BOOLEAN:
+		{
+			difftype = CompareBool( (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+			CopyBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
 		}
-	}
+		break;
 
-	m_pCurrentClassName = NULL;
+	case FIELD_INTEGER:
+		{
+			difftype = CompareInt( (int *)pOutputData, (int const *)pInputData, fieldSize );
+			CopyInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
+		}
+		break;
+
+	case FIELD_SHORT:
+		{
+			difftype = CompareShort( (short *)pOutputData, (short const *)pInputData, fieldSize );
+			CopyShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
+		}
+		break;
+
+	case FIELD_CHARACTER:
+		{
+			difftype = CompareData( fieldSize, ((char *)pOutputData), (const char *)pInputData );
+			CopyData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
+			
+			int valOut = *((char *)pOutputData);
+			int valIn  = *((const char *)pInputData);
+			
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, &valOut, &valIn, fieldSize );
+			if ( bShouldWatch ) WatchData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
+		}
+		break;
+	case FIELD_EHANDLE:
+		{
+			difftype = CompareEHandle( (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+			CopyEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+		}
+		break;
+	case FIELD_FUNCTION:
+		{
+		Assert( 0 );
+		}
+		break;
+	case FIELD_VOID:
+		{
+			// Don't do anything, it's an empty data description
+		}
+		break;
+	default:
+		{
+			Warning( "Bad field type\n" );
+			Assert(0);
+		}
+		break;
+	}
 }
 
 void CPredictionCopy::TransferData_R( int chaincount, datamap_t *dmap )
@@ -1394,6 +1408,313 @@ void CPredictionCopy::DetermineWatchField( const char *operation, int entindex,
 	m_pWatchField = FindFieldByName( pwatchvar.GetString(), dmap );
 }
 
+//-----------------------------------------------------------------------------
+// Copy plans
+//
+// The fields CopyFields ends up touching only depend on the datamap, the copy
+// type and which sides are packed, so rather than walking the override chains,
+// embedded maps and flags of every field for every entity each frame, that walk
+// is done once and flattened into a list of byte ranges cached on the datamap.
+// Fields that are contiguous on both sides are merged into a single memcpy or
+// compare; only a range that differs falls back to the per field code, so the
+// error counts and what gets copied match TransferData_R exactly.
+//-----------------------------------------------------------------------------
+static ConVar pred_copyplan( "pred_copyplan", "1", 0, "Use the flattened copy plans for prediction copies that don't report, describe or watch fields." );
+
+enum
+{
+	COPYPLAN_BYTES = 0,		// memcpy, memcmp to error check
+	COPYPLAN_FLOATS,		// memcpy, float compare to error check
+	COPYPLAN_FIELD,			// always goes through TransferField
+};
+
+struct copyplanfield_t
+{
+	typedescription_t	*pField;
+	datamap_t			*pMap;
+	const char			*pClassName;
+	int					nDestOffset;
+	int					nSrcOffset;
+	int					nBytes;
+	int					nKind;
+};
+
+struct copyplanop_t
+{
+	int					nKind;
+	int					nDestOffset;
+	int					nSrcOffset;
+	int					nBytes;
+	int					nFirstField;
+	int					nFieldCount;
+};
+
+struct copyplan_t
+{
+	// Set if the map has pointers that would have to be followed
+	bool							bUseFields;
+	CUtlVector< copyplanfield_t >	fields;
+	CUtlVector< copyplanop_t >		copyOps;	// used when not error checking
+	CUtlVector< copyplanop_t >		checkOps;	// used when error checking
+};
+
+struct optimized_datamap_t
+{
+	copyplan_t		*plans[ PC_COPYTYPE_COUNT ][ TD_OFFSET_COUNT ][ TD_OFFSET_COUNT ];
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Size of a field that can be copied as a block of bytes, 0 if it can't
+//-----------------------------------------------------------------------------
+static int GetCopyPlanFieldBytes( const typedescription_t *pField )
+{
+	switch ( pField->fieldType )
+	{
+	case FIELD_FLOAT:		return sizeof( float ) * pField->fieldSize;
+	case FIELD_VECTOR:		return sizeof( Vector ) * pField->fieldSize;
+	case FIELD_QUATERNION:	return sizeof( Quaternion ) * pField->fieldSize;
+	case FIELD_COLOR32:		return 4 * pField->fieldSize;
+	case FIELD_BOOLEAN:		return sizeof( bool ) * pField->fieldSize;
+	case FIELD_INTEGER:		return sizeof( int ) * pField->fieldSize;
+	case FIELD_SHORT:		return sizeof( short ) * pField->fieldSize;
+	case FIELD_CHARACTER:	return pField->fieldSize;
+	case FIELD_EHANDLE:		return sizeof( EHANDLE ) * pField->fieldSize;
+	default:				return 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same walk as CopyFields, but records the fields instead of copying them
+//-----------------------------------------------------------------------------
+static void BuildCopyPlanFields_R( copyplan_t *pPlan, int nType, int nDestIndex, int nSrcIndex, int chain_count,
+	datamap_t *pRootMap, const char *pClassName, typedescription_t *pFields, int fieldCount, int nDestBase, int nSrcBase )
+{
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			pField->override_field->override_count = chain_count;
+		}
+
+		if ( pField->override_count == chain_count )
+			continue;
+
+		int nDestOffset = nDestBase + pField->fieldOffset[ nDestIndex ];
+		int nSrcOffset = nSrcBase + pField->fieldOffset[ nSrcIndex ];
+
+		if ( pField->fieldType == FIELD_EMBEDDED )
+		{
+			// Unpacked embedded pointers are followed, so the offsets below them aren't fixed
+			if ( ( flags & FTYPEDESC_PTR ) && ( nDestIndex == TD_OFFSET_NORMAL || nSrcIndex == TD_OFFSET_NORMAL ) )
+			{
+				pPlan->bUseFields = true;
+				return;
+			}
+
+			BuildCopyPlanFields_R( pPlan, nType, nDestIndex, nSrcIndex, chain_count, pRootMap, pField->td->dataClassName,
+				pField->td->dataDesc, pField->td->dataNumFields, nDestOffset, nSrcOffset );
+			if ( pPlan->bUseFields )
+				return;
+			continue;
+		}
+
+		if ( flags & FTYPEDESC_PRIVATE )
+			continue;
+
+		if ( nType == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+			continue;
+
+		if ( nType == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+			continue;
+
+		if ( pField->fieldType == FIELD_VOID )
+			continue;
+
+		int nBytes = GetCopyPlanFieldBytes( pField );
+		int nKind = COPYPLAN_FIELD;
+		if ( nBytes )
+		{
+			bool bFloats = pField->fieldType == FIELD_FLOAT || pField->fieldType == FIELD_VECTOR || pField->fieldType == FIELD_QUATERNION;
+			nKind = bFloats ? COPYPLAN_FLOATS : COPYPLAN_BYTES;
+		}
+
+		int j = pPlan->fields.AddToTail();
+		copyplanfield_t &planField = pPlan->fields[ j ];
+		planField.pField = pField;
+		planField.pMap = pRootMap;
+		planField.pClassName = pClassName;
+		planField.nDestOffset = nDestOffset;
+		planField.nSrcOffset = nSrcOffset;
+		planField.nBytes = nBytes;
+		planField.nKind = nKind;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Appends a field to an op list, merging it into the last op if it follows on from it
+//-----------------------------------------------------------------------------
+static void AddCopyPlanOp( CUtlVector< copyplanop_t > &ops, const copyplanfield_t &field, int nField, int nKind )
+{
+	if ( ops.Count() && nKind != COPYPLAN_FIELD )
+	{
+		copyplanop_t &last = ops.Tail();
+		if ( last.nKind == nKind &&
+			 last.nDestOffset + last.nBytes == field.nDestOffset &&
+			 last.nSrcOffset + last.nBytes == field.nSrcOffset &&
+			 last.nFirstField + last.nFieldCount == nField )
+		{
+			last.nBytes += field.nBytes;
+			last.nFieldCount++;
+			return;
+		}
+	}
+
+	copyplanop_t op;
+	op.nKind = nKind;
+	op.nDestOffset = field.nDestOffset;
+	op.nSrcOffset = field.nSrcOffset;
+	op.nBytes = field.nBytes;
+	op.nFirstField = nField;
+	op.nFieldCount = 1;
+	ops.AddToTail( op );
+}
+
+static copyplan_t *BuildCopyPlan( datamap_t *dmap, int nType, int nDestIndex, int nSrcIndex )
+{
+	copyplan_t *pPlan = new copyplan_t;
+	pPlan->bUseFields = false;
+
+	// Marks overridden fields the same way TransferData does
+	int chain_count = ++g_nChainCount;
+	for ( datamap_t *pMap = dmap; pMap && !pPlan->bUseFields; pMap = pMap->baseMap )
+	{
+		BuildCopyPlanFields_R( pPlan, nType, nDestIndex, nSrcIndex, chain_count, pMap, pMap->dataClassName,
+			pMap->dataDesc, pMap->dataNumFields, 0, 0 );
+	}
+
+	if ( pPlan->bUseFields )
+	{
+		pPlan->fields.Purge();
+		return pPlan;
+	}
+
+	for ( int i = 0; i < pPlan->fields.Count(); i++ )
+	{
+		const copyplanfield_t &field = pPlan->fields[ i ];
+
+		// Without error checking everything that isn't a string or a bad type is a straight copy
+		AddCopyPlanOp( pPlan->copyOps, field, i, field.nBytes ? COPYPLAN_BYTES : COPYPLAN_FIELD );
+
+		// Fields that aren't error checked always compare as identical, so are never copied
+		if ( field.nBytes && ( field.pField->flags & FTYPEDESC_NOERRORCHECK ) )
+			continue;
+
+		AddCopyPlanOp( pPlan->checkOps, field, i, field.nKind );
+	}
+
+	return pPlan;
+}
+
+static copyplan_t *GetCopyPlan( datamap_t *dmap, int nType, int nDestIndex, int nSrcIndex )
+{
+	// Packed offsets aren't known until the entity has been set up for prediction
+	if ( ( nDestIndex == TD_OFFSET_PACKED || nSrcIndex == TD_OFFSET_PACKED ) && !dmap->packed_offsets_computed )
+		return NULL;
+
+	if ( !dmap->optimized_map )
+	{
+		dmap->optimized_map = new optimized_datamap_t;
+		memset( dmap->optimized_map, 0, sizeof( optimized_datamap_t ) );
+	}
+
+	copyplan_t *&pPlan = dmap->optimized_map->plans[ nType ][ nDestIndex ][ nSrcIndex ];
+	if ( !pPlan )
+	{
+		pPlan = BuildCopyPlan( dmap, nType, nDestIndex, nSrcIndex );
+	}
+	return pPlan;
+}
+
+static bool CopyPlanFloatsEqual( const char *pOut, const char *pIn, int nBytes )
+{
+	Assert( ( nBytes % sizeof( float ) ) == 0 );
+	int nFloats = nBytes / sizeof( float );
+	const float *pOutFloats = (const float *)pOut;
+	const float *pInFloats = (const float *)pIn;
+
+	int i = 0;
+	for ( ; i + 4 <= nFloats; i += 4 )
+	{
+		if ( !IsAllEqual( LoadUnalignedSIMD( pOutFloats + i ), LoadUnalignedSIMD( pInFloats + i ) ) )
+			return false;
+	}
+	for ( ; i < nFloats; i++ )
+	{
+		if ( pOutFloats[ i ] != pInFloats[ i ] )
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the cached copy plan for the map. Returns false if there isn't
+//			one, in which case the fields need to be walked by TransferData_R.
+//-----------------------------------------------------------------------------
+bool CPredictionCopy::TransferData_Plan( datamap_t *dmap )
+{
+	copyplan_t *pPlan = GetCopyPlan( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+	if ( !pPlan || pPlan->bUseFields )
+		return false;
+
+	char *pDest = (char *)m_pDest;
+	const char *pSrc = (const char *)m_pSrc;
+
+	const CUtlVector< copyplanop_t > &ops = m_bErrorCheck ? pPlan->checkOps : pPlan->copyOps;
+	for ( int i = 0; i < ops.Count(); i++ )
+	{
+		const copyplanop_t &op = ops[ i ];
+		char *pOut = pDest + op.nDestOffset;
+		const char *pIn = pSrc + op.nSrcOffset;
+
+		if ( op.nKind != COPYPLAN_FIELD )
+		{
+			if ( !m_bErrorCheck )
+			{
+				if ( m_bPerformCopy )
+				{
+					memcpy( pOut, pIn, op.nBytes );
+				}
+				continue;
+			}
+
+			bool bIdentical = ( op.nKind == COPYPLAN_FLOATS ) ?
+				CopyPlanFloatsEqual( pOut, pIn, op.nBytes ) :
+				!memcmp( pOut, pIn, op.nBytes );
+			if ( bIdentical )
+				continue;
+		}
+
+		// Something differs, let the field code sort out which fields and by how much
+		for ( int j = op.nFirstField; j < op.nFirstField + op.nFieldCount; j++ )
+		{
+			const copyplanfield_t &field = pPlan->fields[ j ];
+			m_pCurrentField = field.pField;
+			m_pCurrentMap = field.pMap;
+			m_pCurrentClassName = field.pClassName;
+			m_bShouldReport = m_bReportErrors;
+			m_bShouldDescribe = true;
+
+			TransferField( pDest + field.nDestOffset, pSrc + field.nSrcOffset, false );
+		}
+	}
+
+	m_pCurrentClassName = NULL;
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *operation - 
@@ -1403,7 +1724,8 @@ void CPredictionCopy::DetermineWatchField( const char *operation, int entindex,
 //-----------------------------------------------------------------------------
 int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_t *dmap )
 {
-	++g_nChainCount;
+	// Building a copy plan uses up a chain count of its own
+	int chain_count = ++g_nChainCount;
 
 	if ( !dmap->chains_validated )
 	{
@@ -1412,7 +1734,13 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
-	TransferData_R( g_nChainCount, dmap );
+	if ( pred_copyplan.GetBool() && !m_bReportErrors && !m_bDescribeFields && !m_FieldCompareFunc && !m_pWatchField )
+	{
+		if ( TransferData_Plan( dmap ) )
+			return m_nErrorCount;
+	}
+
+	TransferData_R( chain_count, dmap );
 
 	return m_nErrorCount;
 }
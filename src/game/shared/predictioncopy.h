@@ -36,6 +36,8 @@ enum
 	PC_EVERYTHING = 0,
 	PC_NON_NETWORKED_ONLY,
 	PC_NETWORKED_ONLY,
+
+	PC_COPYTYPE_COUNT,
 };
 
 #define PC_DATA_PACKED			true
@@ -84,6 +86,7 @@ public:
 
 private:
 	void	TransferData_R( int chaincount, datamap_t *dmap );
+	bool	TransferData_Plan( datamap_t *dmap );
 
 	void	DetermineWatchField( const char *operation, int entindex,  datamap_t *dmap );
 	void	DumpWatchField( typedescription_t *field );
@@ -132,6 +135,7 @@ private:
 	bool	CanCheck( void );
 
 	void	CopyFields( int chaincount, datamap_t *pMap, typedescription_t *pFields, int fieldCount );
+	void	TransferField( void *pOutputData, void const *pInputData, bool bShouldWatch );
 
 private:
 
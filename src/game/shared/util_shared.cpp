@@ -18,6 +18,7 @@
 #endif
 #include "particle_parse.h"
 #include "KeyValues.h"
+#include "tier1/mempool.h"
 #include "time.h"
 
 #ifdef USES_ECON_ITEMS
@@ -1672,3 +1673,18 @@ const char *GetCleanMapName( const char *pszUnCleanMapName, char (&pszTmp)[256])
 
 	return pszUnCleanMapName;
 }
+
+
+#if defined( CLIENT_DLL )
+CON_COMMAND_F( cl_mempool_stats, "Display hit rates and depot traffic of the thread safe memory pools (client only)", FCVAR_CHEAT )
+#else
+CON_COMMAND( sv_mempool_stats, "Display hit rates and depot traffic of the thread safe memory pools" )
+#endif
+{
+#ifndef CLIENT_DLL
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+#endif
+
+	CMemoryPoolMT::DumpStats( Msg );
+}
@@ -248,13 +248,16 @@ void CVoiceGameMgr::UpdateMasks()
 			g_SentGameRulesMasks[iClient] = gameRulesMask;
 			g_SentBanMasks[iClient] = g_BanMasks[iClient];
 
+			// same bits as a WRITE_LONG per dword, written in one call
+			uint32 masks[VOICE_MAX_PLAYERS_DW * 2];
+			for(int dw=0; dw < VOICE_MAX_PLAYERS_DW; dw++)
+			{
+				masks[dw*2] = gameRulesMask.GetDWord(dw);
+				masks[dw*2+1] = g_BanMasks[iClient].GetDWord(dw);
+			}
+
 			UserMessageBegin( user, "VoiceMask" );
-				int dw;
-				for(dw=0; dw < VOICE_MAX_PLAYERS_DW; dw++)
-				{
-					WRITE_LONG(gameRulesMask.GetDWord(dw));
-					WRITE_LONG(g_BanMasks[iClient].GetDWord(dw));
-				}
+				WRITE_UBITLONG_ARRAY( masks, ARRAYSIZE( masks ), 32 );
 				WRITE_BYTE( !!g_PlayerModEnable[iClient] );
 			MessageEnd();
 		}
@@ -425,11 +425,14 @@ void CVoiceStatus::UpdateServerState(bool bForce)
 
 void CVoiceStatus::HandleVoiceMaskMsg(bf_read &msg)
 {
+	uint32 masks[VOICE_MAX_PLAYERS_DW * 2];
+	msg.ReadUBitLongArray( masks, ARRAYSIZE( masks ), 32 );
+
 	unsigned int dw;
 	for(dw=0; dw < VOICE_MAX_PLAYERS_DW; dw++)
 	{
-		m_AudiblePlayers.SetDWord(dw, (unsigned long)msg.ReadLong());
-		m_ServerBannedPlayers.SetDWord(dw, (unsigned long)msg.ReadLong());
+		m_AudiblePlayers.SetDWord(dw, masks[dw*2]);
+		m_ServerBannedPlayers.SetDWord(dw, masks[dw*2+1]);
 
 		if( voice_clientdebug.GetInt())
 		{
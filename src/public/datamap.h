@@ -249,6 +249,7 @@ typedef void (CBaseEntity::*inputfunc_t)(inputdata_t &data);
 
 struct datamap_t;
 struct typedescription_t;
+struct optimized_datamap_t;
 
 enum
 {
@@ -308,6 +309,9 @@ struct datamap_t
 #if defined( _DEBUG )
 	bool				bValidityChecked;
 #endif // _DEBUG
+
+	// Flattened copy plans built by the prediction copy code
+	optimized_datamap_t	*optimized_map;
 };
 
 
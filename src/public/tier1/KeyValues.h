@@ -39,6 +39,7 @@ class CUtlBuffer;
 class Color;
 typedef void * FileHandle_t;
 class CKeyValuesGrowableStringTable;
+struct MD5Value_t;
 
 //-----------------------------------------------------------------------------
 // Purpose: Simple recursive data access class
@@ -78,6 +79,13 @@ public:
 	//	understand the implications before using this.
 	static void SetUseGrowableStringTable( bool bUseGrowableTable );
 
+	//	LoadFromFile can keep a binary copy of every file it parses, keyed by a checksum of
+	//	the file's contents, and use it instead of parsing the text the next time the same
+	//	file is loaded. Off by default; -kvcache on the command line turns it on. The cache
+	//	lives in the write path, so only use it where the loaded files don't need to be
+	//	protected from tampering (it is not covered by sv_pure).
+	static void SetUseBinaryCache( bool bUseBinaryCache );
+
 	KeyValues( const char *setName );
 
 	//
@@ -120,6 +128,12 @@ public:
 	// File access. Set UsesEscapeSequences true, if resource file/buffer uses Escape Sequences (eg \n, \t)
 	void UsesEscapeSequences(bool state); // default false
 	void UsesConditionals(bool state); // default true
+
+	// Parse into an arena instead of allocating every key and string on its own. The keys of a file
+	// end up next to each other in memory, and large sections get a hashed FindKey. Arena keys behave
+	// like any other, but like keys using the growable string table they must not be handed to another
+	// module, which would try to free them from its own heap.
+	void UsesArena(bool state); // default false
 	bool LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL, bool refreshCache = false );
 	bool SaveToFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL, bool sortKeys = false, bool bAllowEmptyString = false, bool bCacheResult = false );
 
@@ -205,6 +219,13 @@ public:
 	void operator delete( void *pMem );
 	void operator delete( void *pMem, int nBlockUse, const char *pFileName, int nLine );
 
+private:
+	// Arena keys are constructed in place
+	void *operator new( size_t iAllocSize, void *pMem ) { return pMem; }
+	void operator delete( void *pMem, void *pPlacement ) {}
+
+public:
+
 	KeyValues& operator=( const KeyValues& src );
 
 	// Adds a chain... if we don't find stuff in this keyvalue, we'll look
@@ -271,6 +292,21 @@ private:
 	// prevent delete being called except through deleteThis()
 	~KeyValues();
 
+	// Deletes a key allocated from either the heap or an arena
+	static void DestroyKey( KeyValues *pKey );
+
+	// Allocates a key while parsing, from the parse arena if there is one
+	KeyValues *CreateParsedKey( const char *keyName );
+
+	// Builds the hashed lookups for the large sections of a tree that was just parsed into an arena
+	void BuildArenaIndices();
+
+	// -kvcache binary cache
+	bool LoadFromBinaryCache( IBaseFileSystem *filesystem, const MD5Value_t &checksum );
+	void SaveToBinaryCache( IBaseFileSystem *filesystem, const MD5Value_t &checksum );
+	bool WriteCacheKeys( CUtlBuffer &buf );
+	bool ReadCacheKeys( CUtlBuffer &buf, int nStackDepth );
+
 
 	/// Create a child key, given that we know which child is currently the last child.
 	/// This avoids the O(N^2) behaviour when adding children in sequence to KV,
@@ -330,7 +366,7 @@ private:
 	char	   m_iDataType;
 	char	   m_bHasEscapeSequences; // true, if while parsing this KeyValue, Escape Sequences are used (default false)
 	char	   m_bEvaluateConditionals; // true, if while parsing this KeyValue, conditionals blocks are evaluated (default true)
-	char	   unused[1];
+	char	   m_nArenaFlags;		// KV_ARENA_* flags, see KeyValues.cpp
 
 	KeyValues *m_pPeer;	// pointer to next key in list
 	KeyValues *m_pSub;	// pointer to Start of a new sub key list
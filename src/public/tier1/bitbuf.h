@@ -218,6 +218,15 @@ public:
 	void			WriteBitVec3Normal( const Vector& fa );
 	void			WriteBitAngles( const QAngle& fa );
 
+	// Bulk writers. These produce exactly the same bits as calling the matching single
+	// value writer for each element, but keep the pending bits in a 64-bit accumulator
+	// and check for overflow once per call. If the worst case size of the array doesn't
+	// fit they fall back to the single value writers.
+	void			WriteUBitLongArray( const uint32 *pData, int nCount, int numbits );
+	void			WriteBitCoordArray( const float *pData, int nCount );
+	void			WriteBitVec3NormalArray( const Vector *pData, int nCount );
+	void			WriteVarInt32Array( const uint32 *pData, int nCount );
+
 
 // Byte functions.
 public:
@@ -597,6 +606,13 @@ public:
 	unsigned int	ReadBitCoordBits();
 	unsigned int	ReadBitCoordMPBits( bool bIntegral, bool bLowPrecision );
 
+	// Bulk readers for data written by the bf_write bulk writers (or the equivalent
+	// sequence of single value writes). Returns false if the buffer overflowed.
+	bool			ReadUBitLongArray( uint32 *pOut, int nCount, int numbits );
+	bool			ReadBitCoordArray( float *pOut, int nCount );
+	bool			ReadBitVec3NormalArray( Vector *pOut, int nCount );
+	bool			ReadVarInt32Array( uint32 *pOut, int nCount );
+
 // Byte functions (these still read data in bit-by-bit).
 public:
 	
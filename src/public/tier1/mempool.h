@@ -106,27 +106,78 @@ protected:
 
 
 //-----------------------------------------------------------------------------
-// 
+// Thread safe pool. Each thread allocates from and frees into its own
+// magazines, small stacks of blocks, so most calls never touch shared state.
+// Magazines that run empty or fill up are swapped for others at the pool's
+// depot, which takes the lock once per magazine instead of once per block.
 //-----------------------------------------------------------------------------
 class CMemoryPoolMT : public CUtlMemoryPool
 {
 public:
-	CMemoryPoolMT(int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL) : CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner) {}
+	CMemoryPoolMT( int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL, int nAlignment = 0 );
+	~CMemoryPoolMT();
 
+	void*		Alloc()	{ return Alloc( m_BlockSize ); }
+	void*		Alloc( size_t amount );
+	void*		AllocZero()	{ return AllocZero( m_BlockSize ); }
+	void*		AllocZero( size_t amount );
+	void		Free(void *pMem);
 
-	void*		Alloc()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc(); }
-	void*		Alloc( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc( amount ); }
-	void*		AllocZero()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero(); }	
-	void*		AllocZero( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero( amount ); }
-	void		Free(void *pMem) { AUTO_LOCK( m_mutex ); CUtlMemoryPool::Free( pMem ); }
+	// Frees everything. No other thread may be using the pool.
+	void		Clear();
+
+	// Number of blocks handed out; blocks cached in magazines don't count.
+	// Only exact while no other thread is using the pool.
+	int			Count() const;
+
+	// Prints the hit rate, depot traffic and per thread peaks of every thread safe pool
+	static void DumpStats( MemoryPoolReportFunc_t pfnReport );
 
-	// Frees everything
-	void		Clear() { AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Clear(); }
 private:
-	CThreadFastMutex m_mutex; // @TODO: Rework to use tslist (toml 7/6/2007)
-};
+	enum
+	{
+		MAGAZINE_SIZE = 32,
+		MAX_DEPOT_MAGAZINES = 8,		// full magazines beyond this go back to the free list
+		MAX_CACHED_POOLS = 256,			// pools past this many skip the magazines and always lock
+	};
 
+	struct Magazine_t
+	{
+		Magazine_t	*m_pNext;
+		int			m_nCount;
+		void		*m_pBlocks[MAGAZINE_SIZE];
+	};
 
+	struct ThreadCache_t;
+	struct ThreadCacheTable_t;
+
+	ThreadCache_t *GetThreadCache();
+	ThreadCache_t *CreateThreadCache();
+	bool		LoadFullMagazine( ThreadCache_t *pCache );
+	void		UnloadFullMagazine( ThreadCache_t *pCache );
+	void		FlushMagazine( Magazine_t *pMagazine );
+	int			CountCachedBlocks() const;
+
+	mutable CThreadFastMutex m_mutex;
+
+	// The depot; everything below is guarded by m_mutex
+	Magazine_t		*m_pFullMagazines;
+	Magazine_t		*m_pEmptyMagazines;
+	int				m_nFullMagazines;
+	ThreadCache_t	*m_pThreadCaches;
+	int				m_nDepotLoads;		// full magazines handed to threads
+	int				m_nDepotUnloads;	// full magazines taken back from threads
+	int				m_nRefills;			// magazines filled from the free list
+	int				m_nFlushes;			// magazines emptied into the free list
+
+	int				m_nPoolIndex;
+	CMemoryPoolMT	*m_pNextPool;
+
+	static CTHREADLOCALPTR( ThreadCacheTable_t ) s_pThreadCacheTable;
+	static CThreadFastMutex s_PoolListMutex;
+	static CMemoryPoolMT *s_pFirstPool;
+	static int s_nPoolIndices;
+};
 //-----------------------------------------------------------------------------
 // Wrapper macro to make an allocator that returns particular typed allocations
 // and construction and destruction of objects.
@@ -376,7 +427,7 @@ inline void CClassMemoryPool<T>::Clear()
 		static   CMemoryPoolMT   s_Allocator
 
 #define DEFINE_FIXEDSIZE_ALLOCATOR_MT( _class, _initsize, _grow )					\
-	CMemoryPoolMT   _class::s_Allocator(sizeof(_class), _initsize, _grow, #_class " pool")
+	CMemoryPoolMT   _class::s_Allocator(sizeof(_class), _initsize, _grow, #_class " pool", alignof( _class ) )
 
 //-----------------------------------------------------------------------------
 // Macros that make it simple to make a class use a fixed-size allocator
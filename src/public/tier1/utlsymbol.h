@@ -23,6 +23,7 @@
 //-----------------------------------------------------------------------------
 class CUtlSymbolTable;
 class CUtlSymbolTableMT;
+struct UtlStringSetStats_t;
 
 
 //-----------------------------------------------------------------------------
@@ -59,6 +60,9 @@ public:
 
 	// Modules can choose to disable the static symbol table so to prevent accidental use of them.
 	static void DisableStaticSymbolTable();
+
+	// Contention counters of this module's static symbol table
+	static void GetStaticTableStats( UtlStringSetStats_t &stats );
 		
 protected:
 	UtlSymId_t   m_Id;
@@ -176,46 +180,165 @@ private:
 	friend class CLess;
 };
 
-class CUtlSymbolTableMT : private CUtlSymbolTable
+//-----------------------------------------------------------------------------
+// Counters for the thread safe string tables. Lookups that find their string
+// without taking the lock aren't counted, so they stay free of shared writes.
+//-----------------------------------------------------------------------------
+struct UtlStringSetStats_t
+{
+	int m_nStrings;			// strings in the set
+	int m_nTableSize;		// slots in the hash table
+	int m_nLockedInserts;	// lookups that missed and took the lock to add their string
+	int m_nLockContention;	// times the lock was already held by another thread
+	int m_nInsertRaces;		// strings that were added by another thread while waiting for the lock
+	int m_nRehashes;		// times the hash table was rebuilt
+};
+
+
+//-----------------------------------------------------------------------------
+// CUtlConcurrentStringSet:
+// description:
+//    A hash set of string pointers that can be searched from any thread
+//    without taking a lock. Adding and removing strings is serialized by a
+//    mutex. Tables that are outgrown are kept until Purge(), so a thread still
+//    probing one never touches freed memory. The set doesn't own the strings;
+//    strings that are removed must stay valid while other threads can still
+//    be looking at them.
+//-----------------------------------------------------------------------------
+class CUtlConcurrentStringSet
 {
 public:
-	CUtlSymbolTableMT( int growSize = 0, int initSize = 32, bool caseInsensitive = false )
-		: CUtlSymbolTable( growSize, initSize, caseInsensitive )
-	{
-	}
+	CUtlConcurrentStringSet( bool bCaseInsensitive = false, int nInitSize = 32 );
+	~CUtlConcurrentStringSet();
+
+	unsigned HashString( const char *pString ) const;
+
+	// Returns the string in the set that matches pString, or NULL. Lock free.
+	const char *Find( const char *pString ) const	{ return Find( pString, HashString( pString ) ); }
+	const char *Find( const char *pString, unsigned nHash ) const;
+
+	// Adding and removing strings must be done while holding the lock
+	void Lock();
+	void Unlock()	{ m_Mutex.Unlock(); }
+
+	// Adds a string that isn't in the set yet; pString must stay valid until it's removed
+	void InsertLocked( const char *pString, unsigned nHash );
+
+	// Removes the string matching pString, returning the pointer that was in the set
+	const char *RemoveLocked( const char *pString );
 
-	CUtlSymbol AddString( const char* pString )
+	// Counts a lookup that found its string only after taking the lock
+	void NoteInsertRace()	{ ++m_nInsertRaces; }
+
+	int Count() const	{ return m_nCount; }
+
+	// Visits every string; not safe while other threads add or remove strings
+	template < typename F > void ForEach( F &func ) const;
+
+	// Removes all strings and frees the outgrown tables; no other thread may be using the set
+	void Purge();
+
+	void GetStats( UtlStringSetStats_t &stats ) const;
+
+private:
+	struct Slot_t
 	{
-		m_lock.LockForWrite();
-		CUtlSymbol result = CUtlSymbolTable::AddString( pString );
-		m_lock.UnlockWrite();
-		return result;
-	}
+		const char * volatile m_pString;
+		volatile unsigned m_nHash;
+	};
 
-	CUtlSymbol Find( const char* pString ) const
+	struct Table_t
 	{
-		m_lock.LockForRead();
-		CUtlSymbol result = CUtlSymbolTable::Find( pString );
-		m_lock.UnlockRead();
-		return result;
-	}
+		Table_t *m_pRetired;	// the table this one replaced
+		int m_nMask;
+		Slot_t m_Slots[1];
+	};
+
+	static Table_t *AllocTable( int nSize );
+	void Rehash( int nSize );
+
+	// marks the slots of removed strings, so probing carries on past them
+	static const char * const s_pRemoved;
+
+	Table_t * volatile m_pTable;
+	int m_nCount;
+	int m_nUsed;			// live strings plus removed ones; only a rehash clears removed slots
+	bool m_bInsensitive;
+
+	CThreadMutex m_Mutex;
+	CInterlockedInt m_nLockedInserts;
+	CInterlockedInt m_nLockContention;
+	int m_nInsertRaces;
+	int m_nRehashes;
+};
 
-	const char* String( CUtlSymbol id ) const
+template < typename F >
+void CUtlConcurrentStringSet::ForEach( F &func ) const
+{
+	const Table_t *pTable = m_pTable;
+	for ( int i = 0; i <= pTable->m_nMask; i++ )
 	{
-		m_lock.LockForRead();
-		const char *pszResult = CUtlSymbolTable::String( id );
-		m_lock.UnlockRead();
-		return pszResult;
+		const char *pString = pTable->m_Slots[i].m_pString;
+		if ( pString && pString != s_pRemoved )
+		{
+			func( pString );
+		}
 	}
-	
+}
+
+
+//-----------------------------------------------------------------------------
+// CUtlSymbolTableMT:
+// description:
+//    A symbol table that any thread can use. Finding existing symbols and
+//    looking up their strings never takes a lock; only adding new symbols does.
+//    Strings never move once added, so String() pointers stay valid until
+//    RemoveAll().
+//-----------------------------------------------------------------------------
+class CUtlSymbolTableMT
+{
+public:
+	CUtlSymbolTableMT( int growSize = 0, int initSize = 32, bool caseInsensitive = false );
+	~CUtlSymbolTableMT();
+
+	// Finds and/or creates a symbol based on the string
+	CUtlSymbol AddString( const char* pString );
+
+	// Finds the symbol for pString
+	CUtlSymbol Find( const char* pString ) const;
+
+	// Look up the string associated with a particular symbol
+	const char* String( CUtlSymbol id ) const;
+
+	int GetNumStrings( void ) const	{ return m_nSymbols; }
+
+	// Remove all symbols in the table. No other thread may be using the table.
+	void RemoveAll();
+
+	void GetStats( UtlStringSetStats_t &stats ) const	{ m_Strings.GetStats( stats ); }
+
 private:
-#if defined(WIN32) || defined(_WIN32)
-	mutable CThreadSpinRWLock m_lock;
-#else
-	mutable CThreadRWLock m_lock;
-#endif
-};
+	enum
+	{
+		SYMBOL_BLOCK_SHIFT = 8,
+		SYMBOL_BLOCK_SIZE = 1 << SYMBOL_BLOCK_SHIFT,
+		MAX_SYMBOL_BLOCKS = ( UTL_INVAL_SYMBOL + SYMBOL_BLOCK_SIZE - 1 ) / SYMBOL_BLOCK_SIZE,
+	};
+
+	// Each string is stored right after its symbol id
+	static UtlSymId_t SymbolFromString( const char *pString );
 
+	CUtlConcurrentStringSet m_Strings;
+
+	// symbol id -> string, in blocks that are never moved once published
+	const char * volatile * volatile m_pSymbolBlocks[MAX_SYMBOL_BLOCKS];
+	volatile int m_nSymbols;
+
+	// stores the string data
+	CUtlVector<char*> m_StringPools;
+	int m_nPoolSpaceUsed;
+	int m_nPoolSize;
+};
 
 
 //-----------------------------------------------------------------------------
@@ -278,7 +401,6 @@ public:
 private:
 	//CCountedStringPool	m_StringPool;
 	HashTable* m_Strings;
-	mutable CThreadSpinRWLock m_lock;
 };
 
 
@@ -340,6 +340,9 @@ public:
 	// Add buffer to zip as a file with given name
 	void			AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType );
 
+	// Add data that IZip::PrepareBufferForZip has already converted and compressed
+	void			AddPreparedBufferToZip( const char *relativename, const void *data, int length, int uncompressedLength, CRC32_t crc, IZip::eCompressionType compressionType );
+
 	// Check if a file already exists in the zip.
 	bool			FileExistsInZip( const char *relativename );
 
@@ -985,50 +988,49 @@ static void CopyTextData( char *pDst, const char *pSrc, int dstSize, int srcSize
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Adds a new lump, or overwrites existing one
-// Input  : *relativename - 
-//			*data - 
+// Purpose: Does the text conversion, CRC and compression for a file, without
+//			touching any zip. Safe to call from several threads at once.
+// Input  : *data - 
 //			length - 
+//			outData - receives the data to store in the zip
+//			uncompressedLength - receives the size after text conversion
+//			crc - receives the CRC of the uncompressed data
 //-----------------------------------------------------------------------------
-void CZipFile::AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+bool IZip::PrepareBufferForZip( const void *data, int length, bool bTextMode, eCompressionType compressionType,
+								CUtlBuffer &outData, int &uncompressedLength, CRC32_t &crc )
 {
-	// Lower case only
-	char name[512];
-	Q_strcpy( name, relativename );
-	Q_strlower( name );
-
 	int outLength = length;
-	int uncompressedLength = length;
-	void *outData = data;
+	const void *pData = data;
 	CUtlBuffer textTransform;
-	CUtlBuffer compressionTransform;
 
 	if ( bTextMode )
 	{
-		int textLen = GetLengthOfBinStringAsText( ( const char * )outData, outLength );
+		int textLen = GetLengthOfBinStringAsText( ( const char * )pData, outLength );
 		textTransform.EnsureCapacity( textLen );
-		CopyTextData( (char *)textTransform.Base(), (char *)outData, textLen, outLength );
+		CopyTextData( (char *)textTransform.Base(), (char *)pData, textLen, outLength );
+		textTransform.SeekPut( CUtlBuffer::SEEK_HEAD, textLen );
 
-		outData = (void *)textTransform.Base();
+		pData = (void *)textTransform.Base();
 		outLength = textLen;
-		uncompressedLength = textLen;
 	}
+	uncompressedLength = outLength;
 
 	// uncompressed data final at this point (CRC is before compression)
-	CRC32_t zipCRC;
-	CRC32_Init( &zipCRC );
-	CRC32_ProcessBuffer( &zipCRC, outData, outLength );
-	CRC32_Final( &zipCRC );
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, pData, outLength );
+	CRC32_Final( &crc );
+
+	outData.Purge();
 
 #ifdef ZIP_SUPPORT_LZMA_ENCODE
 	if ( compressionType == IZip::eCompressionType_LZMA )
 	{
 		unsigned int compressedSize = 0;
-		unsigned char *pCompressedOutput = LZMA_Compress( (unsigned char *)outData, outLength, &compressedSize );
+		unsigned char *pCompressedOutput = LZMA_Compress( (unsigned char *)pData, outLength, &compressedSize );
 		if ( !pCompressedOutput || compressedSize < sizeof( lzma_header_t ) )
 		{
 			Warning( "ZipFile: LZMA compression failed\n" );
-			return;
+			return false;
 		}
 
 		// Fixup LZMA header for ZIP payload usage
@@ -1040,35 +1042,85 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 		//  LZMA Properties Data variable, defined by "LZMA Properties Size"
 		unsigned int nZIPHeader = 2 + 2 + sizeof( lzma_header_t().properties );
 		unsigned int finalCompressedSize = compressedSize - sizeof( lzma_header_t ) + nZIPHeader;
-		compressionTransform.EnsureCapacity( finalCompressedSize );
+		outData.EnsureCapacity( finalCompressedSize );
 
 		// LZMA version
-		compressionTransform.PutUnsignedChar( LZMA_SDK_VERSION_MAJOR );
-		compressionTransform.PutUnsignedChar( LZMA_SDK_VERSION_MINOR );
+		outData.PutUnsignedChar( LZMA_SDK_VERSION_MAJOR );
+		outData.PutUnsignedChar( LZMA_SDK_VERSION_MINOR );
 		// properties size
 		uint16 nSwappedPropertiesSize = LittleWord( sizeof( lzma_header_t().properties ) );
-		compressionTransform.Put( &nSwappedPropertiesSize, sizeof( nSwappedPropertiesSize ) );
+		outData.Put( &nSwappedPropertiesSize, sizeof( nSwappedPropertiesSize ) );
 		// properties
-		compressionTransform.Put( &(((lzma_header_t *)pCompressedOutput)->properties), sizeof( lzma_header_t().properties ) );
+		outData.Put( &(((lzma_header_t *)pCompressedOutput)->properties), sizeof( lzma_header_t().properties ) );
 		// payload
-		compressionTransform.Put( pCompressedOutput + sizeof( lzma_header_t ), compressedSize - sizeof( lzma_header_t ) );
+		outData.Put( pCompressedOutput + sizeof( lzma_header_t ), compressedSize - sizeof( lzma_header_t ) );
 
 		// Free original
 		free( pCompressedOutput );
 		pCompressedOutput = NULL;
-
-		outData = (void *)compressionTransform.Base();
-		outLength = finalCompressedSize;
 		// (Not updating uncompressedLength)
+		return true;
 	}
 	else
 #endif
 	/* else from ifdef */ if ( compressionType != IZip::eCompressionType_None )
 	{
 		Error( "Calling AddBufferToZip with unknown compression type\n" );
+		return false;
+	}
+
+	if ( bTextMode )
+	{
+		// the converted text is the final data, hand it over as is
+		outData.Swap( textTransform );
+	}
+	else
+	{
+		outData.Put( pData, outLength );
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a new lump, or overwrites existing one
+// Input  : *relativename - 
+//			*data - 
+//			length - 
+//-----------------------------------------------------------------------------
+void CZipFile::AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+{
+	CRC32_t zipCRC;
+	if ( compressionType == IZip::eCompressionType_None && !bTextMode )
+	{
+		// nothing to convert, so don't stage a copy of the caller's data
+		CRC32_Init( &zipCRC );
+		CRC32_ProcessBuffer( &zipCRC, data, length );
+		CRC32_Final( &zipCRC );
+
+		AddPreparedBufferToZip( relativename, data, length, length, zipCRC, compressionType );
 		return;
 	}
 
+	CUtlBuffer prepared;
+	int uncompressedLength;
+	if ( !IZip::PrepareBufferForZip( data, length, bTextMode, compressionType, prepared, uncompressedLength, zipCRC ) )
+		return;
+
+	AddPreparedBufferToZip( relativename, prepared.Base(), prepared.TellPut(), uncompressedLength, zipCRC, compressionType );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a new lump from data PrepareBufferForZip has already converted
+//			and compressed, or overwrites existing one
+//-----------------------------------------------------------------------------
+void CZipFile::AddPreparedBufferToZip( const char *relativename, const void *outData, int outLength, int uncompressedLength,
+									   CRC32_t zipCRC, IZip::eCompressionType compressionType )
+{
+	// Lower case only
+	char name[512];
+	Q_strcpy( name, relativename );
+	Q_strlower( name );
+
 	// See if entry is in list already
 	CZipEntry e;
 	e.m_Name = name;
@@ -1716,6 +1768,10 @@ public:
 	virtual void			AddBufferToZip( const char *relativename, void *data, int length,
 											bool bTextMode, eCompressionType compressionType ) OVERRIDE;
 
+	// Add buffer that PrepareBufferForZip has already converted and compressed - uses current alignment size
+	virtual void			AddPreparedBufferToZip( const char *relativename, const void *data, int length, int uncompressedLength,
+													CRC32_t crc, eCompressionType compressionType ) OVERRIDE;
+
 	// Writes out zip file to a buffer - uses current alignment size
 	// (set by file's previous alignment, or a call to ForceAlignment)
 	virtual void			SaveToBuffer( CUtlBuffer& outbuf ) OVERRIDE;
@@ -1831,6 +1887,13 @@ void CZip::AddBufferToZip( const char *relativename, void *data, int length, boo
 	m_ZipFile.AddBufferToZip( relativename, data, length, bTextMode, compressionType );
 }
 
+// Add buffer that PrepareBufferForZip has already converted and compressed
+void CZip::AddPreparedBufferToZip( const char *relativename, const void *data, int length, int uncompressedLength,
+								   CRC32_t crc, eCompressionType compressionType )
+{
+	m_ZipFile.AddPreparedBufferToZip( relativename, data, length, uncompressedLength, crc, compressionType );
+}
+
 void CZip::SaveToBuffer( CUtlBuffer& outbuf )
 {
 	m_ZipFile.SaveToBuffer( outbuf );
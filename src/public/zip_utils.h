@@ -11,6 +11,7 @@
 #endif
 
 #include "utlsymbol.h"
+#include "checksum_crc.h"
 
 class CUtlBuffer;
 #include "tier0/dbg.h"
@@ -79,6 +80,15 @@ public:
 	virtual void			SetBigEndian( bool bigEndian ) = 0;
 	virtual void			ActivateByteSwapping( bool bActivate ) = 0;
 
+	// Does the text conversion, CRC and compression AddBufferToZip would, without touching a zip,
+	// so many files can be prepared at once on different threads. Returns false if compression failed.
+	static bool				PrepareBufferForZip	( const void *data, int length, bool bTextMode, eCompressionType compressionType,
+												  CUtlBuffer &outData, int &uncompressedLength, CRC32_t &crc );
+
+	// Add a buffer from PrepareBufferForZip as a file with given name - uses current alignment size
+	virtual void			AddPreparedBufferToZip( const char *relativename, const void *data, int length, int uncompressedLength,
+													CRC32_t crc, eCompressionType compressionType ) = 0;
+
 	// Create/Release additional instances
 	// Disk Caching is necessary for large zips
 	static IZip *CreateZip( const char *pDiskCacheWritePath = NULL, bool bSortByName = false );
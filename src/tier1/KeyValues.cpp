@@ -26,6 +26,8 @@
 #include "tier0/mem.h"
 #include "utlbuffer.h"
 #include "utlhash.h"
+#include "generichash.h"
+#include "checksum_md5.h"
 #include "utlvector.h"
 #include "utlqueue.h"
 #include "UtlSortVector.h"
@@ -44,6 +46,221 @@ CKeyValuesGrowableStringTable *KeyValues::s_pGrowableStringTable = NULL;
 #define KEYVALUES_TOKEN_SIZE	4096
 static char s_pTokenBuf[KEYVALUES_TOKEN_SIZE];
 
+// Flags kept in KeyValues::m_nArenaFlags
+enum
+{
+	KV_ARENA_PARSE		= 0x01,		// UsesArena( true ): keys parsed into this one come from an arena
+	KV_ARENA_KEY		= 0x02,		// this key was allocated from an arena
+	KV_ARENA_STRING		= 0x04,		// m_sValue was allocated from the key's arena
+	KV_ARENA_INDEXED	= 0x08,		// the subkeys have a hashed index, see KeyValuesIndex_t
+};
+
+// Arenas start with a small chunk and double the size of each one after it, so a small
+// file doesn't pay for a large chunk. Every arena key is preceded by a header pointing to
+// its arena and to the index of its subkeys, which is only built for sections with at
+// least KV_ARENA_INDEX_MIN_KEYS subkeys.
+#define KV_ARENA_FIRST_CHUNK_SIZE	( 2 * 1024 )
+#define KV_ARENA_MAX_CHUNK_SIZE		( 64 * 1024 )
+#define KV_ARENA_LARGE_BLOCK		( KV_ARENA_MAX_CHUNK_SIZE / 4 )
+#define KV_ARENA_INDEX_MIN_KEYS		16
+
+struct KeyValuesIndex_t
+{
+	KeyValues	*m_pLastIndexed;	// keys after this one were added after the index was built
+	int			m_nMask;
+	KeyValues	*m_pKeys[1];		// m_nMask + 1 slots, holding the first key with each name
+};
+
+class CKeyValuesArena;
+
+struct KeyValuesArenaKeyHeader_t
+{
+	CKeyValuesArena		*m_pArena;
+	KeyValuesIndex_t	*m_pIndex;
+};
+
+class CKeyValuesArena
+{
+public:
+	CKeyValuesArena();
+	~CKeyValuesArena();
+
+	static CKeyValuesArena *FromKey( const KeyValues *pKey )
+	{
+		return ( (const KeyValuesArenaKeyHeader_t *)pKey - 1 )->m_pArena;
+	}
+
+	static KeyValuesIndex_t *&IndexOf( const KeyValues *pKey )
+	{
+		return ( (KeyValuesArenaKeyHeader_t *)pKey - 1 )->m_pIndex;
+	}
+
+	// Memory for one key; every key holds a reference to the arena
+	void				*AllocKey();
+	void				*Alloc( int nBytes, int nAlign );
+	void				Release();
+
+	KeyValuesIndex_t	*BuildIndex( KeyValues *pFirstKey, int nKeys );
+	static KeyValues	*FindInIndex( const KeyValuesIndex_t *pIndex, int keySymbol );
+
+	// Set once the indices have been built, cleared by anything that relinks or renames a key
+	bool				m_bIndicesValid;
+
+private:
+	CInterlockedInt		m_nRefs;
+	byte				*m_pCur;
+	byte				*m_pEnd;
+	int					m_nNextChunkSize;
+	CUtlVector<byte *>	m_Chunks;
+	CUtlVector<void *>	m_LargeBlocks;
+};
+
+CKeyValuesArena::CKeyValuesArena() : m_bIndicesValid( false ), m_pCur( NULL ), m_pEnd( NULL ), m_nNextChunkSize( KV_ARENA_FIRST_CHUNK_SIZE )
+{
+	// held by the parse until it's done
+	m_nRefs = 1;
+}
+
+CKeyValuesArena::~CKeyValuesArena()
+{
+	for ( int i = 0; i < m_Chunks.Count(); i++ )
+	{
+		free( m_Chunks[i] );
+	}
+	for ( int i = 0; i < m_LargeBlocks.Count(); i++ )
+	{
+		free( m_LargeBlocks[i] );
+	}
+}
+
+void *CKeyValuesArena::Alloc( int nBytes, int nAlign )
+{
+	if ( nBytes > KV_ARENA_LARGE_BLOCK )
+	{
+		// too big to share a chunk
+		void *pBlock = malloc( nBytes );
+		m_LargeBlocks.AddToTail( pBlock );
+		return pBlock;
+	}
+
+	byte *p = AlignValue( m_pCur, nAlign );
+	if ( !m_pCur || p + nBytes > m_pEnd )
+	{
+		int nChunkSize = m_nNextChunkSize;
+		while ( nChunkSize < nBytes + nAlign )
+		{
+			nChunkSize *= 2;
+		}
+		m_nNextChunkSize = MIN( nChunkSize * 2, KV_ARENA_MAX_CHUNK_SIZE );
+
+		MEM_ALLOC_CREDIT();
+		byte *pChunk = (byte *)malloc( nChunkSize );
+		m_Chunks.AddToTail( pChunk );
+		m_pEnd = pChunk + nChunkSize;
+		p = AlignValue( pChunk, nAlign );
+	}
+	m_pCur = p + nBytes;
+	return p;
+}
+
+void *CKeyValuesArena::AllocKey()
+{
+	int nSize = AlignValue( sizeof( KeyValuesArenaKeyHeader_t ) + sizeof( KeyValues ), 16 );
+	KeyValuesArenaKeyHeader_t *pHeader = (KeyValuesArenaKeyHeader_t *)Alloc( nSize, 16 );
+	pHeader->m_pArena = this;
+	pHeader->m_pIndex = NULL;
+	++m_nRefs;
+	return pHeader + 1;
+}
+
+void CKeyValuesArena::Release()
+{
+	if ( --m_nRefs == 0 )
+	{
+		delete this;
+	}
+}
+
+KeyValuesIndex_t *CKeyValuesArena::BuildIndex( KeyValues *pFirstKey, int nKeys )
+{
+	int nSlots = KV_ARENA_INDEX_MIN_KEYS;
+	while ( nSlots < nKeys * 2 )
+	{
+		nSlots *= 2;
+	}
+	KeyValuesIndex_t *pIndex = (KeyValuesIndex_t *)Alloc( sizeof( KeyValuesIndex_t ) + ( nSlots - 1 ) * sizeof( KeyValues * ), sizeof( void * ) );
+	pIndex->m_nMask = nSlots - 1;
+	memset( pIndex->m_pKeys, 0, nSlots * sizeof( KeyValues * ) );
+
+	for ( KeyValues *pKey = pFirstKey; pKey; pKey = pKey->GetNextKey() )
+	{
+		int keySymbol = pKey->GetNameSymbol();
+		int i = HashInt( keySymbol ) & pIndex->m_nMask;
+		while ( pIndex->m_pKeys[i] && pIndex->m_pKeys[i]->GetNameSymbol() != keySymbol )
+		{
+			i = ( i + 1 ) & pIndex->m_nMask;
+		}
+
+		// FindKey returns the first match, so keep the first key with each name
+		if ( !pIndex->m_pKeys[i] )
+		{
+			pIndex->m_pKeys[i] = pKey;
+		}
+		pIndex->m_pLastIndexed = pKey;
+	}
+
+	return pIndex;
+}
+
+KeyValues *CKeyValuesArena::FindInIndex( const KeyValuesIndex_t *pIndex, int keySymbol )
+{
+	int i = HashInt( keySymbol ) & pIndex->m_nMask;
+	for ( KeyValues *pKey = pIndex->m_pKeys[i]; pKey; pKey = pIndex->m_pKeys[i] )
+	{
+		if ( pKey->GetNameSymbol() == keySymbol )
+			return pKey;
+		i = ( i + 1 ) & pIndex->m_nMask;
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Looks a key up in the index of its section, if there is a valid one. Returns true
+// if the key was found, otherwise sets ppKey to the first key that isn't indexed
+// and ppLastKey to the key before it.
+//-----------------------------------------------------------------------------
+static bool FindIndexedKey( const KeyValues *pSection, int keySymbol, KeyValues **ppKey, KeyValues **ppLastKey )
+{
+	if ( !CKeyValuesArena::FromKey( pSection )->m_bIndicesValid )
+		return false;
+
+	const KeyValuesIndex_t *pIndex = CKeyValuesArena::IndexOf( pSection );
+	KeyValues *pKey = CKeyValuesArena::FindInIndex( pIndex, keySymbol );
+	if ( pKey )
+	{
+		*ppKey = pKey;
+		return true;
+	}
+
+	*ppKey = pIndex->m_pLastIndexed->GetNextKey();
+	*ppLastKey = pIndex->m_pLastIndexed;
+	return false;
+}
+
+// The arena keys being parsed come from, while a UsesArena( true ) key is loading.
+// Only touched with g_KVMutex held.
+static CKeyValuesArena *s_pParseArena = NULL;
+
+// -kvcache
+static bool s_bUseBinaryCache = false;
+static bool s_bCheckedBinaryCacheParm = false;
+#define KV_BINARY_CACHE_DIR		"cache/keyvalues"
+#define KV_BINARY_CACHE_PATH	"DEFAULT_WRITE_PATH"
+#define KV_BINARY_CACHE_MAGIC	MAKEID( 'K', 'V', 'C', '1' )
+
+// Number of #include and #base files parsed; files using them can't go in the binary cache
+static int s_nParsedIncludes = 0;
+
 
 #define INTERNALWRITE( pData, len ) InternalWrite( filesystem, f, pBuf, pData, len )
 
@@ -53,7 +270,7 @@ const int MAX_ERROR_STACK = 64;
 class CKeyValuesErrorStack
 {
 public:
-	CKeyValuesErrorStack() : m_pFilename("NULL"), m_errorIndex(0), m_maxErrorIndex(0) {}
+	CKeyValuesErrorStack() : m_pFilename("NULL"), m_errorIndex(0), m_maxErrorIndex(0), m_nErrors(0) {}
 
 	void SetFilename( const char *pFilename )
 	{
@@ -94,6 +311,7 @@ public:
 	void ReportError( const char *pError )
 	{
 		bool bSpewCR = false;
+		m_nErrors++;
 
 		Warning( "KeyValues Error: %s in file %s\n", pError, m_pFilename );
 		for ( int i = 0; i < m_maxErrorIndex; i++ )
@@ -117,11 +335,15 @@ public:
 			Warning( "\n" );
 	}
 
+	// Number of errors reported so far
+	int GetErrorCount() const { return m_nErrors; }
+
 private:
 	int		m_errorStack[MAX_ERROR_STACK];
 	const char *m_pFilename;
 	int		m_errorIndex;
 	int		m_maxErrorIndex;
+	int		m_nErrors;
 } g_KeyValuesErrorStack;
 
 
@@ -344,6 +566,42 @@ void KeyValues::SetUseGrowableStringTable( bool bUseGrowableTable )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Turns the binary cache of parsed files on or off, overriding -kvcache
+//-----------------------------------------------------------------------------
+void KeyValues::SetUseBinaryCache( bool bUseBinaryCache )
+{
+	s_bUseBinaryCache = bUseBinaryCache;
+	s_bCheckedBinaryCacheParm = true;
+}
+
+static bool UseBinaryCache()
+{
+	if ( !s_bCheckedBinaryCacheParm )
+	{
+		s_bUseBinaryCache = ( CommandLine()->FindParm( "-kvcache" ) != 0 );
+		s_bCheckedBinaryCacheParm = true;
+	}
+	return s_bUseBinaryCache;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Checksum the binary cache is keyed by. Conditionals are evaluated while
+//			parsing, so it covers what they evaluate to as well as the text.
+//-----------------------------------------------------------------------------
+static void ComputeBinaryCacheChecksum( const char *pText, int nLength, bool bEscapeSequences, bool bConditionals, MD5Value_t &checksum )
+{
+	int nSettings = ( bEscapeSequences ? 0x01 : 0 ) | ( bConditionals ? 0x02 : 0 ) | ( IsSteamDeck() ? 0x04 : 0 ) |
+		( IsX360() ? 0x08 : 0 ) | ( IsPC() ? 0x10 : 0 ) | ( IsWindows() ? 0x20 : 0 ) | ( IsOSX() ? 0x40 : 0 ) |
+		( IsLinux() ? 0x80 : 0 ) | ( IsPosix() ? 0x100 : 0 );
+
+	MD5Context_t ctx;
+	MD5Init( &ctx );
+	MD5Update( &ctx, (const unsigned char *)&nSettings, sizeof( nSettings ) );
+	MD5Update( &ctx, (const unsigned char *)pText, nLength );
+	MD5Final( checksum.bits, &ctx );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Bodys of the function pointers used for interacting with the key
 //	name string table
@@ -462,8 +720,7 @@ void KeyValues::Init()
 	m_bHasEscapeSequences = false;
 	m_bEvaluateConditionals = true;
 
-	// for future proof
-	memset( unused, 0, sizeof(unused) );
+	m_nArenaFlags = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -487,22 +744,76 @@ void KeyValues::RemoveEverything()
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		DestroyKey( dat );
 	}
 
 	for ( dat = m_pPeer; dat && dat != this; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		DestroyKey( dat );
 	}
 
-	delete [] m_sValue;
+	m_nArenaFlags &= ~KV_ARENA_INDEXED;
+
+	FreeAllocatedValue();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Deletes a key, whether it came from the heap or an arena
+//-----------------------------------------------------------------------------
+void KeyValues::DestroyKey( KeyValues *pKey )
+{
+	if ( !pKey )
+		return;
+
+	if ( pKey->m_nArenaFlags & KV_ARENA_KEY )
+	{
+		CKeyValuesArena *pArena = CKeyValuesArena::FromKey( pKey );
+		pKey->~KeyValues();
+		pArena->Release();
+	}
+	else
+	{
+		delete pKey;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees the string values
+//-----------------------------------------------------------------------------
+void KeyValues::FreeAllocatedValue()
+{
+	// arena strings go away with the arena
+	if ( !( m_nArenaFlags & KV_ARENA_STRING ) )
+	{
+		delete [] m_sValue;
+	}
+	m_nArenaFlags &= ~KV_ARENA_STRING;
 	m_sValue = NULL;
+
 	delete [] m_wsValue;
 	m_wsValue = NULL;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Allocates m_sValue while parsing, from the parse arena if this key is in it
+//-----------------------------------------------------------------------------
+void KeyValues::AllocateValueBlock( int size )
+{
+	Assert( !m_sValue && !m_wsValue );
+
+	if ( ( m_nArenaFlags & KV_ARENA_KEY ) && CKeyValuesArena::FromKey( this ) == s_pParseArena )
+	{
+		m_sValue = (char *)s_pParseArena->Alloc( size, sizeof( uint64 ) );
+		m_nArenaFlags |= KV_ARENA_STRING;
+	}
+	else
+	{
+		m_sValue = new char[size];
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *f - 
@@ -640,6 +951,22 @@ void KeyValues::UsesConditionals(bool state)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: if parser should put the keys it creates in an arena, set to true
+//-----------------------------------------------------------------------------
+void KeyValues::UsesArena(bool state)
+{
+	if ( state )
+	{
+		m_nArenaFlags |= KV_ARENA_PARSE;
+	}
+	else
+	{
+		m_nArenaFlags &= ~KV_ARENA_PARSE;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Load keyValues from disk
 //-----------------------------------------------------------------------------
@@ -716,7 +1043,29 @@ bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceN
 	{
 		buffer[fileSize] = 0; // null terminate file as EOF
 		buffer[fileSize+1] = 0; // double NULL terminating in case this is a unicode file
-		bRetOK = LoadFromBuffer( resourceName, buffer, filesystem );
+
+		// Text we've parsed before can come from the binary cache. Only for empty keys, since
+		// loading into a key that already has subkeys adds to them.
+		bool bUseBinaryCache = UseBinaryCache() && !m_pSub && !m_pPeer && m_iDataType == TYPE_NONE && !m_sValue && !m_wsValue;
+		MD5Value_t checksum;
+		if ( bUseBinaryCache )
+		{
+			ComputeBinaryCacheChecksum( buffer, fileSize, m_bHasEscapeSequences != 0, m_bEvaluateConditionals != 0, checksum );
+		}
+
+		if ( !bUseBinaryCache || !LoadFromBinaryCache( filesystem, checksum ) )
+		{
+			int nErrors = g_KeyValuesErrorStack.GetErrorCount();
+			int nIncludes = s_nParsedIncludes;
+
+			bRetOK = LoadFromBuffer( resourceName, buffer, filesystem );
+
+			// files with errors or #include/#base depend on more than their own text
+			if ( bUseBinaryCache && bRetOK && m_pSub && nErrors == g_KeyValuesErrorStack.GetErrorCount() && nIncludes == s_nParsedIncludes )
+			{
+				SaveToBinaryCache( filesystem, checksum );
+			}
+		}
 	}
 	
 	// The cache relies on the KeyValuesSystem string table, which will only be valid if we're
@@ -967,7 +1316,12 @@ void KeyValues::SaveKeyToFile( KeyValues *dat, IBaseFileSystem *filesystem, File
 //-----------------------------------------------------------------------------
 KeyValues *KeyValues::FindKey(int keySymbol) const
 {
-	for (KeyValues *dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
+	KeyValues *dat = m_pSub;
+	KeyValues *lastItem = NULL;
+	if ( ( m_nArenaFlags & KV_ARENA_INDEXED ) && FindIndexedKey( this, keySymbol, &dat, &lastItem ) )
+		return dat;
+
+	for ( ; dat != NULL; dat = dat->m_pPeer)
 	{
 		if (dat->m_iKeyName == keySymbol)
 			return dat;
@@ -1010,16 +1364,20 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 	}
 
 	KeyValues *lastItem = NULL;
-	KeyValues *dat;
-	// find the searchStr in the current peer list
-	for (dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
+	KeyValues *dat = m_pSub;
+	// large sections parsed into an arena are indexed; only the keys added since need searching
+	if ( !( m_nArenaFlags & KV_ARENA_INDEXED ) || !FindIndexedKey( this, iSearchStr, &dat, &lastItem ) )
 	{
-		lastItem = dat;	// record the last item looked at (for if we need to append to the end of the list)
-
-		// symbol compare
-		if (dat->m_iKeyName == iSearchStr)
+		// find the searchStr in the current peer list
+		for ( ; dat != NULL; dat = dat->m_pPeer)
 		{
-			break;
+			lastItem = dat;	// record the last item looked at (for if we need to append to the end of the list)
+
+			// symbol compare
+			if (dat->m_iKeyName == iSearchStr)
+			{
+				break;
+			}
 		}
 	}
 
@@ -1194,6 +1552,9 @@ void KeyValues::RemoveSubKey(KeyValues *subKey)
 	if (!subKey)
 		return;
 
+	// the index would still point at it
+	m_nArenaFlags &= ~KV_ARENA_INDEXED;
+
 	// check the list pointer
 	if (m_pSub == subKey)
 	{
@@ -1242,6 +1603,13 @@ KeyValues *KeyValues::FindLastSubKey()
 //-----------------------------------------------------------------------------
 void KeyValues::SetNextKey( KeyValues *pDat )
 {
+	// Unlinking keys from the middle of an indexed section would leave them in its index. We don't
+	// know our section, so drop every index in the arena. Appending to the end is fine.
+	if ( m_pPeer && ( m_nArenaFlags & KV_ARENA_KEY ) )
+	{
+		CKeyValuesArena::FromKey( this )->m_bIndicesValid = false;
+	}
+
 	m_pPeer = pDat;
 }
 
@@ -1595,11 +1963,8 @@ void KeyValues::SetColor( const char *keyName, Color value)
 
 void KeyValues::SetStringValue( char const *strValue )
 {
-	// delete the old value
-	delete [] m_sValue;
-	// make sure we're not storing the WSTRING  - as we're converting over to STRING
-	delete [] m_wsValue;
-	m_wsValue = NULL;
+	// delete the old value, making sure we're not storing the WSTRING - as we're converting over to STRING
+	FreeAllocatedValue();
 
 	if (!strValue)
 	{
@@ -1629,11 +1994,8 @@ void KeyValues::SetString( const char *keyName, const char *value )
 			return;
 		}
 
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, making sure we're not storing the WSTRING - as we're converting over to STRING
+		dat->FreeAllocatedValue();
 
 		if (!value)
 		{
@@ -1658,11 +2020,8 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 	KeyValues *dat = FindKey( keyName, true );
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_wsValue;
-		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		// delete the old value, making sure we're not storing the STRING - as we're converting over to WSTRING
+		dat->FreeAllocatedValue();
 
 		if (!value)
 		{
@@ -1702,11 +2061,8 @@ void KeyValues::SetUint64( const char *keyName, uint64 value )
 
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, making sure we're not storing the WSTRING - as we're converting over to STRING
+		dat->FreeAllocatedValue();
 
 		dat->m_sValue = new char[sizeof(uint64)];
 		*((uint64 *)dat->m_sValue) = value;
@@ -1730,6 +2086,12 @@ void KeyValues::SetFloat( const char *keyName, float value )
 
 void KeyValues::SetName( const char * setName )
 {
+	// our section's index would still have us under the old name
+	if ( m_nArenaFlags & KV_ARENA_KEY )
+	{
+		CKeyValuesArena::FromKey( this )->m_bIndicesValid = false;
+	}
+
 	m_iKeyName = s_pfGetSymbolForString( setName, true );
 }
 
@@ -1876,8 +2238,11 @@ void KeyValues::CopyKeyValue( const KeyValues& src, size_t tmpBufferSizeB, char*
 
 KeyValues& KeyValues::operator=( const KeyValues& src )
 {
+	// an arena key stays one
+	int nArenaKey = m_nArenaFlags & KV_ARENA_KEY;
 	RemoveEverything();
 	Init();	// reset all values
+	m_nArenaFlags = nArenaKey;
 	CopyKeyValuesFromRecursive( src );
 	return *this;
 }
@@ -2017,8 +2382,9 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	DestroyKey( m_pSub );
 	m_pSub = NULL;
+	m_nArenaFlags &= ~KV_ARENA_INDEXED;
 	m_iDataType = TYPE_NONE;
 }
 
@@ -2039,7 +2405,7 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
-	delete this;
+	DestroyKey( this );
 }
 
 //-----------------------------------------------------------------------------
@@ -2105,6 +2471,8 @@ void KeyValues::ParseIncludedKeys( char const *resourceName, const char *filetoi
 	// Append included file
 	Q_strncat( fullpath, filetoinclude, sizeof( fullpath ), COPY_ALL_CHARACTERS );
 
+	s_nParsedIncludes++;
+
 	KeyValues *newKV = new KeyValues( fullpath );
 
 	// CUtlSymbol save = s_CurrentFileSymbol;	// did that had any use ???
@@ -2259,6 +2627,14 @@ static CThreadFastMutex g_KVMutex;
 bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBaseFileSystem* pFileSystem, const char *pPathID )
 {
 	AUTO_LOCK( g_KVMutex );
+
+	// Keys parsed for UsesArena( true ) come from one arena, shared by any #include and #base files
+	CKeyValuesArena *pArena = NULL;
+	if ( ( m_nArenaFlags & KV_ARENA_PARSE ) && !s_pParseArena )
+	{
+		pArena = s_pParseArena = new CKeyValuesArena;
+	}
+
 	KeyValues *pPreviousKey = NULL;
 	KeyValues *pCurrentKey = this;
 	CUtlVector< KeyValues * > includedKeys;
@@ -2310,12 +2686,9 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBase
 
 		if ( !pCurrentKey )
 		{
-			pCurrentKey = new KeyValues( s );
+			pCurrentKey = CreateParsedKey( s );
 			Assert( pCurrentKey );
 
-			pCurrentKey->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // same format has parent use
-			pCurrentKey->UsesConditionals( m_bEvaluateConditionals != 0 );
-
 			if ( pPreviousKey )
 			{
 				pPreviousKey->SetNextKey( pCurrentKey );
@@ -2386,6 +2759,13 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBase
 
 	g_KeyValuesErrorStack.SetFilename( "" );	
 
+	if ( pArena )
+	{
+		BuildArenaIndices();
+		s_pParseArena = NULL;
+		pArena->Release();
+	}
+
 	return true;
 }
 
@@ -2466,7 +2846,8 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 
 		// Always create the key; note that this could potentially
 		// cause some duplication, but that's what we want sometimes
-		KeyValues *dat = CreateKeyUsingKnownLastChild( name, pLastChild );
+		KeyValues *dat = CreateParsedKey( name );
+		AddSubkeyUsingKnownLastChild( dat, pLastChild );
 
 		errorKey.Reset( dat->GetNameSymbol() );
 
@@ -2508,11 +2889,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 				break;
 			}
 			
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
+			dat->FreeAllocatedValue();
 
 			int len = Q_strlen( value );
 
@@ -2552,7 +2929,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 							digit -= 'A' - ( '9' + 1 );
 					retVal = ( retVal * 16 ) + ( digit - '0' );
 				}
-				dat->m_sValue = new char[sizeof(uint64)];
+				dat->AllocateValueBlock( sizeof(uint64) );
 				*((uint64 *)dat->m_sValue) = retVal;
 				dat->m_iDataType = TYPE_UINT64;
 			}
@@ -2574,7 +2951,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			if (dat->m_iDataType == TYPE_STRING)
 			{
 				// copy in the string information
-				dat->m_sValue = new char[len+1];
+				dat->AllocateValueBlock( len+1 );
 				Q_memcpy( dat->m_sValue, value, len+1 );
 			}
 
@@ -2726,8 +3103,11 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 	if ( !buffer.IsValid() ) // must be valid, no overflows etc
 		return false;
 
+	// an arena key stays one
+	int nArenaKey = m_nArenaFlags & KV_ARENA_KEY;
 	RemoveEverything(); // remove current content
 	Init();	// reset
+	m_nArenaFlags = nArenaKey;
 	
 	if ( nStackDepth > 100 )
 	{
@@ -2838,6 +3218,263 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 	return buffer.IsValid();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Indexes the large sections of this key, its peers and their subkeys
+//			that were just parsed into s_pParseArena
+//-----------------------------------------------------------------------------
+void KeyValues::BuildArenaIndices()
+{
+	for ( KeyValues *pKey = this; pKey != NULL; pKey = pKey->m_pPeer )
+	{
+		int nSubKeys = 0;
+		for ( KeyValues *dat = pKey->m_pSub; dat != NULL; dat = dat->m_pPeer )
+		{
+			nSubKeys++;
+		}
+
+		if ( nSubKeys >= KV_ARENA_INDEX_MIN_KEYS && ( pKey->m_nArenaFlags & KV_ARENA_KEY ) && CKeyValuesArena::FromKey( pKey ) == s_pParseArena )
+		{
+			CKeyValuesArena::IndexOf( pKey ) = s_pParseArena->BuildIndex( pKey->m_pSub, nSubKeys );
+			pKey->m_nArenaFlags |= KV_ARENA_INDEXED;
+		}
+
+		if ( pKey->m_pSub )
+		{
+			pKey->m_pSub->BuildArenaIndices();
+		}
+	}
+
+	s_pParseArena->m_bIndicesValid = true;
+}
+
+//-----------------------------------------------------------------------------
+// Binary cache of parsed files, for -kvcache. Each file holds the parse of one
+// text file, named after the checksum of the text:
+//
+//		int		KV_BINARY_CACHE_MAGIC
+//		byte	checksum[ MD5_DIGEST_LENGTH ]
+//		int		number of top level keys, each written as a key below
+//
+// and each key is
+//
+//		string	name
+//		byte	type
+//		...		value, if the type has one
+//		int		number of subkeys, each written as a key
+//-----------------------------------------------------------------------------
+static void GetBinaryCacheFilename( const MD5Value_t &checksum, char *pFilename, int nFilenameSize )
+{
+	char szChecksum[ MD5_DIGEST_LENGTH * 2 + 1 ];
+	V_binarytohex( checksum.bits, MD5_DIGEST_LENGTH, szChecksum, sizeof( szChecksum ) );
+	V_snprintf( pFilename, nFilenameSize, KV_BINARY_CACHE_DIR "/%s.kvc", szChecksum );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads this key and its peers from the binary cache.
+//			Returns false, leaving the key empty, if there's no usable cache file.
+//-----------------------------------------------------------------------------
+bool KeyValues::LoadFromBinaryCache( IBaseFileSystem *filesystem, const MD5Value_t &checksum )
+{
+	char szCacheFile[ MAX_PATH ];
+	GetBinaryCacheFilename( checksum, szCacheFile, sizeof( szCacheFile ) );
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( szCacheFile, KV_BINARY_CACHE_PATH, buf ) )
+		return false;
+
+	MD5Value_t fileChecksum;
+	if ( buf.GetInt() != KV_BINARY_CACHE_MAGIC )
+		return false;
+	buf.Get( fileChecksum.bits, sizeof( fileChecksum.bits ) );
+	if ( !buf.IsValid() || fileChecksum != checksum )
+		return false;
+
+	AUTO_LOCK( g_KVMutex );
+
+	CKeyValuesArena *pArena = NULL;
+	if ( ( m_nArenaFlags & KV_ARENA_PARSE ) && !s_pParseArena )
+	{
+		pArena = s_pParseArena = new CKeyValuesArena;
+	}
+
+	// the first top level key is this one, the rest are its peers
+	char token[KEYVALUES_TOKEN_SIZE];
+	int nKeys = buf.GetInt();
+	bool bOK = buf.IsValid() && nKeys > 0;
+	KeyValues *pPreviousKey = NULL;
+	for ( int i = 0; bOK && i < nKeys; i++ )
+	{
+		buf.GetString( token );
+
+		KeyValues *pKey = this;
+		if ( pPreviousKey )
+		{
+			pKey = CreateParsedKey( token );
+			pPreviousKey->SetNextKey( pKey );
+		}
+		else
+		{
+			SetName( token );
+		}
+
+		bOK = pKey->ReadCacheKeys( buf, 0 );
+		pPreviousKey = pKey;
+	}
+
+	if ( bOK )
+	{
+		if ( pArena )
+		{
+			BuildArenaIndices();
+		}
+	}
+	else
+	{
+		Warning( "KeyValues: ignoring bad cache file %s\n", szCacheFile );
+
+		RemoveEverything();
+		m_pSub = NULL;
+		m_pPeer = NULL;
+		m_iDataType = TYPE_NONE;
+	}
+
+	if ( pArena )
+	{
+		s_pParseArena = NULL;
+		pArena->Release();
+	}
+
+	return bOK;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves this key and its peers, just parsed from the text with the
+//			given checksum, to the binary cache
+//-----------------------------------------------------------------------------
+void KeyValues::SaveToBinaryCache( IBaseFileSystem *filesystem, const MD5Value_t &checksum )
+{
+	CUtlBuffer buf;
+	buf.PutInt( KV_BINARY_CACHE_MAGIC );
+	buf.Put( checksum.bits, sizeof( checksum.bits ) );
+
+	int nKeys = 0;
+	for ( KeyValues *dat = this; dat != NULL; dat = dat->m_pPeer )
+	{
+		nKeys++;
+	}
+	buf.PutInt( nKeys );
+
+	for ( KeyValues *dat = this; dat != NULL; dat = dat->m_pPeer )
+	{
+		buf.PutString( dat->GetName() );
+		if ( !dat->WriteCacheKeys( buf ) )
+			return;
+	}
+
+	char szCacheFile[ MAX_PATH ];
+	GetBinaryCacheFilename( checksum, szCacheFile, sizeof( szCacheFile ) );
+
+	((IFileSystem *)filesystem)->CreateDirHierarchy( KV_BINARY_CACHE_DIR, KV_BINARY_CACHE_PATH );
+	filesystem->WriteFile( szCacheFile, KV_BINARY_CACHE_PATH, buf );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the value and subkeys of this key to the binary cache.
+//			Returns false for values the text parser can't have made.
+//-----------------------------------------------------------------------------
+bool KeyValues::WriteCacheKeys( CUtlBuffer &buf )
+{
+	buf.PutUnsignedChar( m_iDataType );
+	switch ( m_iDataType )
+	{
+	case TYPE_NONE:
+		break;
+	case TYPE_STRING:
+		buf.PutString( m_sValue ? m_sValue : "" );
+		break;
+	case TYPE_INT:
+		buf.PutInt( m_iValue );
+		break;
+	case TYPE_FLOAT:
+		buf.PutFloat( m_flValue );
+		break;
+	case TYPE_UINT64:
+		buf.PutInt64( *((int64 *)m_sValue) );
+		break;
+	default:
+		return false;
+	}
+
+	int nSubKeys = 0;
+	for ( KeyValues *dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		nSubKeys++;
+	}
+	buf.PutInt( nSubKeys );
+
+	for ( KeyValues *dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		buf.PutString( dat->GetName() );
+		if ( !dat->WriteCacheKeys( buf ) )
+			return false;
+	}
+
+	return buf.IsValid();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads the value and subkeys of this key from the binary cache
+//-----------------------------------------------------------------------------
+bool KeyValues::ReadCacheKeys( CUtlBuffer &buf, int nStackDepth )
+{
+	if ( nStackDepth > 100 )
+		return false;
+
+	char token[KEYVALUES_TOKEN_SIZE];
+	int nType = buf.GetUnsignedChar();
+	switch ( nType )
+	{
+	case TYPE_NONE:
+		break;
+	case TYPE_STRING:
+		{
+			buf.GetString( token );
+			int len = Q_strlen( token );
+			AllocateValueBlock( len + 1 );
+			Q_memcpy( m_sValue, token, len + 1 );
+			break;
+		}
+	case TYPE_INT:
+		m_iValue = buf.GetInt();
+		break;
+	case TYPE_FLOAT:
+		m_flValue = buf.GetFloat();
+		break;
+	case TYPE_UINT64:
+		AllocateValueBlock( sizeof( uint64 ) );
+		*((uint64 *)m_sValue) = buf.GetInt64();
+		break;
+	default:
+		return false;
+	}
+	m_iDataType = nType;
+
+	int nSubKeys = buf.GetInt();
+	KeyValues *pLastChild = NULL;
+	for ( int i = 0; i < nSubKeys && buf.IsValid(); i++ )
+	{
+		buf.GetString( token );
+		KeyValues *dat = CreateParsedKey( token );
+		AddSubkeyUsingKnownLastChild( dat, pLastChild );
+		pLastChild = dat;
+
+		if ( !dat->ReadCacheKeys( buf, nStackDepth + 1 ) )
+			return false;
+	}
+
+	return buf.IsValid();
+}
+
 #include "tier0/memdbgoff.h"
 
 //-----------------------------------------------------------------------------
@@ -2870,6 +3507,27 @@ void KeyValues::operator delete( void *pMem, int nBlockUse, const char *pFileNam
 	KeyValuesSystem()->FreeKeyValuesMemory(pMem);
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Creates a key for the parser, in the parse arena if there is one
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::CreateParsedKey( const char *keyName )
+{
+	KeyValues *dat;
+	if ( s_pParseArena )
+	{
+		dat = new ( s_pParseArena->AllocKey() ) KeyValues( keyName );
+		dat->m_nArenaFlags = KV_ARENA_KEY;
+	}
+	else
+	{
+		dat = new KeyValues( keyName );
+	}
+
+	dat->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // use same format as parent does
+	dat->UsesConditionals( m_bEvaluateConditionals != 0 );
+	return dat;
+}
+
 void KeyValues::UnpackIntoStructure( KeyValuesUnpackStructure const *pUnpackTable, void *pDest, size_t DestSizeInBytes )
 {
 #ifdef DBGFLAG_ASSERT
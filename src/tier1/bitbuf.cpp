@@ -119,6 +119,125 @@ public:
 static CBitWriteMasksInit g_BitWriteMasksInit;
 
 
+// ---------------------------------------------------------------------------------------- //
+// 64-bit accumulators used by the bulk readers and writers. Pending bits are kept in a
+// register and only moved to or from the buffer a whole dword at a time. Callers must make
+// sure the bits they put or get fit in the buffer; no overflow checking is done here.
+// ---------------------------------------------------------------------------------------- //
+
+class CBitWriteAccumulator
+{
+public:
+	CBitWriteAccumulator( bf_write *pBuf )
+	{
+		m_pBuf = pBuf;
+		m_pOut = &pBuf->m_pData[ pBuf->m_iCurBit >> 5 ];
+		m_nBits = pBuf->m_iCurBit & 31;
+		m_nWritten = 0;
+
+		// Keep the bits already written to the first dword
+		m_nAccum = m_nBits ? ( LoadLittleDWord( m_pOut, 0 ) & ( ( 1u << m_nBits ) - 1 ) ) : 0;
+	}
+
+	FORCEINLINE void Put( uint32 data, int numbits )
+	{
+		Assert( numbits > 0 && numbits <= 32 );
+
+		// Bits above numbits are dropped, just like bf_write::WriteUBitLong
+		m_nAccum |= ( (uint64)data & ( ( (uint64)1 << numbits ) - 1 ) ) << m_nBits;
+		m_nBits += numbits;
+		m_nWritten += numbits;
+
+		if ( m_nBits >= 32 )
+		{
+			StoreLittleDWord( m_pOut, 0, (uint32)m_nAccum );
+			++m_pOut;
+			m_nAccum >>= 32;
+			m_nBits -= 32;
+		}
+	}
+
+	// Write out the last partial dword, preserving the bits that follow it, and advance the buffer
+	void Flush()
+	{
+		if ( m_nBits )
+		{
+			uint32 mask = ( 1u << m_nBits ) - 1;
+			uint32 dword = LoadLittleDWord( m_pOut, 0 );
+			StoreLittleDWord( m_pOut, 0, ( dword & ~mask ) | ( (uint32)m_nAccum & mask ) );
+		}
+
+		m_pBuf->m_iCurBit += m_nWritten;
+	}
+
+private:
+	bf_write *m_pBuf;
+	uint32 *m_pOut;
+	uint64 m_nAccum;
+	int m_nBits;
+	int m_nWritten;
+};
+
+class CBitReadAccumulator
+{
+public:
+	CBitReadAccumulator( bf_read *pBuf )
+	{
+		m_pBuf = pBuf;
+		m_pIn = (uint32*)pBuf->m_pData + ( pBuf->m_iCurBit >> 5 );
+		m_nSkip = pBuf->m_iCurBit & 31;
+		m_nAccum = 0;
+		m_nBits = 0;
+		m_nRead = 0;
+	}
+
+	FORCEINLINE uint32 Get( int numbits )
+	{
+		Assert( numbits > 0 && numbits <= 32 );
+
+		if ( m_nBits < numbits )
+		{
+			// Only touch the next dword once we need a bit from it, so we never read past the last one used
+			m_nAccum |= (uint64)( LoadLittleDWord( m_pIn, 0 ) >> m_nSkip ) << m_nBits;
+			m_nBits += 32 - m_nSkip;
+			m_nSkip = 0;
+			++m_pIn;
+
+			if ( m_nBits < numbits )
+			{
+				m_nAccum |= (uint64)LoadLittleDWord( m_pIn, 0 ) << m_nBits;
+				m_nBits += 32;
+				++m_pIn;
+			}
+		}
+
+		uint32 data = (uint32)( m_nAccum & ( ( (uint64)1 << numbits ) - 1 ) );
+		m_nAccum >>= numbits;
+		m_nBits -= numbits;
+		m_nRead += numbits;
+		return data;
+	}
+
+	void Flush()
+	{
+		m_pBuf->m_iCurBit += m_nRead;
+	}
+
+private:
+	bf_read *m_pBuf;
+	uint32 *m_pIn;
+	uint64 m_nAccum;
+	int m_nSkip;
+	int m_nBits;
+	int m_nRead;
+};
+
+// Worst case sizes of the values handled by the bulk readers and writers
+#define BITCOORD_MAX_BITS		( 3 + COORD_INTEGER_BITS + COORD_FRACTIONAL_BITS )
+#define BITVEC3NORMAL_MAX_BITS	( 3 + 2 * ( 1 + NORMAL_FRACTIONAL_BITS ) )
+#define VARINT32_MAX_BITS		( bitbuf::kMaxVarint32Bytes * 8 )
+
+
 // ---------------------------------------------------------------------------------------- //
 // bf_write
 // ---------------------------------------------------------------------------------------- //
@@ -716,6 +835,164 @@ void bf_write::WriteBitAngles( const QAngle& fa )
 	WriteBitVec3Coord( tmp );
 }
 
+void bf_write::WriteUBitLongArray( const uint32 *pData, int nCount, int numbits )
+{
+	Assert( numbits > 0 && numbits <= 32 );
+
+	if ( nCount <= 0 )
+		return;
+
+	if ( (int64)nCount * numbits > GetNumBitsLeft() )
+	{
+		// Let the single value writer deal with the overflow
+		for ( int i = 0; i < nCount; ++i )
+		{
+			WriteUBitLong( pData[i], numbits );
+		}
+		return;
+	}
+
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+#ifdef _DEBUG
+		if ( numbits < 32 && pData[i] >= (uint32)( 1 << numbits ) )
+		{
+			CallErrorHandler( BITBUFERROR_VALUE_OUT_OF_RANGE, GetDebugName() );
+		}
+#endif
+		accum.Put( pData[i], numbits );
+	}
+	accum.Flush();
+}
+
+void bf_write::WriteBitCoordArray( const float *pData, int nCount )
+{
+	if ( nCount <= 0 )
+		return;
+
+	if ( (int64)nCount * BITCOORD_MAX_BITS > GetNumBitsLeft() )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			WriteBitCoord( pData[i] );
+		}
+		return;
+	}
+
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		// Same fields as WriteBitCoord, packed into a single value
+		float	f = pData[i];
+		int		signbit = (f <= -COORD_RESOLUTION);
+		int		intval = (int)abs(f);
+		int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+		uint32 bits = ( intval ? 1 : 0 ) | ( fractval ? 2 : 0 );
+		int numbits = 2;
+
+		if ( intval || fractval )
+		{
+			bits |= signbit << 2;
+			numbits = 3;
+
+			if ( intval )
+			{
+				// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
+				bits |= ( (uint32)( intval - 1 ) & ( ( 1 << COORD_INTEGER_BITS ) - 1 ) ) << numbits;
+				numbits += COORD_INTEGER_BITS;
+			}
+
+			if ( fractval )
+			{
+				bits |= (uint32)fractval << numbits;
+				numbits += COORD_FRACTIONAL_BITS;
+			}
+		}
+
+		accum.Put( bits, numbits );
+	}
+	accum.Flush();
+}
+
+void bf_write::WriteBitVec3NormalArray( const Vector *pData, int nCount )
+{
+	if ( nCount <= 0 )
+		return;
+
+	if ( (int64)nCount * BITVEC3NORMAL_MAX_BITS > GetNumBitsLeft() )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			WriteBitVec3Normal( pData[i] );
+		}
+		return;
+	}
+
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		// Same fields as WriteBitVec3Normal, packed into a single value
+		const Vector &fa = pData[i];
+		int xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
+		int yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
+
+		uint32 bits = xflag | ( yflag << 1 );
+		int numbits = 2;
+
+		for ( int j = 0; j < 2; ++j )
+		{
+			if ( !( j ? yflag : xflag ) )
+				continue;
+
+			float f = fa[j];
+			int	signbit = (f <= -NORMAL_RESOLUTION);
+			unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+			if (fractval > NORMAL_DENOMINATOR)
+				fractval = NORMAL_DENOMINATOR;
+
+			bits |= ( signbit | ( fractval << 1 ) ) << numbits;
+			numbits += 1 + NORMAL_FRACTIONAL_BITS;
+		}
+
+		// z sign bit
+		bits |= (uint32)(fa[2] <= -NORMAL_RESOLUTION) << numbits;
+		++numbits;
+
+		accum.Put( bits, numbits );
+	}
+	accum.Flush();
+}
+
+void bf_write::WriteVarInt32Array( const uint32 *pData, int nCount )
+{
+	if ( nCount <= 0 )
+		return;
+
+	if ( (int64)nCount * VARINT32_MAX_BITS > GetNumBitsLeft() )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			WriteVarInt32( pData[i] );
+		}
+		return;
+	}
+
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		uint32 data = pData[i];
+		while ( data > 0x7F )
+		{
+			accum.Put( (data & 0x7F) | 0x80, 8 );
+			data >>= 7;
+		}
+		accum.Put( data, 8 );
+	}
+	accum.Flush();
+}
+
 void bf_write::WriteChar(int val)
 {
 	WriteSBitLong(val, sizeof(char) << 3);
@@ -1341,6 +1618,177 @@ void bf_read::ReadBitAngles( QAngle& fa )
 	fa.Init( tmp.x, tmp.y, tmp.z );
 }
 
+bool bf_read::ReadUBitLongArray( uint32 *pOut, int nCount, int numbits )
+{
+	Assert( numbits > 0 && numbits <= 32 );
+
+	if ( nCount <= 0 )
+		return !IsOverflowed();
+
+	if ( (int64)nCount * numbits > GetNumBitsLeft() )
+	{
+		// Let the single value reader deal with the overflow
+		for ( int i = 0; i < nCount; ++i )
+		{
+			pOut[i] = ReadUBitLong( numbits );
+		}
+		return !IsOverflowed();
+	}
+
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		pOut[i] = accum.Get( numbits );
+	}
+	accum.Flush();
+
+	return !IsOverflowed();
+}
+
+bool bf_read::ReadBitCoordArray( float *pOut, int nCount )
+{
+	if ( nCount <= 0 )
+		return !IsOverflowed();
+
+	if ( (int64)nCount * BITCOORD_MAX_BITS > GetNumBitsLeft() )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			pOut[i] = ReadBitCoord();
+		}
+		return !IsOverflowed();
+	}
+
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		uint32 flags = accum.Get( 2 );
+		float value = 0.0;
+
+		if ( flags )
+		{
+			int signbit = accum.Get( 1 );
+			int intval = 0;
+			int fractval = 0;
+
+			if ( flags & 1 )
+			{
+				// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
+				intval = accum.Get( COORD_INTEGER_BITS ) + 1;
+			}
+
+			if ( flags & 2 )
+			{
+				fractval = accum.Get( COORD_FRACTIONAL_BITS );
+			}
+
+			// Same math as ReadBitCoord, so the results match exactly
+			value = intval + ((float)fractval * COORD_RESOLUTION);
+
+			if ( signbit )
+				value = -value;
+		}
+
+		pOut[i] = value;
+	}
+	accum.Flush();
+
+	return !IsOverflowed();
+}
+
+bool bf_read::ReadBitVec3NormalArray( Vector *pOut, int nCount )
+{
+	if ( nCount <= 0 )
+		return !IsOverflowed();
+
+	if ( (int64)nCount * BITVEC3NORMAL_MAX_BITS > GetNumBitsLeft() )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			ReadBitVec3Normal( pOut[i] );
+		}
+		return !IsOverflowed();
+	}
+
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		Vector &fa = pOut[i];
+		uint32 flags = accum.Get( 2 );
+
+		for ( int j = 0; j < 2; ++j )
+		{
+			if ( flags & ( 1 << j ) )
+			{
+				uint32 normal = accum.Get( 1 + NORMAL_FRACTIONAL_BITS );
+
+				float value = (float)( normal >> 1 ) * NORMAL_RESOLUTION;
+				if ( normal & 1 )
+					value = -value;
+
+				fa[j] = value;
+			}
+			else
+			{
+				fa[j] = 0.0f;
+			}
+		}
+
+		// The first two imply the third (but not its sign)
+		int znegative = accum.Get( 1 );
+
+		float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
+		if (fafafbfb < 1.0f)
+			fa[2] = sqrt( 1.0f - fafafbfb );
+		else
+			fa[2] = 0.0f;
+
+		if (znegative)
+			fa[2] = -fa[2];
+	}
+	accum.Flush();
+
+	return !IsOverflowed();
+}
+
+bool bf_read::ReadVarInt32Array( uint32 *pOut, int nCount )
+{
+	if ( nCount <= 0 )
+		return !IsOverflowed();
+
+	if ( (int64)nCount * VARINT32_MAX_BITS > GetNumBitsLeft() )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			pOut[i] = ReadVarInt32();
+		}
+		return !IsOverflowed();
+	}
+
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		uint32 result = 0;
+		int count = 0;
+		uint32 b;
+
+		do 
+		{
+			if ( count == bitbuf::kMaxVarint32Bytes ) 
+				break;
+
+			b = accum.Get( 8 );
+			result |= (b & 0x7F) << (7 * count);
+			++count;
+		} while (b & 0x80);
+
+		pOut[i] = result;
+	}
+	accum.Flush();
+
+	return !IsOverflowed();
+}
+
 int64 bf_read::ReadLongLong()
 {
 	int64 retval;
@@ -310,3 +310,403 @@ void CUtlMemoryPool::Free( void *memBlock )
 }
 
 
+
+
+//-----------------------------------------------------------------------------
+// Thread safe pool
+//-----------------------------------------------------------------------------
+
+// One per thread per pool. Only the owning thread touches the magazines, except
+// for Clear(), Count() and the destructor, which need the pool to be idle.
+struct CMemoryPoolMT::ThreadCache_t
+{
+	Magazine_t		*m_pLoaded;
+	Magazine_t		*m_pPrevious;
+	ThreadCache_t	*m_pNext;
+	ThreadId_t		m_ThreadId;
+
+	// Written only by the owning thread, read without locking by DumpStats
+	int				m_nAllocs;
+	int				m_nFrees;
+	int				m_nDepotTrips;
+	int				m_nOutstanding;		// allocs minus frees made on this thread
+	int				m_nPeakOutstanding;
+};
+
+// Every thread's caches, indexed by pool. Never freed, as the threads don't tell us when they exit.
+struct CMemoryPoolMT::ThreadCacheTable_t
+{
+	ThreadCache_t	*m_pCaches[MAX_CACHED_POOLS];
+};
+
+CTHREADLOCALPTR( CMemoryPoolMT::ThreadCacheTable_t ) CMemoryPoolMT::s_pThreadCacheTable;
+
+CThreadFastMutex CMemoryPoolMT::s_PoolListMutex;
+CMemoryPoolMT *CMemoryPoolMT::s_pFirstPool = NULL;
+int CMemoryPoolMT::s_nPoolIndices = 0;
+
+
+CMemoryPoolMT::CMemoryPoolMT( int blockSize, int numElements, int growMode, const char *pszAllocOwner, int nAlignment ) :
+	CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner, nAlignment )
+{
+	m_pFullMagazines = NULL;
+	m_pEmptyMagazines = NULL;
+	m_nFullMagazines = 0;
+	m_pThreadCaches = NULL;
+	m_nDepotLoads = 0;
+	m_nDepotUnloads = 0;
+	m_nRefills = 0;
+	m_nFlushes = 0;
+
+	// Indices aren't reused, since threads may still point at a dead pool's caches
+	AUTO_LOCK( s_PoolListMutex );
+	m_nPoolIndex = ( s_nPoolIndices < MAX_CACHED_POOLS ) ? s_nPoolIndices++ : -1;
+	m_pNextPool = s_pFirstPool;
+	s_pFirstPool = this;
+}
+
+CMemoryPoolMT::~CMemoryPoolMT()
+{
+	{
+		AUTO_LOCK( s_PoolListMutex );
+		for ( CMemoryPoolMT **ppPool = &s_pFirstPool; *ppPool; ppPool = &(*ppPool)->m_pNextPool )
+		{
+			if ( *ppPool == this )
+			{
+				*ppPool = m_pNextPool;
+				break;
+			}
+		}
+	}
+
+	// Put the cached blocks back on the free list so the leak report is right
+	AUTO_LOCK( m_mutex );
+	while ( m_pThreadCaches )
+	{
+		ThreadCache_t *pCache = m_pThreadCaches;
+		m_pThreadCaches = pCache->m_pNext;
+		FlushMagazine( pCache->m_pLoaded );
+		FlushMagazine( pCache->m_pPrevious );
+		free( pCache->m_pLoaded );
+		free( pCache->m_pPrevious );
+		free( pCache );
+	}
+
+	while ( m_pFullMagazines )
+	{
+		Magazine_t *pNext = m_pFullMagazines->m_pNext;
+		FlushMagazine( m_pFullMagazines );
+		free( m_pFullMagazines );
+		m_pFullMagazines = pNext;
+	}
+	while ( m_pEmptyMagazines )
+	{
+		Magazine_t *pNext = m_pEmptyMagazines->m_pNext;
+		free( m_pEmptyMagazines );
+		m_pEmptyMagazines = pNext;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the calling thread's cache for this pool, or NULL if the
+//			pool doesn't have one
+//-----------------------------------------------------------------------------
+inline CMemoryPoolMT::ThreadCache_t *CMemoryPoolMT::GetThreadCache()
+{
+	if ( m_nPoolIndex < 0 )
+		return NULL;
+
+	ThreadCacheTable_t *pTable = s_pThreadCacheTable;
+	if ( pTable && pTable->m_pCaches[m_nPoolIndex] )
+		return pTable->m_pCaches[m_nPoolIndex];
+
+	return CreateThreadCache();
+}
+
+CMemoryPoolMT::ThreadCache_t *CMemoryPoolMT::CreateThreadCache()
+{
+	MEM_ALLOC_CREDIT_( m_pszAllocOwner );
+
+	ThreadCacheTable_t *pTable = s_pThreadCacheTable;
+	if ( !pTable )
+	{
+		pTable = (ThreadCacheTable_t *)calloc( 1, sizeof( ThreadCacheTable_t ) );
+		s_pThreadCacheTable = pTable;
+	}
+
+	ThreadCache_t *pCache = (ThreadCache_t *)calloc( 1, sizeof( ThreadCache_t ) );
+	pCache->m_pLoaded = (Magazine_t *)calloc( 1, sizeof( Magazine_t ) );
+	pCache->m_pPrevious = (Magazine_t *)calloc( 1, sizeof( Magazine_t ) );
+	pCache->m_ThreadId = ThreadGetCurrentId();
+
+	{
+		AUTO_LOCK( m_mutex );
+		pCache->m_pNext = m_pThreadCaches;
+		m_pThreadCaches = pCache;
+	}
+
+	pTable->m_pCaches[m_nPoolIndex] = pCache;
+	return pCache;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Swaps the thread's empty magazines for a full one from the depot,
+//			filling one from the free list if the depot has none
+//-----------------------------------------------------------------------------
+bool CMemoryPoolMT::LoadFullMagazine( ThreadCache_t *pCache )
+{
+	Assert( !pCache->m_pLoaded->m_nCount && !pCache->m_pPrevious->m_nCount );
+
+	AUTO_LOCK( m_mutex );
+	if ( m_pFullMagazines )
+	{
+		Magazine_t *pFull = m_pFullMagazines;
+		m_pFullMagazines = pFull->m_pNext;
+		--m_nFullMagazines;
+
+		pCache->m_pPrevious->m_pNext = m_pEmptyMagazines;
+		m_pEmptyMagazines = pCache->m_pPrevious;
+		pCache->m_pPrevious = pCache->m_pLoaded;
+		pCache->m_pLoaded = pFull;
+
+		++m_nDepotLoads;
+		return true;
+	}
+
+	Magazine_t *pLoaded = pCache->m_pLoaded;
+	while ( pLoaded->m_nCount < MAGAZINE_SIZE )
+	{
+		void *pBlock = CUtlMemoryPool::Alloc( m_BlockSize );
+		if ( !pBlock )
+			break;
+		pLoaded->m_pBlocks[pLoaded->m_nCount++] = pBlock;
+	}
+
+	++m_nRefills;
+	return pLoaded->m_nCount != 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Hands the thread's full magazines to the depot in exchange for an
+//			empty one. When the depot already has plenty, the blocks go back
+//			to the free list instead.
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::UnloadFullMagazine( ThreadCache_t *pCache )
+{
+	Assert( pCache->m_pLoaded->m_nCount == MAGAZINE_SIZE && pCache->m_pPrevious->m_nCount == MAGAZINE_SIZE );
+
+	AUTO_LOCK( m_mutex );
+	if ( m_nFullMagazines >= MAX_DEPOT_MAGAZINES )
+	{
+		FlushMagazine( pCache->m_pLoaded );
+		return;
+	}
+
+	Magazine_t *pEmpty = m_pEmptyMagazines;
+	if ( pEmpty )
+	{
+		m_pEmptyMagazines = pEmpty->m_pNext;
+	}
+	else
+	{
+		MEM_ALLOC_CREDIT_( m_pszAllocOwner );
+		pEmpty = (Magazine_t *)calloc( 1, sizeof( Magazine_t ) );
+	}
+
+	pCache->m_pPrevious->m_pNext = m_pFullMagazines;
+	m_pFullMagazines = pCache->m_pPrevious;
+	++m_nFullMagazines;
+	pCache->m_pPrevious = pCache->m_pLoaded;
+	pCache->m_pLoaded = pEmpty;
+
+	++m_nDepotUnloads;
+}
+
+// Must be called with m_mutex held
+void CMemoryPoolMT::FlushMagazine( Magazine_t *pMagazine )
+{
+	for ( int i = 0; i < pMagazine->m_nCount; i++ )
+	{
+		CUtlMemoryPool::Free( pMagazine->m_pBlocks[i] );
+	}
+	pMagazine->m_nCount = 0;
+	++m_nFlushes;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Allocs a single block, from the thread's magazines when it can
+//-----------------------------------------------------------------------------
+void *CMemoryPoolMT::Alloc( size_t amount )
+{
+	if ( amount > (unsigned int)m_BlockSize )
+		return NULL;
+
+	ThreadCache_t *pCache = GetThreadCache();
+	if ( !pCache )
+	{
+		AUTO_LOCK( m_mutex );
+		return CUtlMemoryPool::Alloc( amount );
+	}
+
+	if ( !pCache->m_pLoaded->m_nCount )
+	{
+		if ( pCache->m_pPrevious->m_nCount )
+		{
+			V_swap( pCache->m_pLoaded, pCache->m_pPrevious );
+		}
+		else
+		{
+			++pCache->m_nDepotTrips;
+			if ( !LoadFullMagazine( pCache ) )
+				return NULL;
+		}
+	}
+
+	++pCache->m_nAllocs;
+	if ( ++pCache->m_nOutstanding > pCache->m_nPeakOutstanding )
+	{
+		pCache->m_nPeakOutstanding = pCache->m_nOutstanding;
+	}
+
+	Magazine_t *pLoaded = pCache->m_pLoaded;
+	return pLoaded->m_pBlocks[--pLoaded->m_nCount];
+}
+
+void *CMemoryPoolMT::AllocZero( size_t amount )
+{
+	void *mem = Alloc( amount );
+	if ( mem )
+	{
+		memset( mem, 0x00, amount );
+	}
+	return mem;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees a block into the thread's magazines
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::Free( void *memBlock )
+{
+	if ( !memBlock )
+		return;  // trying to delete NULL pointer, ignore
+
+	ThreadCache_t *pCache = GetThreadCache();
+	if ( !pCache )
+	{
+		AUTO_LOCK( m_mutex );
+		CUtlMemoryPool::Free( memBlock );
+		return;
+	}
+
+#ifdef _DEBUG	
+	// invalidate the memory
+	memset( memBlock, 0xDD, m_BlockSize );
+#endif
+
+	if ( pCache->m_pLoaded->m_nCount == MAGAZINE_SIZE )
+	{
+		if ( pCache->m_pPrevious->m_nCount != MAGAZINE_SIZE )
+		{
+			V_swap( pCache->m_pLoaded, pCache->m_pPrevious );
+		}
+		else
+		{
+			++pCache->m_nDepotTrips;
+			UnloadFullMagazine( pCache );
+		}
+	}
+
+	++pCache->m_nFrees;
+	--pCache->m_nOutstanding;
+
+	Magazine_t *pLoaded = pCache->m_pLoaded;
+	pLoaded->m_pBlocks[pLoaded->m_nCount++] = memBlock;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frees everything
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::Clear()
+{
+	AUTO_LOCK( m_mutex );
+
+	// The caches stay attached to their threads, just emptied
+	for ( ThreadCache_t *pCache = m_pThreadCaches; pCache; pCache = pCache->m_pNext )
+	{
+		pCache->m_pLoaded->m_nCount = 0;
+		pCache->m_pPrevious->m_nCount = 0;
+	}
+
+	while ( m_pFullMagazines )
+	{
+		Magazine_t *pNext = m_pFullMagazines->m_pNext;
+		free( m_pFullMagazines );
+		m_pFullMagazines = pNext;
+	}
+	while ( m_pEmptyMagazines )
+	{
+		Magazine_t *pNext = m_pEmptyMagazines->m_pNext;
+		free( m_pEmptyMagazines );
+		m_pEmptyMagazines = pNext;
+	}
+	m_nFullMagazines = 0;
+
+	CUtlMemoryPool::Clear();
+}
+
+// Must be called with m_mutex held
+int CMemoryPoolMT::CountCachedBlocks() const
+{
+	int nCached = m_nFullMagazines * MAGAZINE_SIZE;
+	for ( const ThreadCache_t *pCache = m_pThreadCaches; pCache; pCache = pCache->m_pNext )
+	{
+		nCached += pCache->m_pLoaded->m_nCount + pCache->m_pPrevious->m_nCount;
+	}
+	return nCached;
+}
+
+int CMemoryPoolMT::Count() const
+{
+	AUTO_LOCK( m_mutex );
+	return m_BlocksAllocated - CountCachedBlocks();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Prints the hit rate, depot traffic and per thread peaks of every
+//			thread safe pool. The per thread counters are read without locking.
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::DumpStats( MemoryPoolReportFunc_t pfnReport )
+{
+	AUTO_LOCK( s_PoolListMutex );
+	for ( CMemoryPoolMT *pPool = s_pFirstPool; pPool; pPool = pPool->m_pNextPool )
+	{
+		AUTO_LOCK( pPool->m_mutex );
+
+		int nCached = pPool->CountCachedBlocks();
+		pfnReport( "%s: %d byte blocks, %d in use, %d cached, peak %d\n", pPool->m_pszAllocOwner, pPool->m_BlockSize,
+			pPool->m_BlocksAllocated - nCached, nCached, pPool->m_PeakAlloc );
+		if ( pPool->m_nPoolIndex < 0 )
+		{
+			pfnReport( "    no thread caches, every call takes the lock\n" );
+			continue;
+		}
+
+		pfnReport( "    depot: %d full magazines, %d loads, %d unloads, %d refills, %d flushes\n",
+			pPool->m_nFullMagazines, pPool->m_nDepotLoads, pPool->m_nDepotUnloads, pPool->m_nRefills, pPool->m_nFlushes );
+
+		for ( const ThreadCache_t *pCache = pPool->m_pThreadCaches; pCache; pCache = pCache->m_pNext )
+		{
+			int nCalls = pCache->m_nAllocs + pCache->m_nFrees;
+			float flHitRate = nCalls ? 100.0f * ( nCalls - pCache->m_nDepotTrips ) / nCalls : 100.0f;
+			pfnReport( "    thread %5u: %8d allocs, %8d frees, %5.1f%% hits, peak %d outstanding\n",
+				(unsigned)pCache->m_ThreadId, pCache->m_nAllocs, pCache->m_nFrees, flHitRate, pCache->m_nPeakOutstanding );
+		}
+	}
+}
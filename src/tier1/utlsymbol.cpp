@@ -15,6 +15,7 @@
 #include "stringpool.h"
 #include "utlhashtable.h"
 #include "utlstring.h"
+#include "generichash.h"
 
 // Ensure that everybody has the right compiler version installed. The version
 // number can be obtained by looking at the compiler output when you type 'cl'
@@ -109,6 +110,11 @@ void CUtlSymbol::DisableStaticSymbolTable()
 	s_bAllowStaticSymbolTable = false;
 }
 
+void CUtlSymbol::GetStaticTableStats( UtlStringSetStats_t &stats )
+{
+	CurrTable()->GetStats( stats );
+}
+
 //-----------------------------------------------------------------------------
 // checks if the symbol matches a string
 //-----------------------------------------------------------------------------
@@ -289,7 +295,337 @@ void CUtlSymbolTable::RemoveAll()
 
 
 
-class CUtlFilenameSymbolTable::HashTable : public CUtlStableHashtable<CUtlConstString>
+//-----------------------------------------------------------------------------
+// concurrent string set
+//-----------------------------------------------------------------------------
+
+static char s_RemovedStringMarker;
+const char * const CUtlConcurrentStringSet::s_pRemoved = &s_RemovedStringMarker;
+
+CUtlConcurrentStringSet::CUtlConcurrentStringSet( bool bCaseInsensitive, int nInitSize ) :
+	m_nCount( 0 ), m_nUsed( 0 ), m_bInsensitive( bCaseInsensitive ), m_nInsertRaces( 0 ), m_nRehashes( 0 )
+{
+	int nSize = 16;
+	while ( nSize < nInitSize )
+	{
+		nSize *= 2;
+	}
+	m_pTable = AllocTable( nSize );
+}
+
+CUtlConcurrentStringSet::~CUtlConcurrentStringSet()
+{
+	Purge();
+	free( m_pTable );
+}
+
+CUtlConcurrentStringSet::Table_t *CUtlConcurrentStringSet::AllocTable( int nSize )
+{
+	Assert( ( nSize & ( nSize - 1 ) ) == 0 );
+	Table_t *pTable = (Table_t *)malloc( sizeof( Table_t ) + ( nSize - 1 ) * sizeof( Slot_t ) );
+	pTable->m_pRetired = NULL;
+	pTable->m_nMask = nSize - 1;
+	memset( pTable->m_Slots, 0, nSize * sizeof( Slot_t ) );
+	return pTable;
+}
+
+unsigned CUtlConcurrentStringSet::HashString( const char *pString ) const
+{
+	return m_bInsensitive ? ::HashStringCaseless( pString ) : ::HashString( pString );
+}
+
+
+//-----------------------------------------------------------------------------
+// Probes whichever table is current. A string added by another thread after
+// we've loaded the table pointer may be missed; callers that need to add it
+// look again with the lock held.
+//-----------------------------------------------------------------------------
+const char *CUtlConcurrentStringSet::Find( const char *pString, unsigned nHash ) const
+{
+	const Table_t *pTable = m_pTable;
+	int nMask = pTable->m_nMask;
+	for ( int i = nHash & nMask; ; i = ( i + 1 ) & nMask )
+	{
+		const Slot_t &slot = pTable->m_Slots[i];
+		const char *pSlotString = slot.m_pString;
+		if ( !pSlotString )
+			return NULL;
+
+		if ( pSlotString != s_pRemoved && slot.m_nHash == nHash )
+		{
+			if ( m_bInsensitive ? !V_stricmp( pSlotString, pString ) : !V_strcmp( pSlotString, pString ) )
+				return pSlotString;
+		}
+	}
+}
+
+void CUtlConcurrentStringSet::Lock()
+{
+	if ( !m_Mutex.TryLock() )
+	{
+		++m_nLockContention;
+		m_Mutex.Lock();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Tables are at most half full, counting removed strings, so probing always
+// reaches an empty slot. Slots are only ever written once: the hash goes in
+// before the string pointer is published.
+//-----------------------------------------------------------------------------
+void CUtlConcurrentStringSet::InsertLocked( const char *pString, unsigned nHash )
+{
+	Assert( pString && pString != s_pRemoved );
+	Assert( !Find( pString, nHash ) );
+
+	int nSize = m_pTable->m_nMask + 1;
+	if ( ( m_nUsed + 1 ) * 2 > nSize )
+	{
+		// only grow when it's live strings filling the table, not removed ones
+		Rehash( ( m_nCount + 1 ) * 4 > nSize ? nSize * 2 : nSize );
+	}
+
+	Table_t *pTable = m_pTable;
+	int nMask = pTable->m_nMask;
+	int i = nHash & nMask;
+	while ( pTable->m_Slots[i].m_pString )
+	{
+		i = ( i + 1 ) & nMask;
+	}
+
+	pTable->m_Slots[i].m_nHash = nHash;
+	ThreadMemoryBarrier();
+	pTable->m_Slots[i].m_pString = pString;
+
+	++m_nCount;
+	++m_nUsed;
+	++m_nLockedInserts;
+}
+
+void CUtlConcurrentStringSet::Rehash( int nSize )
+{
+	Table_t *pOldTable = m_pTable;
+	Table_t *pNewTable = AllocTable( nSize );
+	int nMask = pNewTable->m_nMask;
+
+	for ( int i = 0; i <= pOldTable->m_nMask; i++ )
+	{
+		const Slot_t &slot = pOldTable->m_Slots[i];
+		if ( !slot.m_pString || slot.m_pString == s_pRemoved )
+			continue;
+
+		int j = slot.m_nHash & nMask;
+		while ( pNewTable->m_Slots[j].m_pString )
+		{
+			j = ( j + 1 ) & nMask;
+		}
+		pNewTable->m_Slots[j].m_nHash = slot.m_nHash;
+		pNewTable->m_Slots[j].m_pString = slot.m_pString;
+	}
+
+	// Readers may still be probing the old table, so it lives until Purge()
+	pNewTable->m_pRetired = pOldTable;
+	ThreadMemoryBarrier();
+	m_pTable = pNewTable;
+
+	m_nUsed = m_nCount;
+	++m_nRehashes;
+}
+
+const char *CUtlConcurrentStringSet::RemoveLocked( const char *pString )
+{
+	if ( !pString )
+		return NULL;
+
+	unsigned nHash = HashString( pString );
+	Table_t *pTable = m_pTable;
+	int nMask = pTable->m_nMask;
+	for ( int i = nHash & nMask; pTable->m_Slots[i].m_pString; i = ( i + 1 ) & nMask )
+	{
+		Slot_t &slot = pTable->m_Slots[i];
+		const char *pSlotString = slot.m_pString;
+		if ( pSlotString == s_pRemoved || slot.m_nHash != nHash )
+			continue;
+
+		if ( m_bInsensitive ? !V_stricmp( pSlotString, pString ) : !V_strcmp( pSlotString, pString ) )
+		{
+			slot.m_pString = s_pRemoved;
+			--m_nCount;
+			return pSlotString;
+		}
+	}
+	return NULL;
+}
+
+void CUtlConcurrentStringSet::Purge()
+{
+	Table_t *pTable = m_pTable;
+	while ( pTable->m_pRetired )
+	{
+		Table_t *pRetired = pTable->m_pRetired;
+		pTable->m_pRetired = pRetired->m_pRetired;
+		free( pRetired );
+	}
+
+	memset( pTable->m_Slots, 0, ( pTable->m_nMask + 1 ) * sizeof( Slot_t ) );
+	m_nCount = 0;
+	m_nUsed = 0;
+}
+
+void CUtlConcurrentStringSet::GetStats( UtlStringSetStats_t &stats ) const
+{
+	stats.m_nStrings = m_nCount;
+	stats.m_nTableSize = m_pTable->m_nMask + 1;
+	stats.m_nLockedInserts = m_nLockedInserts;
+	stats.m_nLockContention = m_nLockContention;
+	stats.m_nInsertRaces = m_nInsertRaces;
+	stats.m_nRehashes = m_nRehashes;
+}
+
+
+//-----------------------------------------------------------------------------
+// thread safe symbol table
+//-----------------------------------------------------------------------------
+
+CUtlSymbolTableMT::CUtlSymbolTableMT( int growSize, int initSize, bool caseInsensitive ) :
+	m_Strings( caseInsensitive, initSize * 2 ), m_nSymbols( 0 ), m_nPoolSpaceUsed( 0 ), m_nPoolSize( 0 )
+{
+	memset( (void *)m_pSymbolBlocks, 0, sizeof( m_pSymbolBlocks ) );
+}
+
+CUtlSymbolTableMT::~CUtlSymbolTableMT()
+{
+	RemoveAll();
+}
+
+inline UtlSymId_t CUtlSymbolTableMT::SymbolFromString( const char *pString )
+{
+	UtlSymId_t id;
+	memcpy( &id, pString - sizeof( UtlSymId_t ), sizeof( UtlSymId_t ) );
+	return id;
+}
+
+CUtlSymbol CUtlSymbolTableMT::Find( const char* pString ) const
+{
+	if ( !pString )
+		return CUtlSymbol();
+
+	const char *pFound = m_Strings.Find( pString );
+	return pFound ? CUtlSymbol( SymbolFromString( pFound ) ) : CUtlSymbol();
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds and/or creates a symbol based on the string
+//-----------------------------------------------------------------------------
+
+CUtlSymbol CUtlSymbolTableMT::AddString( const char* pString )
+{
+	if ( !pString )
+		return CUtlSymbol( UTL_INVAL_SYMBOL );
+
+	unsigned nHash = m_Strings.HashString( pString );
+	const char *pFound = m_Strings.Find( pString, nHash );
+	if ( pFound )
+		return CUtlSymbol( SymbolFromString( pFound ) );
+
+	m_Strings.Lock();
+
+	// someone else may have added it while we waited
+	pFound = m_Strings.Find( pString, nHash );
+	if ( pFound )
+	{
+		m_Strings.NoteInsertRace();
+		m_Strings.Unlock();
+		return CUtlSymbol( SymbolFromString( pFound ) );
+	}
+
+	UtlSymId_t id = (UtlSymId_t)m_nSymbols;
+	if ( id == UTL_INVAL_SYMBOL )
+	{
+		Error( "CUtlSymbolTableMT: out of symbols\n" );
+	}
+
+	// Copy the string in after its id, starting a new pool when it doesn't fit.
+	int len = V_strlen( pString ) + 1;
+	int nNeeded = len + sizeof( UtlSymId_t );
+	if ( m_nPoolSize - m_nPoolSpaceUsed < nNeeded )
+	{
+		m_nPoolSize = max( nNeeded, MIN_STRING_POOL_SIZE );
+		m_nPoolSpaceUsed = 0;
+		m_StringPools.AddToTail( (char *)malloc( m_nPoolSize ) );
+	}
+
+	char *pStorage = m_StringPools.Tail() + m_nPoolSpaceUsed;
+	m_nPoolSpaceUsed += nNeeded;
+	memcpy( pStorage, &id, sizeof( UtlSymId_t ) );
+	char *pStored = pStorage + sizeof( UtlSymId_t );
+	memcpy( pStored, pString, len );
+
+	int iBlock = id >> SYMBOL_BLOCK_SHIFT;
+	if ( !m_pSymbolBlocks[iBlock] )
+	{
+		const char **pBlock = (const char **)malloc( SYMBOL_BLOCK_SIZE * sizeof( const char * ) );
+		memset( pBlock, 0, SYMBOL_BLOCK_SIZE * sizeof( const char * ) );
+		ThreadMemoryBarrier();
+		m_pSymbolBlocks[iBlock] = pBlock;
+	}
+	m_pSymbolBlocks[iBlock][id & ( SYMBOL_BLOCK_SIZE - 1 )] = pStored;
+	ThreadMemoryBarrier();
+	m_nSymbols = id + 1;
+
+	// publishing the string is what makes the symbol visible to Find()
+	m_Strings.InsertLocked( pStored, nHash );
+	m_Strings.Unlock();
+
+	return CUtlSymbol( id );
+}
+
+
+//-----------------------------------------------------------------------------
+// Look up the string associated with a particular symbol
+//-----------------------------------------------------------------------------
+
+const char* CUtlSymbolTableMT::String( CUtlSymbol id ) const
+{
+	if ( !id.IsValid() )
+		return "";
+
+	Assert( (UtlSymId_t)id < m_nSymbols );
+	return m_pSymbolBlocks[(UtlSymId_t)id >> SYMBOL_BLOCK_SHIFT][(UtlSymId_t)id & ( SYMBOL_BLOCK_SIZE - 1 )];
+}
+
+
+//-----------------------------------------------------------------------------
+// Remove all symbols in the table.
+//-----------------------------------------------------------------------------
+
+void CUtlSymbolTableMT::RemoveAll()
+{
+	m_Strings.Purge();
+
+	for ( int i = 0; i < MAX_SYMBOL_BLOCKS; i++ )
+	{
+		free( (void *)m_pSymbolBlocks[i] );
+		m_pSymbolBlocks[i] = NULL;
+	}
+	m_nSymbols = 0;
+
+	for ( int i = 0; i < m_StringPools.Count(); i++ )
+		free( m_StringPools[i] );
+
+	m_StringPools.RemoveAll();
+	m_nPoolSpaceUsed = 0;
+	m_nPoolSize = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// filename symbol table
+//-----------------------------------------------------------------------------
+
+class CUtlFilenameSymbolTable::HashTable : public CUtlSymbolTableMT
 {
 };
 
@@ -337,11 +673,10 @@ FileNameHandle_t CUtlFilenameSymbolTable::FindOrAddFileName( const char *pFileNa
 	char filename[ MAX_PATH ];
 	Q_strncpy( filename, fn + Q_strlen( basepath ), sizeof( filename ) );
 
-	// not found, lock and look again
+	// not found, add the parts; the table does its own locking
 	FileNameHandleInternal_t handle;
-	m_lock.LockForWrite();
-	handle.path = m_Strings->Insert( basepath ) + 1;
-	handle.file = m_Strings->Insert( filename ) + 1;
+	handle.path = (UtlSymId_t)m_Strings->AddString( basepath ) + 1;
+	handle.file = (UtlSymId_t)m_Strings->AddString( filename ) + 1;
 	//handle.path = m_StringPool.FindStringHandle( basepath );
 	//handle.file = m_StringPool.FindStringHandle( filename );
 	//if ( handle.path != m_Strings.InvalidHandle() && handle.file )
@@ -354,7 +689,6 @@ FileNameHandle_t CUtlFilenameSymbolTable::FindOrAddFileName( const char *pFileNa
 	// safely add it
 	//handle.path = m_StringPool.ReferenceStringHandle( basepath );
 	//handle.file = m_StringPool.ReferenceStringHandle( filename );
-	m_lock.UnlockWrite();
 
 	return *( FileNameHandle_t * )( &handle );
 }
@@ -382,14 +716,12 @@ FileNameHandle_t CUtlFilenameSymbolTable::FindFileName( const char *pFileName )
 
 	FileNameHandleInternal_t handle;
 
-	Assert( (uint16)(m_Strings->InvalidHandle() + 1) == 0 );
+	Assert( (uint16)(UTL_INVAL_SYMBOL + 1) == 0 );
 
-	m_lock.LockForRead();
-	handle.path = m_Strings->Find(basepath) + 1;
-	handle.file = m_Strings->Find(filename) + 1;
+	handle.path = (UtlSymId_t)m_Strings->Find(basepath) + 1;
+	handle.file = (UtlSymId_t)m_Strings->Find(filename) + 1;
 	//handle.path = m_StringPool.FindStringHandle(basepath);
 	//handle.file = m_StringPool.FindStringHandle(filename);
-	m_lock.UnlockRead();
 
 	if ( handle.path == 0 || handle.file == 0 )
 		return NULL;
@@ -412,12 +744,10 @@ bool CUtlFilenameSymbolTable::String( const FileNameHandle_t& handle, char *buf,
 		return false;
 	}
 
-	m_lock.LockForRead();
 	//const char *path = m_StringPool.HandleToString(internal->path);
 	//const char *fn = m_StringPool.HandleToString(internal->file);
-	const char *path = (*m_Strings)[ internal->path - 1 ].Get();
-	const char *fn = (*m_Strings)[ internal->file - 1].Get();
-	m_lock.UnlockRead();
+	const char *path = m_Strings->String( CUtlSymbol( internal->path - 1 ) );
+	const char *fn = m_Strings->String( CUtlSymbol( internal->file - 1 ) );
 
 	if ( !path || !fn )
 	{
@@ -432,5 +762,5 @@ bool CUtlFilenameSymbolTable::String( const FileNameHandle_t& handle, char *buf,
 
 void CUtlFilenameSymbolTable::RemoveAll()
 {
-	m_Strings->Purge();
+	m_Strings->RemoveAll();
 }
@@ -0,0 +1,243 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Micro-benchmark for the bf_write / bf_read single value and bulk
+//			encoders. Also checks that both produce the same bits.
+//
+// $NoKeywords: $
+//
+//===========================================================================//
+#include <stdlib.h>
+#include <stdio.h>
+#include "tier0/platform.h"
+#include "tier1/bitbuf.h"
+#include "tier1/strtools.h"
+#include "mathlib/mathlib.h"
+#include "coordsize.h"
+
+static const int NUM_VALUES = 4096;
+static const int BUFFER_BYTES = NUM_VALUES * 8;
+
+static float		g_Coords[ NUM_VALUES ];
+static Vector		g_Normals[ NUM_VALUES ];
+static uint32		g_VarInts[ NUM_VALUES ];
+
+static uint32		g_SingleBuffer[ BUFFER_BYTES / 4 ];
+static uint32		g_BulkBuffer[ BUFFER_BYTES / 4 ];
+
+static float		g_CoordsOut[ NUM_VALUES ];
+static Vector		g_NormalsOut[ NUM_VALUES ];
+static uint32		g_VarIntsOut[ NUM_VALUES ];
+
+static Vector		g_SingleReadOut[ NUM_VALUES ];		// what the single value reader decoded, large enough for any case
+
+
+void Usage( void )
+{
+	printf( "Usage: bitbufbench [-iterations <count>]\n" );
+	exit( -1 );
+}
+
+static float RandFloat( float flMin, float flMax )
+{
+	return flMin + ( flMax - flMin ) * ( (float)rand() / (float)RAND_MAX );
+}
+
+//-----------------------------------------------------------------------------
+// Values with roughly the distribution seen in entity and temp entity data
+//-----------------------------------------------------------------------------
+static void GenerateValues( void )
+{
+	srand( 1234 );
+
+	for ( int i = 0; i < NUM_VALUES; ++i )
+	{
+		// a mix of zeros, whole numbers and fractional world coordinates
+		int type = rand() % 4;
+		float coord = RandFloat( -16384.0f, 16384.0f );
+		g_Coords[i] = ( type == 0 ) ? 0.0f : ( type == 1 ) ? (float)(int)coord : coord;
+
+		Vector normal( RandFloat( -1.0f, 1.0f ), RandFloat( -1.0f, 1.0f ), RandFloat( -1.0f, 1.0f ) );
+		VectorNormalize( normal );
+		g_Normals[i] = normal;
+
+		g_VarInts[i] = (uint32)rand() >> ( rand() % 31 );
+	}
+}
+
+typedef void (*BenchFunc_t)( bf_write &buf );
+typedef void (*ReadBenchFunc_t)( bf_read &buf );
+
+static void WriteCoordsSingle( bf_write &buf )		{ for ( int i = 0; i < NUM_VALUES; ++i ) buf.WriteBitCoord( g_Coords[i] ); }
+static void WriteCoordsBulk( bf_write &buf )		{ buf.WriteBitCoordArray( g_Coords, NUM_VALUES ); }
+static void WriteNormalsSingle( bf_write &buf )		{ for ( int i = 0; i < NUM_VALUES; ++i ) buf.WriteBitVec3Normal( g_Normals[i] ); }
+static void WriteNormalsBulk( bf_write &buf )		{ buf.WriteBitVec3NormalArray( g_Normals, NUM_VALUES ); }
+static void WriteVarIntsSingle( bf_write &buf )		{ for ( int i = 0; i < NUM_VALUES; ++i ) buf.WriteVarInt32( g_VarInts[i] ); }
+static void WriteVarIntsBulk( bf_write &buf )		{ buf.WriteVarInt32Array( g_VarInts, NUM_VALUES ); }
+
+static void ReadCoordsSingle( bf_read &buf )		{ for ( int i = 0; i < NUM_VALUES; ++i ) g_CoordsOut[i] = buf.ReadBitCoord(); }
+static void ReadCoordsBulk( bf_read &buf )			{ buf.ReadBitCoordArray( g_CoordsOut, NUM_VALUES ); }
+static void ReadNormalsSingle( bf_read &buf )		{ for ( int i = 0; i < NUM_VALUES; ++i ) buf.ReadBitVec3Normal( g_NormalsOut[i] ); }
+static void ReadNormalsBulk( bf_read &buf )			{ buf.ReadBitVec3NormalArray( g_NormalsOut, NUM_VALUES ); }
+static void ReadVarIntsSingle( bf_read &buf )		{ for ( int i = 0; i < NUM_VALUES; ++i ) g_VarIntsOut[i] = buf.ReadVarInt32(); }
+static void ReadVarIntsBulk( bf_read &buf )			{ buf.ReadVarInt32Array( g_VarIntsOut, NUM_VALUES ); }
+
+//-----------------------------------------------------------------------------
+// Check decoded values against the source values, within the precision of the encoding
+//-----------------------------------------------------------------------------
+static int VerifyCoords( void )
+{
+	for ( int i = 0; i < NUM_VALUES; ++i )
+	{
+		if ( fabs( g_CoordsOut[i] - g_Coords[i] ) > COORD_RESOLUTION )
+			return i;
+	}
+	return -1;
+}
+
+static int VerifyNormals( void )
+{
+	// z is rebuilt from the truncated x and y, so it is less precise than they are near the xy plane
+	const float flMaxZError = 0.05f;
+	for ( int i = 0; i < NUM_VALUES; ++i )
+	{
+		const Vector &in = g_Normals[i];
+		const Vector &out = g_NormalsOut[i];
+		if ( fabs( out.x - in.x ) > NORMAL_RESOLUTION || fabs( out.y - in.y ) > NORMAL_RESOLUTION || fabs( out.z - in.z ) > flMaxZError )
+			return i;
+	}
+	return -1;
+}
+
+static int VerifyVarInts( void )
+{
+	for ( int i = 0; i < NUM_VALUES; ++i )
+	{
+		if ( g_VarIntsOut[i] != g_VarInts[i] )
+			return i;
+	}
+	return -1;
+}
+
+typedef int (*VerifyFunc_t)( void );
+
+struct BenchCase_t
+{
+	const char *m_pName;
+	BenchFunc_t m_pWriteSingle;
+	BenchFunc_t m_pWriteBulk;
+	ReadBenchFunc_t m_pReadSingle;
+	ReadBenchFunc_t m_pReadBulk;
+	VerifyFunc_t m_pVerify;				// returns the index of the first wrong value, or -1
+	void *m_pOutput;
+	int m_nOutputBytes;
+};
+
+static BenchCase_t s_BenchCases[] =
+{
+	{ "BitCoord",		WriteCoordsSingle,	WriteCoordsBulk,	ReadCoordsSingle,	ReadCoordsBulk,		VerifyCoords,	g_CoordsOut,	sizeof( g_CoordsOut ) },
+	{ "BitVec3Normal",	WriteNormalsSingle,	WriteNormalsBulk,	ReadNormalsSingle,	ReadNormalsBulk,	VerifyNormals,	g_NormalsOut,	sizeof( g_NormalsOut ) },
+	{ "VarInt32",		WriteVarIntsSingle,	WriteVarIntsBulk,	ReadVarIntsSingle,	ReadVarIntsBulk,	VerifyVarInts,	g_VarIntsOut,	sizeof( g_VarIntsOut ) },
+};
+
+//-----------------------------------------------------------------------------
+// Returns nanoseconds per value. Writing starts at an odd bit so the
+// unaligned paths are measured.
+//-----------------------------------------------------------------------------
+static double TimeWrite( BenchFunc_t pFunc, uint32 *pBuffer, int nIterations, int *pBitsWritten )
+{
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		bf_write buf( pBuffer, BUFFER_BYTES );
+		buf.WriteOneBit( 1 );
+		pFunc( buf );
+		*pBitsWritten = buf.GetNumBitsWritten();
+	}
+	return ( Plat_FloatTime() - flStart ) * 1e9 / ( (double)nIterations * NUM_VALUES );
+}
+
+static double TimeRead( ReadBenchFunc_t pFunc, uint32 *pBuffer, int nIterations, int *pBitsRead )
+{
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		bf_read buf( pBuffer, BUFFER_BYTES );
+		buf.ReadOneBit();
+		pFunc( buf );
+		*pBitsRead = buf.GetNumBitsRead();
+	}
+	return ( Plat_FloatTime() - flStart ) * 1e9 / ( (double)nIterations * NUM_VALUES );
+}
+
+int main( int argc, char **argv )
+{
+	int nIterations = 1000;
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( !Q_stricmp( argv[i], "-iterations" ) && i + 1 < argc )
+		{
+			// MAX evaluates its arguments twice
+			nIterations = atoi( argv[++i] );
+			nIterations = MAX( 1, nIterations );
+		}
+		else
+		{
+			Usage();
+		}
+	}
+
+	GenerateValues();
+
+	bool bMismatch = false;
+
+	printf( "%-16s %12s %12s %12s %12s\n", "", "write", "write bulk", "read", "read bulk" );
+	for ( int i = 0; i < ARRAYSIZE( s_BenchCases ); ++i )
+	{
+		const BenchCase_t &bench = s_BenchCases[i];
+
+		int nSingleBits, nBulkBits, nReadBits, nReadBulkBits;
+		double flWrite = TimeWrite( bench.m_pWriteSingle, g_SingleBuffer, nIterations, &nSingleBits );
+		double flWriteBulk = TimeWrite( bench.m_pWriteBulk, g_BulkBuffer, nIterations, &nBulkBits );
+
+		if ( nSingleBits != nBulkBits || V_memcmp( g_SingleBuffer, g_BulkBuffer, BitByte( nSingleBits ) ) )
+		{
+			printf( "%s: bulk writer output does not match the single value writer!\n", bench.m_pName );
+			bMismatch = true;
+		}
+
+		double flRead = TimeRead( bench.m_pReadSingle, g_SingleBuffer, nIterations, &nReadBits );
+
+		int nBadValue = bench.m_pVerify();
+		if ( nBadValue >= 0 )
+		{
+			printf( "%s: single value reader decoded value %d incorrectly!\n", bench.m_pName, nBadValue );
+			bMismatch = true;
+		}
+		V_memcpy( g_SingleReadOut, bench.m_pOutput, bench.m_nOutputBytes );
+		V_memset( bench.m_pOutput, 0, bench.m_nOutputBytes );
+
+		double flReadBulk = TimeRead( bench.m_pReadBulk, g_SingleBuffer, nIterations, &nReadBulkBits );
+
+		nBadValue = bench.m_pVerify();
+		if ( nBadValue >= 0 )
+		{
+			printf( "%s: bulk reader decoded value %d incorrectly!\n", bench.m_pName, nBadValue );
+			bMismatch = true;
+		}
+		if ( V_memcmp( g_SingleReadOut, bench.m_pOutput, bench.m_nOutputBytes ) )
+		{
+			printf( "%s: bulk reader output does not match the single value reader!\n", bench.m_pName );
+			bMismatch = true;
+		}
+
+		if ( nReadBits != nSingleBits || nReadBulkBits != nSingleBits )
+		{
+			printf( "%s: readers consumed a different number of bits than were written!\n", bench.m_pName );
+			bMismatch = true;
+		}
+
+		printf( "%-16s %9.2f ns %9.2f ns %9.2f ns %9.2f ns\n", bench.m_pName, flWrite, flWriteBulk, flRead, flReadBulk );
+	}
+
+	return bMismatch ? 1 : 0;
+}
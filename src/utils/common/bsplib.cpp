@@ -23,6 +23,7 @@
 #include "utlstring.h"
 #include "checksum_crc.h"
 #include "physdll.h"
+#include "threads.h"
 #include "tier0/dbg.h"
 #include "lumpfiles.h"
 #include "vtf/vtf.h"
@@ -718,6 +719,11 @@ CGameLump	g_GameLumps;
 
 static IZip *s_pakFile = 0;
 
+// AddFileToPak and AddBufferToPak queue here until something needs the pak
+static CPakFileBatch *s_pPendingPakBatch = NULL;
+
+int g_nPakFileThreads = -1;
+
 //-----------------------------------------------------------------------------
 // Keep the file position aligned to an arbitrary boundary.
 // Returns updated file position.
@@ -758,6 +764,50 @@ static unsigned int AlignFilePosition( FileHandle_t hFile, int alignment )
 	return currPosition;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Get the batch AddFileToPak and AddBufferToPak queue pak work on
+//-----------------------------------------------------------------------------
+static CPakFileBatch *GetPendingPakBatch( IZip *pak )
+{
+	// one pending batch at a time, it's rare to fill two paks at once
+	if ( s_pPendingPakBatch && s_pPendingPakBatch->GetPak() != pak )
+	{
+		FlushPakFile( s_pPendingPakBatch->GetPak() );
+	}
+
+	if ( !s_pPendingPakBatch )
+	{
+		s_pPendingPakBatch = new CPakFileBatch( pak );
+	}
+	return s_pPendingPakBatch;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Add everything still queued for a pak to it
+//-----------------------------------------------------------------------------
+void FlushPakFile( IZip *pak )
+{
+	if ( !s_pPendingPakBatch || s_pPendingPakBatch->GetPak() != pak )
+		return;
+
+	CPakFileBatch *pBatch = s_pPendingPakBatch;
+	s_pPendingPakBatch = NULL;
+	pBatch->Flush();
+	delete pBatch;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Throw away anything queued for a pak that's being reset or released
+//-----------------------------------------------------------------------------
+static void DiscardPendingPakFiles( IZip *pak )
+{
+	if ( !s_pPendingPakBatch || s_pPendingPakBatch->GetPak() != pak )
+		return;
+
+	delete s_pPendingPakBatch;
+	s_pPendingPakBatch = NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: // Get a pakfile instance
 // Output : IZip*
@@ -777,6 +827,7 @@ IZip* GetPakFile( void )
 void ReleasePakFileLumps( void )
 {
 	// Release the pak files
+	DiscardPendingPakFiles( s_pakFile );
 	IZip::ReleaseZip( s_pakFile );
 	s_pakFile = NULL;
 }
@@ -786,6 +837,8 @@ void ReleasePakFileLumps( void )
 //-----------------------------------------------------------------------------
 void ForceAlignment( IZip *pak, bool bAlign, bool bCompatibleFormat, unsigned int alignmentSize )
 {
+	// anything already queued goes in with the old alignment
+	FlushPakFile( pak );
 	pak->ForceAlignment( bAlign, bCompatibleFormat, alignmentSize );
 }
 
@@ -795,6 +848,7 @@ void ForceAlignment( IZip *pak, bool bAlign, bool bCompatibleFormat, unsigned in
 static void WritePakFileLump( void )
 {
 	CUtlBuffer buf( 0, 0 );
+	FlushPakFile( GetPakFile() );
 	GetPakFile()->ActivateByteSwapping( IsX360() );
 	GetPakFile()->SaveToBuffer( buf );
 
@@ -811,6 +865,7 @@ static void WritePakFileLump( void )
 //-----------------------------------------------------------------------------
 void ClearPakFile( IZip *pak )
 {
+	DiscardPendingPakFiles( pak );
 	pak->Reset();
 }
 
@@ -822,7 +877,7 @@ void ClearPakFile( IZip *pak )
 void AddFileToPak( IZip *pak, const char *relativename, const char *fullpath, IZip::eCompressionType compressionType )
 {
 	DevMsg( "Adding file to pakfile [ %s ]\n", fullpath );
-	pak->AddFileToZip( relativename, fullpath, compressionType );
+	GetPendingPakBatch( pak )->AddFile( relativename, fullpath, compressionType );
 }
 
 //-----------------------------------------------------------------------------
@@ -833,25 +888,26 @@ void AddFileToPak( IZip *pak, const char *relativename, const char *fullpath, IZ
 //-----------------------------------------------------------------------------
 void AddBufferToPak( IZip *pak, const char *pRelativeName, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
 {
-	pak->AddBufferToZip( pRelativeName, data, length, bTextMode, compressionType );
-}
-
-//-----------------------------------------------------------------------------
-// Purpose: Add entire directory to .bsp PAK lump as named file
-// Input  : *relativename - 
-//			*data - 
-//			length - 
-//-----------------------------------------------------------------------------
-void AddDirToPak( IZip *pak, const char *pDirPath, const char *pPakPrefix )
-{
-	if ( !g_pFullFileSystem->IsDirectory( pDirPath ) )
+	if ( compressionType == IZip::eCompressionType_None && !bTextMode )
 	{
-		Warning( "Passed non-directory to AddDirToPak [ %s ]\n", pDirPath );
+		// nothing to do off the main thread, so don't pay for queueing a copy. The zip
+		// keeps the last buffer added under a name, so drop any queued one it replaces.
+		if ( s_pPendingPakBatch && s_pPendingPakBatch->GetPak() == pak )
+		{
+			s_pPendingPakBatch->RemoveFile( pRelativeName );
+		}
+		pak->AddBufferToZip( pRelativeName, data, length, bTextMode, compressionType );
 		return;
 	}
 
-	DevMsg( "Adding directory to pakfile [ %s ]\n", pDirPath );
+	GetPendingPakBatch( pak )->AddBuffer( pRelativeName, data, length, bTextMode, compressionType );
+}
 
+//-----------------------------------------------------------------------------
+// Purpose: Queue every file in a directory, recursing into subdirectories
+//-----------------------------------------------------------------------------
+static void AddDirToPakBatch( CPakFileBatch &batch, const char *pDirPath, const char *pPakPrefix )
+{
 	// Enumerate dir
 	char szEnumerateDir[MAX_PATH] = { 0 };
 	V_snprintf( szEnumerateDir, sizeof( szEnumerateDir ), "%s/*.*", pDirPath );
@@ -880,16 +936,221 @@ void AddDirToPak( IZip *pak, const char *pDirPath, const char *pPakPrefix )
 			if ( g_pFullFileSystem->FindIsDirectory( handle ) )
 			{
 				// Recurse
-				AddDirToPak( pak, szFullPath, szPakName );
+				AddDirToPakBatch( batch, szFullPath, szPakName );
 			}
 			else
 			{
 				// Just add this file
-				AddFileToPak( pak, szPakName, szFullPath );
+				DevMsg( "Adding file to pakfile [ %s ]\n", szFullPath );
+				batch.AddFile( szPakName, szFullPath );
 			}
 		}
 		szFindResult = g_pFullFileSystem->FindNext( handle );
 	} while ( szFindResult);
+	g_pFullFileSystem->FindClose( handle );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Add entire directory to .bsp PAK lump as named file
+// Input  : *relativename - 
+//			*data - 
+//			length - 
+//-----------------------------------------------------------------------------
+void AddDirToPak( IZip *pak, const char *pDirPath, const char *pPakPrefix )
+{
+	if ( !g_pFullFileSystem->IsDirectory( pDirPath ) )
+	{
+		Warning( "Passed non-directory to AddDirToPak [ %s ]\n", pDirPath );
+		return;
+	}
+
+	DevMsg( "Adding directory to pakfile [ %s ]\n", pDirPath );
+
+	CPakFileBatch batch( pak );
+	AddDirToPakBatch( batch, pDirPath, pPakPrefix );
+	batch.Flush();
+}
+
+//-----------------------------------------------------------------------------
+// CPakFileBatch
+//-----------------------------------------------------------------------------
+struct CPakFileBatch::PakEntry_t
+{
+	CUtlString	m_RelativeName;
+	CUtlString	m_FullPath;				// empty for buffers
+	CUtlBuffer	m_Data;					// queued buffer, or the file once it's read
+	bool		m_bTextMode;
+	IZip::eCompressionType m_CompressionType;
+
+	// filled in by PrepareEntryThread
+	bool		m_bPrepared;
+	CUtlBuffer	m_Prepared;
+	int			m_nUncompressedSize;
+	CRC32_t		m_CRC;
+	float		m_flTime;
+};
+
+// The batch RunThreadsOnIndividual is working on
+static CPakFileBatch *s_pPakFileBatch = NULL;
+
+CPakFileBatch::CPakFileBatch( IZip *pak, IZip::eCompressionType compressionType )
+{
+	m_pPak = pak;
+	m_CompressionType = compressionType;
+}
+
+CPakFileBatch::~CPakFileBatch()
+{
+	// anything still queued was never meant to go in
+	m_Entries.PurgeAndDeleteElements();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queue a file from disk; it's read when the batch is flushed
+//-----------------------------------------------------------------------------
+void CPakFileBatch::AddFile( const char *pRelativeName, const char *fullpath, IZip::eCompressionType compressionType )
+{
+	PakEntry_t *pEntry = new PakEntry_t;
+	pEntry->m_RelativeName = pRelativeName;
+	pEntry->m_FullPath = fullpath;
+	pEntry->m_bTextMode = false;
+	pEntry->m_CompressionType = ( compressionType != IZip::eCompressionType_Unknown ) ? compressionType : m_CompressionType;
+	pEntry->m_bPrepared = false;
+	m_Entries.AddToTail( pEntry );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queue a copy of a buffer
+//-----------------------------------------------------------------------------
+void CPakFileBatch::AddBuffer( const char *pRelativeName, const void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+{
+	PakEntry_t *pEntry = new PakEntry_t;
+	pEntry->m_RelativeName = pRelativeName;
+	pEntry->m_Data.Put( data, length );
+	pEntry->m_bTextMode = bTextMode;
+	pEntry->m_CompressionType = ( compressionType != IZip::eCompressionType_Unknown ) ? compressionType : m_CompressionType;
+	pEntry->m_bPrepared = false;
+	m_Entries.AddToTail( pEntry );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Is anything queued under this name? Names match the way the zip's do.
+//-----------------------------------------------------------------------------
+bool CPakFileBatch::HasFile( const char *pRelativeName ) const
+{
+	for ( int i = 0; i < m_Entries.Count(); i++ )
+	{
+		if ( !V_stricmp( m_Entries[i]->m_RelativeName, pRelativeName ) )
+			return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drop anything queued under this name
+//-----------------------------------------------------------------------------
+void CPakFileBatch::RemoveFile( const char *pRelativeName )
+{
+	for ( int i = m_Entries.Count() - 1; i >= 0; i-- )
+	{
+		if ( !V_stricmp( m_Entries[i]->m_RelativeName, pRelativeName ) )
+		{
+			delete m_Entries[i];
+			m_Entries.Remove( i );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads and compresses one entry. Must not touch the pak.
+//-----------------------------------------------------------------------------
+void CPakFileBatch::PrepareEntryThread( int iThread, int iEntry )
+{
+	CPakFileBatch *pBatch = s_pPakFileBatch;
+	PakEntry_t *pEntry = pBatch->m_Entries[iEntry];
+
+	double flStart = Plat_FloatTime();
+
+	if ( !pEntry->m_FullPath.IsEmpty() && !g_pFullFileSystem->ReadFile( pEntry->m_FullPath, NULL, pEntry->m_Data ) )
+	{
+		Warning( "Can't read %s for pakfile\n", pEntry->m_FullPath.Get() );
+		return;
+	}
+
+	if ( pEntry->m_CompressionType == IZip::eCompressionType_None && !pEntry->m_bTextMode )
+	{
+		// stored as is, so hand the buffer over rather than copying it
+		pEntry->m_nUncompressedSize = pEntry->m_Data.TellPut();
+		CRC32_Init( &pEntry->m_CRC );
+		CRC32_ProcessBuffer( &pEntry->m_CRC, pEntry->m_Data.Base(), pEntry->m_nUncompressedSize );
+		CRC32_Final( &pEntry->m_CRC );
+		pEntry->m_Prepared.Swap( pEntry->m_Data );
+		pEntry->m_bPrepared = true;
+	}
+	else
+	{
+		pEntry->m_bPrepared = IZip::PrepareBufferForZip( pEntry->m_Data.Base(), pEntry->m_Data.TellPut(), pEntry->m_bTextMode,
+			pEntry->m_CompressionType, pEntry->m_Prepared, pEntry->m_nUncompressedSize, pEntry->m_CRC );
+	}
+	pEntry->m_Data.Purge();
+
+	pEntry->m_flTime = Plat_FloatTime() - flStart;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads and compresses everything queued on all threads, then adds
+//			it to the pak in the order it was queued
+//-----------------------------------------------------------------------------
+void CPakFileBatch::Flush()
+{
+	int nEntries = m_Entries.Count();
+	if ( !nEntries )
+		return;
+
+	double flStart = Plat_FloatTime();
+
+	// tools like vbsp run their own passes single threaded, but reading and compressing
+	// independent files always scales
+	int nSaveThreads = numthreads;
+	if ( g_nPakFileThreads > 0 )
+	{
+		numthreads = g_nPakFileThreads;
+	}
+
+	Assert( !s_pPakFileBatch );
+	s_pPakFileBatch = this;
+	RunThreadsOnIndividual( nEntries, false, PrepareEntryThread );
+	s_pPakFileBatch = NULL;
+
+	numthreads = nSaveThreads;
+
+	int nAdded = 0;
+	int64 nTotalUncompressed = 0;
+	int64 nTotalCompressed = 0;
+	for ( int i = 0; i < nEntries; i++ )
+	{
+		PakEntry_t *pEntry = m_Entries[i];
+		if ( pEntry->m_bPrepared )
+		{
+			int nSize = pEntry->m_Prepared.TellPut();
+			m_pPak->AddPreparedBufferToZip( pEntry->m_RelativeName, pEntry->m_Prepared.Base(), nSize,
+				pEntry->m_nUncompressedSize, pEntry->m_CRC, pEntry->m_CompressionType );
+
+			DevMsg( "Packed %s: %d -> %d bytes (%.1f%%) in %.1f ms\n", pEntry->m_RelativeName.Get(),
+				pEntry->m_nUncompressedSize, nSize,
+				pEntry->m_nUncompressedSize ? 100.0f * nSize / pEntry->m_nUncompressedSize : 100.0f,
+				pEntry->m_flTime * 1000.0f );
+
+			++nAdded;
+			nTotalUncompressed += pEntry->m_nUncompressedSize;
+			nTotalCompressed += nSize;
+		}
+		delete pEntry;
+	}
+	m_Entries.RemoveAll();
+
+	Msg( "Packed %d files: %lld -> %lld bytes (%.1f%%) in %.2f seconds\n", nAdded, nTotalUncompressed, nTotalCompressed,
+		nTotalUncompressed ? 100.0 * nTotalCompressed / nTotalUncompressed : 100.0, Plat_FloatTime() - flStart );
 }
 
 //-----------------------------------------------------------------------------
@@ -898,6 +1159,9 @@ void AddDirToPak( IZip *pak, const char *pDirPath, const char *pPakPrefix )
 //-----------------------------------------------------------------------------
 bool FileExistsInPak( IZip *pak, const char *pRelativeName )
 {
+	if ( s_pPendingPakBatch && s_pPendingPakBatch->GetPak() == pak && s_pPendingPakBatch->HasFile( pRelativeName ) )
+		return true;
+
 	return pak->FileExistsInZip( pRelativeName );
 }
 
@@ -907,6 +1171,7 @@ bool FileExistsInPak( IZip *pak, const char *pRelativeName )
 //-----------------------------------------------------------------------------
 bool ReadFileFromPak( IZip *pak, const char *pRelativeName, bool bTextMode, CUtlBuffer &buf )
 {
+	FlushPakFile( pak );
 	return pak->ReadFileFromZip( pRelativeName, bTextMode, buf );
 }
 
@@ -917,6 +1182,10 @@ bool ReadFileFromPak( IZip *pak, const char *pRelativeName, bool bTextMode, CUtl
 //-----------------------------------------------------------------------------
 void RemoveFileFromPak( IZip *pak, const char *relativename )
 {
+	if ( s_pPendingPakBatch && s_pPendingPakBatch->GetPak() == pak )
+	{
+		s_pPendingPakBatch->RemoveFile( relativename );
+	}
 	pak->RemoveFileFromZip( relativename );
 }
 
@@ -927,6 +1196,7 @@ void RemoveFileFromPak( IZip *pak, const char *relativename )
 //-----------------------------------------------------------------------------
 int GetNextFilename( IZip *pak, int id, char *pBuffer, int bufferSize, int &fileSize )
 {
+	FlushPakFile( pak );
 	return pak->GetNextFilename( id, pBuffer, bufferSize, fileSize );
 }
 
@@ -2307,6 +2577,7 @@ void LoadBSPFile( const char *filename )
 	// Load PAK file lump into appropriate data structure
 	byte *pakbuffer = NULL;
 	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
+	DiscardPendingPakFiles( GetPakFile() );
 	if ( paksize > 0 )
 	{
 		GetPakFile()->ActivateByteSwapping( IsX360() );
@@ -2456,6 +2727,7 @@ void LoadBSPFile_FileSystemOnly( const char *filename )
 	// Load PAK file lump into appropriate data structure
 	byte *pakbuffer = NULL;
 	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer, 1 );
+	DiscardPendingPakFiles( GetPakFile() );
 	if ( paksize > 0 )
 	{
 		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
@@ -2938,6 +3210,7 @@ void PrintBSPFileSizes (void)
 	if (h != g_GameLumps.InvalidGameLump())
 		totalmemory += GlobUsage( "static props",	1,	g_GameLumps.GameLumpSize(h) );
 
+	FlushPakFile( GetPakFile() );
 	totalmemory += GlobUsage( "pakfile",		GetPakFile()->EstimateSize(), 0 );
 	// HACKHACK: Set physics limit at 4MB, in reality this is totally dynamic
 	totalmemory += GlobUsage( "physics",		g_PhysCollideSize, 4*1024*1024 );
@@ -2969,6 +3242,7 @@ Dumps a list of files stored in the bsp pack.
 */
 void PrintBSPPackDirectory( void )
 {
+	FlushPakFile( GetPakFile() );
 	GetPakFile()->PrintDirectory();	
 }
 
@@ -4046,6 +4320,7 @@ void ConvertPakFileContents( const char *pInFilename )
 	}
 
 	// strip ldr version of hdr files
+	FlushPakFile( newPakFile );
 	for ( int i=0; i<hdrFiles.Count(); i++ )
 	{
 		char ldrFileName[MAX_PATH];
@@ -4069,6 +4344,7 @@ void ConvertPakFileContents( const char *pInFilename )
 	}
 
 	// discard old pak in favor of new pak
+	DiscardPendingPakFiles( s_pakFile );
 	IZip::ReleaseZip( s_pakFile );
 	s_pakFile = newPakFile;
 }
@@ -4304,6 +4580,7 @@ void SwapPakfileLumpToDisk( const char *pInFilename )
 	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
 	if ( paksize > 0 )
 	{
+		DiscardPendingPakFiles( GetPakFile() );
 		GetPakFile()->ActivateByteSwapping( IsX360() );
 		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
 
@@ -4680,6 +4957,7 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 				IZip *oldPakFile = IZip::CreateZip( NULL );
 				oldPakFile->ParseFromBuffer( inputBuffer.Base(), inputBuffer.Size() );
 
+				CPakFileBatch batch( newPakFile, packfileCompression );
 				int id = -1;
 				int fileSize;
 				while ( 1 )
@@ -4699,11 +4977,14 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 						continue;
 					}
 
-					AddBufferToPak( newPakFile, relativeName, sourceBuf.Base(), sourceBuf.TellMaxPut(), false, packfileCompression );
+					batch.AddBuffer( relativeName, sourceBuf.Base(), sourceBuf.TellMaxPut(), false );
 
-					DevMsg( "Repacking BSP: Created '%s' in lump pak\n", relativeName );
+					DevMsg( "Repacking BSP: Queued '%s' for lump pak\n", relativeName );
 				}
 
+				// compress everything at once
+				batch.Flush();
+
 				// save new pack to buffer
 				newPakFile->SaveToBuffer( outputBuffer );
 				sOutBSPHeader.lumps[lumpNum].fileofs = newOffset;
@@ -205,6 +205,51 @@ void				RemoveFileFromPak( IZip *pak, const char *pRelativeName );
 int					GetNextFilename( IZip *pak, int id, char *pBuffer, int bufferSize, int &fileSize );
 void				ForceAlignment( IZip *pak, bool bAlign, bool bCompatibleFormat, unsigned int alignmentSize );
 
+// AddFileToPak and AddBufferToPak queue work for a batch; this adds whatever is still queued for the pak.
+// The helpers above and the bsp writer call it, anything else using the IZip directly must too.
+void				FlushPakFile( IZip *pak );
+
+// Threads a pak batch reads and compresses on, -1 to use numthreads
+extern int			g_nPakFileThreads;
+
+//-----------------------------------------------------------------------------
+// Queues up files for a pak, then reads and compresses them on all threads at
+// once. They are added to the pak in the order they were queued, so the pak
+// comes out the same as adding them one at a time.
+//-----------------------------------------------------------------------------
+class CPakFileBatch
+{
+public:
+	CPakFileBatch( IZip *pak, IZip::eCompressionType compressionType = IZip::eCompressionType_None );
+	~CPakFileBatch();
+
+	// Queue a file from disk. Entries use the batch's compression unless given their own.
+	void				AddFile( const char *pRelativeName, const char *fullpath, IZip::eCompressionType compressionType = IZip::eCompressionType_Unknown );
+
+	// Queue a buffer; the data is copied
+	void				AddBuffer( const char *pRelativeName, const void *data, int length, bool bTextMode, IZip::eCompressionType compressionType = IZip::eCompressionType_Unknown );
+
+	// Is anything queued under this name?
+	bool				HasFile( const char *pRelativeName ) const;
+
+	// Drop anything queued under this name
+	void				RemoveFile( const char *pRelativeName );
+
+	IZip				*GetPak() const { return m_pPak; }
+
+	// Reads, compresses and adds everything queued so far to the pak
+	void				Flush();
+
+private:
+	struct PakEntry_t;
+
+	static void			PrepareEntryThread( int iThread, int iEntry );
+
+	IZip					*m_pPak;
+	IZip::eCompressionType	m_CompressionType;
+	CUtlVector<PakEntry_t *> m_Entries;
+};
+
 typedef bool (*CompressFunc_t)( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer );
 typedef bool (*VTFConvertFunc_t)( const char *pDebugName, CUtlBuffer &sourceBuf, CUtlBuffer &targetBuf, CompressFunc_t pCompressFunc );
 typedef bool (*VHVFixupFunc_t)( const char *pVhvFilename, const char *pModelName, CUtlBuffer &sourceBuf, CUtlBuffer &targetBuf );
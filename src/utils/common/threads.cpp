@@ -18,8 +18,8 @@
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
+#include "tier0/threadtools.h"
 
-#define	MAX_THREADS	16
 
 
 class CRunThreadsData
@@ -30,18 +30,182 @@ public:
 	RunThreadsFn m_Fn;
 };
 
-CRunThreadsData g_RunThreadsData[MAX_THREADS];
+CRunThreadsData g_RunThreadsData[MAX_TOOL_THREADS];
 
 
-int		dispatch;
 int		workcount;
 qboolean		pacifier;
 
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+HANDLE g_ThreadHandles[MAX_TOOL_THREADS];
 
+// Index of the tool thread we're running on, plus one (zero on threads not started by RunThreads_Start).
+static CTHREADLOCALINT g_iToolThread;
+
+
+/*
+===================================================================
+
+WORK SCHEDULING
+
+Work items are handed out without taking ThreadLock. The unclaimed items
+form a global pool that threads take chunks of with an atomic add. The
+chunks start large and shrink as the pool drains, so that the expensive
+items that tools sort to the end are spread out one at a time.
+
+Each thread works through its own chunk from the front. A thread that
+runs out of work, with the global pool empty, steals the back half of
+the largest range another thread has left.
+
+===================================================================
+*/
+
+// A range of work items [begin, end), packed into one 64-bit value so that the
+// owner and thieves can both update it with a single compare-and-swap.
+class CWorkRange
+{
+public:
+	int64 volatile m_Range;
+	byte m_Pad[ 64 - sizeof( int64 ) ];		// keep each thread's range on its own cache line
+};
+
+static CWorkRange g_WorkRanges[MAX_TOOL_THREADS];
+
+static int32 volatile g_iNextWork;			// first item in the global pool
+static int32 volatile g_nWorkHandedOut;		// for the pacifier
+static int32 volatile g_bUpdatingPacifier;
+
+static inline int64 PackWorkRange( int iBegin, int iEnd )
+{
+	return ( (int64)(uint32)iBegin << 32 ) | (uint32)iEnd;
+}
+
+static inline int WorkRangeBegin( int64 range )
+{
+	return (int)( range >> 32 );
+}
+
+static inline int WorkRangeEnd( int64 range )
+{
+	return (int)( range & 0xffffffff );
+}
+
+static inline int64 ReadWorkRange( int64 volatile *pRange )
+{
+	// atomic read, even on 32-bit
+	return ThreadInterlockedCompareExchange64( pRange, 0, 0 );
+}
+
+
+static void ResetThreadWork( int workcnt )
+{
+	workcount = workcnt;
+	g_iNextWork = 0;
+	g_nWorkHandedOut = 0;
+	g_bUpdatingPacifier = 0;
+
+	for ( int i=0; i < MAX_TOOL_THREADS; i++ )
+	{
+		g_WorkRanges[i].m_Range = PackWorkRange( 0, 0 );
+	}
+}
+
+
+// Called for each work item handed out.
+static int HandOutWork( int iWork )
+{
+	int nHandedOut = ThreadInterlockedIncrement( &g_nWorkHandedOut );
+
+	// The pacifier isn't thread safe, so only one thread updates it at a time. Others just skip it.
+	if ( ThreadInterlockedAssignIf( &g_bUpdatingPacifier, 1, 0 ) )
+	{
+		UpdatePacifier( (float)( nHandedOut - 1 ) / workcount );
+		g_bUpdatingPacifier = 0;
+	}
+
+	return iWork;
+}
+
+
+// Take a chunk of items from the global pool.
+static bool ClaimWorkChunk( int *pBegin, int *pEnd )
+{
+	int nRemaining = workcount - g_iNextWork;
+	if ( nRemaining <= 0 )
+		return false;
+
+	int nChunk = nRemaining / ( max( numthreads, 1 ) * 4 );
+	if ( nChunk < 1 )
+		nChunk = 1;
+
+	int iBegin = ThreadInterlockedExchangeAdd( &g_iNextWork, nChunk );
+	if ( iBegin >= workcount )
+		return false;
+
+	*pBegin = iBegin;
+	*pEnd = min( iBegin + nChunk, workcount );
+	return true;
+}
+
+
+// Take the back half of the largest range owned by another thread.
+static bool StealWork( int iThread, int *pBegin, int *pEnd )
+{
+	while ( 1 )
+	{
+		int iVictim = -1;
+		int64 victimRange = 0;
+		int nMostLeft = 0;
+
+		for ( int i=0; i < numthreads; i++ )
+		{
+			if ( i == iThread )
+				continue;
+
+			int64 range = ReadWorkRange( &g_WorkRanges[i].m_Range );
+			int nLeft = WorkRangeEnd( range ) - WorkRangeBegin( range );
+			if ( nLeft > nMostLeft )
+			{
+				iVictim = i;
+				victimRange = range;
+				nMostLeft = nLeft;
+			}
+		}
+
+		if ( iVictim == -1 )
+			return false;
+
+		int iBegin = WorkRangeBegin( victimRange );
+		int iEnd = WorkRangeEnd( victimRange );
+		int iSplit = iEnd - ( nMostLeft + 1 ) / 2;
+
+		if ( ThreadInterlockedAssignIf64( &g_WorkRanges[iVictim].m_Range, PackWorkRange( iBegin, iSplit ), victimRange ) )
+		{
+			*pBegin = iSplit;
+			*pEnd = iEnd;
+			return true;
+		}
+
+		// The owner or another thief got there first. Look again.
+	}
+}
+
+
+// Make [iBegin, iEnd) the calling thread's range. Its current range is empty, which nobody else touches.
+static void SetWorkRange( int iThread, int iBegin, int iEnd )
+{
+	int64 volatile *pRange = &g_WorkRanges[iThread].m_Range;
+
+	int64 oldRange;
+	do
+	{
+		oldRange = ReadWorkRange( pRange );
+		Assert( WorkRangeBegin( oldRange ) >= WorkRangeEnd( oldRange ) );
+	}
+	while ( !ThreadInterlockedAssignIf64( pRange, PackWorkRange( iBegin, iEnd ), oldRange ) );
+}
 
 
 /*
@@ -52,23 +216,38 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
+	int iThread = g_iToolThread - 1;
+	if ( iThread < 0 )
+	{
+		// Not a tool thread, so there is no range of our own. Take items one at a time from the pool.
+		int iWork = ThreadInterlockedExchangeAdd( &g_iNextWork, 1 );
+		if ( iWork >= workcount )
+			return -1;
 
-	ThreadLock ();
+		return HandOutWork( iWork );
+	}
 
-	if (dispatch == workcount)
+	// Take the next item from our own range.
+	int64 volatile *pRange = &g_WorkRanges[iThread].m_Range;
+	while ( 1 )
 	{
-		ThreadUnlock ();
-		return -1;
-	}
+		int64 range = ReadWorkRange( pRange );
+		int iBegin = WorkRangeBegin( range );
+		int iEnd = WorkRangeEnd( range );
+		if ( iBegin >= iEnd )
+			break;
 
-	UpdatePacifier( (float)dispatch / workcount );
+		if ( ThreadInterlockedAssignIf64( pRange, PackWorkRange( iBegin + 1, iEnd ), range ) )
+			return HandOutWork( iBegin );
+	}
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
+	// Our range is empty. Refill it from the global pool, or from another thread.
+	int iBegin, iEnd;
+	if ( !ClaimWorkChunk( &iBegin, &iEnd ) && !StealWork( iThread, &iBegin, &iEnd ) )
+		return -1;
 
-	return r;
+	SetWorkRange( iThread, iBegin + 1, iEnd );
+	return HandOutWork( iBegin );
 }
 
 
@@ -136,8 +315,10 @@ void ThreadSetDefault (void)
 	{
 		GetSystemInfo (&info);
 		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+		if (numthreads < 1)
 			numthreads = 1;
+		if (numthreads > MAX_TOOL_THREADS)
+			numthreads = MAX_TOOL_THREADS;
 	}
 
 	Msg ("%i threads\n", numthreads);
@@ -169,6 +350,7 @@ void ThreadUnlock (void)
 DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	g_iToolThread = pData->m_iThread + 1;
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
 	return 0;
 }
@@ -212,7 +394,10 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
+	// WaitForMultipleObjects can only wait on MAXIMUM_WAIT_OBJECTS handles at once.
+	for ( int i=0; i < numthreads; i += MAXIMUM_WAIT_OBJECTS )
+		WaitForMultipleObjects( min( numthreads - i, MAXIMUM_WAIT_OBJECTS ), &g_ThreadHandles[i], TRUE, INFINITE );
+
 	for ( int i=0; i < numthreads; i++ )
 		CloseHandle( g_ThreadHandles[i] );
 
@@ -230,8 +415,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	int		start, end;
 
 	start = Plat_FloatTime();
-	dispatch = 0;
-	workcount = workcnt;
+	ResetThreadWork( workcnt );
 	StartPacifier("");
 	pacifier = showpacifier;
 
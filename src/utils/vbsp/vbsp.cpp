@@ -1277,6 +1277,7 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
+	g_nPakFileThreads = numthreads;	// packing files does scale, keep every thread for it
 	numthreads = 1;		// multiple threads aren't helping...
 
 	// Setup the logfile.
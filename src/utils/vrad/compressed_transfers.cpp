@@ -0,0 +1,303 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for the patch to patch transfer lists used by the
+//			radiosity bounces.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "compressed_transfers.h"
+#include "mathlib/ssemath.h"
+#include "tier1/utlvector.h"
+
+
+// Weights are stored as the top 16 bits of a float with its exponent rebiased by
+// TRANSFER_WEIGHT_EXPONENT_BIAS, so every nonzero weight decodes to a normal float.
+// That covers [2^-30,1] with 10 mantissa bits; anything smaller is dropped.
+#define TRANSFER_WEIGHT_EXPONENT_BIAS	96
+#define TRANSFER_WEIGHT_MIN				9.31322575e-10f		// 2^-30
+
+static int64 s_nCompressedTransferBytes = 0;
+
+// emitlight * reflectivity and origin of every patch, for the current bounce.
+// Padded by one, since FourVectors::LoadAndSwizzle reads a float past each vector.
+static CUtlVector<Vector> s_PatchRadiance;
+static CUtlVector<Vector> s_PatchOrigins;
+
+
+static inline uint16 EncodeTransferWeight( float flWeight )
+{
+	Assert( flWeight <= 1.0f );
+	if ( flWeight < TRANSFER_WEIGHT_MIN )
+		return 0;
+
+	uint32 nBits = *(uint32*)&flWeight;
+	return (uint16)( ( nBits + 0x1000 - ( TRANSFER_WEIGHT_EXPONENT_BIAS << 23 ) ) >> 13 );
+}
+
+static inline float DecodeTransferWeight( uint16 nWeight )
+{
+	if ( !nWeight )
+		return 0.0f;
+
+	uint32 nBits = ( (uint32)nWeight << 13 ) + ( TRANSFER_WEIGHT_EXPONENT_BIAS << 23 );
+	return *(float*)&nBits;
+}
+
+static inline int EncodeIndexDelta( byte *pOut, uint32 nDelta )
+{
+	int nBytes = 0;
+	while ( nDelta >= 0x80 )
+	{
+		if ( pOut )
+			pOut[nBytes] = (byte)( nDelta | 0x80 );
+		nDelta >>= 7;
+		++nBytes;
+	}
+	if ( pOut )
+		pOut[nBytes] = (byte)nDelta;
+	return nBytes + 1;
+}
+
+static inline uint32 DecodeIndexDelta( const byte *&pIn )
+{
+	uint32 nDelta = 0;
+	int nShift = 0;
+	byte b;
+	do
+	{
+		b = *pIn++;
+		nDelta |= (uint32)( b & 0x7f ) << nShift;
+		nShift += 7;
+	} while ( b & 0x80 );
+	return nDelta;
+}
+
+static int __cdecl TransferPatchCompare( const transfer_t *pLeft, const transfer_t *pRight )
+{
+	return pLeft->patch - pRight->patch;
+}
+
+
+//-----------------------------------------------------------------------------
+// Replaces the patch's transfer list with a compressed one
+//-----------------------------------------------------------------------------
+void CompressTransfers( CPatch *patch, const transfer_t *pTransfers, int numTransfers, float flScale )
+{
+	patch->numtransfers = numTransfers;
+	patch->transfers = NULL;
+	patch->compressedTransfers = NULL;
+	if ( !numTransfers )
+		return;
+
+	CUtlVector<transfer_t> sorted;
+	sorted.CopyArray( pTransfers, numTransfers );
+	sorted.Sort( TransferPatchCompare );
+
+	float flMaxTransfer = 0.0f;
+	int nIndexBytes = 0;
+	int nPrevPatch = 0;
+	for ( int i = 0; i < numTransfers; i++ )
+	{
+		flMaxTransfer = max( flMaxTransfer, sorted[i].transfer );
+		nIndexBytes += EncodeIndexDelta( NULL, sorted[i].patch - nPrevPatch );
+		nPrevPatch = sorted[i].patch;
+	}
+
+	int nPaddedCount = ( numTransfers + 3 ) & ~3;
+	int nBytes = sizeof( float ) + nPaddedCount * sizeof( uint16 ) + nIndexBytes;
+	byte *pData = (byte *)malloc( nBytes );
+	if ( !pData )
+		Error( "Memory allocation failure" );
+
+	*(float*)pData = flMaxTransfer * flScale;
+
+	float flInvMaxTransfer = ( flMaxTransfer > 0.0f ) ? 1.0f / flMaxTransfer : 0.0f;
+	uint16 *pWeights = (uint16 *)( pData + sizeof( float ) );
+	for ( int i = 0; i < nPaddedCount; i++ )
+	{
+		pWeights[i] = ( i < numTransfers ) ? EncodeTransferWeight( min( sorted[i].transfer * flInvMaxTransfer, 1.0f ) ) : 0;
+	}
+
+	byte *pIndex = (byte *)( pWeights + nPaddedCount );
+	nPrevPatch = 0;
+	for ( int i = 0; i < numTransfers; i++ )
+	{
+		pIndex += EncodeIndexDelta( pIndex, sorted[i].patch - nPrevPatch );
+		nPrevPatch = sorted[i].patch;
+	}
+	Assert( pIndex == pData + nBytes );
+
+	patch->compressedTransfers = pData;
+
+	ThreadLock();
+	s_nCompressedTransferBytes += nBytes;
+	ThreadUnlock();
+}
+
+
+int64 GetCompressedTransferBytes()
+{
+	return s_nCompressedTransferBytes;
+}
+
+
+//-----------------------------------------------------------------------------
+// Size of a patch's compressed transfer list, in bytes
+//-----------------------------------------------------------------------------
+int GetCompressedTransferSize( const CPatch *patch )
+{
+	if ( !patch->compressedTransfers )
+		return 0;
+
+	int nPaddedCount = ( patch->numtransfers + 3 ) & ~3;
+	const byte *pIndex = patch->compressedTransfers + sizeof( float ) + nPaddedCount * sizeof( uint16 );
+	for ( int i = 0; i < patch->numtransfers; i++ )
+	{
+		DecodeIndexDelta( pIndex );
+	}
+	return pIndex - patch->compressedTransfers;
+}
+
+
+//-----------------------------------------------------------------------------
+// Hands a compressed transfer list that was saved earlier back to a patch
+//-----------------------------------------------------------------------------
+void RestoreCompressedTransfers( CPatch *patch, int numTransfers, byte *pData, int nBytes )
+{
+	patch->numtransfers = numTransfers;
+	patch->transfers = NULL;
+	patch->compressedTransfers = pData;
+
+	ThreadLock();
+	s_nCompressedTransferBytes += nBytes;
+	ThreadUnlock();
+}
+
+
+//-----------------------------------------------------------------------------
+// Caches what GatherCompressedLight needs from the shooting patches
+//-----------------------------------------------------------------------------
+void PrepareCompressedGather( const Vector *pEmitLight )
+{
+	int nPatches = g_Patches.Count();
+	s_PatchRadiance.SetCount( nPatches + 1 );
+	s_PatchOrigins.SetCount( nPatches + 1 );
+
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+		for ( int j = 0; j < 3; j++ )
+		{
+			s_PatchRadiance[i][j] = pEmitLight[i][j] * patch->reflectivity[j];
+		}
+		s_PatchOrigins[i] = patch->origin;
+	}
+
+	s_PatchRadiance[nPatches].Init();
+	s_PatchOrigins[nPatches].Init();
+}
+
+
+//-----------------------------------------------------------------------------
+// Gathers the light transferred to a patch, four transfers at a time
+//-----------------------------------------------------------------------------
+void GatherCompressedLight( CPatch *patch, const Vector *pNormals, int numNormals, Vector *pLight )
+{
+	Assert( numNormals <= NUM_BUMP_VECTS + 1 );
+
+	for ( int n = 0; n < numNormals; n++ )
+	{
+		pLight[n].Init();
+	}
+
+	if ( !patch->compressedTransfers )
+		return;
+
+	int numTransfers = patch->numtransfers;
+	int nPaddedCount = ( numTransfers + 3 ) & ~3;
+	const byte *pData = patch->compressedTransfers;
+	fltx4 weightScale = ReplicateX4( *(const float*)pData );
+	const uint16 *pWeights = (const uint16 *)( pData + sizeof( float ) );
+	const byte *pIndex = (const byte *)( pWeights + nPaddedCount );
+
+	const Vector *pRadiance = s_PatchRadiance.Base();
+	const Vector *pOrigins = s_PatchOrigins.Base();
+	bool bBump = ( numNormals > 1 );
+
+	FourVectors origin, patchNormal;
+	FourVectors normals[NUM_BUMP_VECTS + 1];
+	FourVectors sum[NUM_BUMP_VECTS + 1];
+	origin.DuplicateVector( patch->origin );
+	patchNormal.DuplicateVector( patch->normal );
+	for ( int n = 0; n < numNormals; n++ )
+	{
+		if ( bBump )
+		{
+			normals[n].DuplicateVector( pNormals[n] );
+		}
+		sum[n].DuplicateVector( vec3_origin );
+	}
+
+	int nPatch = 0;
+	int idx[4];
+	float ALIGN16 weights[4] ALIGN16_POST;
+	for ( int k = 0; k < numTransfers; k += 4 )
+	{
+		// padding lanes repeat the last patch with a zero weight
+		int nLanes = min( 4, numTransfers - k );
+		for ( int i = 0; i < 4; i++ )
+		{
+			if ( i < nLanes )
+			{
+				nPatch += DecodeIndexDelta( pIndex );
+			}
+			idx[i] = nPatch;
+			weights[i] = DecodeTransferWeight( pWeights[k + i] );
+		}
+		fltx4 weight = MulSIMD( LoadAlignedSIMD( weights ), weightScale );
+
+		FourVectors v;
+		v.LoadAndSwizzle( pRadiance[idx[0]], pRadiance[idx[1]], pRadiance[idx[2]], pRadiance[idx[3]] );
+
+		if ( !bBump )
+		{
+			v *= weight;
+			sum[0] += v;
+			continue;
+		}
+
+		// get vector to other patch
+		FourVectors delta;
+		delta.LoadAndSwizzle( pOrigins[idx[0]], pOrigins[idx[1]], pOrigins[idx[2]], pOrigins[idx[3]] );
+		delta -= origin;
+		delta *= ReciprocalSqrtSIMD( delta.length2() );
+
+		// remove normal already factored into transfer steradian
+		fltx4 scale = ReciprocalSIMD( delta * patchNormal );
+		v *= MulSIMD( weight, scale );
+
+		// mask the products rather than the dots, so the padding lanes and normals facing
+		// away stay out of the sums even if the scale blew up
+		fltx4 laneMask = LoadAlignedSIMD( g_SIMD_SkipTailMask[nLanes & 3] );
+		for ( int n = 0; n < numNormals; n++ )
+		{
+			fltx4 dot = delta * normals[n];
+			fltx4 mask = AndSIMD( CmpGtSIMD( dot, Four_Zeros ), laneMask );
+
+			FourVectors bumpTransfer = v;
+			bumpTransfer *= dot;
+			sum[n].x = AddSIMD( sum[n].x, AndSIMD( bumpTransfer.x, mask ) );
+			sum[n].y = AddSIMD( sum[n].y, AndSIMD( bumpTransfer.y, mask ) );
+			sum[n].z = AddSIMD( sum[n].z, AndSIMD( bumpTransfer.z, mask ) );
+		}
+	}
+
+	for ( int n = 0; n < numNormals; n++ )
+	{
+		for ( int i = 0; i < 4; i++ )
+		{
+			pLight[n] += sum[n].Vec( i );
+		}
+	}
+}
@@ -0,0 +1,51 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for the patch to patch transfer lists used by the
+//			radiosity bounces.
+//
+//=============================================================================//
+
+#ifndef COMPRESSED_TRANSFERS_H
+#define COMPRESSED_TRANSFERS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+class CPatch;
+struct transfer_t;
+
+
+// A patch's compressed transfers live in a single allocation:
+//
+//		float	weight scale
+//		uint16	weights[ numtransfers rounded up to a multiple of 4 ]
+//		byte	patch index deltas, as 7 bit varints
+//
+// The transfers are sorted by patch index, so most deltas fit in a byte. Each weight is
+// stored as a half float relative to the largest transfer of the patch, which keeps about
+// 11 bits of precision for every transfer no matter how small it is.
+
+// Replaces the patch's transfer list with a compressed one. The weights are multiplied by flScale.
+void CompressTransfers( CPatch *patch, const transfer_t *pTransfers, int numTransfers, float flScale );
+
+// Size of all the compressed transfer lists, in bytes
+int64 GetCompressedTransferBytes();
+
+// Size of one patch's compressed transfer list, in bytes
+int GetCompressedTransferSize( const CPatch *patch );
+
+// Gives a patch a compressed transfer list that was saved earlier; the patch takes
+// ownership of pData, which must come from malloc
+void RestoreCompressedTransfers( CPatch *patch, int numTransfers, byte *pData, int nBytes );
+
+// Call at the start of each bounce, after emitlight has been updated
+void PrepareCompressedGather( const Vector *pEmitLight );
+
+// Gathers the light transferred to a patch from all the patches it can see.
+// numNormals is 1 for unbumped patches, otherwise NUM_BUMP_VECTS+1 with pNormals
+// holding the normal for each bumped lightmap.
+void GatherCompressedLight( CPatch *patch, const Vector *pNormals, int numNormals, Vector *pLight );
+
+
+#endif // COMPRESSED_TRANSFERS_H
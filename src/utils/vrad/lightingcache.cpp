@@ -0,0 +1,992 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-face direct lighting and transfer caches used by -incremental,
+//			so a recompile only relights the faces an edit can have changed.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightingcache.h"
+#include "compressed_transfers.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+
+
+#define LIGHTING_CACHE_ID			(('C'<<24)+('L'<<16)+('R'<<8)+'V')		// little-endian "VRLC"
+#define LIGHTING_CACHE_VERSION		1
+
+#define TRANSFER_CACHE_ID			(('C'<<24)+('T'<<16)+('R'<<8)+'V')		// little-endian "VRTC"
+#define TRANSFER_CACHE_VERSION		1
+
+// the centroid and corners of a triangle, each on both sides of it
+#define MAX_OCCLUDER_CLUSTERS		8
+
+
+struct LightingCacheHeader_t
+{
+	int		id;
+	int		version;
+	CRC32_t	settingsCRC;
+	CRC32_t	visCRC;
+	int		numClusters;
+	int		pvsStride;				// bytes per light pvs, padded to a multiple of 4
+	int		numLights;
+	int		numOccluders;
+	int		numFaces;
+};
+
+// followed by numClusters ints, then numSamples LightingValue_t for each normal of each style
+struct CachedFaceHeader_t
+{
+	CRC32_t	faceCRC;
+	int		numSamples;
+	int		numNormals;
+	int		numClusters;
+	byte	styles[MAXLIGHTMAPS];
+};
+
+// A triangle in the ray tracer, and the clusters it is in
+struct OccluderInfo_t
+{
+	CRC32_t			crc;
+	unsigned short	clusters[MAX_OCCLUDER_CLUSTERS];
+	int				numClusters;
+};
+
+struct TransferCacheHeader_t
+{
+	int		id;
+	int		version;
+	CRC32_t	visCRC;
+	CRC32_t	occluderCRC;
+	CRC32_t	patchCRC;
+	int		numPatches;
+	int		compressed;
+	int		textureShadows;
+};
+
+// Used to match this run's faces, lights and triangles against the cached ones
+struct CRCIndex_t
+{
+	CRC32_t	crc;
+	int		index;
+};
+
+
+static CRC32_t s_SettingsCRC;
+static CRC32_t s_VisCRC;
+static CRC32_t s_OccluderCRC;
+static int s_nPVSStride;
+
+// this run
+static CUtlVector<OccluderInfo_t> s_Occluders;
+static CUtlVector<CRC32_t> s_FaceCRCs;
+static CUtlVector< CUtlVector<int> > s_FaceClusters;
+
+// the last run
+static CUtlBuffer s_CacheBuffer;
+static CUtlVector<const CachedFaceHeader_t *> s_CachedFaces;		// indexed by this run's face numbers
+
+static bool s_bWriteError;
+
+
+template< class T >
+static inline void CRC32_ProcessValue( CRC32_t *pCRC, const T &value )
+{
+	CRC32_ProcessBuffer( pCRC, &value, sizeof( value ) );
+}
+
+static int __cdecl CRCIndexCompare( const CRCIndex_t *pLeft, const CRCIndex_t *pRight )
+{
+	if ( pLeft->crc != pRight->crc )
+		return ( pLeft->crc < pRight->crc ) ? -1 : 1;
+	return pLeft->index - pRight->index;
+}
+
+static void GetCacheFilename( char *pFilename, int nMaxLen, const char *pExtension )
+{
+	char szBase[MAX_PATH];
+	Q_StripExtension( source, szBase, sizeof( szBase ) );
+	Q_snprintf( pFilename, nMaxLen, "%s.%s", szBase, pExtension );
+}
+
+static void GetLightingCacheFilename( char *pFilename, int nMaxLen )
+{
+	GetCacheFilename( pFilename, nMaxLen, g_bHDR ? "hdr.lightcache" : "ldr.lightcache" );
+}
+
+static const void *GetCacheData( int nBytes )
+{
+	const void *pData = s_CacheBuffer.PeekGet( nBytes, 0 );
+	if ( pData )
+	{
+		s_CacheBuffer.SeekGet( CUtlBuffer::SEEK_CURRENT, nBytes );
+	}
+	return pData;
+}
+
+static void WriteCacheData( FileHandle_t fp, const void *pData, int nBytes )
+{
+	if ( !s_bWriteError && nBytes && g_pFileSystem->Write( pData, nBytes, fp ) != nBytes )
+	{
+		s_bWriteError = true;
+	}
+}
+
+static inline void SetClusterBit( byte *pBits, int cluster )
+{
+	pBits[cluster >> 3] |= ( 1 << ( cluster & 7 ) );
+}
+
+static bool PVSIntersects( const byte *pPVS, const byte *pClusters, int nBytes )
+{
+	for ( int i = 0; i < nBytes; i++ )
+	{
+		if ( pPVS[i] & pClusters[i] )
+			return true;
+	}
+	return false;
+}
+
+static void MergePVS( byte *pDest, const byte *pPVS, int nBytes )
+{
+	for ( int i = 0; i < nBytes; i++ )
+	{
+		pDest[i] |= pPVS[i];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Everything about a face that changes the light that lands on it
+//-----------------------------------------------------------------------------
+static CRC32_t ComputeFaceCRC( int facenum )
+{
+	dface_t *f = &g_pFaces[facenum];
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	dplane_t *plane = &dplanes[f->planenum];
+	CRC32_ProcessValue( &crc, plane->normal );
+	CRC32_ProcessValue( &crc, plane->dist );
+	CRC32_ProcessValue( &crc, f->side );
+	CRC32_ProcessValue( &crc, face_offset[facenum] );
+	for ( int i = 0; i < f->numedges; i++ )
+	{
+		CRC32_ProcessValue( &crc, dvertexes[EdgeVertex( f, i )].point );
+	}
+
+	texinfo_t *tx = &texinfo[f->texinfo];
+	CRC32_ProcessValue( &crc, tx->textureVecsTexelsPerWorldUnits );
+	CRC32_ProcessValue( &crc, tx->lightmapVecsLuxelsPerWorldUnits );
+	CRC32_ProcessValue( &crc, tx->flags );
+	if ( tx->texdata >= 0 )
+	{
+		dtexdata_t *pTexData = &dtexdata[tx->texdata];
+		CRC32_ProcessValue( &crc, pTexData->reflectivity );
+		const char *pName = TexDataStringTable_GetString( pTexData->nameStringTableID );
+		CRC32_ProcessBuffer( &crc, pName, Q_strlen( pName ) );
+	}
+
+	CRC32_ProcessValue( &crc, f->m_LightmapTextureMinsInLuxels );
+	CRC32_ProcessValue( &crc, f->m_LightmapTextureSizeInLuxels );
+	CRC32_ProcessValue( &crc, f->smoothingGroups );
+
+	if ( f->dispinfo != -1 )
+	{
+		ddispinfo_t *pDisp = &g_dispinfo[f->dispinfo];
+		CRC32_ProcessValue( &crc, pDisp->startPosition );
+		CRC32_ProcessValue( &crc, pDisp->power );
+		CRC32_ProcessValue( &crc, pDisp->minTess );
+		CRC32_ProcessValue( &crc, pDisp->smoothingAngle );
+		CRC32_ProcessValue( &crc, pDisp->contents );
+		CRC32_ProcessBuffer( &crc, &g_DispVerts[pDisp->m_iDispVertStart], pDisp->NumVerts() * sizeof( CDispVert ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//-----------------------------------------------------------------------------
+// Everything about a light that changes what it lights. Surface lights use the
+// checksum of their face rather than its number, which can change between compiles.
+//-----------------------------------------------------------------------------
+static CRC32_t ComputeLightCRC( directlight_t *dl )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	dworldlight_t *wl = &dl->light;
+	CRC32_ProcessValue( &crc, wl->origin );
+	CRC32_ProcessValue( &crc, wl->intensity );
+	CRC32_ProcessValue( &crc, wl->normal );
+	CRC32_ProcessValue( &crc, wl->cluster );
+	CRC32_ProcessValue( &crc, wl->type );
+	CRC32_ProcessValue( &crc, wl->style );
+	CRC32_ProcessValue( &crc, wl->stopdot );
+	CRC32_ProcessValue( &crc, wl->stopdot2 );
+	CRC32_ProcessValue( &crc, wl->exponent );
+	CRC32_ProcessValue( &crc, wl->radius );
+	CRC32_ProcessValue( &crc, wl->constant_attn );
+	CRC32_ProcessValue( &crc, wl->linear_attn );
+	CRC32_ProcessValue( &crc, wl->quadratic_attn );
+	CRC32_ProcessValue( &crc, wl->flags );
+
+	if ( wl->type == emit_surface )
+	{
+		CRC32_ProcessValue( &crc, s_FaceCRCs[dl->facenum] );
+	}
+
+	CRC32_ProcessValue( &crc, dl->snormal );
+	CRC32_ProcessValue( &crc, dl->tnormal );
+	CRC32_ProcessValue( &crc, dl->sscale );
+	CRC32_ProcessValue( &crc, dl->tscale );
+	CRC32_ProcessValue( &crc, dl->soffset );
+	CRC32_ProcessValue( &crc, dl->toffset );
+	CRC32_ProcessValue( &crc, dl->m_flStartFadeDistance );
+	CRC32_ProcessValue( &crc, dl->m_flEndFadeDistance );
+	CRC32_ProcessValue( &crc, dl->m_flCapDist );
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+static CRC32_t ComputeVisCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessValue( &crc, dvis->numclusters );
+	CRC32_ProcessBuffer( &crc, dvisdata, visdatasize );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+static CRC32_t ComputePatchCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	for ( int i = 0; i < g_Patches.Count(); i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+		int sky = patch->sky;
+		CRC32_ProcessValue( &crc, patch->origin );
+		CRC32_ProcessValue( &crc, patch->normal );
+		CRC32_ProcessValue( &crc, patch->area );
+		CRC32_ProcessValue( &crc, patch->faceNumber );
+		CRC32_ProcessValue( &crc, patch->clusterNumber );
+		CRC32_ProcessValue( &crc, patch->parent );
+		CRC32_ProcessValue( &crc, patch->child1 );
+		CRC32_ProcessValue( &crc, patch->child2 );
+		CRC32_ProcessValue( &crc, sky );
+	}
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes a ray tracer triangle and finds the clusters it is in. The points are
+// nudged off both sides, since a point on a brush face can land in the solid leaf.
+//-----------------------------------------------------------------------------
+static void AddOccluderCluster( OccluderInfo_t *pInfo, const Vector &vPoint )
+{
+	int cluster = ClusterFromPoint( vPoint );
+	if ( cluster < 0 )
+		return;
+
+	for ( int i = 0; i < pInfo->numClusters; i++ )
+	{
+		if ( pInfo->clusters[i] == cluster )
+			return;
+	}
+	pInfo->clusters[pInfo->numClusters++] = cluster;
+}
+
+static void HashOccluder( int iThread, int iTriangle )
+{
+	const CacheOptimizedTriangle &tri = g_RtEnv.OptimizedTriangleList[iTriangle];
+	OccluderInfo_t *pInfo = &s_Occluders[iTriangle];
+
+	CRC32_Init( &pInfo->crc );
+	for ( int i = 0; i < 3; i++ )
+	{
+		CRC32_ProcessValue( &pInfo->crc, tri.Vertex( i ) );
+	}
+	CRC32_ProcessValue( &pInfo->crc, tri.m_Data.m_GeometryData.m_nFlags );
+	if ( iTriangle < g_RtEnv.TriangleColors.Count() )
+	{
+		CRC32_ProcessValue( &pInfo->crc, g_RtEnv.TriangleColors[iTriangle] );
+	}
+	if ( iTriangle < g_RtEnv.TriangleMaterials.Count() )
+	{
+		CRC32_ProcessValue( &pInfo->crc, g_RtEnv.TriangleMaterials[iTriangle] );
+	}
+	CRC32_Final( &pInfo->crc );
+
+	Vector vCentroid = ( tri.Vertex( 0 ) + tri.Vertex( 1 ) + tri.Vertex( 2 ) ) * ( 1.0f / 3.0f );
+	Vector vNormal = CrossProduct( tri.Vertex( 1 ) - tri.Vertex( 0 ), tri.Vertex( 2 ) - tri.Vertex( 0 ) );
+	VectorNormalize( vNormal );
+
+	pInfo->numClusters = 0;
+	for ( int i = 0; i < 4; i++ )
+	{
+		// pull the corners in a little so they don't sit on the edge of a leaf
+		Vector vPoint = ( i < 3 ) ? tri.Vertex( i ) + ( vCentroid - tri.Vertex( i ) ) * 0.05f : vCentroid;
+		AddOccluderCluster( pInfo, vPoint + vNormal );
+		AddOccluderCluster( pInfo, vPoint - vNormal );
+	}
+}
+
+void HashLightingCacheOccluders()
+{
+	int nTriangles = g_RtEnv.OptimizedTriangleList.Count();
+	s_Occluders.SetCount( nTriangles );
+	memset( s_Occluders.Base(), 0, nTriangles * sizeof( OccluderInfo_t ) );
+
+	RunThreadsOnIndividual( nTriangles, false, HashOccluder );
+
+	CRC32_Init( &s_OccluderCRC );
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		CRC32_ProcessValue( &s_OccluderCRC, s_Occluders[i].crc );
+	}
+	CRC32_Final( &s_OccluderCRC );
+}
+
+
+//-----------------------------------------------------------------------------
+// Marks the clusters of every triangle that was added or removed since the last run
+//-----------------------------------------------------------------------------
+static int FindChangedOccluders( const OccluderInfo_t *pCached, int nCached, byte *pClusters )
+{
+	CUtlVector<CRCIndex_t> oldList, newList;
+	oldList.SetCount( nCached );
+	for ( int i = 0; i < nCached; i++ )
+	{
+		oldList[i].crc = pCached[i].crc;
+		oldList[i].index = i;
+	}
+	newList.SetCount( s_Occluders.Count() );
+	for ( int i = 0; i < s_Occluders.Count(); i++ )
+	{
+		newList[i].crc = s_Occluders[i].crc;
+		newList[i].index = i;
+	}
+	oldList.Sort( CRCIndexCompare );
+	newList.Sort( CRCIndexCompare );
+
+	int nChanged = 0;
+	int iOld = 0, iNew = 0;
+	while ( iOld < oldList.Count() || iNew < newList.Count() )
+	{
+		const OccluderInfo_t *pChanged;
+		if ( iNew == newList.Count() || ( iOld < oldList.Count() && oldList[iOld].crc < newList[iNew].crc ) )
+		{
+			pChanged = &pCached[oldList[iOld++].index];
+		}
+		else if ( iOld == oldList.Count() || newList[iNew].crc < oldList[iOld].crc )
+		{
+			pChanged = &s_Occluders[newList[iNew++].index];
+		}
+		else
+		{
+			++iOld;
+			++iNew;
+			continue;
+		}
+
+		for ( int i = 0; i < pChanged->numClusters; i++ )
+		{
+			SetClusterBit( pClusters, pChanged->clusters[i] );
+		}
+		++nChanged;
+	}
+	return nChanged;
+}
+
+
+//-----------------------------------------------------------------------------
+// Marks the faces next to a changed face, since their smoothed normals can change too
+//-----------------------------------------------------------------------------
+static void MarkNeighborsDirty( int facenum, CUtlVector<bool> &dirty )
+{
+	faceneighbor_t *fn = &faceneighbor[facenum];
+	for ( int i = 0; i < fn->numneighbors; i++ )
+	{
+		dirty[fn->neighbor[i]] = true;
+	}
+
+	dface_t *f = &g_pFaces[facenum];
+	if ( f->dispinfo == -1 )
+		return;
+
+	ddispinfo_t *pDisp = &g_dispinfo[f->dispinfo];
+	for ( int iEdge = 0; iEdge < 4; iEdge++ )
+	{
+		for ( int iSub = 0; iSub < 2; iSub++ )
+		{
+			CDispSubNeighbor *pSub = &pDisp->m_EdgeNeighbors[iEdge].m_SubNeighbors[iSub];
+			if ( pSub->IsValid() )
+			{
+				dirty[g_dispinfo[pSub->GetNeighborIndex()].m_iMapFace] = true;
+			}
+		}
+	}
+	for ( int iCorner = 0; iCorner < 4; iCorner++ )
+	{
+		CDispCornerNeighbors *pCorner = &pDisp->m_CornerNeighbors[iCorner];
+		for ( int i = 0; i < pCorner->m_nNeighbors; i++ )
+		{
+			dirty[g_dispinfo[pCorner->m_Neighbors[i]].m_iMapFace] = true;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Loads the cache from the last run and works out which faces need relighting
+//-----------------------------------------------------------------------------
+void LoadLightingCache( CRC32_t settingsCRC )
+{
+	s_SettingsCRC = settingsCRC;
+	s_nPVSStride = ( ( dvis->numclusters / 8 + 1 ) + 3 ) & ~3;
+	s_VisCRC = ComputeVisCRC();
+
+	s_FaceCRCs.SetCount( numfaces );
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		s_FaceCRCs[i] = ComputeFaceCRC( i );
+	}
+
+	s_FaceClusters.SetCount( numfaces );
+	s_CachedFaces.SetCount( numfaces );
+	memset( s_CachedFaces.Base(), 0, numfaces * sizeof( const CachedFaceHeader_t * ) );
+
+	char szFilename[MAX_PATH];
+	GetLightingCacheFilename( szFilename, sizeof( szFilename ) );
+
+	s_CacheBuffer.Purge();
+	if ( !g_pFileSystem->ReadFile( szFilename, NULL, s_CacheBuffer ) )
+	{
+		Msg( "No lighting cache found, lighting all faces\n" );
+		return;
+	}
+
+	const LightingCacheHeader_t *pHeader = ( const LightingCacheHeader_t * )GetCacheData( sizeof( LightingCacheHeader_t ) );
+	if ( !pHeader || pHeader->id != LIGHTING_CACHE_ID || pHeader->version != LIGHTING_CACHE_VERSION )
+	{
+		Warning( "%s is from another version of vrad, lighting all faces\n", szFilename );
+		s_CacheBuffer.Purge();
+		return;
+	}
+
+	if ( pHeader->settingsCRC != settingsCRC )
+	{
+		Msg( "Lighting options changed since the last compile, lighting all faces\n" );
+		s_CacheBuffer.Purge();
+		return;
+	}
+
+	if ( pHeader->visCRC != s_VisCRC || pHeader->numClusters != dvis->numclusters || pHeader->pvsStride != s_nPVSStride )
+	{
+		Msg( "Vis changed since the last compile, lighting all faces\n" );
+		s_CacheBuffer.Purge();
+		return;
+	}
+
+	const CRC32_t *pCachedLightCRCs = ( const CRC32_t * )GetCacheData( pHeader->numLights * sizeof( CRC32_t ) );
+	const byte *pCachedLightPVS = ( const byte * )GetCacheData( pHeader->numLights * s_nPVSStride );
+	const OccluderInfo_t *pCachedOccluders = ( const OccluderInfo_t * )GetCacheData( pHeader->numOccluders * sizeof( OccluderInfo_t ) );
+
+	CUtlVector<CRCIndex_t> oldFaces;
+	oldFaces.SetCount( pHeader->numFaces );
+	CUtlVector<const CachedFaceHeader_t *> oldFaceData;
+	oldFaceData.SetCount( pHeader->numFaces );
+	bool bValid = pCachedLightCRCs && pCachedLightPVS && pCachedOccluders;
+	for ( int i = 0; bValid && i < pHeader->numFaces; i++ )
+	{
+		const CachedFaceHeader_t *pFace = ( const CachedFaceHeader_t * )GetCacheData( sizeof( CachedFaceHeader_t ) );
+		int numStyles = 0;
+		while ( pFace && numStyles < MAXLIGHTMAPS && pFace->styles[numStyles] != 255 )
+		{
+			++numStyles;
+		}
+
+		bValid = pFace && GetCacheData( pFace->numClusters * sizeof( int ) ) &&
+			GetCacheData( numStyles * pFace->numNormals * pFace->numSamples * sizeof( LightingValue_t ) );
+		if ( bValid )
+		{
+			oldFaces[i].crc = pFace->faceCRC;
+			oldFaces[i].index = i;
+			oldFaceData[i] = pFace;
+		}
+	}
+
+	if ( !bValid )
+	{
+		Warning( "%s is damaged, lighting all faces\n", szFilename );
+		s_CacheBuffer.Purge();
+		return;
+	}
+
+	int nPVSBytes = dvis->numclusters / 8 + 1;
+	CUtlVector<byte> changedOccluderClusters, dirtyClusters;
+	changedOccluderClusters.SetCount( nPVSBytes );
+	dirtyClusters.SetCount( nPVSBytes );
+	memset( changedOccluderClusters.Base(), 0, nPVSBytes );
+	memset( dirtyClusters.Base(), 0, nPVSBytes );
+
+	int nChangedOccluders = FindChangedOccluders( pCachedOccluders, pHeader->numOccluders, changedOccluderClusters.Base() );
+
+	// Lights that were added, removed or changed relight everything they can see.
+	// So do lights that can see a shadow caster that was added or removed.
+	CUtlVector<CRCIndex_t> oldLights, newLights;
+	CUtlVector<const byte *> newLightPVS;
+	oldLights.SetCount( pHeader->numLights );
+	for ( int i = 0; i < pHeader->numLights; i++ )
+	{
+		oldLights[i].crc = pCachedLightCRCs[i];
+		oldLights[i].index = i;
+	}
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		CRCIndex_t light;
+		light.crc = ComputeLightCRC( dl );
+		light.index = newLights.Count();
+		newLights.AddToTail( light );
+		newLightPVS.AddToTail( dl->pvs );
+	}
+	oldLights.Sort( CRCIndexCompare );
+	newLights.Sort( CRCIndexCompare );
+
+	int nChangedLights = 0;
+	int iOld = 0, iNew = 0;
+	while ( iOld < oldLights.Count() || iNew < newLights.Count() )
+	{
+		const byte *pPVS;
+		bool bChanged;
+		if ( iNew == newLights.Count() || ( iOld < oldLights.Count() && oldLights[iOld].crc < newLights[iNew].crc ) )
+		{
+			pPVS = pCachedLightPVS + oldLights[iOld++].index * s_nPVSStride;
+			bChanged = true;
+		}
+		else if ( iOld == oldLights.Count() || newLights[iNew].crc < oldLights[iOld].crc )
+		{
+			pPVS = newLightPVS[newLights[iNew++].index];
+			bChanged = true;
+		}
+		else
+		{
+			pPVS = newLightPVS[newLights[iNew].index];
+			bChanged = false;
+			++iOld;
+			++iNew;
+		}
+
+		if ( !pPVS )
+		{
+			// no vis for this light, it can reach everything
+			if ( bChanged || nChangedOccluders )
+			{
+				memset( dirtyClusters.Base(), 0xFF, nPVSBytes );
+				++nChangedLights;
+			}
+			continue;
+		}
+
+		if ( bChanged || ( nChangedOccluders && PVSIntersects( pPVS, changedOccluderClusters.Base(), nPVSBytes ) ) )
+		{
+			MergePVS( dirtyClusters.Base(), pPVS, nPVSBytes );
+			++nChangedLights;
+		}
+	}
+
+	// match this run's faces to the cached ones
+	oldFaces.Sort( CRCIndexCompare );
+	CUtlVector<bool> usedFaces, dirtyFaces;
+	usedFaces.SetCount( oldFaces.Count() );
+	dirtyFaces.SetCount( numfaces );
+	memset( usedFaces.Base(), 0, usedFaces.Count() * sizeof( bool ) );
+	memset( dirtyFaces.Base(), 0, numfaces * sizeof( bool ) );
+
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		CRCIndex_t search;
+		search.crc = s_FaceCRCs[i];
+		search.index = -1;
+
+		int lo = 0, hi = oldFaces.Count();
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) / 2;
+			if ( CRCIndexCompare( &oldFaces[mid], &search ) < 0 )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for ( ; lo < oldFaces.Count() && oldFaces[lo].crc == search.crc; lo++ )
+		{
+			if ( !usedFaces[lo] )
+			{
+				usedFaces[lo] = true;
+				s_CachedFaces[i] = oldFaceData[oldFaces[lo].index];
+				break;
+			}
+		}
+
+		if ( !s_CachedFaces[i] )
+		{
+			dirtyFaces[i] = true;
+			MarkNeighborsDirty( i, dirtyFaces );
+		}
+	}
+
+	int nRelight = 0;
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		const CachedFaceHeader_t *pFace = s_CachedFaces[i];
+		if ( pFace && !dirtyFaces[i] )
+		{
+			const int *pClusters = ( const int * )( pFace + 1 );
+			for ( int j = 0; j < pFace->numClusters; j++ )
+			{
+				// PVSCheck lets every light reach samples outside the world
+				if ( pClusters[j] < 0 ? ( nChangedLights != 0 ) : ( PVSCheck( dirtyClusters.Base(), pClusters[j] ) != 0 ) )
+				{
+					dirtyFaces[i] = true;
+					break;
+				}
+			}
+		}
+
+		if ( dirtyFaces[i] )
+		{
+			s_CachedFaces[i] = NULL;
+			++nRelight;
+		}
+	}
+
+	Msg( "Incremental lighting: relighting %d of %d faces (%d lights and %d shadow casting triangles changed)\n",
+		nRelight, numfaces, nChangedLights, nChangedOccluders );
+}
+
+
+//-----------------------------------------------------------------------------
+// Remembers the clusters a face's samples are in
+//-----------------------------------------------------------------------------
+void AddLightingCacheClusters( int facenum, const int *pClusters, int numClusters )
+{
+	if ( facenum >= s_FaceClusters.Count() )
+		return;
+
+	CUtlVector<int> &clusters = s_FaceClusters[facenum];
+	for ( int i = 0; i < numClusters; i++ )
+	{
+		if ( clusters.Find( pClusters[i] ) == clusters.InvalidIndex() )
+		{
+			clusters.AddToTail( pClusters[i] );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Copies the direct lighting of an unchanged face from the cache
+//-----------------------------------------------------------------------------
+bool RestoreCachedFaceLight( int facenum, dface_t *f, facelight_t *fl, int numNormals )
+{
+	if ( facenum >= s_CachedFaces.Count() )
+		return false;
+
+	const CachedFaceHeader_t *pFace = s_CachedFaces[facenum];
+	if ( !pFace || pFace->numSamples != fl->numsamples || pFace->numNormals != numNormals || pFace->styles[0] != 0 )
+		return false;
+
+	const int *pClusters = ( const int * )( pFace + 1 );
+	const byte *pLight = ( const byte * )( pClusters + pFace->numClusters );
+	int nBytes = fl->numsamples * sizeof( LightingValue_t );
+
+	for ( int k = 0; k < MAXLIGHTMAPS && pFace->styles[k] != 255; k++ )
+	{
+		if ( k > 0 )
+		{
+			AllocateLightstyleSamples( fl, k, numNormals );
+		}
+		f->styles[k] = pFace->styles[k];
+
+		for ( int n = 0; n < numNormals; n++ )
+		{
+			memcpy( fl->light[k][n], pLight, nBytes );
+			pLight += nBytes;
+		}
+	}
+
+	// supersampling isn't redone, so its clusters come from the cache
+	AddLightingCacheClusters( facenum, pClusters, pFace->numClusters );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes the direct lighting of all faces
+//-----------------------------------------------------------------------------
+void SaveLightingCache()
+{
+	char szFilename[MAX_PATH];
+	GetLightingCacheFilename( szFilename, sizeof( szFilename ) );
+
+	FileHandle_t fp = g_pFileSystem->Open( szFilename, "wb" );
+	if ( !fp )
+	{
+		Warning( "Can't write %s\n", szFilename );
+		return;
+	}
+	s_bWriteError = false;
+
+	LightingCacheHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.id = LIGHTING_CACHE_ID;
+	header.version = LIGHTING_CACHE_VERSION;
+	header.settingsCRC = s_SettingsCRC;
+	header.visCRC = s_VisCRC;
+	header.numClusters = dvis->numclusters;
+	header.pvsStride = s_nPVSStride;
+	header.numOccluders = s_Occluders.Count();
+
+	CUtlVector<CRC32_t> lightCRCs;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		lightCRCs.AddToTail( ComputeLightCRC( dl ) );
+	}
+	header.numLights = lightCRCs.Count();
+
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		if ( facelight[i].light[0][0] )
+		{
+			++header.numFaces;
+		}
+	}
+
+	WriteCacheData( fp, &header, sizeof( header ) );
+	WriteCacheData( fp, lightCRCs.Base(), lightCRCs.Count() * sizeof( CRC32_t ) );
+
+	int nPVSBytes = dvis->numclusters / 8 + 1;
+	CUtlVector<byte> pvs;
+	pvs.SetCount( s_nPVSStride );
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		memset( pvs.Base(), 0, s_nPVSStride );
+		if ( dl->pvs )
+		{
+			memcpy( pvs.Base(), dl->pvs, nPVSBytes );
+		}
+		else
+		{
+			memset( pvs.Base(), 0xFF, nPVSBytes );
+		}
+		WriteCacheData( fp, pvs.Base(), s_nPVSStride );
+	}
+
+	WriteCacheData( fp, s_Occluders.Base(), s_Occluders.Count() * sizeof( OccluderInfo_t ) );
+
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		facelight_t *fl = &facelight[i];
+		if ( !fl->light[0][0] )
+			continue;
+
+		CachedFaceHeader_t face;
+		face.faceCRC = s_FaceCRCs[i];
+		face.numSamples = fl->numsamples;
+		face.numNormals = 0;
+		while ( face.numNormals < NUM_BUMP_VECTS + 1 && fl->light[0][face.numNormals] )
+		{
+			++face.numNormals;
+		}
+		face.numClusters = s_FaceClusters[i].Count();
+		memcpy( face.styles, g_pFaces[i].styles, sizeof( face.styles ) );
+
+		WriteCacheData( fp, &face, sizeof( face ) );
+		WriteCacheData( fp, s_FaceClusters[i].Base(), face.numClusters * sizeof( int ) );
+		for ( int k = 0; k < MAXLIGHTMAPS && face.styles[k] != 255; k++ )
+		{
+			for ( int n = 0; n < face.numNormals; n++ )
+			{
+				WriteCacheData( fp, fl->light[k][n], fl->numsamples * sizeof( LightingValue_t ) );
+			}
+		}
+	}
+
+	g_pFileSystem->Close( fp );
+	if ( s_bWriteError )
+	{
+		Warning( "Error writing %s\n", szFilename );
+	}
+
+	// the last run's lighting is no longer needed
+	s_CacheBuffer.Purge();
+	s_CachedFaces.Purge();
+	s_FaceClusters.Purge();
+}
+
+
+static void GetTransferCacheHeader( TransferCacheHeader_t &header )
+{
+	memset( &header, 0, sizeof( header ) );
+	header.id = TRANSFER_CACHE_ID;
+	header.version = TRANSFER_CACHE_VERSION;
+	header.visCRC = ComputeVisCRC();
+	header.occluderCRC = s_OccluderCRC;
+	header.patchCRC = ComputePatchCRC();
+	header.numPatches = g_Patches.Count();
+	header.compressed = g_bCompressTransfers;
+	header.textureShadows = g_bTextureShadows;
+}
+
+
+//-----------------------------------------------------------------------------
+// Loads the transfers of all patches, if nothing they depend on has changed
+//-----------------------------------------------------------------------------
+bool LoadCachedTransfers()
+{
+	char szFilename[MAX_PATH];
+	GetCacheFilename( szFilename, sizeof( szFilename ), "transfercache" );
+
+	FileHandle_t fp = g_pFileSystem->Open( szFilename, "rb" );
+	if ( !fp )
+		return false;
+
+	TransferCacheHeader_t header, cachedHeader;
+	GetTransferCacheHeader( header );
+	if ( g_pFileSystem->Read( &cachedHeader, sizeof( cachedHeader ), fp ) != sizeof( cachedHeader ) ||
+		memcmp( &header, &cachedHeader, sizeof( header ) ) )
+	{
+		Msg( "Patches or shadow casters changed since the last compile, rebuilding transfers\n" );
+		g_pFileSystem->Close( fp );
+		return false;
+	}
+
+	int i;
+	for ( i = 0; i < g_Patches.Count(); i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+
+		int counts[2];
+		if ( g_pFileSystem->Read( counts, sizeof( counts ), fp ) != sizeof( counts ) )
+			break;
+
+		int numTransfers = counts[0];
+		int nBytes = counts[1];
+		if ( !numTransfers )
+		{
+			patch->numtransfers = 0;
+			patch->transfers = NULL;
+			patch->compressedTransfers = NULL;
+			continue;
+		}
+
+		if ( !header.compressed && nBytes != numTransfers * (int)sizeof( transfer_t ) )
+			break;
+
+		byte *pData = ( byte * )malloc( nBytes );
+		if ( !pData )
+			Error( "Memory allocation failure" );
+
+		if ( g_pFileSystem->Read( pData, nBytes, fp ) != nBytes )
+		{
+			free( pData );
+			break;
+		}
+
+		if ( header.compressed )
+		{
+			RestoreCompressedTransfers( patch, numTransfers, pData, nBytes );
+		}
+		else
+		{
+			patch->numtransfers = numTransfers;
+			patch->transfers = ( transfer_t * )pData;
+			patch->compressedTransfers = NULL;
+		}
+	}
+
+	g_pFileSystem->Close( fp );
+
+	if ( i < g_Patches.Count() )
+	{
+		Warning( "%s is damaged, rebuilding transfers\n", szFilename );
+		while ( --i >= 0 )
+		{
+			CPatch *patch = &g_Patches[i];
+			free( patch->transfers );
+			free( patch->compressedTransfers );
+			patch->numtransfers = 0;
+			patch->transfers = NULL;
+			patch->compressedTransfers = NULL;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes the transfers of all patches
+//-----------------------------------------------------------------------------
+void SaveCachedTransfers()
+{
+	char szFilename[MAX_PATH];
+	GetCacheFilename( szFilename, sizeof( szFilename ), "transfercache" );
+
+	FileHandle_t fp = g_pFileSystem->Open( szFilename, "wb" );
+	if ( !fp )
+	{
+		Warning( "Can't write %s\n", szFilename );
+		return;
+	}
+	s_bWriteError = false;
+
+	TransferCacheHeader_t header;
+	GetTransferCacheHeader( header );
+	WriteCacheData( fp, &header, sizeof( header ) );
+
+	for ( int i = 0; i < g_Patches.Count(); i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+
+		const void *pData;
+		int counts[2];
+		counts[0] = patch->numtransfers;
+		if ( patch->compressedTransfers )
+		{
+			pData = patch->compressedTransfers;
+			counts[1] = GetCompressedTransferSize( patch );
+		}
+		else
+		{
+			pData = patch->transfers;
+			counts[1] = pData ? patch->numtransfers * sizeof( transfer_t ) : 0;
+		}
+		if ( !pData )
+		{
+			counts[0] = 0;
+		}
+
+		WriteCacheData( fp, counts, sizeof( counts ) );
+		WriteCacheData( fp, pData, counts[1] );
+	}
+
+	g_pFileSystem->Close( fp );
+	if ( s_bWriteError )
+	{
+		Warning( "Error writing %s\n", szFilename );
+	}
+}
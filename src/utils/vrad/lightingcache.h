@@ -0,0 +1,64 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-face direct lighting and transfer caches used by -incremental,
+//			so a recompile only relights the faces an edit can have changed.
+//
+//=============================================================================//
+
+#ifndef LIGHTINGCACHE_H
+#define LIGHTINGCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/checksum_crc.h"
+
+
+struct dface_t;
+struct facelight_t;
+
+
+// The cache is two files next to the .bsp:
+//
+//		<map>.ldr.lightcache / <map>.hdr.lightcache
+//			the lights, shadow casting triangles and direct lighting of every face
+//		<map>.transfercache
+//			the patch to patch transfers, shared by the ldr and hdr passes
+//
+// Faces are matched to the previous run by a checksum of their geometry and texture
+// mapping, so renumbered faces still hit the cache. A face is relit when:
+//
+//		- it is new or changed, or one of its neighbors is (smoothed normals)
+//		- a light that is new, removed or changed can see one of its clusters
+//		- a shadow casting triangle that was added or removed is in the pvs of a
+//		  light that can see one of its clusters
+//
+// Anything that changes the vis data or the lighting options throws the whole cache away.
+// Bounced light is always recomputed, but the transfers are reused when no patch moved
+// and the shadow casting geometry is the same.
+
+// Call once the ray tracer has all its triangles, before the acceleration structure is built
+void HashLightingCacheOccluders();
+
+// Loads the cache from the last run and works out which faces need relighting.
+// Call after the direct lights have been created, before BuildFacelights.
+void LoadLightingCache( CRC32_t settingsCRC );
+
+// Called by BuildFacelights for every group of samples it lights
+void AddLightingCacheClusters( int facenum, const int *pClusters, int numClusters );
+
+// Copies the direct lighting of an unchanged face from the cache. Style 0 must already be
+// allocated, the other styles are allocated here. Returns false if the face must be relit.
+bool RestoreCachedFaceLight( int facenum, dface_t *f, facelight_t *fl, int numNormals );
+
+// Writes the direct lighting of all faces; call once BuildFacelights is done
+void SaveLightingCache();
+
+// Loads the transfers of all patches, if nothing they depend on has changed
+bool LoadCachedTransfers();
+
+// Writes the transfers of all patches; call after BuildVisMatrix
+void SaveCachedTransfers();
+
+
+#endif // LIGHTINGCACHE_H
@@ -16,6 +16,7 @@
 #include "map_utils.h"
 #include "mathlib/halton.h"
 #include "imagepacker.h"
+#include "lightingcache.h"
 #include "tier1/utlrbtree.h"
 #include "tier1/utlbuffer.h"
 #include "bitmap/tgawriter.h"
@@ -1977,9 +1978,18 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 	}
 
 	// Raytrace for visibility function
-	fltx4 fractionVisible = Four_Ones;
-	TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
-	dot = MulSIMD( fractionVisible, dot );
+	if ( nLFlags & GATHERLFLAGS_DEFER_VISIBILITY )
+	{
+		// the caller traces pos -> src itself and zeroes the occluded samples
+		out.m_ShadowRayEnd = src;
+		out.m_bVisibilityDeferred = true;
+	}
+	else
+	{
+		fltx4 fractionVisible = Four_Ones;
+		TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
+		dot = MulSIMD( fractionVisible, dot );
+	}
 	out.m_flDot[0] = dot;
 
 	for ( int i = 1; i < normalCount; i++ )
@@ -2010,6 +2020,7 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 		out.m_flDot[b] = Four_Zeros;
 	out.m_flFalloff = Four_Zeros;
 	out.m_flSunAmount = Four_Zeros;
+	out.m_bVisibilityDeferred = false;
 	Assert( normalCount <= (NUM_BUMP_VECTS+1) );
 
 	// skylights work fundamentally differently than normal lights
@@ -2382,7 +2393,7 @@ void DumpSamples( int ndxFace, facelight_t *pFaceLight )
 //-----------------------------------------------------------------------------
 // Allocates light sample data
 //-----------------------------------------------------------------------------
-static inline void AllocateLightstyleSamples( facelight_t* fl, int styleIndex, int numnormals )
+void AllocateLightstyleSamples( facelight_t* fl, int styleIndex, int numnormals )
 {
 	for (int n = 0; n < numnormals; ++n)
 	{
@@ -2483,85 +2494,319 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 	// TODO: this may slow things down a bit ( using Vec )
 	for ( int i = 0; i < 4; ++i )
 		pInfo->m_Clusters[i] = ClusterFromPoint( pos.Vec( i ) );
+
+	if ( g_bLightingCache )
+	{
+		AddLightingCacheClusters( pInfo->m_FaceNum, pInfo->m_Clusters, numSamples );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Computes falloff x dot for a light at up to 4 sample points.
+// Returns false if the light doesn't reach any of them.
+//-----------------------------------------------------------------------------
+static bool ComputeLightAt4Points( SSE_SampleInfo_t& info, directlight_t *dl, int numSamples, int nLFlags,
+								   SSE_sampleLightOutput_t &out, fltx4 *fxdot )
+{
+	// is this lights cluster visible?
+	fltx4 dotMask = Four_Zeros;
+	bool skipLight = true;
+	for( int s = 0; s < numSamples; s++ )
+	{
+		if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
+		{
+			dotMask = SetComponentSIMD( dotMask, s, 1.0f );
+			skipLight = false;
+		}
+	}
+	if ( skipLight )
+		return false;
+
+	GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread, nLFlags );
+	
+	// Apply the PVS check filter and compute falloff x dot
+	skipLight = true;
+	for ( int b = 0; b < info.m_NormalCount; b++ )
+	{
+		fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
+		fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
+		if ( !IsAllZeros( fxdot[b] ) )
+		{
+			skipLight = false;
+		}
+	}
+	return !skipLight;
 }
 
+
+//-----------------------------------------------------------------------------
+// Adds a light's contribution to up to 4 samples
+//-----------------------------------------------------------------------------
+static void AddLightToSamples( SSE_SampleInfo_t& info, directlight_t *dl, int sampleIdx, int numSamples,
+							   fltx4 const *fxdot, fltx4 const &sunAmount, Vector const &vecSamplePos )
+{
+	// Figure out the lightstyle for this particular sample
+	int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
+		dl->light.style, info.m_NormalCount );
+	if (lightStyleIndex < 0)
+	{
+		if (info.m_WarnFace != info.m_FaceNum)
+		{
+			Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
+				vecSamplePos.x, vecSamplePos.y, vecSamplePos.z );
+			info.m_WarnFace = info.m_FaceNum;
+		}
+		return;
+	}
+
+	// pLightmaps is an array of the lightmaps for each normal direction,
+	// here's where the result of the sample gathering goes
+	LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+
+	// Incremental lighting only cares about lightstyle zero
+	if( g_pIncremental && (dl->light.style == 0) )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
+				info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+		}
+	}
+
+	for( int n = 0; n < info.m_NormalCount; ++n )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( sunAmount, i ) );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Iterates over all lights and computes lighting at up to 4 sample points
 //-----------------------------------------------------------------------------
 static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
 {
 	SSE_sampleLightOutput_t out;
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
 
 	// Iterate over all direct lights and add them to the particular sample
 	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
 	{	    
-		// is this lights cluster visible?
-		fltx4 dotMask = Four_Zeros;
-		bool skipLight = true;
-		for( int s = 0; s < numSamples; s++ )
+		if ( !ComputeLightAt4Points( info, dl, numSamples, 0, out, fxdot ) )
+			continue;
+
+		AddLightToSamples( info, dl, sampleIdx, numSamples, fxdot, out.m_flSunAmount, info.m_Points.Vec( 0 ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Streamed direct lighting.
+// Rather than tracing the shadow rays for each group of 4 samples as soon as they're
+// built, this collects the shadow rays for every sample and light of a face, sorts them
+// so that rays towards the same light from neighboring luxels end up next to each other,
+// and traces them through a RayStream. The light is then added to the lightmaps in the
+// same sample/light order GatherSampleLightAt4Points uses, so the results are identical.
+//-----------------------------------------------------------------------------
+#define DIRECTLIGHT_STREAM_MAX_RAYS		8192		// flush once this many shadow rays are queued
+#define DIRECTLIGHT_STREAM_CELL_SIZE	64.0f		// size of the cells ray origins are sorted by
+
+class CDirectLightStream
+{
+public:
+	void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples );
+	void Flush( SSE_SampleInfo_t& info );
+
+private:
+	struct PendingLight_t
+	{
+		directlight_t *m_pLight;
+		int m_nSampleIdx;
+		int m_nNumSamples;
+		int m_nRay[4];								// shadow ray for each sample, or -1 if it doesn't need one
+		float m_flFxDot[NUM_BUMP_VECTS + 1][4];		// falloff x dot, not yet masked by visibility
+		float m_flSunAmount[4];
+		Vector m_vecSamplePos;
+	};
+
+	struct ShadowRay_t
+	{
+		uint64 m_nSortKey;
+		int m_nResult;
+		Vector m_vecStart;
+		Vector m_vecEnd;
+	};
+
+	static uint64 ComputeSortKey( int nLight, Vector const &vecStart, Vector const &vecEnd );
+	static int __cdecl ShadowRayCompare( const ShadowRay_t *pLeft, const ShadowRay_t *pRight );
+
+	CUtlVector< PendingLight_t > m_Pending;
+	CUtlVector< ShadowRay_t > m_Rays;
+	CUtlVector< RayTracingSingleResult > m_Results;
+};
+
+// spreads the low 10 bits of x out to every third bit
+static inline uint32 SpreadBits10( uint32 x )
+{
+	x &= 0x3ff;
+	x = ( x | ( x << 16 ) ) & 0x030000ff;
+	x = ( x | ( x <<  8 ) ) & 0x0300f00f;
+	x = ( x | ( x <<  4 ) ) & 0x030c30c3;
+	x = ( x | ( x <<  2 ) ) & 0x09249249;
+	return x;
+}
+
+//-----------------------------------------------------------------------------
+// Sort by light, then by direction octant, then by the Morton order of the origin cell
+//-----------------------------------------------------------------------------
+uint64 CDirectLightStream::ComputeSortKey( int nLight, Vector const &vecStart, Vector const &vecEnd )
+{
+	Vector vecDelta = vecEnd - vecStart;
+	uint32 nSigns = ( vecDelta.x < 0 ? 1 : 0 ) | ( vecDelta.y < 0 ? 2 : 0 ) | ( vecDelta.z < 0 ? 4 : 0 );
+
+	uint32 nCellX = (uint32)(int)floor( vecStart.x / DIRECTLIGHT_STREAM_CELL_SIZE );
+	uint32 nCellY = (uint32)(int)floor( vecStart.y / DIRECTLIGHT_STREAM_CELL_SIZE );
+	uint32 nCellZ = (uint32)(int)floor( vecStart.z / DIRECTLIGHT_STREAM_CELL_SIZE );
+	uint32 nCell = SpreadBits10( nCellX ) | ( SpreadBits10( nCellY ) << 1 ) | ( SpreadBits10( nCellZ ) << 2 );
+
+	return ( (uint64)nLight << 33 ) | ( (uint64)nSigns << 30 ) | nCell;
+}
+
+int __cdecl CDirectLightStream::ShadowRayCompare( const ShadowRay_t *pLeft, const ShadowRay_t *pRight )
+{
+	if ( pLeft->m_nSortKey != pRight->m_nSortKey )
+		return ( pLeft->m_nSortKey < pRight->m_nSortKey ) ? -1 : 1;
+
+	// keep the sort deterministic
+	return pLeft->m_nResult - pRight->m_nResult;
+}
+
+//-----------------------------------------------------------------------------
+// Computes falloff x dot for all lights at up to 4 sample points, and queues
+// the shadow rays needed to finish them.
+//-----------------------------------------------------------------------------
+void CDirectLightStream::GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
+{
+	SSE_sampleLightOutput_t out;
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+
+	int nLight = 0;
+	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next, ++nLight)
+	{
+		if ( !ComputeLightAt4Points( info, dl, numSamples, GATHERLFLAGS_DEFER_VISIBILITY, out, fxdot ) )
+			continue;
+
+		PendingLight_t &pending = m_Pending[ m_Pending.AddToTail() ];
+		pending.m_pLight = dl;
+		pending.m_nSampleIdx = sampleIdx;
+		pending.m_nNumSamples = numSamples;
+		for ( int n = 0; n < info.m_NormalCount; n++ )
 		{
-			if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
-			{
-				dotMask = SetComponentSIMD( dotMask, s, 1.0f );
-				skipLight = false;
-			}
+			StoreUnalignedSIMD( pending.m_flFxDot[n], fxdot[n] );
 		}
-		if ( skipLight )
-			continue;
+		StoreUnalignedSIMD( pending.m_flSunAmount, out.m_flSunAmount );
+		pending.m_vecSamplePos = info.m_Points.Vec( 0 );
 
-		GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
-		
-		// Apply the PVS check filter and compute falloff x dot
-		fltx4 fxdot[NUM_BUMP_VECTS + 1];
-		skipLight = true;
-		for ( int b = 0; b < info.m_NormalCount; b++ )
+		for ( int i = 0; i < 4; i++ )
 		{
-			fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
-			fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
-			if ( !IsAllZeros( fxdot[b] ) )
-			{
-				skipLight = false;
-			}
+			pending.m_nRay[i] = -1;
 		}
-		if ( skipLight )
+
+		// Sky lights have already been traced
+		if ( !out.m_bVisibilityDeferred )
 			continue;
 
-		// Figure out the lightstyle for this particular sample
-		int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
-			dl->light.style, info.m_NormalCount );
-		if (lightStyleIndex < 0)
+		for ( int i = 0; i < numSamples; i++ )
 		{
-			if (info.m_WarnFace != info.m_FaceNum)
+			// samples that get no light from this one don't need a shadow ray
+			bool bLit = false;
+			for ( int n = 0; n < info.m_NormalCount; n++ )
 			{
-				Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
-					info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
-				info.m_WarnFace = info.m_FaceNum;
+				if ( pending.m_flFxDot[n][i] != 0.0f )
+				{
+					bLit = true;
+					break;
+				}
 			}
-			continue;
+			if ( !bLit )
+				continue;
+
+			int nRay = m_Rays.AddToTail();
+			ShadowRay_t &ray = m_Rays[nRay];
+			ray.m_vecStart = info.m_Points.Vec( i );
+			ray.m_vecEnd = out.m_ShadowRayEnd.Vec( i );
+			ray.m_nSortKey = ComputeSortKey( nLight, ray.m_vecStart, ray.m_vecEnd );
+			ray.m_nResult = nRay;
+			pending.m_nRay[i] = nRay;
 		}
+	}
 
-		// pLightmaps is an array of the lightmaps for each normal direction,
-		// here's where the result of the sample gathering goes
-		LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+	if ( m_Rays.Count() >= DIRECTLIGHT_STREAM_MAX_RAYS )
+	{
+		Flush( info );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Traces the queued shadow rays and adds the visible light to the lightmaps
+//-----------------------------------------------------------------------------
+void CDirectLightStream::Flush( SSE_SampleInfo_t& info )
+{
+	if ( m_Rays.Count() )
+	{
+		m_Results.SetCount( m_Rays.Count() );
+		m_Rays.Sort( ShadowRayCompare );
 
-		// Incremental lighting only cares about lightstyle zero
-		if( g_pIncremental && (dl->light.style == 0) )
+		RayStream stream;
+		for ( int i = 0; i < m_Rays.Count(); i++ )
 		{
-			for ( int i = 0; i < numSamples; i++ )
+			ShadowRay_t const &ray = m_Rays[i];
+			g_RtEnv.AddToRayStream( stream, ray.m_vecStart, ray.m_vecEnd, &m_Results[ ray.m_nResult ] );
+		}
+		g_RtEnv.FinishRayStream( stream );
+	}
+
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+	for ( int p = 0; p < m_Pending.Count(); p++ )
+	{
+		PendingLight_t &pending = m_Pending[p];
+
+		// Same test as TestLine: anything hit before the light blocks it
+		for ( int i = 0; i < pending.m_nNumSamples; i++ )
+		{
+			if ( pending.m_nRay[i] < 0 )
+				continue;
+
+			RayTracingSingleResult const &result = m_Results[ pending.m_nRay[i] ];
+			if ( ( result.HitID != -1 ) && ( result.HitDistance < result.ray_length ) )
 			{
-				g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
-					info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+				for ( int n = 0; n < info.m_NormalCount; n++ )
+				{
+					pending.m_flFxDot[n][i] = 0.0f;
+				}
 			}
 		}
 
-		for( int n = 0; n < info.m_NormalCount; ++n )
+		bool skipLight = true;
+		for ( int n = 0; n < info.m_NormalCount; n++ )
 		{
-			for ( int i = 0; i < numSamples; i++ )
+			fxdot[n] = LoadUnalignedSIMD( pending.m_flFxDot[n] );
+			if ( !IsAllZeros( fxdot[n] ) )
 			{
-				pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
+				skipLight = false;
 			}
 		}
+		if ( skipLight )
+			continue;
+
+		AddLightToSamples( info, pending.m_pLight, pending.m_nSampleIdx, pending.m_nNumSamples, 
+			fxdot, LoadUnalignedSIMD( pending.m_flSunAmount ), pending.m_vecSamplePos );
 	}
+
+	m_Pending.RemoveAll();
+	m_Rays.RemoveAll();
 }
 
 
@@ -3113,6 +3358,13 @@ void BuildFacelights (int iThread, int facenum)
 	f->styles[0] = 0;
 	AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
 
+	// With -incremental, faces nothing has changed around keep their lighting from the last compile
+	bool bRestored = g_bLightingCache && RestoreCachedFaceLight( facenum, f, fl, sampleInfo.m_NormalCount );
+
+	// Texture shadows need the coverage callback, which ray streams don't support
+	bool bStreamLighting = g_bStreamDirectLighting && !g_bTextureShadows;
+	CDirectLightStream lightStream;
+
 	// sample the lights at each sample location
 	for ( int grp = 0; grp < numGroups; ++grp )
 	{
@@ -3141,8 +3393,23 @@ void BuildFacelights (int iThread, int facenum)
 				sample[i].normal = sampleInfo.m_PointNormals[0].Vec( i );
 		}
 
+		if ( bRestored )
+			continue;
+
 		// Iterate over all the lights and add their contribution to this group of spots
-		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		if ( bStreamLighting )
+		{
+			lightStream.GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		}
+		else
+		{
+			GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		}
+	}
+
+	if ( bStreamLighting )
+	{
+		lightStream.Flush( sampleInfo );
 	}
 	
 	// Tell the incremental light manager that we're done with this face.
@@ -3161,7 +3428,7 @@ void BuildFacelights (int iThread, int facenum)
 	}
 
 	// get rid of the -extra functionality on displacement surfaces
-	if (do_extra && !sampleInfo.m_IsDispFace)
+	if (do_extra && !sampleInfo.m_IsDispFace && !bRestored)
 	{
 		// For each lightstyle, perform a supersampling pass
 		for ( i = 0; i < MAXLIGHTMAPS; ++i )
@@ -133,6 +133,10 @@ struct SSE_SampleInfo_t
 
 extern void InitLightinfo( lightinfo_t *l, int facenum );
 
+int EdgeVertex( dface_t *f, int edge );
+
+void AllocateLightstyleSamples( facelight_t* fl, int styleIndex, int numnormals );
+
 void FreeDLights();
 
 void ExportDirectLightsToWorldLights();
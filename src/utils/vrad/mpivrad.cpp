@@ -22,6 +22,7 @@
 #include "bsplib.h"
 #include "consolewnd.h"
 #include "vismat.h"
+#include "compressed_transfers.h"
 #include "vmpi_filesystem.h"
 #include "vmpi_dispatch.h"
 #include "utllinkedlist.h"
@@ -297,8 +298,18 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		patch->numtransfers = numtransfers;
 		if (numtransfers) 
 		{
-			patch->transfers = new transfer_t[numtransfers];
-			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+			if ( g_bCompressTransfers )
+			{
+				CUtlVector<transfer_t> transfers;
+				transfers.SetCount( numtransfers );
+				pBuf->read( transfers.Base(), numtransfers * sizeof(transfer_t) );
+				CompressTransfers( patch, transfers.Base(), numtransfers, 1.0f );
+			}
+			else
+			{
+				patch->transfers = new transfer_t[numtransfers];
+				pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+			}
 		}
 		
 		total_transfer += numtransfers;
@@ -16,6 +16,8 @@
 #include "macro_texture.h"
 #include "vmpi_tools_shared.h"
 #include "leaf_ambient_lighting.h"
+#include "compressed_transfers.h"
+#include "lightingcache.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
@@ -118,6 +120,9 @@ double		g_flStartTime;
 bool		g_bStaticPropLighting = false;
 bool        g_bStaticPropPolys = false;
 bool        g_bTextureShadows = false;
+bool        g_bStreamDirectLighting = true;
+bool        g_bCompressTransfers = false;
+bool        g_bLightingCache = false;
 bool        g_bDisablePropSelfShadowing = false;
 
 
@@ -1199,6 +1204,20 @@ void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers )
 }
 
 
+//-----------------------------------------------------------------------------
+// MPI workers send their transfers back uncompressed, the master compresses
+// them as they come in.
+//-----------------------------------------------------------------------------
+static bool ShouldCompressTransfers()
+{
+#ifdef MPI
+	if ( g_bUseMPI && !g_bMPIMaster )
+		return false;
+#endif
+	return g_bCompressTransfers;
+}
+
+
 void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 {
 	int		j;
@@ -1218,11 +1237,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 			max_transfer = patch->numtransfers;
 		}
 
-
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1238,12 +1252,23 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		if ( ShouldCompressTransfers() )
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			CompressTransfers( patch, all_transfers, patch->numtransfers, total );
+		}
+		else
+		{
+			patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			t = patch->transfers;
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+			{
+				t->transfer = t2->transfer*total;
+				t->patch = t2->patch;
+			}
 		}
 		if (patch->numtransfers > max_transfer)
 		{
@@ -1588,6 +1613,12 @@ void GatherLight (int threadnum, void *pUserData)
 				VectorFill( bumpSum[i], 0 );
 			}
 
+			if ( patch->compressedTransfers )
+			{
+				GatherCompressedLight( patch, normals, NUM_BUMP_VECTS+1, bumpSum );
+				num = 0;
+			}
+
 			float dot;
 			for (k=0 ; k<num ; k++, trans++)
 			{
@@ -1623,6 +1654,10 @@ void GatherLight (int threadnum, void *pUserData)
 				VectorCopy( bumpSum[i], addlight[j].light[i] );
 			}
 		}
+		else if ( patch->compressedTransfers )
+		{
+			GatherCompressedLight( patch, NULL, 1, &addlight[j].light[0] );
+		}
 		else
 		{
 			VectorFill( sum, 0 );
@@ -1701,10 +1736,17 @@ void BounceLight (void)
 #endif
 
 	i = 0;
+	double flBounceStart = Plat_FloatTime();
 	while ( bouncing )
 	{
+		double flStart = Plat_FloatTime();
+
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
+		if ( GetCompressedTransferBytes() )
+		{
+			PrepareCompressedGather( emitlight.Base() );
+		}
 		unsigned int uiPatchCount = g_Patches.Size();
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
@@ -1712,7 +1754,7 @@ void BounceLight (void)
 		// light is always received to leaf patches
 		CollectLight( added );
 
-		qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f)\n", i+1, added[0], added[1], added[2] );
+		qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f) (%.2f seconds)\n", i+1, added[0], added[1], added[2], Plat_FloatTime() - flStart );
 
 		if ( i+1 == numbounce || (added[0] < 1.0 && added[1] < 1.0 && added[2] < 1.0) )
 			bouncing = false;
@@ -1724,6 +1766,11 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	if ( i )
+	{
+		qprintf ("%i bounces in %.2f seconds\n", i, Plat_FloatTime() - flBounceStart );
+	}
 }
 
 
@@ -1924,16 +1971,45 @@ void BuildFacesVisibleToLights( bool bAllVisible )
 
 void MakeAllScales (void)
 {
-	// determine visibility between patches
-	BuildVisMatrix ();
-	
-	// release visibility matrix
-	FreeVisMatrix ();
+	if ( g_bLightingCache && LoadCachedTransfers() )
+	{
+		Msg( "Reusing the transfers from the last compile\n" );
+
+		total_transfer = max_transfer = 0;
+		for ( int i = 0; i < g_Patches.Count(); i++ )
+		{
+			total_transfer += g_Patches[i].numtransfers;
+			if ( g_Patches[i].numtransfers > max_transfer )
+			{
+				max_transfer = g_Patches[i].numtransfers;
+			}
+		}
+	}
+	else
+	{
+		// determine visibility between patches
+		BuildVisMatrix ();
+		
+		// release visibility matrix
+		FreeVisMatrix ();
+
+		if ( g_bLightingCache )
+		{
+			SaveCachedTransfers();
+		}
+	}
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
 	qprintf ("transfer lists: %5.1f megs\n"
 		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+
+	int64 nCompressedBytes = GetCompressedTransferBytes();
+	if ( nCompressedBytes )
+	{
+		Msg( "compressed transfer lists: %5.1f megs (%.2f bytes per transfer)\n",
+			(float)nCompressedBytes / (1024*1024), total_transfer ? (float)nCompressedBytes / total_transfer : 0.0f );
+	}
 }
 
 
@@ -1998,6 +2074,56 @@ void MakeAllScales (void)
 #endif
 
 
+//-----------------------------------------------------------------------------
+// Checksum of the options that change the direct lighting or the patches, so
+// -incremental never reuses lighting from a compile with different options
+//-----------------------------------------------------------------------------
+static CRC32_t ComputeLightingSettingsCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+#define PROCESS_SETTING( x )	CRC32_ProcessBuffer( &crc, &(x), sizeof(x) )
+	PROCESS_SETTING( g_bHDR );
+	PROCESS_SETTING( maxchop );
+	PROCESS_SETTING( minchop );
+	PROCESS_SETTING( dispchop );
+	PROCESS_SETTING( g_MaxDispPatchRadius );
+	PROCESS_SETTING( ambient );
+	PROCESS_SETTING( lightscale );
+	PROCESS_SETTING( dlight_threshold );
+	PROCESS_SETTING( g_SunAngularExtent );
+	PROCESS_SETTING( g_flSkySampleScale );
+	PROCESS_SETTING( g_bLargeDispSampleRadius );
+	PROCESS_SETTING( gamma );
+	PROCESS_SETTING( indirect_sun );
+	PROCESS_SETTING( reflectivityScale );
+	PROCESS_SETTING( do_extra );
+	PROCESS_SETTING( debug_extra );
+	PROCESS_SETTING( do_fast );
+	PROCESS_SETTING( do_centersamples );
+	PROCESS_SETTING( extrapasses );
+	PROCESS_SETTING( smoothing_threshold );
+	PROCESS_SETTING( coring );
+	PROCESS_SETTING( texscale );
+	PROCESS_SETTING( dlight_map );
+	PROCESS_SETTING( luxeldensity );
+	PROCESS_SETTING( g_flMaxDispSampleSize );
+	PROCESS_SETTING( g_bStaticPropPolys );
+	PROCESS_SETTING( g_bTextureShadows );
+	PROCESS_SETTING( g_bDisablePropSelfShadowing );
+	PROCESS_SETTING( g_bNoSkyRecurse );
+	PROCESS_SETTING( g_bFastAmbient );
+	PROCESS_SETTING( num_sky_cameras );
+	CRC32_ProcessBuffer( &crc, sky_cameras, num_sky_cameras * sizeof( sky_camera_t ) );
+	CRC32_ProcessBuffer( &crc, area_sky_cameras, sizeof( area_sky_cameras ) );
+#undef PROCESS_SETTING
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
 bool RadWorld_Go()
 {
 	g_iCurFace = 0;
@@ -2019,6 +2145,11 @@ bool RadWorld_Go()
 		BuildFacesVisibleToLights( true );
 	}
 
+	if ( g_bLightingCache )
+	{
+		LoadLightingCache( ComputeLightingSettingsCRC() );
+	}
+
 	// build initial facelights
 #ifdef MPI
 	if (g_bUseMPI) 
@@ -2032,6 +2163,11 @@ bool RadWorld_Go()
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
 	}
 
+	if ( g_bLightingCache )
+	{
+		SaveLightingCache();
+	}
+
 	// Was the process interrupted?
 	if( g_pIncremental && (g_iCurFace != numfaces) )
 		return false;
@@ -2282,6 +2418,21 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
+#ifdef MPI
+	if ( g_bUseMPI && g_bLightingCache )
+	{
+		Warning( "-incremental doesn't work with -mpi, lighting all faces\n" );
+		g_bLightingCache = false;
+	}
+#endif
+
+	// The triangles are converted to a form without their vertices when the
+	// acceleration structure is built, so hash them for -incremental first
+	if ( g_bLightingCache )
+	{
+		HashLightingCacheOccluders();
+	}
+
 	// Build acceleration structure
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
@@ -2412,6 +2563,18 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bTextureShadows = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-nostreamlight" ) )
+		{
+			g_bStreamDirectLighting = false;
+		}
+		else if ( !Q_stricmp( argv[i], "-compresstransfers" ) )
+		{
+			g_bCompressTransfers = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-incremental" ) )
+		{
+			g_bLightingCache = true;
+		}
 		else if ( !strcmp(argv[i], "-dump") )
 		{
 			g_bDumpPatches = true;
@@ -2875,6 +3038,9 @@ void PrintUsage( int argc, char **argv )
 		"  -StaticPropNormals : when lighting static props, just show their normal vector\n"
 		"  -textureshadows : Allows texture alpha channels to block light - rays intersecting alpha surfaces will sample the texture\n"
 		"  -noskyboxrecurse : Turn off recursion into 3d skybox (skybox shadows on world)\n"
+		"  -nostreamlight  : Trace direct light shadow rays one sample group at a time instead of batching them per face\n"
+		"  -compresstransfers : Store the radiosity transfer lists quantized (less than half the memory, slightly less precise bounces)\n"
+		"  -incremental    : Cache the lighting next to the .bsp, and on later compiles only relight the faces affected by what changed\n"
 		"  -nossprops      : Globally disable self-shadowing on static props\n"
 		"\n"
 #if 1 // Disabled for the initial SDK release with VMPI so we can get feedback from selected users.
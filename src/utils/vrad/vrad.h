@@ -238,6 +238,7 @@ struct CPatch
 
 	int			numtransfers;
 	transfer_t	*transfers;
+	byte		*compressedTransfers;	// used instead of transfers with -compresstransfers, see compressed_transfers.h
 
 	short		indices[3];				// displacement use these for subdivision
 };
@@ -288,6 +289,9 @@ extern float g_flSkySampleScale;								// extra sampling factor for indirect li
 extern bool g_bLargeDispSampleRadius;
 extern bool g_bStaticPropPolys;
 extern bool g_bTextureShadows;
+extern bool g_bStreamDirectLighting;
+extern bool g_bCompressTransfers;
+extern bool g_bLightingCache;
 extern bool g_bShowStaticPropNormals;
 extern bool g_bDisablePropSelfShadowing;
 
@@ -448,10 +452,13 @@ struct SSE_sampleLightOutput_t
 	fltx4 m_flDot[NUM_BUMP_VECTS+1];
 	fltx4 m_flFalloff;
 	fltx4 m_flSunAmount;
+	FourVectors m_ShadowRayEnd;			// with GATHERLFLAGS_DEFER_VISIBILITY, where the caller must trace to
+	bool m_bVisibilityDeferred;			// true if m_flDot[] hasn't been masked by the shadow ray yet
 };
 
 #define GATHERLFLAGS_FORCE_FAST 1
 #define GATHERLFLAGS_IGNORE_NORMALS 2
+#define GATHERLFLAGS_DEFER_VISIBILITY 4		// don't trace point/spot/surface shadow rays, leave them to the caller
 
 // SSE Gather light stuff
 void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
@@ -7,6 +7,7 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include "mathlib/ssemath.h"
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -42,12 +43,38 @@ int CountBits (byte *bits, int numbits)
 	return c;
 }
 
+/*
+==============
+CalcPortalFloodRange
+
+Finds the range of longs in portalflood that have any bits set, so the flow
+can skip the empty words at either end of the mightsee bits.
+==============
+*/
+void CalcPortalFloodRange (portal_t *p)
+{
+	long	*flood = (long *)p->portalflood;
+
+	p->floodfirst = p->floodlast = 0;
+	for (int j=0 ; j<portallongs ; j++)
+	{
+		if (!flood[j])
+			continue;
+
+		if (p->floodlast == 0)
+			p->floodfirst = j;
+		p->floodlast = j+1;
+	}
+}
+
 int		c_fullskip;
 int		c_portalskip, c_leafskip;
 int		c_vistest, c_mighttest;
 
 int		c_chop, c_nochop;
 
+int		c_seperatorhits, c_seperatormisses;
+
 int		active;
 
 #ifdef MPI
@@ -104,6 +131,78 @@ void FreeStackWinding (winding_t *w, pstack_t *stack)
 	stack->freewindings[i] = 1;
 }
 
+/*
+==============
+ClassifyWinding
+
+Computes the distance of every point in the winding to the plane, four points at
+a time. The distances use the same operations in the same order as
+DotProduct (point, normal) - dist, so they match the scalar code bit for bit.
+Bit i of front / back is set if point i is in front of / behind the plane.
+
+dists must have room for numpoints rounded up to a multiple of 4.
+==============
+*/
+static float VisEpsilon (void)
+{
+	// ON_VIS_EPSILON is a double, and the scalar tests compare float distances against it
+	// in double precision. For a float d, d > e is the same test as d > f where f is the
+	// largest float <= e, so that's what the SIMD compares use.
+	union { float f; uint32 u; } epsilon;
+	epsilon.f = (float)ON_VIS_EPSILON;
+	if ((double)epsilon.f > ON_VIS_EPSILON)
+		epsilon.u--;
+	return epsilon.f;
+}
+
+static const float s_flVisEpsilon = VisEpsilon ();
+
+static void ClassifyWinding (const winding_t *w, const plane_t *plane, vec_t *dists, uint64 &front, uint64 &back)
+{
+	int		numpoints = w->numpoints;
+	fltx4	dist = ReplicateX4 (plane->dist);
+	fltx4	epsilon = ReplicateX4 (s_flVisEpsilon);
+	fltx4	negepsilon = ReplicateX4 (-s_flVisEpsilon);
+
+	Assert (numpoints <= 64);
+
+	front = back = 0;
+	for (int i=0 ; i<numpoints ; i+=4)
+	{
+		FourVectors	points;
+
+		if (i + 4 < numpoints)
+		{
+			// LoadAndSwizzle reads one float past the fourth point, which is still inside the winding here
+			points.LoadAndSwizzle (w->points[i], w->points[i+1], w->points[i+2], w->points[i+3]);
+		}
+		else
+		{
+			// pad the last group by repeating the last point
+			Vector	tail[5];
+			for (int k=0 ; k<4 ; k++)
+			{
+				tail[k] = w->points[MIN (i+k, numpoints-1)];
+			}
+			points.LoadAndSwizzle (tail[0], tail[1], tail[2], tail[3]);
+		}
+
+		fltx4	d = SubSIMD (points * plane->normal, dist);
+		StoreUnalignedSIMD (&dists[i], d);
+
+		front |= (uint64)TestSignSIMD (CmpGtSIMD (d, epsilon)) << i;
+		back |= (uint64)TestSignSIMD (CmpLtSIMD (d, negepsilon)) << i;
+	}
+
+	// drop the padding
+	if (numpoints < 64)
+	{
+		uint64	valid = ((uint64)1 << numpoints) - 1;
+		front &= valid;
+		back &= valid;
+	}
+}
+
 /*
 ==============
 ChopWinding
@@ -117,42 +216,36 @@ ChopWinding
 
 winding_t	*ChopWinding (winding_t *in, pstack_t *stack, plane_t *split)
 {
-	vec_t	dists[128];
-	int		sides[128];
-	int		counts[3];
+	vec_t	dists[MAX_POINTS_ON_WINDING+4];
+	int		sides[MAX_POINTS_ON_WINDING+4];
+	uint64	front, back;
 	vec_t	dot;
 	int		i, j;
 	Vector	mid;
 	winding_t	*neww;
 
-	counts[0] = counts[1] = counts[2] = 0;
-
 // determine sides for each point
-	for (i=0 ; i<in->numpoints ; i++)
-	{
-		dot = DotProduct (in->points[i], split->normal);
-		dot -= split->dist;
-		dists[i] = dot;
-		if (dot > ON_VIS_EPSILON)
-			sides[i] = SIDE_FRONT;
-		else if (dot < -ON_VIS_EPSILON)
-			sides[i] = SIDE_BACK;
-		else
-		{
-			sides[i] = SIDE_ON;
-		}
-		counts[sides[i]]++;
-	}
+	ClassifyWinding (in, split, dists, front, back);
 
-	if (!counts[1])
+	if (!back)
 		return in;		// completely on front side
 	
-	if (!counts[0])
+	if (!front)
 	{
 		FreeStackWinding (in, stack);
 		return NULL;
 	}
 
+	for (i=0 ; i<in->numpoints ; i++)
+	{
+		if ((front >> i) & 1)
+			sides[i] = SIDE_FRONT;
+		else if ((back >> i) & 1)
+			sides[i] = SIDE_BACK;
+		else
+			sides[i] = SIDE_ON;
+	}
+
 	sides[i] = sides[0];
 	dists[i] = dists[0];
 	
@@ -220,6 +313,98 @@ winding_t	*ChopWinding (winding_t *in, pstack_t *stack, plane_t *split)
 #pragma warning (default:4701)
 #endif
 
+/*
+==============
+SeperatorPlane
+
+Builds the candidate seperating plane through edge i of source and point j of
+pass. Returns false if it isn't a seperating plane.
+
+Normal clip keeps target on the same side as pass, which is correct if the
+order goes source, pass, target.  If the order goes pass, source, target then
+flipclip should be set.
+==============
+*/
+static bool SeperatorPlane (winding_t *source, winding_t *pass, int i, int j, bool flipclip, plane_t &plane)
+{
+	int			l;
+	Vector		v1, v2;
+	vec_t		length;
+	vec_t		dists[MAX_POINTS_ON_WINDING+4];
+	uint64		front, back, others;
+	bool		fliptest;
+
+	l = (i+1)%source->numpoints;
+	VectorSubtract (source->points[l] , source->points[i], v1);
+	VectorSubtract (pass->points[j], source->points[i], v2);
+
+	plane.normal[0] = v1[1]*v2[2] - v1[2]*v2[1];
+	plane.normal[1] = v1[2]*v2[0] - v1[0]*v2[2];
+	plane.normal[2] = v1[0]*v2[1] - v1[1]*v2[0];
+	
+// if points don't make a valid plane, skip it
+
+	length = plane.normal[0] * plane.normal[0]
+	+ plane.normal[1] * plane.normal[1]
+	+ plane.normal[2] * plane.normal[2];
+	
+	if (length < ON_VIS_EPSILON)
+		return false;
+
+	length = 1/sqrt(length);
+	
+	plane.normal[0] *= length;
+	plane.normal[1] *= length;
+	plane.normal[2] *= length;
+
+	plane.dist = DotProduct (pass->points[j], plane.normal);
+
+//
+// find out which side of the generated seperating plane has the
+// source portal. The first source point (other than the edge) that
+// is off the plane decides.
+//
+	ClassifyWinding (source, &plane, dists, front, back);
+	others = (front | back) & ~(((uint64)1 << i) | ((uint64)1 << l));
+	if (!others)
+		return false;		// planar with source portal
+
+	// source on the positive side means we want all pass and target on the negative side
+	fliptest = (front & (others & (0 - others))) != 0;
+
+//
+// flip the normal if the source portal is backwards
+//
+	if (fliptest)
+	{
+		VectorSubtract (vec3_origin, plane.normal, plane.normal);
+		plane.dist = -plane.dist;
+	}
+
+//
+// if all of the pass portal points are now on the positive side,
+// this is the seperating plane
+//
+	ClassifyWinding (pass, &plane, dists, front, back);
+	others = ~((uint64)1 << j);
+	if (back & others)
+		return false;	// points on negative side, not a seperating plane
+		
+	if (!(front & others))
+		return false;	// planar with seperating plane
+
+//
+// flip the normal if we want the back side
+//
+	if (flipclip)
+	{
+		VectorSubtract (vec3_origin, plane.normal, plane.normal);
+		plane.dist = -plane.dist;
+	}
+
+	return true;
+}
+
 /*
 ==============
 ClipToSeperators
@@ -230,134 +415,23 @@ Generates seperating planes canidates by taking two points from source and one
 point from pass, and clips target by them.
 
 If target is totally clipped away, that portal can not be seen through.
-
-Normal clip keeps target on the same side as pass, which is correct if the
-order goes source, pass, target.  If the order goes pass, source, target then
-flipclip should be set.
 ==============
 */
 winding_t	*ClipToSeperators (winding_t *source, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack)
 {
-	int			i, j, k, l;
+	int			i, j;
 	plane_t		plane;
-	Vector		v1, v2;
-	float		d;
-	vec_t		length;
-	int			counts[3];
-	bool		fliptest;
 
 // check all combinations	
 	for (i=0 ; i<source->numpoints ; i++)
 	{
-		l = (i+1)%source->numpoints;
-		VectorSubtract (source->points[l] , source->points[i], v1);
-
 	// fing a vertex of pass that makes a plane that puts all of the
 	// vertexes of pass on the front side and all of the vertexes of
 	// source on the back side
 		for (j=0 ; j<pass->numpoints ; j++)
 		{
-			VectorSubtract (pass->points[j], source->points[i], v2);
-
-			plane.normal[0] = v1[1]*v2[2] - v1[2]*v2[1];
-			plane.normal[1] = v1[2]*v2[0] - v1[0]*v2[2];
-			plane.normal[2] = v1[0]*v2[1] - v1[1]*v2[0];
-			
-		// if points don't make a valid plane, skip it
-
-			length = plane.normal[0] * plane.normal[0]
-			+ plane.normal[1] * plane.normal[1]
-			+ plane.normal[2] * plane.normal[2];
-			
-			if (length < ON_VIS_EPSILON)
-				continue;
-
-			length = 1/sqrt(length);
-			
-			plane.normal[0] *= length;
-			plane.normal[1] *= length;
-			plane.normal[2] *= length;
-
-			plane.dist = DotProduct (pass->points[j], plane.normal);
-
-		//
-		// find out which side of the generated seperating plane has the
-		// source portal
-		//
-#if 1
-			fliptest = false;
-			for (k=0 ; k<source->numpoints ; k++)
-			{
-				if (k == i || k == l)
-					continue;
-				d = DotProduct (source->points[k], plane.normal) - plane.dist;
-				if (d < -ON_VIS_EPSILON)
-				{	// source is on the negative side, so we want all
-					// pass and target on the positive side
-					fliptest = false;
-					break;
-				}
-				else if (d > ON_VIS_EPSILON)
-				{	// source is on the positive side, so we want all
-					// pass and target on the negative side
-					fliptest = true;
-					break;
-				}
-			}
-			if (k == source->numpoints)
-				continue;		// planar with source portal
-#else
-			fliptest = flipclip;
-#endif
-		//
-		// flip the normal if the source portal is backwards
-		//
-			if (fliptest)
-			{
-				VectorSubtract (vec3_origin, plane.normal, plane.normal);
-				plane.dist = -plane.dist;
-			}
-#if 1
-		//
-		// if all of the pass portal points are now on the positive side,
-		// this is the seperating plane
-		//
-			counts[0] = counts[1] = counts[2] = 0;
-			for (k=0 ; k<pass->numpoints ; k++)
-			{
-				if (k==j)
-					continue;
-				d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-				if (d < -ON_VIS_EPSILON)
-					break;
-				else if (d > ON_VIS_EPSILON)
-					counts[0]++;
-				else
-					counts[2]++;
-			}
-			if (k != pass->numpoints)
-				continue;	// points on negative side, not a seperating plane
-				
-			if (!counts[0])
-				continue;	// planar with seperating plane
-#else
-			k = (j+1)%pass->numpoints;
-			d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-			if (d < -ON_VIS_EPSILON)
+			if (!SeperatorPlane (source, pass, i, j, flipclip, plane))
 				continue;
-			k = (j+pass->numpoints-1)%pass->numpoints;
-			d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-			if (d < -ON_VIS_EPSILON)
-				continue;			
-#endif
-		//
-		// flip the normal if we want the back side
-		//
-			if (flipclip)
-			{
-				VectorSubtract (vec3_origin, plane.normal, plane.normal);
-				plane.dist = -plane.dist;
-			}
 			
 		//
 		// clip target by the seperating plane
@@ -374,6 +448,58 @@ winding_t	*ClipToSeperators (winding_t *source, winding_t *pass, winding_t *targ
 	return target;
 }
 
+/*
+==============
+ClipToCachedSeperators
+
+Same as ClipToSeperators, for when source and pass are the unclipped windings
+of the base portal and passportal. The seperating planes are found once per
+PortalFlow and reused by every path through passportal, in the same order, so
+the clipped result is identical.
+==============
+*/
+winding_t	*ClipToCachedSeperators (threaddata_t *thread, portal_t *passportal, winding_t *source, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack)
+{
+	int		key = (int)(passportal - portals) * 2 + (flipclip ? 1 : 0);
+	int		index = thread->seperatorcache.Find (key);
+
+	if (index == thread->seperatorcache.InvalidIndex ())
+	{
+		seperatorcache_t	entry;
+		plane_t				plane;
+
+		entry.first = thread->seperators.Count ();
+		for (int i=0 ; i<source->numpoints ; i++)
+		{
+			for (int j=0 ; j<pass->numpoints ; j++)
+			{
+				if (SeperatorPlane (source, pass, i, j, flipclip, plane))
+				{
+					thread->seperators.AddToTail (plane);
+				}
+			}
+		}
+		entry.count = thread->seperators.Count () - entry.first;
+
+		index = thread->seperatorcache.Insert (key, entry);
+		thread->c_seperatormisses++;
+	}
+	else
+	{
+		thread->c_seperatorhits++;
+	}
+
+	const seperatorcache_t &entry = thread->seperatorcache[index];
+	for (int k=0 ; k<entry.count ; k++)
+	{
+		target = ChopWinding (target, stack, &thread->seperators[entry.first + k]);
+		if (!target)
+			return NULL;		// target is not visible
+	}
+
+	return target;
+}
+
 
 class CPortalTrace
 {
@@ -469,6 +595,21 @@ void WritePortalTrace( const char *source )
 	Warning("Wrote %s!!!\n", filename);
 }
 
+/*
+==================
+MightSeePortal
+==================
+*/
+static inline bool MightSeePortal (const pstack_t *stack, int pnum)
+{
+	int		word = pnum / (8 * sizeof(long));
+
+	if (word < stack->mightseefirst || word >= stack->mightseelast)
+		return false;
+
+	return CheckBit (stack->mightsee, pnum) != 0;
+}
+
 /*
 ==================
 RecursiveLeafFlow
@@ -486,6 +627,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	int			i, j;
 	long		*test, *might, *vis, more;
 	int			pnum;
+	int			first, last;
 
 #ifdef MPI
 	// Early-out if we're a VMPI worker that's told to exit. If we don't do this here, then the
@@ -520,7 +662,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		p = leaf->portals[i];
 		pnum = p - portals;
 
-		if ( ! (prevstack->mightsee[pnum >> 3] & (1<<(pnum&7)) ) )
+		if ( !MightSeePortal( prevstack, pnum ) )
 		{
 			continue;	// can't possibly see it
 		}
@@ -535,12 +677,29 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			test = (long *)p->portalflood;
 		}
 
+		// only the words where both the previous mightsee and this portal's flood
+		// can be nonzero need to be combined, and the result is trimmed to the
+		// words that actually have bits left
+		first = MAX( prevstack->mightseefirst, p->floodfirst );
+		last = MIN( prevstack->mightseelast, p->floodlast );
+
 		more = 0;
-		for (j=0 ; j<portallongs ; j++)
+		stack.mightseefirst = last;
+		stack.mightseelast = first;
+		for (j=first ; j<last ; j++)
 		{
 			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
+			if (might[j])
+			{
+				stack.mightseefirst = MIN( stack.mightseefirst, j );
+				stack.mightseelast = j+1;
+			}
 			more |= (might[j] & ~vis[j]);
 		}
+		if (stack.mightseefirst >= stack.mightseelast)
+		{
+			stack.mightseefirst = stack.mightseelast = 0;
+		}
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
 		{	// can't see anything new
@@ -604,13 +763,28 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			continue;
 		}
 
-		stack.pass = ClipToSeperators (stack.source, prevstack->pass, stack.pass, false, &stack);
-		if (!stack.pass)
-			continue;
-		
-		stack.pass = ClipToSeperators (prevstack->pass, stack.source, stack.pass, true, &stack);
-		if (!stack.pass)
-			continue;
+		if (stack.source == thread->base->winding && prevstack->pass == prevstack->portal->winding)
+		{
+			// neither winding has been clipped on the way here, so the seperators
+			// are the same for every path through the previous portal
+			stack.pass = ClipToCachedSeperators (thread, prevstack->portal, stack.source, prevstack->pass, stack.pass, false, &stack);
+			if (!stack.pass)
+				continue;
+
+			stack.pass = ClipToCachedSeperators (thread, prevstack->portal, prevstack->pass, stack.source, stack.pass, true, &stack);
+			if (!stack.pass)
+				continue;
+		}
+		else
+		{
+			stack.pass = ClipToSeperators (stack.source, prevstack->pass, stack.pass, false, &stack);
+			if (!stack.pass)
+				continue;
+			
+			stack.pass = ClipToSeperators (prevstack->pass, stack.source, stack.pass, true, &stack);
+			if (!stack.pass)
+				continue;
+		}
 
 		// mark the portal as visible
 		SetBit( thread->base->portalvis, pnum );
@@ -640,13 +814,20 @@ void PortalFlow (int iThread, int portalnum)
 				
 	c_might = CountBits (p->portalflood, g_numportals*2);
 
-	memset (&data, 0, sizeof(data));
 	data.base = p;
-	
+	data.c_chains = 0;
+	data.c_seperatorhits = 0;
+	data.c_seperatormisses = 0;
+	data.seperatorcache.SetLessFunc (DefLessFunc (int));
+
+	// the mightsee bits outside of the valid range are never read
+	memset (&data.pstack_head, 0, offsetof (pstack_t, mightsee));
 	data.pstack_head.portal = p;
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
-	for (i=0 ; i<portallongs ; i++)
+	data.pstack_head.mightseefirst = p->floodfirst;
+	data.pstack_head.mightseelast = p->floodlast;
+	for (i=p->floodfirst ; i<p->floodlast ; i++)
 		((long *)data.pstack_head.mightsee)[i] = ((long *)p->portalflood)[i];
 
 	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
@@ -654,6 +835,9 @@ void PortalFlow (int iThread, int portalnum)
 
 	p->status = stat_done;
 
+	ThreadInterlockedExchangeAdd ((int32 volatile *)&c_seperatorhits, data.c_seperatorhits);
+	ThreadInterlockedExchangeAdd ((int32 volatile *)&c_seperatormisses, data.c_seperatormisses);
+
 	c_can = CountBits (p->portalvis, g_numportals*2);
 
 	qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n", 
@@ -799,6 +983,7 @@ void BasePortalVis (int iThread, int portalnum)
 	SimpleFlood (p, p->leaf);
 
 	p->nummightsee = CountBits (p->portalflood, g_numportals*2);
+	CalcPortalFloodRange (p);
 //	Msg ("portal %i: %i mightsee\n", portalnum, p->nummightsee);
 	c_flood += p->nummightsee;
 }
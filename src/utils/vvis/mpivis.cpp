@@ -197,6 +197,7 @@ void ReceiveBasePortalVis( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
 	memset (p->portalvis, 0, portalbytes);
 
 	p->nummightsee = CountBits( p->portalflood, g_numportals*2 );
+	CalcPortalFloodRange( p );
 }
 
 
@@ -292,6 +293,7 @@ void RunMPIBasePortalVis()
 			memset (p->portalvis, 0, portalbytes);
 		
 			p->nummightsee = CountBits (p->portalflood, g_numportals*2);
+			CalcPortalFloodRange (p);
 		}
 
 		g_pFileSystem->Close( fp );
@@ -10,6 +10,7 @@
 #include "cmdlib.h"
 #include "mathlib/mathlib.h"
 #include "bsplib.h"
+#include "utlmap.h"
 
 
 #define	MAX_PORTALS	65536
@@ -56,6 +57,8 @@ struct portal_t
 	byte		*portalvis;		// [portals], final
 
 	int			nummightsee;	// bit count on portalflood for sort
+	int			floodfirst;		// range of longs in portalflood that may be nonzero, [floodfirst, floodlast)
+	int			floodlast;
 };
 
 struct leaf_t
@@ -64,25 +67,45 @@ struct leaf_t
 };
 
 	
+// The per level data that is touched while clipping comes first, so it shares
+// cache lines instead of sitting on the far side of the mightsee bits.
 struct pstack_t
 {
-	byte		mightsee[MAX_PORTALS/8];		// bit string
 	pstack_t	*next;
 	leaf_t		*leaf;
 	portal_t	*portal;	// portal exiting
 	winding_t	*source;
 	winding_t	*pass;
 
-	winding_t	windings[3];	// source, pass, temp in any order
+	plane_t		portalplane;
+
 	int			freewindings[3];
+	winding_t	windings[3];	// source, pass, temp in any order
 
-	plane_t		portalplane;
+	// only the longs in [mightseefirst, mightseelast) of mightsee are valid, the rest are zero
+	int			mightseefirst;
+	int			mightseelast;
+	byte		mightsee[MAX_PORTALS/8];		// bit string
+};
+
+// Seperating planes between the base portal and an unclipped pass portal, which
+// don't depend on the path taken through the leafs.
+struct seperatorcache_t
+{
+	int			first;		// index into threaddata_t::seperators
+	int			count;
 };
 
 struct threaddata_t
 {
 	portal_t	*base;
 	int			c_chains;
+	int			c_seperatorhits;
+	int			c_seperatormisses;
+
+	CUtlMap<int, seperatorcache_t>	seperatorcache;		// keyed by pass portal * 2 + flipclip
+	CUtlVector<plane_t>				seperators;
+
 	pstack_t	pstack_head;
 };
 
@@ -119,6 +142,10 @@ extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
 extern int g_TraceClusterStart, g_TraceClusterStop;
 
 int CountBits (byte *bits, int numbits);
+void CalcPortalFloodRange (portal_t *p);
+
+extern bool	g_bBench;
+extern int	c_seperatorhits, c_seperatormisses;
 
 #define CheckBit( bitstring, bitNumber )	( (bitstring)[ ((bitNumber) >> 3) ] & ( 1 << ( (bitNumber) & 7 ) ) )
 #define SetBit( bitstring, bitNumber )	( (bitstring)[ ((bitNumber) >> 3) ] |= ( 1 << ( (bitNumber) & 7 ) ) )
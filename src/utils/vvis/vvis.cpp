@@ -56,6 +56,56 @@ double		g_VisRadius = 4096.0f * 4096.0f;
 
 bool		g_bLowPriority = false;
 
+bool		g_bBench = false;
+
+//=============================================================================
+
+/*
+==================
+BenchPhase
+
+Records the time since the previous phase ended, reported at the end with -bench
+==================
+*/
+struct benchphase_t
+{
+	const char	*name;
+	double		seconds;
+};
+
+static CUtlVector<benchphase_t>	g_BenchPhases;
+static double					g_flBenchPhaseStart;
+
+void BenchPhase (const char *name)
+{
+	double	now = Plat_FloatTime ();
+
+	if (name)
+	{
+		benchphase_t	&phase = g_BenchPhases[g_BenchPhases.AddToTail ()];
+		phase.name = name;
+		phase.seconds = now - g_flBenchPhaseStart;
+	}
+
+	g_flBenchPhaseStart = now;
+}
+
+void PrintBenchPhases (void)
+{
+	double	total = 0;
+
+	Msg ("\n%-24s %10s\n", "phase", "seconds");
+	for (int i=0 ; i<g_BenchPhases.Count() ; i++)
+	{
+		Msg ("%-24s %10.3f\n", g_BenchPhases[i].name, g_BenchPhases[i].seconds);
+		total += g_BenchPhases[i].seconds;
+	}
+	Msg ("%-24s %10.3f\n", "total", total);
+
+	int	lookups = c_seperatorhits + c_seperatormisses;
+	Msg ("seperator cache: %i lookups, %.1f%% hits\n", lookups, lookups ? c_seperatorhits * 100.0 / lookups : 0.0);
+}
+
 //=============================================================================
 
 void PlaneFromWinding (winding_t *w, plane_t *plane)
@@ -343,10 +393,13 @@ void CalcVis (void)
 	{
 	    RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
 	}
+	BenchPhase ("BasePortalVis");
 
 	SortPortals ();
+	BenchPhase ("SortPortals");
 
 	CalcPortalVis ();
+	BenchPhase ("PortalFlow");
 
 	//
 	// assemble the leaf vis lists by oring the portal lists
@@ -362,6 +415,7 @@ void CalcVis (void)
 	{
 		count += CompressAndCrosscheckClusterVis( i );
 	}
+	BenchPhase ("ClusterMerge");
 
 		
 	Msg ("Optimized: %d visible clusters (%.2f%%)\n", count, count*100.0/totalvis);
@@ -955,6 +1009,11 @@ int ParseCommandLine( int argc, char **argv )
 		}
 		else if (!Q_stricmp (argv[i],"-tmpin"))
 			strcpy (inbase, "/tmp");
+		else if (!Q_stricmp (argv[i],"-bench"))
+		{
+			Msg ("bench = true\n");
+			g_bBench = true;
+		}
 		else if( !Q_stricmp( argv[i], "-low" ) )
 		{
 			g_bLowPriority = true;
@@ -1042,6 +1101,7 @@ void PrintUsage( int argc, char **argv )
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
+		"  -bench          : Report the time spent in each phase of the compile.\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
@@ -1139,6 +1199,8 @@ int RunVVis( int argc, char **argv )
 
 	ThreadSetDefault ();
 
+	BenchPhase (NULL);
+
 	Msg ("reading %s\n", mapFile);
 	LoadBSPFile (mapFile);
 	if (numnodes == 0 || numfaces == 0)
@@ -1174,12 +1236,14 @@ int RunVVis( int argc, char **argv )
 
 	Msg ("reading %s\n", portalfile);
 	LoadPortals (portalfile);
+	BenchPhase ("Load");
 
 	// don't write out results when simply doing a trace
 	if ( g_TraceClusterStart < 0 )
 	{
 		CalcVis ();
 		CalcPAS ();
+		BenchPhase ("CalcPAS");
 
 		// We need a mapping from cluster to leaves, since the PVS
 		// deals with clusters for both CalcVisibleFogVolumes and
@@ -1187,12 +1251,14 @@ int RunVVis( int argc, char **argv )
 
 		CalcVisibleFogVolumes();
 		CalcDistanceFromLeavesToWater();
+		BenchPhase ("FogAndWater");
 
 		visdatasize = vismap_p - dvisdata;
 		Msg ("visdatasize:%i  compressed from %i\n", visdatasize, originalvismapsize*2);
 
 		Msg ("writing %s\n", mapFile);
 		WriteBSPFile (mapFile);
+		BenchPhase ("Write");
 	}
 	else
 	{
@@ -1208,6 +1274,12 @@ int RunVVis( int argc, char **argv )
 #endif
 		CalcVisTrace ();
 		WritePortalTrace(source);
+		BenchPhase ("Trace");
+	}
+
+	if ( g_bBench )
+	{
+		PrintBenchPhases ();
 	}
 
 	end = Plat_FloatTime();